@@ -89,6 +89,10 @@ int MRIfromSymMatrix(MRI *mri, int c, int r, int s, MATRIX *M);
 MRI *MRInormWeights(MRI *w, int sqrtFlag, int invFlag, MRI *mask, MRI *wn);
 
 int MRIglmFitAndTest(MRIGLM *mriglm);
+int MRIglmFitAndTestStream(MRIGLM *mriglm, const char *yfile, double MaxMB);
+MRI *MRIframeBinarizeStream(const char *yfile, MRI *yhdr, double MaxMB, double thresh, MRI *mask);
+MRIGLM *MRIglmCopyDesign(MRIGLM *src);
+int MRIglmFreeCopy(MRIGLM **pmriglm);
 int MRIglmFit(MRIGLM *glmmri);
 int MRIglmTest(MRIGLM *mriglm);
 int MRIglmLoadVox(MRIGLM *mriglm, int c, int r, int s, int LoadBeta, GLMMAT *glm);
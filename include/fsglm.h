@@ -71,6 +71,7 @@ typedef struct {
   MATRIX *gCVM[GLMMAT_NCONTRASTS_MAX];
   MATRIX *igCVM[GLMMAT_NCONTRASTS_MAX];
   MATRIX *gtigCVM[GLMMAT_NCONTRASTS_MAX];
+  MATRIX *Fm[GLMMAT_NCONTRASTS_MAX];  // gtigCVM*gamma, held here so GLMtest() is reentrant
 
   // These are elements used to compute pcc
   int DoPCC;
@@ -89,6 +90,43 @@ typedef struct {
 }
 GLMMAT;
 
+/* Batched fit and test of many y's that all share the same X (Workflow 3
+   in fsglm.cpp). Arrays hold one column per voxel, eg, the kth beta of
+   voxel v is beta[k*nvox + v]. The caller fills y and runs
+   GLMbatchFitAndTest() on the first nv <= nvox columns. */
+#define GLMBATCH_BLOCK 64 // voxels per thread work item
+typedef struct {
+  int nvox;     // columns allocated
+  int nframes;  // rows of X
+  int nregs;    // cols of X
+  int ncontrasts;
+
+  double *y;     // input: nframes-by-nvox
+  double *beta;  // nregs-by-nvox
+  double *yhat;  // nframes-by-nvox, NULL unless requested
+  double *eres;  // nframes-by-nvox, NULL unless requested
+  double *rvar;  // 1-by-nvox
+  double *gamma[GLMMAT_NCONTRASTS_MAX];     // C rows-by-nvox
+  double *gammaVar[GLMMAT_NCONTRASTS_MAX];  // 1-by-nvox, t-tests only
+  double *F[GLMMAT_NCONTRASTS_MAX];         // 1-by-nvox
+  double *p[GLMMAT_NCONTRASTS_MAX];         // 1-by-nvox
+  double *z[GLMMAT_NCONTRASTS_MAX];         // 1-by-nvox
+  double *pcc[GLMMAT_NCONTRASTS_MAX];       // 1-by-nvox, t-tests with pcc only
+  double *ypmf[GLMMAT_NCONTRASTS_MAX];      // Mpmf rows-by-nvox, if ypmfflag
+
+  // Precomputed from X and the Cs by GLMbatchAlloc()
+  double *X;  // nframes-by-nregs
+  double *P;  // inv(X'*X)*X', nregs-by-nframes
+  double *C[GLMMAT_NCONTRASTS_MAX];
+  double *CiXtXCt[GLMMAT_NCONTRASTS_MAX];
+  double *iCiXtXCt[GLMMAT_NCONTRASTS_MAX];  // NULL if not invertible
+  double *Mpmf[GLMMAT_NCONTRASTS_MAX];
+  double *gamma0[GLMMAT_NCONTRASTS_MAX];    // NULL unless UseGamma0
+  // pcc: with R = RD*X, yhatd = R*beta, so Xcd'*yhatd = pccw*beta,
+  // sum(yhatd) = pccs*beta, and sum(yhatd.^2) = beta'*pccG*beta
+  double *pccw[GLMMAT_NCONTRASTS_MAX], *pccs[GLMMAT_NCONTRASTS_MAX], *pccG[GLMMAT_NCONTRASTS_MAX];
+} GLMBATCH;
+
 GLMMAT *GLMalloc(void);
 int GLMfree(GLMMAT **pgm);
 int GLMallocX(GLMMAT *glm, int nrows, int ncols);
@@ -100,6 +138,11 @@ int GLMfit(GLMMAT *glm);
 int GLMtest(GLMMAT *glm);
 int GLMtestFFx(GLMMAT *glm);
 
+GLMBATCH *GLMbatchAlloc(GLMMAT *glm, int nvox, int SaveYhat, int SaveEres);
+int GLMbatchNVox(GLMMAT *glm, double MaxMB, int SaveYhat, int SaveEres, int nvoxmax);
+int GLMbatchFree(GLMBATCH **pgb);
+int GLMbatchFitAndTest(GLMMAT *glm, GLMBATCH *gb, int nv);
+
 int GLManalyze(GLMMAT *glm);
 
 int GLMprofile(int nrows, int ncols, int ncon, int niters);
@@ -222,9 +222,36 @@ typedef struct
   int          total_training ;
   int          max_label ;
   COLOR_TABLE  *ct ;
+  struct GCA_FLAT *flat ;   // contiguous storage of the node and prior arrays (see gca.cpp)
+  struct GCA_DENSITIES *densities ;  // cached by labeling, see GCAdensitiesAlloc
 }
 GAUSSIAN_CLASSIFIER_ARRAY, GCA ;
 
+/*
+  Inverse covariances and log determinants of every node class, computed
+  once so that all classes of a node can be evaluated together. The arrays
+  of node n start at offset[n] (one entry per class), and within a node the
+  values of one component are contiguous over classes. Only valid while
+  the class statistics are unchanged.
+*/
+#define GCA_DENSITY_MAX_INPUTS 8
+typedef struct GCA_DENSITIES
+{
+  int     ninputs ;
+  int     node_width, node_height, node_depth ;
+  size_t  *offset ;        /* [nnodes+1] */
+  float   *means ;         /* node block [ninputs][nlabels] */
+  double  *inv_covars ;    /* node block [ninputs*(ninputs+1)/2][nlabels], packed upper triangle */
+  double  *half_log_det ;  /* -log(sqrt(det)), NaN if not positive definite */
+}
+GCA_DENSITIES ;
+
+GCA_DENSITIES *GCAdensitiesAlloc(GCA *gca) ;
+int    GCAdensitiesFree(GCA_DENSITIES **pgd) ;
+void   GCAdensitiesInvalidate(GCA *gca) ;  // call after changing node class means, covariances or labels
+int    GCAnodeLogDensities(GCA *gca, int xn, int yn, int zn, const float *vals, double *log_p) ;
+int    GCAprofileDensities(GCA *gca, int nnodes) ;
+
 typedef struct
 {
   MRI *modalities; // each mode in a differnt frame
@@ -271,12 +298,15 @@ int  GCAvoxelToNodeNearest(GCA *gca, MRI *mri,
 GCA  *GCAalloc(int ninputs, float prior_spacing, float node_spacing, int width, int height, int depth, int flags) ;
 int  GCAfree(GCA **pgca) ;
 int  GCAPfree(GCA_PRIOR *gcap) ;
-int  GCANfree(GCA_NODE *gcan, int ninputs) ;
+int  GCANfree(const GCA *gca, GCA_NODE *gcan) ;  // gca owns gcan, or NULL for a node on the heap
+void GCAfreeArray(const GCA *gca, void *p) ;  // free() for the node/prior/class arrays of gca, which may live in its flat image
 int  GCAtrain(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform,
               GCA *gca_prune, int noint) ;
 int  GCAtrainCovariances(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform) ;
 int  GCAwrite(GCA *gca,const char *fname) ;
+int  GCAwriteFlat(GCA *gca,const char *fname) ;
 GCA  *GCAread(const char *fname) ;
+int  GCAisFlat(const char *fname) ;
 int  GCAcompleteMeanTraining(GCA *gca) ;
 int  GCAcompleteCovarianceTraining(GCA *gca) ;
 MRI  *GCAlabel(MRI *mri_src, GCA *gca, MRI *mri_dst, TRANSFORM *transform) ;
@@ -302,6 +332,14 @@ float GCAcomputeNumberOfGoodFittingSamples(GCA *gca, GCA_SAMPLE *gcas,
 float  GCAcomputeLogSampleProbability(GCA *gca, GCA_SAMPLE *gcas,
                                       MRI *mri_inputs,
                                       TRANSFORM *transform,int nsamples, double clamp);
+int    GCAlogSampleProbabilityBounds(GCA *gca, GCA_SAMPLE *gcas, int nsamples,
+                                     double clamp, double *ubound);
+float  GCAcomputeLogSampleProbabilityMatrix(GCA *gca, GCA_SAMPLE *gcas,
+                                            const float *prior_coords,
+                                            MRI *mri_inputs, const float *m,
+                                            int nsamples, double clamp,
+                                            const double *ubound,
+                                            double prune_below);
 float  GCAcomputeLabelIntensityVariance(GCA *gca, GCA_SAMPLE *gcas,
 					MRI *mri_inputs,
 					TRANSFORM *transform,int nsamples);
@@ -87,16 +87,37 @@
 
 typedef struct
 {
-  // gcamorph uses these fields in its hottest function so put them together to reduce cache misses
+  // gcamorph uses these fields in its hottest functions (the energy and
+  // gradient terms visit every node of the morph on each step) so put them
+  // together to reduce cache misses
   char   invalid;       /* if invalid = 1, then don't use this structure */
   int    label ;
+  int    status ;       /* ignore likelihood term */
   double x ;          //  updated original src voxel position
   double y ;
   double z ;
   double origx ;      //  mri original src voxel position (using lta)
   double origy ;
   double origz ;
+  float  dx, dy, dz;     /* current gradient */
+  float  odx, ody, odz ; /* previous gradient */
+  float  jx, jy, jz ;    /* jacobian gradient */
+  float  area ;
+  float  area1 ;      // right handed coordinate system
+  float  area2 ;      // left-handed coordinate system
+  float  orig_area ;
+  float  orig_area1 ;
+  float  orig_area2 ;
+  float  log_p ;         /* current log probability of this sample */
+  float  prior ;
+  GC1D   *gc ;
+  int    xn ;         /* node coordinates */
+  int    yn ;         //  prior voxel position
+  int    zn ;
+  int    n ;          /* index in gcan structure */
   //
+  // the rest is only touched by the label matching terms, by i/o and
+  // by the saving/restoring of positions, so keep it out of the way
   double saved_origx ;      //  mri original src voxel position (using lta)
   double saved_origy ;
   double saved_origz ;
@@ -106,31 +127,14 @@ typedef struct
   double xs2 ;         //  more tmp storage
   double ys2 ;
   double zs2 ;
-  int    xn ;         /* node coordinates */
-  int    yn ;         //  prior voxel position
-  int    zn ;
-  int    n ;          /* index in gcan structure */
-  float  prior ;
-  GC1D   *gc ;
-  float  log_p ;         /* current log probability of this sample */
-  float  dx, dy, dz;     /* current gradient */
-  float  odx, ody, odz ; /* previous gradient */
-  float  jx, jy, jz ;    /* jacobian gradient */
-  float  area ;
-  float  area1 ;      // right handed coordinate system
-  float  area2 ;      // left-handed coordinate system
-  float  orig_area ;
-  float  orig_area1 ;
-  float  orig_area2 ;
-  int    status ;       /* ignore likelihood term */
   float  label_dist ;   /* for computing label dist */
   float  last_se ;
   float  predicted_val ; /* weighted average of all class 
                             means in a ball around this node */
-  double sum_ci_vi_ui ;
-  double sum_ci_vi ;
   float  target_dist ;   /* target distance to move towards for 
                             label matching with distance xform */
+  double sum_ci_vi_ui ;
+  double sum_ci_vi ;
 }
 GCA_MORPH_NODE, GMN ;
 
@@ -604,6 +608,7 @@ double MRIlabelMorphSSE(MRI *mri_source, MRI *mri_atlas, MRI *mri_morph) ;
   int gcamSmoothnessTerm( GCA_MORPH *gcam,
 			  const MRI *mri,
 			  const double l_smoothness );
+  int GCAMprofileSmoothness( GCA_MORPH *gcam, int ntimes, double *pmax_diff );
   
   int  gcamJacobianTermAtNode( GCA_MORPH *gcam, 
 			       const MRI *mri, 
@@ -283,6 +283,8 @@ public:
   bool owndata = true;          // indicates ownership of the chunked buffer data
   BUFTYPE ***slices = nullptr;  // fallback non-contiguous storage for 3D-indexed image data
   void *chunk = nullptr;        // default contiguous storage for image data
+  void *mapping = nullptr;      // file mapping backing the chunk, if any (see mghRead)
+  size_t mapping_bytes = 0;     // size of the file mapping
 };
 
 
@@ -1340,9 +1342,11 @@ float MRIvolumeDeterminant(MRI *mri);
 
 int mriio_command_line(int argc, char *argv[]);
 void mriio_set_gdf_crop_flag(int new_gdf_crop_flag);
+void mriio_set_mgh_mmap_flag(int new_mgh_mmap_flag);
 int MRIgetVolumeName(const char *string, char *name_only);
 MRI *MRIread(const char *fname);
 MRI *MRIreadEx(const char *fname, int nthframe);
+MRI *MRIreadRegion(const char *fname, const MRI_REGION *region, int start_frame, int end_frame);
 MRI *MRIreadType(const char *fname, int type);
 MRI *MRIreadInfo(const char *fname);
 MRI *MRIreadHeader(const char *fname, int type);
@@ -0,0 +1,72 @@
+#pragma once
+/**
+ * @brief bounding volume hierarchy over the faces or vertices of a surface
+ *
+ * An axis aligned bounding box tree for exact closest vertex, closest
+ * point on the surface and ray queries. Unlike MRIS_HASH_TABLE it needs
+ * no resolution to be chosen, never fails to find an answer, and is
+ * immutable once built so any number of threads can query it.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include "mrisurf_aaa.h"
+
+typedef struct MRIS_BVH MRIS_BVH;
+
+// Construction. The coordinates selected by which (CURRENT_VERTICES,
+// ORIGINAL_VERTICES, ...) are copied, so the tree does not follow later
+// changes to the surface. Ripped vertices and ripped faces are left out.
+//
+MRIS_BVH* MRISbvhCreateVertexTree(MRIS *mris, int which);
+MRIS_BVH* MRISbvhCreateFaceTree  (MRIS *mris, int which);
+void      MRISbvhFree            (MRIS_BVH **pbvh);
+
+// true if FS_SURFACE_BVH is set, for the callers that can use a tree
+// instead of a hash table when asked to
+//
+int MRISbvhRequested(void);
+
+// Vertex trees: closest vertex, -1 only if the tree is empty
+//
+int MRISbvhFindClosestVertex(MRIS_BVH const *bvh, float x, float y, float z, float *pdist);
+
+// Face trees: closest point on the surface within max_dist (use a large
+// number to ignore), returns the face it is on or -1.  pclosest may be NULL.
+//
+int MRISbvhFindClosestFace(MRIS_BVH const *bvh,
+                           float x, float y, float z, float max_dist,
+                           float *pdist, float *pclosest /* [3] */);
+
+// Face trees: first face hit by the ray origin + t*dir with 0 <= t <= max_t
+//
+int MRISbvhIntersectRay(MRIS_BVH const *bvh,
+                        float const *origin /* [3] */, float const *dir /* [3] */, float max_t,
+                        float *pt);
+
+// Batched queries, one per (x,y,z) triple, done in parallel. The output
+// arrays hold one entry per point (three for pclosest); dists, pclosest
+// and ts may be NULL.
+//
+void MRISbvhFindClosestVertexBatch(MRIS_BVH const *bvh, int npoints, float const *xyz,
+                                   int *vnos, float *dists);
+void MRISbvhFindClosestFaceBatch  (MRIS_BVH const *bvh, int npoints, float const *xyz, float max_dist,
+                                   int *fnos, float *dists, float *pclosest);
+void MRISbvhIntersectRayBatch     (MRIS_BVH const *bvh, int nrays, float const *origins, float const *dirs,
+                                   float max_t, int *fnos, float *ts);
+
+// Times closest vertex and closest face queries of the trees against
+// MRIS_HASH_TABLE at several resolutions on npoints random points near
+// the surface, and checks that the answers agree.
+//
+int MRISbvhBenchmark(MRIS *mris, int npoints);
@@ -120,6 +120,14 @@ void MHT_maybeParallel_end();
 int  MHTwhich(MRIS_HASH_TABLE const * mht);
 void MHTfree(MRIS_HASH_TABLE**mht);
 
+// Freezing makes a table immutable: its buckets and bins are compacted into
+// contiguous arrays and lookups no longer lock, so any number of threads can
+// query it without MHT_maybeParallel_begin().  Adding or removing faces or
+// vertices afterwards is an error.
+//
+void MHTfreeze  (MRIS_HASH_TABLE* mht);
+bool MHTisFrozen(MRIS_HASH_TABLE const * mht);
+
 // Support multiple representations
 //
 #define MHT_VIRTUAL                 
@@ -179,3 +187,31 @@ void MHTfindClosestFaceGeneric(
         int *pfno, 
         double *pface_distance);
                             
+
+// Batched queries, one per (x,y,z) triple in xyz.  Run in parallel if the table is frozen.
+//
+void MHTfindClosestVertexNoXYZBatch(
+        MRIS_HASH_TABLE *mht,
+        MRIS *mris,
+        int npoints, float const *xyz,
+        int *vnos,              // npoints
+        float *dists);          // npoints, may be NULL
+
+void MHTfindKClosestVertexNosBatch(
+        MRIS_HASH_TABLE *mht,
+        MRIS *mris,
+        int npoints, float const *xyz,
+        float max_dist, int k,
+        int *vnos,              // npoints*k, nearest first
+        float *dists,           // npoints*k, may be NULL
+        int *nfound);           // npoints, may be NULL
+
+void MHTfindClosestFaceNoGenericBatch(
+        MRIS_HASH_TABLE *mht,
+        MRIS *mris,
+        int npoints, float const *xyz,
+        double in_max_distance_mm,
+        int    in_max_mhts,
+        int    project_into_face,
+        int *fnos,              // npoints
+        double *face_distances);// npoints, may be NULL
@@ -25,6 +25,11 @@ MHT_VIRTUAL int MHT_FUNCTION(findClosestVertexGeneric)      (MHT_THIS_PARAMETER
                                                                                                    double in_max_distance_mm, int in_max_halfmhts, 
                                                                                                    int *vtxnum,  double *vtx_distance               ) MHT_ABSTRACT;
 
+// The k closest vertices within max_dist, nearest first, returns how many were found
+//
+MHT_VIRTUAL int MHT_FUNCTION(findKClosestVertexNos)         (MHT_THIS_PARAMETER MHT_MRIS_PARAMETER float x, float y, float z, float max_dist,
+                                                                                                   int k, int *vnos, float *dists                   ) MHT_ABSTRACT;
+
 // Find closest face
 //
 MHT_VIRTUAL void MHT_FUNCTION(findClosestFaceNoGeneric)(MHT_THIS_PARAMETER MHT_MRIS_PARAMETER 
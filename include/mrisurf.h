@@ -234,6 +234,9 @@ typedef struct
 }
 MRI_SURFACE_PARAMETERIZATION, MRI_SP ;
 
+typedef struct MRISP_BLUR_CACHE MRISP_BLUR_CACHE;
+typedef struct MRIS_SOA MRIS_SOA;
+
 #define L_ANGLE              0.25f /*was 0.01*/ /* coefficient of angle term */
 #define L_AREA               1.0f    /* coefficient of angle term */
 #define N_AVERAGES           4096
@@ -351,6 +354,11 @@ class INTEGRATION_PARMS {
   MRI_SP  *mrisp_template ;   /* parameterization of canonical surface */
   MRI_SP  *mrisp_blurred_template ; /* parameterization of canonical
                                        surface convolve with Gaussian */
+  MRISP_BLUR_CACHE *mrisp_template_cache ; /* blurred frames of the template
+                                              passed to MRISregister, if any */
+  MRIS_SOA *soa ;             /* vertex arrays of the spring terms, kept
+                                 across the steps of an integration and
+                                 freed at its end (see MRISsoaAcquire) */
   double  area_coef_scale ;
   float   sigma ;             /* blurring scale */
 
@@ -475,7 +483,8 @@ class INTEGRATION_PARMS {
       flags(0), dt_increase(0), dt_decrease(0), error_ratio(0), epsilon(0),
       desired_rms_height(0), starting_sse(0), ending_sse(0), scale(0),
       mrisp(nullptr), frame_no(0), mrisp_template(nullptr),
-      mrisp_blurred_template(nullptr), area_coef_scale(0), sigma(0),
+      mrisp_blurred_template(nullptr), mrisp_template_cache(nullptr), soa(nullptr),
+      area_coef_scale(0), sigma(0),
       nfields(0),
       fields(), /* Array should initialize to zero */
       mri_brain(nullptr), mri_smooth(nullptr), user_parms(nullptr),
@@ -903,6 +912,45 @@ int          MRIScomputeSurfaceNormals(MRI_SURFACE *mris,
                                        int which,
                                        int navgs) ;
 int          MRIScomputeMetricProperties(MRI_SURFACE *mris) ;
+
+/*
+  Incremental metric properties for the integration loops. The tracker
+  remembers the vertex positions (and ripflags) the metric properties were
+  last computed for. MRIScomputeMetricPropertiesIncremental() then only
+  recomputes the faces, vertex normals and areas, and neighbor distances
+  around the vertices that have moved more than tol mm since, and does a
+  full MRIScomputeMetricProperties() when more than max_frac of the
+  vertices moved, the topology, status or ripflags changed, a vertex normal
+  degenerates, or the surface is a plane. With tol = 0 the results are
+  those of a full pass (the surface totals up to rounding), a larger tol
+  trades accuracy for speed. A NULL tracker always does a full pass.
+*/
+typedef struct
+{
+  float  tol ;            // mm a vertex must move to be recomputed
+  float  max_frac ;       // fraction of moved vertices above which a full pass is done
+  int    nvertices ;      // topology and status the snapshot is valid for
+  int    nfaces ;
+  int    nsize ;
+  int    status ;
+  float  *xyz ;           // [3*nvertices] positions at the last update, NULL before the first
+  char   *vripflag ;      // [nvertices] ripflags at the last update
+  char   *fripflag ;      // [nfaces]
+  char   *vflags ;        // [nvertices] scratch
+  char   *fflags ;        // [nfaces] scratch
+  int    nfull ;          // statistics
+  int    nincremental ;
+  double nupdated ;       // vertices recomputed, summed over the incremental updates
+  double seconds ;
+}
+MRIS_METRIC_TRACKER ;
+
+MRIS_METRIC_TRACKER *MRISmetricTrackerAlloc(MRI_SURFACE *mris, float tol, float max_frac) ;
+MRIS_METRIC_TRACKER *MRISmetricTrackerRequested(MRI_SURFACE *mris) ;  // NULL unless FS_INCREMENTAL_MP is set
+void         MRISmetricTrackerFree(MRIS_METRIC_TRACKER **pmpt) ;
+int          MRISmetricTrackerPrint(FILE *fp, MRIS_METRIC_TRACKER const *mpt) ;
+int          MRIScomputeMetricPropertiesIncremental(MRI_SURFACE *mris, MRIS_METRIC_TRACKER *mpt) ;
+
 double       MRISrescaleMetricProperties(MRIS *surf);
 int          MRISrestoreOldPositions(MRI_SURFACE *mris) ;
 int          MRISstoreCurrentPositions(MRI_SURFACE *mris) ;
@@ -1451,6 +1499,10 @@ MRI *MRISmakeBoundingVolume(MRIS *mris, double resolution);
 MRI *MRISfillInterior(MRI_SURFACE *mris,
                       double resolution,
                       MRI *mri_interior) ;
+MRI *MRISfillInteriorScanline(MRI_SURFACE *mris,
+                              MRI *mri_dst,
+                              int nsub,
+                              int coords_are_voxels) ;
 int MRISfillInteriorRibbonTest(char *subject, int UseNew, FILE *fp);
 MRI   *MRISshell(MRI *mri_src,
                  MRI_SURFACE *mris,
@@ -1520,6 +1572,23 @@ MRI_SP * MRISPblurFrames(MRI_SP *mrisp_src,
                          MRI_SP *mrisp_dst, float sigma, int *frames,
                          int nframes);
 
+// Blurred frames of a parameterization that is blurred to the same sigmas
+// over and over, e.g. a registration template, keyed by (sigma, frame).
+// MRISPblurCached(cache, src, dst, sigma, fno) gives the same result as
+// MRISPblur(src, dst, sigma, fno). The src the cache was made for must not
+// change while the cache is in use; other sources are not cached.
+//
+MRISP_BLUR_CACHE *MRISPblurCacheAlloc(MRI_SP *mrisp_src);
+void              MRISPblurCacheFree(MRISP_BLUR_CACHE **pcache);
+MRI_SP           *MRISPblurCached(MRISP_BLUR_CACHE *cache, MRI_SP *mrisp_src,
+                                  MRI_SP *mrisp_dst, float sigma, int fno);
+
+// Times MRISPblur on every frame of mrisp for each sigma with the default
+// kernel and with the separable one selected by FS_SEPARABLE_MRISPBLUR,
+// and reports how much the results differ.
+//
+int MRISPblurBenchmark(MRI_SP *mrisp, float *sigmas, int nsigmas);
+
 typedef struct
 {
   float   x ;
@@ -1742,6 +1811,71 @@ int MRISaverageGradients(MRI_SURFACE *mris, int num_avgs) ;
 int MRISaverageGradientsFast(MRI_SURFACE *mris, int num_avgs);
 int MRISaverageGradientsFastCheck(int num_avgs);
 
+/*
+  Sparse one-ring averaging operator. Each row replaces a vertex value by
+  the mean of itself and its unripped (and unmasked) neighbors, exactly as
+  the per-vertex loops in MRISaverageVals() and friends do. Build it once
+  for a topology/ripflag/mask configuration and apply it as often as
+  needed to 1 to 3 interleaved channels of per-vertex floats.
+*/
+typedef struct
+{
+  int   nvertices ;   // # of vertices of the surface it was built for
+  int   nrows ;       // # of vertices that change when averaged
+  int   *row_vno ;    // [nrows] vertex of each row
+  int   *row_start ;  // [nrows+1] neighbors of row r are nbrs[row_start[r]..row_start[r+1]-1]
+  int   *nbrs ;       // neighboring vertex numbers
+  float *num ;        // [nrows] # of values averaged, including the center
+}
+MRIS_AVERAGER ;
+
+// average ripped vertices too (only their neighbors are checked for ripflag)
+#define MRIS_AVERAGER_RIPPED_CENTERS  0x01
+
+MRIS_AVERAGER *MRISaveragerAlloc(MRI_SURFACE *mris, const float *mask, int flags) ;
+void MRISaveragerFree(MRIS_AVERAGER **pavg) ;
+int MRISaveragerApply(const MRIS_AVERAGER *avg, float *vals, int nchannels, int navgs) ;
+int MRISaveragerBenchmark(MRI_SURFACE *mris, int navgs) ;
+
+/*
+  Structure-of-arrays copy of the vertex fields that the spring and
+  smoothness sweeps stream through, one array per field, plus the one-ring
+  neighborhoods in the same CSR form as MRIS_AVERAGER. Load the groups a
+  sweep needs, run the sweep on the arrays and store back what it changed;
+  the VERTEX array is not touched in between, and stays the primary store
+  everywhere else. Only the spring and Laplacian terms use it so far, each
+  loading and storing the whole surface per call. An integration keeps one
+  MRIS_SOA across its steps with MRISsoaAcquire, so the arrays and the
+  neighbor table are only built again when mris->topology_clock changes.
+*/
+#define MRIS_SOA_XYZ      0x01    // x, y, z
+#define MRIS_SOA_NORMALS  0x02    // nx, ny, nz
+#define MRIS_SOA_DXYZ     0x04    // dx, dy, dz
+#define MRIS_SOA_TMP2     0x08    // t2x, t2y, t2z
+#define MRIS_SOA_FLAGS    0x10    // ripflag, border, neg (read only)
+
+struct MRIS_SOA
+{
+  int   nvertices ;
+  int   nfaces ;                  // of the surface the neighbor table was built for
+  long  topology_clock ;          // mris->topology_clock when it was built
+  int   fields ;                  // MRIS_SOA_* groups that are allocated
+  float *x, *y, *z ;
+  float *nx, *ny, *nz ;
+  float *dx, *dy, *dz ;
+  float *t2x, *t2y, *t2z ;
+  char  *ripflag, *border, *neg ;
+  int   *nbr_start ;              // [nvertices+1] one-ring of vno is nbrs[nbr_start[vno]..nbr_start[vno+1]-1]
+  int   *nbrs ;                   // vt->v[0..vnum-1] of every vertex, ripped ones included
+} ;
+
+MRIS_SOA *MRISsoaAlloc(MRI_SURFACE *mris, int fields) ;
+void MRISsoaFree(MRIS_SOA **psoa) ;
+MRIS_SOA *MRISsoaAcquire(MRIS_SOA **psoa, MRI_SURFACE *mris, int fields) ;
+int MRISsoaLoad(MRIS_SOA *soa, MRI_SURFACE *mris, int fields) ;
+int MRISsoaStore(const MRIS_SOA *soa, MRI_SURFACE *mris, int fields) ;
+int MRISsoaBenchmark(MRI_SURFACE *mris, int ntimes) ;
+
 int MRISnormalTermWithGaussianCurvature(MRI_SURFACE *mris,double l_lambda) ;
 int MRISnormalSpringTermWithGaussianCurvature(MRI_SURFACE *mris,
                                               double gaussian_norm,
@@ -2143,6 +2277,7 @@ void mrisRemoveEdge(MRIS *mris, int vno1, int vno2);
 // Neighbourhoods
 //
 void mrisVertexReplacingNeighbors(MRIS * mris, int vno, int vnum);
+void mrisTopologyChanged         (MRIS const * mris);           // restamps mris->topology_clock
 void mrisForgetNeighborhoods     (MRIS * mris);
 
 int  MRISresetNeighborhoodSize      (MRIS *mris, int nsize) ;
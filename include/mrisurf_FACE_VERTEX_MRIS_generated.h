@@ -224,6 +224,7 @@ struct MRIS {
     char                          nsize                    ;  //  size of neighborhoods or -1
     uchar                         vtotalsMightBeTooBig     ;  //  MRISsampleDistances sets this
     short                         nsizeMaxClock            ;  //  changed whenever an edge is added or removed, which invalidates the vertex v#num values
+    long                          topology_clock           ;  //  restamped whenever vertex neighbors or faces are added, removed or renumbered
     char                          max_nsize                ;  //  max the neighborhood size has been set to (typically 3)
     char                          dist_nsize               ;  //  max mrisComputeVertexDistances has computed distances out to
     char                          dist_orig_nsize          ;  //  max mrisComputeOriginalVertexDistances has computed distances out to
@@ -493,6 +494,7 @@ struct MRIS {
     ELTT(char,nsize)  SEP \
     ELTT(uchar,vtotalsMightBeTooBig)  SEP \
     ELTX(short,nsizeMaxClock)  SEP \
+    ELTX(long,topology_clock)  SEP \
     ELTT(char,max_nsize)  SEP \
     ELTT(char,dist_nsize)  SEP \
     ELTT(char,dist_orig_nsize)  SEP \
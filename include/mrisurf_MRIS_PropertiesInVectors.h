@@ -211,6 +211,7 @@ struct MRISPV {
     char                          nsize                    ;  //  size of neighborhoods or -1
     uchar                         vtotalsMightBeTooBig     ;  //  MRISsampleDistances sets this
     short                         nsizeMaxClock            ;  //  changed whenever an edge is added or removed, which invalidates the vertex v#num values
+    long                          topology_clock           ;  //  restamped whenever vertex neighbors or faces are added, removed or renumbered
     char                          max_nsize                ;  //  max the neighborhood size has been set to (typically 3)
     char                          dist_nsize               ;  //  max mrisComputeVertexDistances has computed distances out to
     char                          dist_orig_nsize          ;  //  max mrisComputeOriginalVertexDistances has computed distances out to
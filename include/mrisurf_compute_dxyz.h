@@ -34,14 +34,16 @@ int mrisComputeExpansionTerm(MRIS *mris, double l_expand);
 int mrisComputeHistoTerm(MRIS *mris, INTEGRATION_PARMS *parms);
 int mrisComputeIntensityGradientTerm(MRIS *mris, double l_grad, MRI *mri_brain, MRI *mri_smooth);
 int mrisComputeIntensityTerm(MRIS *mris, double l_intensity, MRI *mri_brain, MRI *mri_smooth, double sigma, INTEGRATION_PARMS *parms);
-int mrisComputeLaplacianTerm(MRIS *mris, double l_lap);
+int mrisComputeLaplacianTerm(MRIS *mris, double l_lap, MRIS_SOA **psoa = NULL);
 int mrisComputeLinkTerm(MRIS *mris, double l_link, int pial);
 int mrisComputeMaxSpringTerm(MRIS *mris, double l_max_spring);
 int mrisComputeNonlinearAreaTerm(MRIS *mris, INTEGRATION_PARMS *parms);
 int mrisComputeNonlinearDistanceTerm(MRIS *mris, INTEGRATION_PARMS *parms);
 int mrisComputeNonlinearSpringTerm(MRIS *mris, double l_nlspring, INTEGRATION_PARMS *parms);
 int mrisComputeNonlinearTangentialSpringTerm(MRIS *mris, double l_spring, double min_dist);
-int mrisComputeNormalizedSpringTerm(MRIS *mris, double const l_spring);
+int mrisComputeNormalizedSpringTerm(MRIS *mris, double const l_spring, MRIS_SOA **psoa = NULL);
+int mrisComputeSpringTerms(MRIS *mris, double l_spring, double l_lap, double l_spring_norm, MRIS_SOA **psoa = NULL);
+int mrisComputeSpringTermsSoA(MRIS *mris, MRIS_SOA *soa, double l_spring, double l_lap, double l_spring_norm);
 int mrisComputePlaneTerm(MRIS *mris, double l_plane, double l_spacing);
 int mrisComputePolarCorrelationTerm(MRIS *mris, INTEGRATION_PARMS *parms);
 int mrisComputePolarVectorCorrelationTerm(MRIS *mris, INTEGRATION_PARMS *parms);
@@ -68,5 +70,5 @@ void mrisComputeNormalSpringTerm(MRIS *mris, double l_spring);
 void vertexComputeNormalSpringTerm(MRIS* mris, int vno, float* dx, float* dy, float* dz, double l_spring = 1.0);
 
 // tangential spring
-void mrisComputeTangentialSpringTerm(MRIS *mris, double l_spring);
+void mrisComputeTangentialSpringTerm(MRIS *mris, double l_spring, MRIS_SOA **psoa = NULL);
 void vertexComputeTangentialSpringTerm(MRIS* mris, int vno, float* dx, float* dy, float* dz, double l_spring = 1.0);
@@ -0,0 +1,41 @@
+/**
+ * @brief parallel block-gzip file io
+ *
+ * Multi-threaded drop-in replacement for znzopen() on compressed files.
+ * Files are written as a series of independent gzip members, so they
+ * remain readable by gzip, zlib and any other gzip reader, and each
+ * member header carries its compressed size so that the members can be
+ * located without inflating, and only the members that are read get
+ * inflated, in parallel.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef PGZIP_H
+#define PGZIP_H
+
+#include <stddef.h>
+
+#include "znzlib.h"
+
+// uncompressed bytes per gzip member - fixed so that the output does
+// not depend on the number of threads
+#define PGZIP_BLOCK_SIZE (1024 * 1024)
+
+znzFile pgzopen(const char *path, const char *mode, int use_compression);
+int pgzipEnabled(void);
+void pgzipSetEnabled(int enabled);
+int pgzipIsBlocked(const char *fname);
+int pgzipCompress(const void *buf, size_t nbytes, FILE *fp, int level);
+
+#endif
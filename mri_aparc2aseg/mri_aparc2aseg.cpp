@@ -229,6 +229,9 @@ int main(int argc, char **argv)
     printf("\n");
     printf("Building hash of lh pial\n");
     lhpial_hash = MHTcreateVertexTable_Resolution(lhpial, CURRENT_VERTICES,hashres);
+    // only looked up from here on, so no locking is needed in the voxel loop
+    MHTfreeze(lhwhite_hash);
+    MHTfreeze(lhpial_hash);
   }
 
   if(DoRH){
@@ -293,6 +296,8 @@ int main(int argc, char **argv)
     printf("\n");
     printf("Building hash of rh pial\n");
     rhpial_hash = MHTcreateVertexTable_Resolution(rhpial, CURRENT_VERTICES,hashres);
+    MHTfreeze(rhwhite_hash);
+    MHTfreeze(rhpial_hash);
   }
 
   if(UseNewRibbon){
@@ -926,6 +926,9 @@ int Surf2VolSeg::LoadData(void){
     if(lhpial==NULL) exit(1);
     lhwhite_hash = MHTcreateVertexTable_Resolution(lhwhite, CURRENT_VERTICES,hashres);
     lhpial_hash = MHTcreateVertexTable_Resolution(lhpial, CURRENT_VERTICES,hashres);
+    // only looked up from here on, so no locking is needed in the voxel loop
+    MHTfreeze(lhwhite_hash);
+    MHTfreeze(lhpial_hash);
     printf("Loading %s\n",lhcortexlabelpath.c_str());
     LABEL *cortexlabel = LabelRead(NULL, &(lhcortexlabelpath.c_str()[0]));
     if(cortexlabel==NULL) exit(1);
@@ -967,6 +970,8 @@ int Surf2VolSeg::LoadData(void){
     if(rhpial==NULL) exit(1);
     rhwhite_hash = MHTcreateVertexTable_Resolution(rhwhite, CURRENT_VERTICES,hashres);
     rhpial_hash = MHTcreateVertexTable_Resolution(rhpial, CURRENT_VERTICES,hashres);
+    MHTfreeze(rhwhite_hash);
+    MHTfreeze(rhpial_hash);
     printf("Loading %s\n",rhcortexlabelpath.c_str());
     LABEL *cortexlabel = LabelRead(NULL, &(rhcortexlabelpath.c_str()[0]));
     if(cortexlabel==NULL) exit(1);
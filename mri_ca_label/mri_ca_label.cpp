@@ -4397,6 +4397,7 @@ GCAremoveWMSA( GCA *gca )
       }
     }
   }
+  GCAdensitiesInvalidate(gca) ;
   return(NO_ERROR) ;
 }
 
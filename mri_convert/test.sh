@@ -37,3 +37,12 @@ compare_vol vnav.non-mosaic.mgz vnav.non-mosaic.ref.mgz
 # DICOM with identical geometry - but mosaic'd
 test_command mri_convert --mosaic-fix-noascii vnav.mosaic.dcm vnav.mosaic.mgz
 compare_vol vnav.mosaic.mgz vnav.mosaic.ref.mgz
+
+# parallel block-gzip output must inflate with stock gzip, and both the
+# gunzipped and the read-back volume must match the input
+FS_PGZIP=1 OMP_NUM_THREADS=4 test_command mri_convert orig.ref.mgz pgzip.mgz
+FSTEST_NO_DATA_RESET=1 test_command "gzip -dc pgzip.mgz > pgzip.mgh"
+FSTEST_NO_DATA_RESET=1 FS_PGZIP=1 OMP_NUM_THREADS=4 test_command mri_convert pgzip.mgz pgzip.read.mgh
+diffcmd=$(find_path $FSTEST_CWD mri_diff/mri_diff)
+eval_cmd $diffcmd pgzip.mgh orig.ref.mgz
+eval_cmd $diffcmd pgzip.read.mgh orig.ref.mgz
@@ -112,6 +112,7 @@ typedef struct {
   int optschema;
   int seed=53;
   char *movoutfile=NULL;
+  double SampleFrac;
 } CMDARGS;
 CMDARGS *cmdargs;
 
@@ -130,6 +131,10 @@ int WriteDoubleMatrix(const char *fname, const char *fmt, double **M, int rows,
 int PrintDoubleMatrix(FILE *fp, const char *fmt, double **M, int rows, int cols);
 double *SumVectorDoubleMatrix(double **M, int rows, int cols, int dim, double *sumvect, int *nv);
 
+// Number of partial joint histograms, fixed so that the sum does not
+// depend on the number of threads
+#define COREG_NCHUNKS 32
+
 typedef struct {
   MRI *ref, *mov, *refmask, *movmask;
   int seplist[10],nsep,sep,sepmin;
@@ -165,6 +170,13 @@ typedef struct {
   int optschema;
   int debug;
   int seed;
+  double **HH; // partial joint histograms, one per chunk
+  double SampleFrac; // sparse mode: fraction of the sep grid sampled, 0 = all
+  int samplesep; // sep the sample list was built for
+  long nsamples, ngrid;
+  double *csamp, *rsamp, *ssamp; // ref crs of the samples
+  int *ivgsamp; // binned ref intensity of the samples
+  long samplechunk[COREG_NCHUNKS+1]; // first sample of each chunk
 } COREG;
 
 double COREGcost(COREG *coreg);
@@ -175,6 +187,9 @@ int COREGfwhm(MRI *mri, double sep, double fwhm[3]);
 int COREGpreproc(COREG *coreg);
 LTA *LTAcreate(MRI *src, MRI *dst, MATRIX *T, int type);
 int COREGhist(COREG *coreg);
+long COREGhistGrid(COREG *coreg, const double *V2V);
+long COREGhistSamples(COREG *coreg, const double *V2V);
+int COREGsampleList(COREG *coreg);
 long COREGvolIndex(int ncols, int nrows, int nslices, int c, int r, int s);
 double COREGsamp(unsigned char *f, const double c, const double r, const double s, 
 		  const int ncols, const int nrows, const int nslices);
@@ -380,6 +395,8 @@ int main(int argc, char *argv[]) {
   coreg->MovOOBFlag = cmdargs->MovOOBFlag;
   coreg->optschema = cmdargs->optschema;
   coreg->debug = debug;
+  coreg->SampleFrac = cmdargs->SampleFrac;
+  if(coreg->SampleFrac > 0) printf("Sparse sampling of %g of each sep grid\n",coreg->SampleFrac);
 
   if(coreg->DoCoordDither){
     // Creating a dither volume is needed for thread safety
@@ -793,6 +810,11 @@ static int parse_commandline(int argc, char **argv) {
       sscanf(pargv[0],"%lf",&cmdargs->linmintol);
       nargsused = 1;
     } 
+    else if (!strcasecmp(option, "--sample-frac")) {
+      if(nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%lf",&cmdargs->SampleFrac);
+      nargsused = 1;
+    } 
     else if (!strcasecmp(option, "--sep")) {
       if(nargc < 1) CMDargNErr(option,1);
       sscanf(pargv[0],"%d",&cmdargs->seplist[cmdargs->nsep]);
@@ -909,6 +931,8 @@ static void print_usage(void) {
   printf("   --no-coord-dither: turn off coordinate dithering\n");
   printf("   --no-intensity-dither: turn off intensity dithering\n");
   printf("   --sep voxsep1 <--sep voxsep2> : set spatial scales (def is 2 vox and 4 vox)\n");
+  printf("   --sample-frac frac : only use a fixed random fraction (0-1] of the voxels at each spatial scale\n");
+  printf("      (drawn with --seed; default is to use all of them)\n");
   printf("   --trans Tx Ty Tz : initial translation in mm (implies --no-cras0)\n");
   printf("   --rot   Rx Ry Rz : initial rotation in deg\n");
   printf("   --scale Sx Sy Sz : initial scale\n");
@@ -989,6 +1013,10 @@ static void check_options(void) {
     printf("ERROR: must spec --reg\n");
     exit(1);
   }
+  if(cmdargs->SampleFrac < 0 || cmdargs->SampleFrac > 1){
+    printf("ERROR: --sample-frac must be between 0 and 1\n");
+    exit(1);
+  }
   if(cmdargs->nsep == 0){
     cmdargs->nsep = 2;
     cmdargs->seplist[0] = 4;
@@ -1018,6 +1046,7 @@ static void dump_options(FILE *fp) {
   fprintf(fp,"SatPct    %lf\n",cmdargs->SatPct);
   fprintf(fp,"MovOOB %d\n",cmdargs->MovOOBFlag);
   fprintf(fp,"optschema %d\n",cmdargs->optschema);
+  fprintf(fp,"SampleFrac %lf\n",cmdargs->SampleFrac);
   return;
 }
 
@@ -1075,7 +1104,7 @@ double COREGsamp(unsigned char *f, const double c, const double r, const double
  */
 int COREGhist(COREG *coreg)
 {
-  int const nchunks = 32;
+  int const nchunks = COREG_NCHUNKS;
 
   // Pack vox2voxl matrix into an array for speed
   //
@@ -1098,14 +1127,72 @@ int COREGhist(COREG *coreg)
   V2V[14] = coreg->V2V->rptr[3][4];
   V2V[15] = 0;
 
-  double **HH  = (double **)calloc(sizeof(double*),nchunks);
-  { int n;
+  // The partial histograms are kept for the next evaluation
+  if(coreg->HH == NULL){
+    int n;
+    coreg->HH = (double **)calloc(sizeof(double*),nchunks);
     for(n=0; n < nchunks; n++) 
-      HH[n] = (double *)calloc(sizeof(double),256*256);
+      coreg->HH[n] = (double *)calloc(sizeof(double),256*256);
   }
+  else {
+    int n;
+    for(n=0; n < nchunks; n++) memset(coreg->HH[n],0,sizeof(double)*256*256);
+  }
+  double ** const HH = coreg->HH;
   
   long nhits = 0;
 
+  if(coreg->SampleFrac > 0) nhits = COREGhistSamples(coreg, V2V);
+  else                     nhits = COREGhistGrid(coreg, V2V);
+
+  // Collect the chunks, always in the same order
+  int k;
+  ROMP_PF_begin
+  #ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+  #endif
+  for(k=0; k < 256*256; k++){
+    ROMP_PFLB_begin
+    double sum = 0;
+    int n;
+    for(n=0; n < nchunks; n++) sum += HH[n][k];
+    coreg->H01d[k] = sum;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  
+  // Repackage Histogram into a 2D array
+  if(!coreg->H0) coreg->H0 = AllocDoubleMatrix(256,256);
+  
+  int n = 0;
+  int c;
+  for(c=0; c < 256; c++){
+    int r;
+    for(r=0; r < 256; r++){
+      coreg->H0[r][c] = coreg->H01d[n];
+      n++;
+    }
+  }
+
+  // This is good for computing whether and how much the mov and ref overlap
+  coreg->nhits   = nhits;
+  coreg->pcthits = pow(coreg->sep,3)*(double) 100.0*nhits/coreg->nvoxref;
+  if(coreg->SampleFrac > 0 && coreg->nsamples > 0)
+    coreg->pcthits *= (double)coreg->ngrid/coreg->nsamples;
+
+  return(nhits);
+}
+
+/*!
+  \fn long COREGhistGrid(COREG *coreg, const double *V2V)
+  \brief Fills the partial joint histograms coreg->HH from every point of
+  the sep grid of the ref. Returns the number of points inside the mov.
+ */
+long COREGhistGrid(COREG *coreg, const double *V2V)
+{
+  int const nchunks = COREG_NCHUNKS;
+  long nhits = 0;
+
   // Calculate the number of iterations the original loop did
   // Do in chunks in parallel to get deterministic results independent of the number of threads used
   //
@@ -1127,7 +1214,7 @@ int COREGhist(COREG *coreg)
     int cref;
     for(cref=crefBegin; cref < crefEnd; cref += coreg->sep){
   
-      double * const H = HH[chunk];
+      double * const H = coreg->HH[chunk];
 
       int rref,sref;
       for(rref=0; rref < coreg->ref->height; rref += coreg->sep){
@@ -1182,36 +1269,190 @@ int COREGhist(COREG *coreg)
   }
   ROMP_PF_end
 
-  // Collect the chunks
-  { int k;
-    for(k=0; k < 256*256; k++){
-      coreg->H01d[k] = 0;
-      int n;
-      for(n=0; n < nchunks; n++) coreg->H01d[k] += HH[n][k];
+  return(nhits);
+}
+
+/*!
+  \fn double COREGsampleUniform(int c, int r, int s, int seed)
+  \brief Uniform(0,1) number that only depends on the voxel and the seed,
+  so it does not matter which thread or in what order it is computed.
+ */
+static double COREGsampleUniform(int c, int r, int s, int seed)
+{
+  unsigned int h;
+  h  = (unsigned int)seed;
+  h ^= (unsigned int)c * 73856093u;
+  h ^= (unsigned int)r * 19349663u;
+  h ^= (unsigned int)s * 83492791u;
+  // murmur3 finalizer to mix the bits
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return(h/4294967296.0);
+}
+
+/*!
+  \fn int COREGsampleList(COREG *coreg)
+  \brief Builds the list of ref voxels used by the sparse sampling mode
+  at the current sep. Each point of the sep grid is kept with probability
+  SampleFrac, so the subset is fixed for a given seed and sep and is
+  redrawn at each sep. The (dithered) ref coordinates and the binned ref
+  intensity do not depend on the registration, so they are computed here
+  once instead of at every evaluation. The samples are grouped in the
+  same column chunks as the full grid in COREGhistGrid().
+ */
+int COREGsampleList(COREG *coreg)
+{
+  int const nchunks = COREG_NCHUNKS;
+  int const niters    = (coreg->ref->width + coreg->sep - 1) / coreg->sep;
+  int const chunkSize = (niters            + nchunks    - 1) / nchunks;
+  int const seed = coreg->seed*31 + coreg->sep;
+  long nchunk[COREG_NCHUNKS];
+  int chunk, pass;
+
+  free(coreg->csamp);
+  free(coreg->rsamp);
+  free(coreg->ssamp);
+  free(coreg->ivgsamp);
+  coreg->csamp = coreg->rsamp = coreg->ssamp = NULL;
+  coreg->ivgsamp = NULL;
+
+  // pass 0 counts the samples of each chunk, pass 1 fills them in
+  for(pass = 0; pass < 2; pass++){
+    ROMP_PF_begin
+    #ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible)
+    #endif
+    for(chunk = 0; chunk < nchunks; chunk++){
+      ROMP_PFLB_begin
+      int const crefBegin = (chunk+0)*chunkSize*coreg->sep;
+      int       crefEnd   = (chunk+1)*chunkSize*coreg->sep;
+      if (crefEnd > coreg->ref->width) crefEnd = coreg->ref->width;
+      long i = 0;
+      if(pass == 1) i = coreg->samplechunk[chunk];
+
+      int cref,rref,sref;
+      for(cref=crefBegin; cref < crefEnd; cref += coreg->sep){
+	for(rref=0; rref < coreg->ref->height; rref += coreg->sep){
+	  for(sref=0; sref < coreg->ref->depth; sref += coreg->sep){
+	    if(COREGsampleUniform(cref,rref,sref,seed) >= coreg->SampleFrac) continue;
+	    if(pass == 0){
+	      i++;
+	      continue;
+	    }
+
+	    double dcref = cref, drref = rref, dsref = sref;
+	    if(coreg->DoCoordDither){
+	      // dither is uniform(0,1), scale by separation to sample entire vol
+	      dcref += coreg->sep*MRIgetVoxVal(coreg->cdither,cref,rref,sref,0);
+	      drref += coreg->sep*MRIgetVoxVal(coreg->cdither,cref,rref,sref,1);
+	      dsref += coreg->sep*MRIgetVoxVal(coreg->cdither,cref,rref,sref,2);
+	      if(dcref > coreg->ref->width-1)  dcref = coreg->ref->width-1;
+	      if(drref > coreg->ref->height-1) drref = coreg->ref->height-1;
+	      if(dsref > coreg->ref->depth-1)  dsref = coreg->ref->depth-1;
+	    }
+	    double vg = COREGsamp(coreg->g, dcref, drref, dsref, coreg->ref->width,coreg->ref->height,coreg->ref->depth);
+	    coreg->csamp[i] = dcref;
+	    coreg->rsamp[i] = drref;
+	    coreg->ssamp[i] = dsref;
+	    coreg->ivgsamp[i] = floor(vg+0.5);
+	    i++;
+	  }
+	}
+      }
+      if(pass == 0) nchunk[chunk] = i;
+      ROMP_PFLB_end
     }
-  }
-  
-  { int n;
-    for(n=0; n < nchunks; n++) free(HH[n]);
-    free(HH); HH=NULL;
-  }
-  
-  // Repackage Histogram into a 2D array
-  if(!coreg->H0) coreg->H0 = AllocDoubleMatrix(256,256);
-  
-  int n = 0;
-  int c;
-  for(c=0; c < 256; c++){
-    int r;
-    for(r=0; r < 256; r++){
-      coreg->H0[r][c] = coreg->H01d[n];
-      n++;
+    ROMP_PF_end
+
+    if(pass == 0){
+      coreg->samplechunk[0] = 0;
+      for(chunk = 0; chunk < nchunks; chunk++)
+	coreg->samplechunk[chunk+1] = coreg->samplechunk[chunk] + nchunk[chunk];
+      coreg->nsamples = coreg->samplechunk[nchunks];
+      coreg->csamp = (double *)calloc(sizeof(double),MAX(coreg->nsamples,1));
+      coreg->rsamp = (double *)calloc(sizeof(double),MAX(coreg->nsamples,1));
+      coreg->ssamp = (double *)calloc(sizeof(double),MAX(coreg->nsamples,1));
+      coreg->ivgsamp = (int *)calloc(sizeof(int),MAX(coreg->nsamples,1));
     }
   }
 
-  // This is good for computing whether and how much the mov and ref overlap
-  coreg->nhits   = nhits;
-  coreg->pcthits = pow(coreg->sep,3)*(double) 100.0*nhits/coreg->nvoxref;
+  coreg->ngrid = (long)niters *
+    ((coreg->ref->height + coreg->sep - 1) / coreg->sep) *
+    ((coreg->ref->depth  + coreg->sep - 1) / coreg->sep);
+  coreg->samplesep = coreg->sep;
+  printf("sep = %d, sampling %ld of %ld voxels\n",coreg->sep,coreg->nsamples,coreg->ngrid);
+  fflush(stdout);
+  return(0);
+}
+
+/*!
+  \fn long COREGhistSamples(COREG *coreg, const double *V2V)
+  \brief Fills the partial joint histograms coreg->HH from the sample list
+  of the sparse sampling mode (rebuilt when sep changes). Same histogram
+  updates as the full grid loop in COREGhist(). The samples are mapped
+  into the mov in blocks so that the affine part vectorizes. Returns the
+  number of samples inside the mov.
+ */
+long COREGhistSamples(COREG *coreg, const double *V2V)
+{
+  int const nchunks = COREG_NCHUNKS;
+  int const zonly = (coreg->optschema == 2 || coreg->optschema == 4 || coreg->optschema == 5);
+  long nhits = 0;
+  int chunk;
+
+  if(coreg->samplesep != coreg->sep) COREGsampleList(coreg);
+
+  ROMP_PF_begin
+  #ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+:nhits)
+  #endif
+  for (chunk = 0; chunk < nchunks; chunk++) {
+    ROMP_PFLB_begin
+    int const nblock = 256;
+    double cmov[256], rmov[256], smov[256];
+    double * const H = coreg->HH[chunk];
+    int const ncols = coreg->mov->width, nrows = coreg->mov->height, nslices = coreg->mov->depth;
+    long i0, i1, i;
+    int j, nb;
+
+    i1 = coreg->samplechunk[chunk+1];
+    for(i0 = coreg->samplechunk[chunk]; i0 < i1; i0 += nblock){
+      nb = MIN(nblock, i1-i0);
+      const double * const cref = &coreg->csamp[i0];
+      const double * const rref = &coreg->rsamp[i0];
+      const double * const sref = &coreg->ssamp[i0];
+
+      for(j=0; j < nb; j++){
+	cmov[j] = V2V[0]*cref[j] + V2V[4]*rref[j] + V2V[ 8]*sref[j] + V2V[12];
+	rmov[j] = V2V[1]*cref[j] + V2V[5]*rref[j] + V2V[ 9]*sref[j] + V2V[13];
+	smov[j] = V2V[2]*cref[j] + V2V[6]*rref[j] + V2V[10]*sref[j] + V2V[14];
+      }
+      if(zonly) for(j=0; j < nb; j++) smov[j] = 0;
+
+      for(j=0; j < nb; j++){
+	double vf;
+	i = i0 + j;
+	if(cmov[j] < 0 || cmov[j] > ncols-1 || rmov[j] < 0 || rmov[j] > nrows-1 ||
+	   (!zonly && (smov[j] < 0 || smov[j] > nslices-1))){
+	  if(coreg->MovOOBFlag) vf = 0;
+	  else continue;
+	}
+	else {
+	  vf = COREGsamp(coreg->f, cmov[j], rmov[j], smov[j], ncols, nrows, nslices);
+	  nhits ++;
+	}
+	int const ivf = floor(vf);
+	int const ivg = coreg->ivgsamp[i];
+	H[ivf+ivg*256] += (1-(vf-ivf));
+	if(ivf<255) H[ivf+1+ivg*256] += (vf-ivf);
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
 
   return(nhits);
 }
@@ -20,6 +20,8 @@
 
 #include <iostream>
 
+#include "romp_support.h"
+
 #include "macros.h"
 #include "diag.h"
 #include "cma.h"
@@ -84,6 +86,166 @@ double local_GCAcomputeLogSampleProbability( GCA *gca,
 }
 
 
+// ===========================================
+
+/*
+  returns NULL if the queue cannot reproduce
+  local_GCAcomputeLogSampleProbability (ex vivo, robust and variance
+  costs) or if the one-at-a-time search was requested, in which case the
+  callers fall back to it.
+*/
+EM_CANDIDATES *EMcandidatesAlloc( GCA *gca,
+                                  GCA_SAMPLE *gcas,
+                                  MRI *mri,
+                                  int nsamples,
+                                  double clamp,
+                                  int nparms )
+{
+  EM_CANDIDATES *emc ;
+  int           i ;
+
+  if (serial_search || exvivo || robust || use_variance)
+  {
+    return(NULL) ;
+  }
+
+  emc = (EM_CANDIDATES *)calloc(1, sizeof(EM_CANDIDATES)) ;
+  if (!emc)
+  {
+    ErrorExit(ERROR_NOMEMORY, "EMcandidatesAlloc: could not allocate struct") ;
+  }
+  emc->gca = gca ;
+  emc->gcas = gcas ;
+  emc->mri = mri ;
+  emc->nsamples = nsamples ;
+  emc->clamp = clamp ;
+  emc->nparms = nparms ;
+  emc->prior_coords = (float *)calloc(3*nsamples, sizeof(float)) ;
+  emc->ubound = (double *)calloc(nsamples+1, sizeof(double)) ;
+  emc->m_prior2source =
+    (float *)calloc(12*EM_CANDIDATE_BLOCK, sizeof(float)) ;
+  emc->parms = (double *)calloc(nparms*EM_CANDIDATE_BLOCK, sizeof(double)) ;
+  emc->log_p = (double *)calloc(EM_CANDIDATE_BLOCK, sizeof(double)) ;
+  if (!emc->prior_coords || !emc->ubound || !emc->m_prior2source ||
+      !emc->parms || !emc->log_p)
+  {
+    ErrorExit(ERROR_NOMEMORY,
+              "EMcandidatesAlloc: could not allocate %d samples", nsamples) ;
+  }
+  for (i = 0 ; i < nsamples ; i++)
+  {
+    emc->prior_coords[3*i] = gcas[i].xp ;
+    emc->prior_coords[3*i+1] = gcas[i].yp ;
+    emc->prior_coords[3*i+2] = gcas[i].zp ;
+  }
+  emc->reentrant =
+    GCAlogSampleProbabilityBounds(gca, gcas, nsamples, clamp, emc->ubound) ;
+  emc->transform = TransformAlloc(LINEAR_VOX_TO_VOX, NULL) ;
+  return(emc) ;
+}
+
+/*
+  queue the candidate m_L with its search parameters. The prior->source
+  matrix is built through the same TransformInvert and
+  GCAgetPriorToSourceVoxelMatrix calls as GCAcomputeLogSampleProbability.
+  Returns 1 when the block is full and must be flushed.
+*/
+int EMcandidatesAdd( EM_CANDIDATES *emc, MATRIX *m_L, const double *parms )
+{
+  LTA    *lta = (LTA *)emc->transform->xform ;
+  MATRIX *m_L_save, *m ;
+  float  *dst ;
+  int    r, c, n ;
+
+  n = emc->ncandidates++ ;
+  m_L_save = lta->xforms[0].m_L ;
+  lta->xforms[0].m_L = m_L ;
+  TransformInvert(emc->transform, emc->mri) ;
+  m = GCAgetPriorToSourceVoxelMatrix(emc->gca, emc->mri, emc->transform) ;
+  lta->xforms[0].m_L = m_L_save ;
+
+  dst = &emc->m_prior2source[12*n] ;
+  for (r = 1 ; r <= 3 ; r++)
+    for (c = 1 ; c <= 4 ; c++)
+    {
+      *dst++ = *MATRIX_RELT(m, r, c) ;
+    }
+  MatrixFree(&m) ;
+  for (r = 0 ; r < emc->nparms ; r++)
+  {
+    emc->parms[emc->nparms*n+r] = parms[r] ;
+  }
+
+  return(emc->ncandidates >= EM_CANDIDATE_BLOCK) ;
+}
+
+/*
+  evaluate the queued candidates concurrently, then scan them in the order
+  they were queued and update *pmax_log_p and best_parms wherever a
+  candidate strictly improves on it, exactly like the serial loops do.
+*/
+int EMcandidatesFlush( EM_CANDIDATES *emc,
+                       double *pmax_log_p,
+                       double *best_parms )
+{
+  double const prune_below = *pmax_log_p ;
+  int    n, r, nbetter = 0 ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP2(emc->reentrant, assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (n = 0 ; n < emc->ncandidates ; n++)
+  {
+    ROMP_PFLB_begin
+    double log_p ;
+
+    log_p = GCAcomputeLogSampleProbabilityMatrix
+            (emc->gca, emc->gcas, emc->prior_coords, emc->mri,
+             &emc->m_prior2source[12*n], emc->nsamples, emc->clamp,
+             emc->ubound, prune_below) ;
+    emc->log_p[n] = log_p ;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (n = 0 ; n < emc->ncandidates ; n++)
+  {
+    if (emc->log_p[n] > *pmax_log_p)
+    {
+      *pmax_log_p = emc->log_p[n] ;
+      for (r = 0 ; r < emc->nparms ; r++)
+      {
+        best_parms[r] = emc->parms[emc->nparms*n+r] ;
+      }
+      nbetter++ ;
+    }
+  }
+
+  emc->ncandidates = 0 ;
+  return(nbetter) ;
+}
+
+int EMcandidatesFree( EM_CANDIDATES **pemc )
+{
+  EM_CANDIDATES *emc = *pemc ;
+
+  if (!emc)
+  {
+    return(NO_ERROR) ;
+  }
+  *pemc = NULL ;
+  TransformFree(&emc->transform) ;
+  free(emc->prior_coords) ;
+  free(emc->ubound) ;
+  free(emc->m_prior2source) ;
+  free(emc->parms) ;
+  free(emc->log_p) ;
+  free(emc) ;
+  return(NO_ERROR) ;
+}
+
+
 // ===========================================
 
 
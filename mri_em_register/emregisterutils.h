@@ -27,6 +27,7 @@
 
 extern int exvivo;
 extern int robust;
+extern int serial_search;
 extern float G_wm_mean, G_gm_mean, G_fluid_mean;
 
 double local_GCAcomputeLogSampleProbability( GCA *gca,
@@ -36,6 +37,46 @@ double local_GCAcomputeLogSampleProbability( GCA *gca,
                                              int nsamples,
                                              int exvivo, double clamp );
 
+/*
+  Candidate transforms of the global searches, queued so that a whole block
+  of them is evaluated concurrently. The sample coordinates are gathered
+  into one contiguous array up front, and a candidate is abandoned as soon
+  as the per-sample upper bounds show it cannot beat the best log p found
+  before its block (branch-and-bound), so the maximum found is the one of
+  the one-at-a-time scan.
+*/
+#define EM_CANDIDATE_BLOCK 256
+
+typedef struct
+{
+  GCA        *gca ;
+  GCA_SAMPLE *gcas ;
+  MRI        *mri ;
+  int        nsamples ;
+  double     clamp ;
+  int        reentrant ;       // sample densities may be evaluated concurrently
+  float      *prior_coords ;   // (xp, yp, zp) of each sample
+  double     *ubound ;         // suffix sums of the per-sample log p bounds
+  TRANSFORM  *transform ;
+  int        nparms ;          // search parameters kept per candidate
+  int        ncandidates ;
+  float      *m_prior2source ; // 3x4 prior->source voxel matrix per candidate
+  double     *parms ;
+  double     *log_p ;
+} EM_CANDIDATES ;
+
+EM_CANDIDATES *EMcandidatesAlloc( GCA *gca,
+                                  GCA_SAMPLE *gcas,
+                                  MRI *mri,
+                                  int nsamples,
+                                  double clamp,
+                                  int nparms );
+int EMcandidatesAdd( EM_CANDIDATES *emc, MATRIX *m_L, const double *parms );
+int EMcandidatesFlush( EM_CANDIDATES *emc,
+                       double *pmax_log_p,
+                       double *best_parms );
+int EMcandidatesFree( EM_CANDIDATES **pemc );
+
 int compute_tissue_modes( MRI *mri_inputs,
                           GCA *gca,
                           GCA_SAMPLE *gcas,
@@ -91,8 +91,9 @@ double find_optimal_translation( GCA *gca,
                                  double clamp ) {
   MATRIX   *m_trans, *m_L_tmp ;
   double   x_trans, y_trans, z_trans, x_max, y_max, z_max, delta,
-           log_p, max_log_p, mean_trans ;
+           log_p, max_log_p, mean_trans, parms[3], best[3] ;
   int      i ;
+  EM_CANDIDATES *emc ;
 
   log_p = 0;
   x_trans = 0;
@@ -105,6 +106,11 @@ double find_optimal_translation( GCA *gca,
   x_max = y_max = z_max = 0.0 ;
   max_log_p = local_GCAcomputeLogSampleProbability
     (gca, gcas, mri, m_L,nsamples, exvivo, clamp) ;
+#ifdef OUTPUT_STAGES
+  emc = NULL ;  // every candidate is written out, scan them one at a time
+#else
+  emc = EMcandidatesAlloc(gca, gcas, mri, nsamples, clamp, 3) ;
+#endif
 
   for (i = 0 ; i <= nreductions ; i++)
   {
@@ -120,6 +126,7 @@ double find_optimal_translation( GCA *gca,
     delta = (max_trans-min_trans) / trans_steps ;
     if (FZERO(delta))
     {
+      EMcandidatesFree(&emc) ;
       return(max_log_p) ;
     }
     if (Gdiag & DIAG_SHOW)
@@ -130,6 +137,7 @@ double find_optimal_translation( GCA *gca,
       fflush(stdout) ;
     }
 
+    best[0] = x_max ; best[1] = y_max ; best[2] = z_max ;
     for (x_trans = min_trans ; x_trans <= max_trans ; x_trans += delta)
     {
       *MATRIX_RELT(m_trans, 1, 4) = x_trans ;
@@ -148,6 +156,15 @@ double find_optimal_translation( GCA *gca,
           }
           // get the transform
           m_L_tmp = MatrixMultiply(m_trans, m_L, m_L_tmp) ;
+          if (emc)
+          {
+            parms[0] = x_trans ; parms[1] = y_trans ; parms[2] = z_trans ;
+            if (EMcandidatesAdd(emc, m_L_tmp, parms))
+            {
+              EMcandidatesFlush(emc, &max_log_p, best) ;
+            }
+            continue ;
+          }
           // calculate the LogSample probability
 
           log_p = local_GCAcomputeLogSampleProbability(gca, gcas, mri, m_L_tmp,nsamples, exvivo, clamp) ;
@@ -200,6 +217,14 @@ double find_optimal_translation( GCA *gca,
       }
     }
 
+    if (emc)
+    {
+      EMcandidatesFlush(emc, &max_log_p, best) ;
+      x_max = best[0] ;
+      y_max = best[1] ;
+      z_max = best[2] ;
+    }
+
     if( Gdiag & DIAG_SHOW )
     {
       printf(
@@ -235,6 +260,7 @@ double find_optimal_translation( GCA *gca,
   }
 
   MatrixFree(&m_trans) ;
+  EMcandidatesFree(&emc) ;
 
 #ifdef OUTPUT_STAGES
   std::cerr << __FUNCTION__
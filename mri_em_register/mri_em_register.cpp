@@ -141,6 +141,7 @@ static double rxrot = 0.0 ;
 static double ryrot = 0.0 ;
 
 int exvivo = 0 ;
+int serial_search = 0 ;  // scan the global search candidates one at a time
 static int remove_lh = 0 ;
 static int remove_rh = 0 ;
 
@@ -1713,6 +1714,11 @@ get_option(int argc, char *argv[])
   {
     robust = 1 ;
   }
+  else if (!stricmp(option, "SERIAL_SEARCH"))
+  {
+    serial_search = 1 ;
+    printf("evaluating global search candidates one at a time\n") ;
+  }
   else if (!stricmp(option, "FLASH"))
   {
     map_to_flash = 1 ;
@@ -2243,8 +2249,9 @@ find_optimal_linear_xform
   double x_trans, y_trans, z_trans;
   double x_scale, y_scale, z_scale;
   double x_angle, y_angle, z_angle;
-  double log_p;
+  double log_p, parms[9], best[9];
   int i;
+  EM_CANDIDATES *emc ;
 
   if (rigid)
   {
@@ -2262,6 +2269,7 @@ find_optimal_linear_xform
   x_max_scale = y_max_scale = z_max_scale = 1.0f ;
   m_scale = MatrixIdentity(4, NULL) ;
   max_log_p = local_GCAcomputeLogSampleProbability(gca, gcas, mri, m_L, nsamples, exvivo, Gclamp) ;
+  emc = EMcandidatesAlloc(gca, gcas, mri, nsamples, Gclamp, 9) ;
 
   // Loop a set number of times to polish transform
 
@@ -2294,6 +2302,10 @@ find_optimal_linear_xform
       fflush(stdout) ;
     }
 
+    best[0] = x_max_scale ; best[1] = y_max_scale ; best[2] = z_max_scale ;
+    best[3] = x_max_rot ; best[4] = y_max_rot ; best[5] = z_max_rot ;
+    best[6] = x_max_trans ; best[7] = y_max_trans ; best[8] = z_max_trans ;
+
     // scale /////////////////////////////////////////////////////////////
     for (x_scale = min_scale ; x_scale <= max_scale ; x_scale += delta_scale)
     {
@@ -2365,6 +2377,19 @@ find_optimal_linear_xform
 
                       m_L_tmp = MatrixMultiply
                                 (m_trans, m_tmp3, m_L_tmp) ;
+                      if (emc)
+                      {
+                        parms[0] = x_scale ; parms[1] = y_scale ;
+                        parms[2] = z_scale ; parms[3] = x_angle ;
+                        parms[4] = y_angle ; parms[5] = z_angle ;
+                        parms[6] = x_trans ; parms[7] = y_trans ;
+                        parms[8] = z_trans ;
+                        if (EMcandidatesAdd(emc, m_L_tmp, parms))
+                        {
+                          EMcandidatesFlush(emc, &max_log_p, best) ;
+                        }
+                        continue ;
+                      }
 
                       log_p = local_GCAcomputeLogSampleProbability(gca, gcas, mri, m_L_tmp, nsamples, exvivo, Gclamp);
                       if (log_p > max_log_p)
@@ -2403,6 +2428,20 @@ find_optimal_linear_xform
       }
     }
 
+    if (emc)
+    {
+      EMcandidatesFlush(emc, &max_log_p, best) ;
+      x_max_scale = best[0] ; y_max_scale = best[1] ; z_max_scale = best[2] ;
+      x_max_rot = best[3] ; y_max_rot = best[4] ; z_max_rot = best[5] ;
+      x_max_trans = best[6] ; y_max_trans = best[7] ; z_max_trans = best[8] ;
+
+      // leave the sample positions where the one-at-a-time scan leaves them
+      if (m_L_tmp)
+      {
+        local_GCAcomputeLogSampleProbability(gca, gcas, mri, m_L_tmp, nsamples, exvivo, Gclamp) ;
+      }
+    }
+
     if (Gdiag & DIAG_SHOW)
     {
       printf("  max log p = %2.3f @ R=(%2.3f,%2.3f,%2.3f),"
@@ -2477,6 +2516,7 @@ find_optimal_linear_xform
   MatrixFree(&m_tmp2) ;
   MatrixFree(&m_trans) ;
   MatrixFree(&m_tmp3) ;
+  EMcandidatesFree(&emc) ;
 
   return(max_log_p) ;
 }
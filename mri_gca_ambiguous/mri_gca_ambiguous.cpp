@@ -722,6 +722,7 @@ GCAscale(GCA *gca, double min_val, double max_val) {
       }
     }
   }
+  GCAdensitiesInvalidate(gca) ;
 
 
   return(NO_ERROR) ;
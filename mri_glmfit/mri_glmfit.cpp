@@ -75,6 +75,7 @@ USAGE: ./mri_glmfit
    --eres-save : save residual error (eres)
    --eres-scm : save residual error spatial correlation matrix (eres.scm). Big!
    --y-out y.out.mgh : save input after any pre-processing
+   --stream MB : read y in blocks of at most MB megabytes instead of all at once
 
    --surf subject hemi <surfname> : needed for some flags (uses white by default)
 
@@ -113,6 +114,7 @@ USAGE: ./mri_glmfit
    --allow-zero-dof : mostly for very special purposes
    --illcond : allow ill-conditioned design matrices
    --sim-done SimDoneFile : create DoneFile when simulation finished 
+   --threads N : number of threads to run simulation iterations with
 
 ENDUSAGE --------------------------------------------------------------
 
@@ -370,6 +372,21 @@ create the mask.
 
 Use threshold to create the mask using pruning. Default is FLT_MIN
 
+--stream MB
+
+Do not load the entire input into memory. Instead, read it in blocks of
+slices (or vertices for surface data) that contain all the frames, and
+fit and test each block before reading the next. The block and the
+voxels being fit take at most MB megabytes together. Use this when there
+are so many inputs that y does not fit in memory. The input should be an
+uncompressed mgh or nii file; compressed files work but are much slower.
+Only plain fits can be streamed: --sim, --fwhm, --var-fwhm, --w, --pvr,
+--selfreg, --frame-mask, --ffxdof, --logy, --rm-spatial-mean, --synth,
+kinetic modeling, DTI, and saving yhat, eres, pca, tar1, skew or
+kurtosis (all of which need all of y or eres) are not allowed. The FWHM
+of the residual is not computed. Unless --no-prune is given, y is read
+twice: once to build the pruning mask and once for the fit.
+
 --surf subject hemi <surfname>
 
 Specify that the input has a surface geometry from the hemisphere of the
@@ -494,6 +511,16 @@ only have one row.
 For mc-full, synthesize input as a uniform distribution between min
 and max. 
 
+--threads N
+
+Run the simulation iterations in N threads (default is the
+OMP_NUM_THREADS environment variable or, if it is not set, the number
+of cores). Each iteration gets its own random seed computed from --seed
+and the iteration number, so the CSD files are the same regardless of
+the number of threads. Each thread keeps its own copy of the outputs
+(and of the input for mc-full), so memory use grows with the number of
+threads.
+
 ENDHELP --------------------------------------------------------------
 
 */
@@ -522,6 +549,8 @@ double round(double x);
 #include <float.h>
 #include <errno.h>
 
+#include <vector>
+
 #include "macros.h"
 #include "utils.h"
 #include "mrisurf.h"
@@ -548,6 +577,7 @@ double round(double x);
 #include "dti.h"
 #include "image.h"
 #include "stats.h"
+#include "romp_support.h"
 
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag);
 
@@ -560,6 +590,19 @@ static void print_version(void) ;
 static void dump_options(FILE *fp);
 static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel);
 
+// Per-thread state for the simulation loop
+typedef struct {
+  MRIGLM *mriglm; // own copy of the design and outputs (and y for mc-full)
+  MATRIX *Xg0;    // unpermuted design (perm)
+  MRIS *surf;     // own copy for smoothing and clustering
+  RFS *rfs;       // own random number generator, reseeded each iteration
+  MRI *sig, *z, *zabs, *p, *ar1, *fwhmmap;
+} SIMTHREAD;
+static SIMTHREAD *SimThreadAlloc(void);
+static int SimThreadFree(SIMTHREAD **pst);
+static int SimIteration(int nthsim, SIMTHREAD *st);
+static int SimWriteCSDs(int nreps);
+
 int main(int argc, char *argv[]) ;
 
 const char *Progname = "mri_glmfit";
@@ -642,23 +685,18 @@ int UseUniform = 0;
 double UniformMin = 0;
 double UniformMax = 0;
 
-SURFCLUSTERSUM *SurfClustList;
-int nClusters;
 char *subject=NULL, *hemi=NULL, *simbase=NULL;
 MRI_SURFACE *surf=NULL;
-int nsim,nthsim;
-double csize;
+int nsim;
 MRI *fwhmmap = NULL;
 
-VOLCLUSTER **VolClustList;
-
 int DiagCluster=0;
 
 double InterVertexDistAvg, InterVertexDistStdDev, avgvtxarea;
 double ar1mn, ar1std, ar1max;
 double eresgstd, eresfwhm, searchspace;
 double car1mn, rar1mn,sar1mn,cfwhm,rfwhm,sfwhm;
-MRI *ar1=NULL, *tar1=NULL, *z=NULL, *zabs=NULL, *cnr=NULL;
+MRI *ar1=NULL, *tar1=NULL, *z=NULL, *cnr=NULL;
 
 CSD *csd;
 RFS *rfs;
@@ -745,6 +783,7 @@ MRI *MRIconjunct3(MRI *sig1, MRI *sig2, MRI *sig3, MRI *mask, MRI *c123);
 int NSplits=0, SplitNo=0;
 int SplitMin, SplitMax, nPerSplit, RandSplit;
 int DoFisher = 0; 
+double StreamMB = 0;
 int DoPCC=1;
 int RmSpatialMean = 0;
 
@@ -762,8 +801,7 @@ int main(int argc, char **argv) {
   MATRIX *wvect=NULL, *Mtmp=NULL, *Xselfreg=NULL, *Ex=NULL, *XgNew=NULL;
   MATRIX *Ct, *CCt;
   FILE *fp;
-  double Ccond, dtmp, threshadj, eff;
-  const char *tmpstr2=NULL;
+  double Ccond, dtmp, eff;
 
   eresfwhm = -1;
   csd = CSDalloc();
@@ -855,7 +893,20 @@ int main(int argc, char **argv) {
   // Load input--------------------------------------
   printf("Loading y from %s\n",yFile.c_str());
   fflush(stdout);
-  if(! UseStatTable){
+  if(StreamMB > 0){
+    // Only the header now, y is read block-by-block during the fit
+    mriglm->y = MRIreadHeader(yFile.c_str(),MRI_VOLUME_TYPE_UNKNOWN);
+    if (mriglm->y == NULL) {
+      printf("ERROR: loading y %s\n",yFile.c_str());
+      exit(1);
+    }
+    nvoxels = mriglm->y->width * mriglm->y->height * mriglm->y->depth;
+    if(nvoxels == 163842 && surf == NULL){
+      printf("ERROR: you must use '--surface subject hemi' with surface data\n");
+      exit(1);
+    }
+  }
+  else if(! UseStatTable){
     mriglm->y = MRIread(yFile.c_str());
     printf("   ... done reading.\n");
     fflush(stdout);
@@ -891,7 +942,7 @@ int main(int argc, char **argv) {
     if (scale_stats_by_etiv) ScaleStatTableByETIV(StatTable, 1e5);
     mriglm->y = StatTable->mri;
   }
-  if (mriglm->y->type != MRI_FLOAT) {
+  if (mriglm->y->type != MRI_FLOAT && StreamMB == 0) {
     printf("INFO: changing y type to float\n");
     mritmp = MRISeqchangeType(mriglm->y,MRI_FLOAT,0,0,0);
     if (mritmp == NULL) {
@@ -1289,7 +1340,13 @@ int main(int argc, char **argv) {
     MRIfree(&mriglm->mask);
     mriglm->mask = mritmp;
   }
-  if(prunemask) {
+  if(prunemask && StreamMB > 0) {
+    // y is not in memory, so prune from y read in slabs
+    printf("Pruning voxels by thr: %e\n", prune_thr);
+    mriglm->mask = MRIframeBinarizeStream(yFile.c_str(),mriglm->y,StreamMB,prune_thr,mriglm->mask);
+    if(mriglm->mask == NULL) exit(1);
+  }
+  else if(prunemask) {
     printf("Pruning voxels by thr: %e\n", prune_thr);
     if(usedti){
       // NOTE: for DWI volumes
@@ -1639,7 +1696,11 @@ int main(int argc, char **argv) {
     // Now do the estimation and testing
     mytimer.reset() ;
 
-    if (VarFWHM > 0) {
+    if (StreamMB > 0) {
+      printf("Starting streaming fit and test\n");   fflush(stdout);
+      err = MRIglmFitAndTestStream(mriglm, yFile.c_str(), StreamMB);
+      if(err) exit(1);
+    } else if (VarFWHM > 0) {
       printf("Starting fit\n");  fflush(stdout);
       MRIglmFit(mriglm);
       printf("Variance smoothing\n");
@@ -1668,21 +1729,17 @@ int main(int argc, char **argv) {
     csd->searchspace = searchspace;
     csd->nreps = nsim;
     CSDallocData(csd);
+    // Distribution for mc-z and mc-t, copied into each thread's rfs
     if (!strcmp(csd->simtype,"mc-z")) {
       rfs = RFspecInit(SynthSeed,NULL);
       rfs->name = strcpyalloc("gaussian");
       rfs->params[0] = 0;
       rfs->params[1] = 1;
-      //z = MRIalloc(mriglm->y->width,mriglm->y->height,mriglm->y->depth,MRI_FLOAT);
-      z = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
-      zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
     }
     if (!strcmp(csd->simtype,"mc-t")) {
       rfs = RFspecInit(SynthSeed,NULL);
       rfs->name = strcpyalloc("t");
       rfs->params[0] = mriglm->glm->dof;
-      z = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
-      zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
     }
     printf("thresh = %g, threshadj = %g \n",csd->thresh,csd->thresh-log10(2.0));
 
@@ -1694,225 +1751,56 @@ int main(int argc, char **argv) {
       DoSimThreshLoop = 1;
     }
 
-    if(DoSimThreshLoop){
-      for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
-	for(nthSign = 0; nthSign < nSignList; nthSign++){
-	  for (n=0; n < mriglm->glm->ncontrasts; n++) {
-	    csdList[nthThresh][nthSign][n] = CSDcopy(csd,NULL);
-	    csdList[nthThresh][nthSign][n]->thresh = ThreshList[nthThresh];
-	    csdList[nthThresh][nthSign][n]->threshsign = SignList[nthSign];
-	    csdList[nthThresh][nthSign][n]->seed = csd->seed;
-	  }
+    for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+      for(nthSign = 0; nthSign < nSignList; nthSign++){
+	for (n=0; n < mriglm->glm->ncontrasts; n++) {
+	  csdList[nthThresh][nthSign][n] = CSDcopy(csd,NULL);
+	  csdList[nthThresh][nthSign][n]->thresh = ThreshList[nthThresh];
+	  csdList[nthThresh][nthSign][n]->threshsign = SignList[nthSign];
+	  // Change sign to abs for F-tests
+	  if(mriglm->glm->C[n]->rows > 1) csdList[nthThresh][nthSign][n]->threshsign = 0;
+	  csdList[nthThresh][nthSign][n]->seed = csd->seed;
+	  strcpy(csdList[nthThresh][nthSign][n]->contrast,mriglm->glm->Cname[n]);
 	}
       }
     }
 
-    printf("\n\nStarting simulation sim over %d trials\n",nsim);
+    // Iterations are spread over threads, each with its own copy of the
+    // design, outputs, and surface. Each iteration seeds its own random
+    // number generator from the seed and the iteration number and puts
+    // its results in its own slot of the CSDs, so the CSDs do not depend
+    // on the number of threads. The CSD files are rewritten whenever the
+    // run of completed iterations from the start grows.
+    int nsimthreads = omp_get_max_threads();
+    if (mriglm->FrameMask != NULL || DiagCluster) nsimthreads = 1;
+    if (nsimthreads > nsim) nsimthreads = MAX(nsim,1);
+    std::vector<SIMTHREAD *> simthreads(nsimthreads);
+    for (n=0; n < nsimthreads; n++) simthreads[n] = SimThreadAlloc();
+    std::vector<char> simdone(nsim,0);
+    int nsimdone = 0;
+
+    printf("\n\nStarting simulation sim over %d trials with %d threads\n",nsim,nsimthreads);
     mytimer.reset() ;
-    for (nthsim=0; nthsim < nsim; nthsim++) {
-      msecFitTime = mytimer.milliseconds();
-      if(debug) printf("%d/%d t=%g ---------------------------------\n",
-             nthsim+1,nsim,msecFitTime/(1000*60.0));
-
-      if (!strcmp(csd->simtype,"mc-full")) {
-	if(! UseUniform)
-	  MRIrandn(mriglm->y->width,mriglm->y->height,mriglm->y->depth,
-		   mriglm->y->nframes,0,1,mriglm->y);
-	else
-	  MRIdrand48(mriglm->y->width,mriglm->y->height,mriglm->y->depth,
-		  mriglm->y->nframes,UniformMin,UniformMax,mriglm->y);
-        if(logflag) MRIlog(mriglm->y,mriglm->mask,-1,1,mriglm->y);
-        if(FWHM > 0)
-          SmoothSurfOrVol(surf, mriglm->y, mriglm->mask, SmoothLevel);
-      }
-      if (!strcmp(csd->simtype,"perm")) {
-        if (!OneSamplePerm) MatrixRandPermRows(mriglm->Xg);
-        else {
-          for (n=0; n < mriglm->y->nframes; n++) {
-            if (drand48() > 0.5) m = +1;
-            else                m = -1;
-            mriglm->Xg->rptr[n+1][1] = m;
-          }
-          //MatrixPrint(stdout,mriglm->Xg);
-        }
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) num_threads(nsimthreads) schedule(dynamic,1)
+#endif
+    for (int nthsim=0; nthsim < nsim; nthsim++) {
+      ROMP_PFLB_begin
+      SimIteration(nthsim, simthreads[omp_get_thread_num()]);
+#ifdef HAVE_OPENMP
+      #pragma omp critical
+#endif
+      {
+        int nprev = nsimdone;
+        simdone[nthsim] = 1;
+        while (nsimdone < nsim && simdone[nsimdone]) nsimdone++;
+        if (nsimdone > nprev) SimWriteCSDs(nsimdone);
       }
-
-      // Variance smoothing
-      if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
-        // If variance smoothing, then need to test and fit separately
-        if (VarFWHM > 0) {
-          if(!DoSim) printf("Starting fit\n");
-          MRIglmFit(mriglm);
-          if(!DoSim) printf("Variance smoothing\n");
-          SmoothSurfOrVol(surf, mriglm->rvar, mriglm->mask, VarSmoothLevel);
-          if(!DoSim) printf("Starting test\n");
-          MRIglmTest(mriglm);
-        }
-	else {
-          if(!DoSim) printf("Starting fit and test\n");
-          MRIglmFitAndTest(mriglm);
-	  // If using permutation with non-stationary correction, compute fwhmmap here
-	  if(!strcmp(csd->simtype,"perm") && PermNonStatCor) {
-	    if(ar1)     MRIfree(&ar1);
-	    if(fwhmmap) MRIfree(&fwhmmap);
-	    ar1 = MRISar1(surf, mriglm->eres, mriglm->mask, NULL);
-	    fwhmmap = MRISfwhmFromAR1Map(surf, mriglm->mask, ar1);
-	    // MRISsmoothMRI(surf, fwhmmap, SmthLevel, mriglm->mask, fwhmmap)
-	  }
-        }
-      }
-
-      for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
-	for(nthSign = 0; nthSign < nSignList; nthSign++){
-	  // Go through each contrast.
-	  for (n=0; n < mriglm->glm->ncontrasts; n++) {
-	    if(DoSimThreshLoop) {
-	      csd = csdList[nthThresh][nthSign][n];
-	      tSimSign = SignList[nthSign];
-	    }
-	    if(debug) printf("%2d %d %5.1f  %d %2d %5.1f\n",nthsim,nthThresh,
-			     csd->thresh,nthSign,tSimSign,mytimer.seconds());
-
-	    // Change sign to abs for F-tests
-	    csd->threshsign = tSimSign;
-	    if(mriglm->glm->C[n]->rows > 1) csd->threshsign = 0;
-	    
-	    // Adjust threshold for one- or two-sided
-	    if(csd->threshsign == 0) threshadj = csd->thresh;
-	    else threshadj = csd->thresh - log10(2.0); // one-sided test
-
-	    if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
-	      sig = MRIlog10(mriglm->p[n],NULL,sig,1);
-	      // If test is not ABS then apply the sign
-	      if(csd->threshsign != 0) MRIsetSign(sig,mriglm->gamma[n],0);
-	      sigmax = MRIframeMax(sig,0,mriglm->mask,csd->threshsign,
-				   &cmax,&rmax,&smax);
-	      // Get Fmax at sig max 
-	      Fmax = MRIgetVoxVal(mriglm->F[n],cmax,rmax,smax,0);
-	      if(csd->threshsign != 0) Fmax = Fmax*SIGN(sigmax);
-	    } 
-	    else {
-	      // mc-z or mc-t: synth z-field, smooth, rescale,
-	      // compute p, compute sig
-	      // This should do the same thing as AFNI's AlphaSim
-	      // Synth and rescale without the mask, otherwise smoothing
-	      // smears the 0s into the mask area. Also, the stuff outisde
-	      // the mask area wont get zeroed.
-	      if(nthThresh == 0 && nthSign == 0) {
-		RFsynth(z,rfs,mriglm->mask); // z or t, as needed
-		if (SmoothLevel > 0) {
-		  SmoothSurfOrVol(surf, z, mriglm->mask, SmoothLevel);
-		  if(DiagCluster) {
-		    sprintf(tmpstr,"./%s-zsm0.%s",mriglm->glm->Cname[n],format);
-		    printf("Saving z into %s\n",tmpstr);
-		    MRIwrite(z,tmpstr);
-		    // Exits below
-		  }
-		  RFrescale(z,rfs,mriglm->mask,z);
-		}
-	      }
-	      if(DiagCluster) {
-		sprintf(tmpstr,"./%s-zsm1.%s",mriglm->glm->Cname[n],format);
-		printf("Saving z into %s\n",tmpstr);
-		MRIwrite(z,tmpstr);
-		// Exits below
-	      }
-	      // Slightly tortured way to get the right p-values because
-	      //   RFstat2P() computes one-sided, but I handle sidedness
-	      //   during thresholding.
-	      // First, use zabs to get a two-sided pval bet 0 and 0.5
-	      zabs = MRIabs(z,zabs);
-	      mriglm->p[n] = RFstat2P(zabs,rfs,mriglm->mask,0,mriglm->p[n]);
-	      // Next, mult pvals by 2 to get two-sided bet 0 and 1
-	      MRIscalarMul(mriglm->p[n],mriglm->p[n],2);
-	      // sig = -log10(p)
-	      sig = MRIlog10(mriglm->p[n],NULL,sig,1);
-	      // If test is not ABS then apply the sign
-	      if(csd->threshsign != 0) MRIsetSign(sig,z,0);
-
-	      sigmax = MRIframeMax(sig,0,mriglm->mask,csd->threshsign,
-				   &cmax,&rmax,&smax);
-	      Fmax = MRIgetVoxVal(z,cmax,rmax,smax,0);
-	      if(csd->threshsign == 0) Fmax = fabs(Fmax);
-	    }
-	    if(mriglm->mask) MRImask(sig,mriglm->mask,sig,0.0,0.0);
-
-	    if(surf) {
-	      // surface clustering -------------
-	      MRIScopyMRI(surf, sig, 0, "val");
-	      if(debug || Gdiag_no > 0) printf("Clustering on surface %lf\n",
-					       mytimer.seconds());
-	      SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,csd->threshsign,
-						    0,&nClusters,NULL,fwhmmap);
-	      csize = sclustMaxClusterArea(SurfClustList, nClusters);
-	    } 
-	    else {
-	      // volume clustering -------------
-	      if (debug) printf("Clustering on volume\n");
-	      VolClustList = clustGetClusters(sig, 0, threshadj,-1,csd->threshsign,0,
-					      mriglm->mask, &nClusters, NULL);
-	      csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
-	      if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
-	      clustFreeClusterList(&VolClustList,nClusters);
-	    }
-	    if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
-			     mriglm->glm->Cname[n],nthsim,nClusters,csize,sigmax,Fmax);
-
-	    // Re-write the full CSD file each time. Should not take that
-	    // long and assures output can be used immediately regardless
-	    // of whether the job terminated properly or not
-	    strcpy(csd->contrast,mriglm->glm->Cname[n]);
-	    if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
-	      if(round(csd->threshsign) ==  0) tmpstr2 = "abs"; 
-	      if(round(csd->threshsign) == +1) tmpstr2 = "pos"; 
-	      if(round(csd->threshsign) == -1) tmpstr2 = "neg"; 
-	      //sprintf(tmpstr,"%s-%s.th%04d.%s.csd",simbase,mriglm->glm->Cname[n],
-	      //      (int)round(csd->thresh*100),tmpstr2);
-	      sprintf(tmpstr,"%s.th%02d.%s.j001-%s.csd",simbase,
-		      (int)round(csd->thresh*10),tmpstr2,mriglm->glm->Cname[n]);
-	    }
-	    else
-	      sprintf(tmpstr,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
-	    if(debug) printf("csd %s \n",tmpstr);
-	    fflush(stdout);
-	    fp = fopen(tmpstr,"w");
-	    if (fp == NULL) {
-	      printf("ERROR: opening %s\n",tmpstr);
-	      exit(1);
-	    }
-	    fprintf(fp,"# ClusterSimulationData 2\n");
-	    fprintf(fp,"# mri_glmfit simulation sim\n");
-	    fprintf(fp,"# hostname %s\n",uts.nodename);
-	    fprintf(fp,"# machine  %s\n",uts.machine);
-	    fprintf(fp,"# runtime_min %g\n",msecFitTime/(1000*60.0));
-	    fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
-	    if (mriglm->mask) fprintf(fp,"# masking 1\n");
-	    else             fprintf(fp,"# masking 0\n");
-	    fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
-	    fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
-	    fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
-	    csd->nreps = nthsim+1;
-	    csd->nClusters[nthsim] = nClusters;
-	    csd->MaxClusterSize[nthsim] = csize;
-	    csd->MaxSig[nthsim] = sigmax;
-	    csd->MaxStat[nthsim] = Fmax;
-	    CSDprint(fp, csd);
-	    fclose(fp);
-	    if(debug) CSDprint(stdout, csd);
-
-	    if(DiagCluster) {
-	      sprintf(tmpstr,"./%s-sig.%s",mriglm->glm->Cname[n],format);
-	      printf("Saving sig into %s and exiting ... \n",tmpstr);
-	      MRIwrite(sig,tmpstr);
-	      exit(1);
-	    }
-	    free(SurfClustList);
-	  } // contrasts
-	} // sign list
-      } // thresh list
-      //MRIfree(&sig);
-
+      ROMP_PFLB_end
     }// simulation loop
+    ROMP_PF_end
+    for (n=0; n < nsimthreads; n++) SimThreadFree(&simthreads[n]);
     if(SimDoneFile){
       fp = fopen(SimDoneFile,"w");
       fclose(fp);
@@ -2475,6 +2363,15 @@ static int parse_commandline(int argc, char **argv) {
       usepruning = 1;
       nargsused = 1;
     }
+    else if (!strcasecmp(option, "--stream")){
+      if (nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%lf",&StreamMB);
+      if(StreamMB <= 0){
+        printf("ERROR: --stream MB must be > 0\n");
+        exit(1);
+      }
+      nargsused = 1;
+    }
     else if (!strcasecmp(option, "--nii")) format = "nii";
     else if (!strcasecmp(option, "--nii.gz")) format = "nii.gz";
     else if (!strcasecmp(option, "--mgh")) format = "mgh";
@@ -2975,6 +2872,15 @@ static int parse_commandline(int argc, char **argv) {
       SimDoneFile = pargv[0];
       nargsused = 1;
     } 
+    else if (!strcasecmp(option, "--threads") || !strcasecmp(option, "--nthreads")) {
+      if(nargc < 1) CMDargNErr(option,1);
+      int nthreads;
+      sscanf(pargv[0],"%d",&nthreads);
+#ifdef HAVE_OPENMP
+      omp_set_num_threads(nthreads);
+#endif
+      nargsused = 1;
+    } 
     else {
       fprintf(stderr,"ERROR: Option %s unknown\n",option);
       if (CMDsingleDash(option))
@@ -3039,6 +2945,7 @@ printf("   --eres-save : save residual error (eres)\n");
 printf("   --eres-scm : save residual error spatial correlation matrix (eres.scm). Big!\n");
 printf("   --save-fwhm-map : save voxel-wise map of FWHM estimates\n");
 printf("   --y-out y.out.mgh : save input after any pre-processing\n");
+printf("   --stream MB : read y in blocks of at most MB megabytes instead of all at once\n");
 printf("\n");
 printf("   --surf subject hemi <surfname> : needed for some flags (uses white by default)\n");
 printf("\n");
@@ -3078,6 +2985,7 @@ printf("                  before --fsgd)\n");
 printf("   --allow-zero-dof : mostly for very special purposes\n");
 printf("   --illcond : allow ill-conditioned design matrices\n");
 printf("   --sim-done SimDoneFile : create DoneFile when simulation finished \n");
+printf("   --threads N : number of threads to run simulation iterations with\n");
 printf("\n");
 printf("\n");
 }
@@ -3343,6 +3251,21 @@ printf("--prune_thr threshold\n");
 printf("\n");
 printf("Use threshold to create the mask using pruning. Default is FLT_MIN\n");
 printf("\n");
+printf("--stream MB\n");
+printf("\n");
+printf("Do not load the entire input into memory. Instead, read it in blocks of\n");
+printf("slices (or vertices for surface data) that contain all the frames, and\n");
+printf("fit and test each block before reading the next. The block and the\n");
+printf("voxels being fit take at most MB megabytes together. Use this when there\n");
+printf("are so many inputs that y does not fit in memory. The input should be an\n");
+printf("uncompressed mgh or nii file; compressed files work but are much slower.\n");
+printf("Only plain fits can be streamed: --sim, --fwhm, --var-fwhm, --w, --pvr,\n");
+printf("--selfreg, --frame-mask, --ffxdof, --logy, --rm-spatial-mean, --synth,\n");
+printf("kinetic modeling, DTI, and saving yhat, eres, pca, tar1, skew or\n");
+printf("kurtosis (all of which need all of y or eres) are not allowed. The FWHM\n");
+printf("of the residual is not computed. Unless --no-prune is given, y is read\n");
+printf("twice: once to build the pruning mask and once for the fit.\n");
+printf("\n");
 printf("--surf subject hemi <surfname>\n");
 printf("\n");
 printf("Specify that the input has a surface geometry from the hemisphere of the\n");
@@ -3466,6 +3389,16 @@ printf("--uniform min max\n");
 printf("\n");
 printf("For mc-full, synthesize input as a uniform distribution between min\n");
 printf("and max. \n");
+printf("\n");
+printf("--threads N\n");
+printf("\n");
+printf("Run the simulation iterations in N threads (default is the\n");
+printf("OMP_NUM_THREADS environment variable or, if it is not set, the number\n");
+printf("of cores). Each iteration gets its own random seed computed from --seed\n");
+printf("and the iteration number, so the CSD files are the same regardless of\n");
+printf("the number of threads. Each thread keeps its own copy of the outputs\n");
+printf("(and of the input for mc-full), so memory use grows with the number of\n");
+printf("threads.\n");
 printf("\n");
   exit(1) ;
 }
@@ -3632,6 +3565,24 @@ static void check_options(void) {
     printf("ERROR: cannot have compute pcc with pvr\n");
     exit(1);
   }
+  if(StreamMB > 0){
+    if(DoSim || FWHM > 0 || VarFWHM > 0 || wFile || npvr != 0 || nSelfReg > 0 ||
+       frameMaskFile || DoFFx || logflag || RmSpatialMean || synth || DoFisher ||
+       DoReshape || DoDistance || SubSample || NSplits > 0 || nRandExclude > 0 ||
+       usedti || DoMRTM1 || DoMRTM2 || DoLogan || UseStatTable || voxdumpflag){
+      printf("ERROR: --stream can only be used for a plain fit of a volume or surface input\n");
+      exit(1);
+    }
+    if(yhatSave || eresSave || eresSCMSave || yOutFile.size() != 0 || pcaSave ||
+       DoTemporalAR1 || DoKurtosis || DoSkew || SaveFWHMMap){
+      printf("ERROR: cannot save yhat, eres, y, pca, tar1, skew, kurtosis or fwhm map with --stream\n");
+      exit(1);
+    }
+    if(ComputeFWHM){
+      printf("INFO: not computing the FWHM of the residual with --stream\n");
+      ComputeFWHM = 0;
+    }
+  }
 
 
   return;
@@ -3739,6 +3690,299 @@ static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel) {
 }
 
 
+/*--------------------------------------------------------------------
+  SimThreadAlloc() - allocates the state a thread needs to run
+  simulation iterations independently of the other threads.
+  --------------------------------------------------------------------*/
+static SIMTHREAD *SimThreadAlloc(void)
+{
+  SIMTHREAD *st;
+
+  st = (SIMTHREAD *) calloc(sizeof(SIMTHREAD),1);
+  st->mriglm = MRIglmCopyDesign(mriglm);
+  if (!strcmp(csd->simtype,"mc-full")) {
+    st->mriglm->y = MRIallocSequence(mriglm->y->width,mriglm->y->height,
+				     mriglm->y->depth,MRI_FLOAT,mriglm->y->nframes);
+    MRIcopyHeader(mriglm->y,st->mriglm->y);
+  }
+  if (!strcmp(csd->simtype,"perm")) st->Xg0 = MatrixCopy(mriglm->Xg,NULL);
+  if (surf) st->surf = MRISclone(surf);
+
+  st->rfs = RFspecInit(SynthSeed+1,NULL);
+  if (!strcmp(csd->simtype,"mc-z") || !strcmp(csd->simtype,"mc-t")) {
+    st->rfs->name = strcpyalloc(rfs->name);
+    memcpy(st->rfs->params,rfs->params,sizeof(rfs->params));
+    st->z    = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+    st->zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+  }
+  else if (!strcmp(csd->simtype,"mc-full") && !UseUniform) {
+    st->rfs->name = strcpyalloc("gaussian");
+    st->rfs->params[0] = 0;
+    st->rfs->params[1] = 1;
+  }
+  else {
+    // mc-full with uniform noise, or uniform draws for permutation
+    st->rfs->name = strcpyalloc("uniform");
+    st->rfs->params[0] = 0;
+    st->rfs->params[1] = 1;
+    if (!strcmp(csd->simtype,"mc-full")) {
+      st->rfs->params[0] = UniformMin;
+      st->rfs->params[1] = UniformMax;
+    }
+  }
+  return(st);
+}
+
+/*--------------------------------------------------------------------*/
+static int SimThreadFree(SIMTHREAD **pst)
+{
+  SIMTHREAD *st = *pst;
+
+  if (!strcmp(csd->simtype,"mc-full")) MRIfree(&st->mriglm->y);
+  MRIglmFreeCopy(&st->mriglm);
+  if (st->Xg0) MatrixFree(&st->Xg0);
+  if (st->surf) MRISfree(&st->surf);
+  RFspecFree(&st->rfs);
+  if (st->sig) MRIfree(&st->sig);
+  if (st->z) MRIfree(&st->z);
+  if (st->zabs) MRIfree(&st->zabs);
+  if (st->p) MRIfree(&st->p);
+  if (st->ar1) MRIfree(&st->ar1);
+  if (st->fwhmmap) MRIfree(&st->fwhmmap);
+  free(st);
+  *pst = NULL;
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  SimIteration() - runs simulation iteration nthsim using the thread
+  state st and puts the result for each threshold, sign, and contrast
+  into slot nthsim of the corresponding CSD.
+  --------------------------------------------------------------------*/
+static int SimIteration(int nthsim, SIMTHREAD *st)
+{
+  int n, f, k, nthThresh, nthSign, cmax, rmax, smax, nClusters;
+  double threshadj, sigmax, Fmax, csize, tmp;
+  MRIGLM *simglm = st->mriglm;
+  CSD *csd0;
+  SURFCLUSTERSUM *SurfClustList;
+  VOLCLUSTER **VolClustList;
+  char tmpstr[2000];
+
+  if(debug) printf("%d/%d t=%g ---------------------------------\n",
+		   nthsim+1,nsim,mytimer.seconds()/60.0);
+
+  // Seed depends only on the iteration so that the result does
+  // not depend on which thread runs it
+  RFspecSetSeed(st->rfs,(unsigned long)SynthSeed + 1 + 104729UL*nthsim);
+
+  if (!strcmp(csd->simtype,"mc-full")) {
+    RFsynth(simglm->y,st->rfs,NULL);
+    if(logflag) MRIlog(simglm->y,simglm->mask,-1,1,simglm->y);
+    if(FWHM > 0)
+      SmoothSurfOrVol(st->surf, simglm->y, simglm->mask, SmoothLevel);
+  }
+  if (!strcmp(csd->simtype,"perm")) {
+    if (!OneSamplePerm) {
+      // Shuffle the rows of the original design (Fisher-Yates)
+      MatrixCopy(st->Xg0,simglm->Xg);
+      for (f = simglm->Xg->rows; f > 1; f--) {
+	n = (int)(RFdrawVal(st->rfs)*f) + 1;
+	if (n > f) n = f;
+	for (k = 1; k <= simglm->Xg->cols; k++) {
+	  tmp = simglm->Xg->rptr[f][k];
+	  simglm->Xg->rptr[f][k] = simglm->Xg->rptr[n][k];
+	  simglm->Xg->rptr[n][k] = tmp;
+	}
+      }
+    }
+    else {
+      for (f=1; f <= simglm->Xg->rows; f++) {
+	if (RFdrawVal(st->rfs) > 0.5) simglm->Xg->rptr[f][1] = +1;
+	else                          simglm->Xg->rptr[f][1] = -1;
+      }
+    }
+  }
+
+  if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
+    // If variance smoothing, then need to test and fit separately
+    if (VarFWHM > 0) {
+      MRIglmFit(simglm);
+      SmoothSurfOrVol(st->surf, simglm->rvar, simglm->mask, VarSmoothLevel);
+      MRIglmTest(simglm);
+    }
+    else {
+      MRIglmFitAndTest(simglm);
+      // If using permutation with non-stationary correction, compute fwhmmap here
+      if(!strcmp(csd->simtype,"perm") && PermNonStatCor) {
+	if(st->ar1)     MRIfree(&st->ar1);
+	if(st->fwhmmap) MRIfree(&st->fwhmmap);
+	st->ar1 = MRISar1(st->surf, simglm->eres, simglm->mask, NULL);
+	st->fwhmmap = MRISfwhmFromAR1Map(st->surf, simglm->mask, st->ar1);
+      }
+    }
+  }
+
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      // Go through each contrast.
+      for (n=0; n < simglm->glm->ncontrasts; n++) {
+	csd0 = csdList[nthThresh][nthSign][n];
+	if(debug) printf("%2d %d %5.1f  %d %2g %5.1f\n",nthsim,nthThresh,
+			 csd0->thresh,nthSign,csd0->threshsign,mytimer.seconds());
+
+	// Adjust threshold for one- or two-sided
+	if(csd0->threshsign == 0) threshadj = csd0->thresh;
+	else threshadj = csd0->thresh - log10(2.0); // one-sided test
+
+	if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
+	  st->sig = MRIlog10(simglm->p[n],NULL,st->sig,1);
+	  // If test is not ABS then apply the sign
+	  if(csd0->threshsign != 0) MRIsetSign(st->sig,simglm->gamma[n],0);
+	  sigmax = MRIframeMax(st->sig,0,simglm->mask,csd0->threshsign,
+			       &cmax,&rmax,&smax);
+	  // Get Fmax at sig max
+	  Fmax = MRIgetVoxVal(simglm->F[n],cmax,rmax,smax,0);
+	  if(csd0->threshsign != 0) Fmax = Fmax*SIGN(sigmax);
+	}
+	else {
+	  // mc-z or mc-t: synth z-field, smooth, rescale,
+	  // compute p, compute sig
+	  // This should do the same thing as AFNI's AlphaSim
+	  // Synth and rescale without the mask, otherwise smoothing
+	  // smears the 0s into the mask area. Also, the stuff outisde
+	  // the mask area wont get zeroed.
+	  if(nthThresh == 0 && nthSign == 0) {
+	    RFsynth(st->z,st->rfs,simglm->mask); // z or t, as needed
+	    if (SmoothLevel > 0) {
+	      SmoothSurfOrVol(st->surf, st->z, simglm->mask, SmoothLevel);
+	      if(DiagCluster) {
+		sprintf(tmpstr,"./%s-zsm0.%s",simglm->glm->Cname[n],format);
+		printf("Saving z into %s\n",tmpstr);
+		MRIwrite(st->z,tmpstr);
+		// Exits below
+	      }
+	      RFrescale(st->z,st->rfs,simglm->mask,st->z);
+	    }
+	  }
+	  if(DiagCluster) {
+	    sprintf(tmpstr,"./%s-zsm1.%s",simglm->glm->Cname[n],format);
+	    printf("Saving z into %s\n",tmpstr);
+	    MRIwrite(st->z,tmpstr);
+	    // Exits below
+	  }
+	  // Slightly tortured way to get the right p-values because
+	  //   RFstat2P() computes one-sided, but I handle sidedness
+	  //   during thresholding.
+	  // First, use zabs to get a two-sided pval bet 0 and 0.5
+	  st->zabs = MRIabs(st->z,st->zabs);
+	  st->p = RFstat2P(st->zabs,st->rfs,simglm->mask,0,st->p);
+	  // Next, mult pvals by 2 to get two-sided bet 0 and 1
+	  MRIscalarMul(st->p,st->p,2);
+	  // sig = -log10(p)
+	  st->sig = MRIlog10(st->p,NULL,st->sig,1);
+	  // If test is not ABS then apply the sign
+	  if(csd0->threshsign != 0) MRIsetSign(st->sig,st->z,0);
+
+	  sigmax = MRIframeMax(st->sig,0,simglm->mask,csd0->threshsign,
+			       &cmax,&rmax,&smax);
+	  Fmax = MRIgetVoxVal(st->z,cmax,rmax,smax,0);
+	  if(csd0->threshsign == 0) Fmax = fabs(Fmax);
+	}
+	if(simglm->mask) MRImask(st->sig,simglm->mask,st->sig,0.0,0.0);
+
+	if(st->surf) {
+	  // surface clustering -------------
+	  MRIScopyMRI(st->surf, st->sig, 0, "val");
+	  SurfClustList = sclustMapSurfClusters(st->surf,threshadj,-1,csd0->threshsign,
+						0,&nClusters,NULL,st->fwhmmap);
+	  csize = sclustMaxClusterArea(SurfClustList, nClusters);
+	  free(SurfClustList);
+	}
+	else {
+	  // volume clustering -------------
+	  VolClustList = clustGetClusters(st->sig, 0, threshadj,-1,csd0->threshsign,0,
+					  simglm->mask, &nClusters, NULL);
+	  csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
+	  if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
+	  clustFreeClusterList(&VolClustList,nClusters);
+	}
+	if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
+			 simglm->glm->Cname[n],nthsim,nClusters,csize,sigmax,Fmax);
+
+	csd0->nClusters[nthsim] = nClusters;
+	csd0->MaxClusterSize[nthsim] = csize;
+	csd0->MaxSig[nthsim] = sigmax;
+	csd0->MaxStat[nthsim] = Fmax;
+
+	if(DiagCluster) {
+	  sprintf(tmpstr,"./%s-sig.%s",simglm->glm->Cname[n],format);
+	  printf("Saving sig into %s and exiting ... \n",tmpstr);
+	  MRIwrite(st->sig,tmpstr);
+	  exit(1);
+	}
+      } // contrasts
+    } // sign list
+  } // thresh list
+
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  SimWriteCSDs() - writes the first nreps iterations of each CSD. The
+  full CSD files are rewritten each time. This should not take that
+  long and assures output can be used immediately regardless of
+  whether the job terminated properly or not.
+  --------------------------------------------------------------------*/
+static int SimWriteCSDs(int nreps)
+{
+  int nthThresh, nthSign, n;
+  CSD *csd0;
+  FILE *fp;
+  const char *tmpstr2 = "";
+  char tmpstr[2000];
+
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+	csd0 = csdList[nthThresh][nthSign][n];
+	if(nThreshList > 1 || nSignList > 1){
+	  if(round(csd0->threshsign) ==  0) tmpstr2 = "abs";
+	  if(round(csd0->threshsign) == +1) tmpstr2 = "pos";
+	  if(round(csd0->threshsign) == -1) tmpstr2 = "neg";
+	  sprintf(tmpstr,"%s.th%02d.%s.j001-%s.csd",simbase,
+		  (int)round(csd0->thresh*10),tmpstr2,mriglm->glm->Cname[n]);
+	}
+	else
+	  sprintf(tmpstr,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
+	if(debug) printf("csd %s \n",tmpstr);
+	fflush(stdout);
+	fp = fopen(tmpstr,"w");
+	if (fp == NULL) {
+	  printf("ERROR: opening %s\n",tmpstr);
+	  exit(1);
+	}
+	fprintf(fp,"# ClusterSimulationData 2\n");
+	fprintf(fp,"# mri_glmfit simulation sim\n");
+	fprintf(fp,"# hostname %s\n",uts.nodename);
+	fprintf(fp,"# machine  %s\n",uts.machine);
+	fprintf(fp,"# runtime_min %g\n",mytimer.milliseconds()/(1000*60.0));
+	fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
+	if (mriglm->mask) fprintf(fp,"# masking 1\n");
+	else             fprintf(fp,"# masking 0\n");
+	fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
+	fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
+	fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
+	csd0->nreps = nreps;
+	CSDprint(fp, csd0);
+	fclose(fp);
+	if(debug) CSDprint(stdout, csd0);
+      }
+    }
+  }
+  return(0);
+}
+
 /*--------------------------------------------------------------------*/
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag) {
   int **crslut, *lbmask, vtxno, n, c, r, s, f;
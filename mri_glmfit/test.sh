@@ -23,3 +23,83 @@ done
 for f in F.mgh gamma.mgh sig.mgh; do
     compare_vol ${actual}/age/${f} ${expected}/age/${f} --thresh 0.008
 done
+
+# same fit, streaming y in small blocks
+test_command mri_glmfit \
+    --seed 1234 \
+    --y lh.gender_age.thickness.10.mgh \
+    --fsgd gender_age.txt doss \
+    --no-cortex \
+    --glmdir lh.gender_age.stream.glmdir \
+    --surf average lh \
+    --C age.mat \
+    --stream 0.1
+
+actual="${FSTEST_TESTDATA_DIR}/lh.gender_age.stream.glmdir"
+
+for f in beta.mgh mask.mgh rstd.mgh rvar.mgh; do
+    compare_vol ${actual}/${f} ${expected}/${f} --thresh 0.00007
+done
+
+for f in F.mgh gamma.mgh sig.mgh; do
+    compare_vol ${actual}/age/${f} ${expected}/age/${f} --thresh 0.008
+done
+
+# inverted (pruning) mask, which must select the same voxels with and
+# without streaming. Keep the output of each run for the comparison.
+FSTEST_NO_DATA_RESET=1 && init_testdata
+
+test_command mri_glmfit \
+    --seed 1234 \
+    --y lh.gender_age.thickness.10.mgh \
+    --fsgd gender_age.txt doss \
+    --no-cortex \
+    --mask-inv \
+    --glmdir lh.gender_age.maskinv.glmdir \
+    --surf average lh \
+    --C age.mat
+
+test_command mri_glmfit \
+    --seed 1234 \
+    --y lh.gender_age.thickness.10.mgh \
+    --fsgd gender_age.txt doss \
+    --no-cortex \
+    --mask-inv \
+    --glmdir lh.gender_age.maskinv.stream.glmdir \
+    --surf average lh \
+    --C age.mat \
+    --stream 0.1
+
+actual="${FSTEST_TESTDATA_DIR}/lh.gender_age.maskinv.stream.glmdir"
+expected="${FSTEST_TESTDATA_DIR}/lh.gender_age.maskinv.glmdir"
+
+compare_vol ${actual}/mask.mgh ${expected}/mask.mgh
+
+for f in beta.mgh rstd.mgh rvar.mgh; do
+    compare_vol ${actual}/${f} ${expected}/${f} --thresh 0.00007
+done
+
+for f in F.mgh gamma.mgh sig.mgh; do
+    compare_vol ${actual}/age/${f} ${expected}/age/${f} --thresh 0.008
+done
+
+# simulation with a per-vertex regressor, which fits each vertex with its
+# own X; the CSDs (without the header) must not depend on the number of
+# threads
+for threads in 1 2 4; do
+    test_command mri_glmfit \
+        --seed 1234 \
+        --y lh.gender_age.thickness.10.mgh \
+        --fsgd gender_age.txt doss \
+        --no-cortex \
+        --pvr lh.gender_age.thickness.10.mgh \
+        --glmdir lh.gender_age.pvr.glmdir \
+        --surf average lh \
+        --C age.mat \
+        --sim mc-full 6 2 pvr.t${threads} \
+        --threads ${threads}
+    test_command "grep -v '^#' pvr.t${threads}-age.csd > pvr.t${threads}.dat"
+done
+
+compare_file pvr.t2.dat pvr.t1.dat
+compare_file pvr.t4.dat pvr.t1.dat
@@ -363,6 +363,7 @@ void MultiRegistration::initRegistration(RegRobust & R)
   R.setCost(Registration::ROB);
   R.setSaturation(sat);
   R.setDoublePrec(doubleprec);
+  R.setNormalEquations(normaleq);
   //R.setDebug(debug);
 
   if (subsamplesize > 0)
@@ -520,10 +521,13 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
   }
 
   strncpy(mri_mean->fname, (outdir + "template-it0.mgz").c_str(), STRLEN-1);
+  // intermediate templates (debug) are written while the next iteration
+  // registers the time points to them (mri_mean is read only then)
+  string templatefn;
   if (debug)
   {
     cout << "debug: saving template-it0.mgz" << endl;
-    MRIwrite(mri_mean, (outdir + "template-it0.mgz").c_str());
+    templatefn = outdir + "template-it0.mgz";
   }
 
   //cout << "template fname: " << mri_mean->fname << endl;
@@ -563,6 +567,11 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
   // the methods are: maxit 3, maxit 2, maxit 1, subsample 180
   int noxformits[4] =
   { 3, 1, 0, 0 };
+
+  // pyramid of the current template, built by the first registration and
+  // shared by all time points
+  SharedPyramid gpmean;
+
   while (itcount < itmax && maxchange > eps)
   {
     itcount++;
@@ -588,246 +597,261 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
     // register all inputs to mean
     vector<double> dists(nin, 1000); // should be larger than maxchange!
 #ifdef HAVE_OPENMP
-#pragma omp parallel for schedule(static,1)
+#pragma omp parallel
 #endif
-    for (int i = 0; i < nin; i++)
     {
+      // one thread writes the previous template, the others start registering
+#ifdef HAVE_OPENMP
+#pragma omp single nowait
+#endif
+      if (templatefn != "")
+        MRIwrite(mri_mean, templatefn.c_str());
+
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+      for (int i = 0; i < nin; i++)
+      {
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif  
-      cout << endl << "Working on TP " << i + 1 << endl << endl;
-      RegRobust R; // create new registration each time to keep mem usage smaller
+        cout << endl << "Working on TP " << i + 1 << endl << endl;
+        RegRobust R; // create new registration each time to keep mem usage smaller
 //      Rv[i].clear();
-      R.setVerbose(0);
-      initRegistration(R); //set parameters
+        R.setVerbose(0);
+        initRegistration(R); //set parameters
 //      R.setSource(mri_mov[i], fixvoxel, keeptype);
 //      R.setTarget(mri_mean, fixvoxel, keeptype); // gaussian pyramid will be constructed for
 //                                                 // each Rv[i], could be optimized
-      R.setSourceAndTarget(mri_mov[i],mri_mean,keeptype);
+        R.setSourceAndTarget(mri_mov[i],mri_mean,keeptype);
+        R.setSharedTargetPyramid(&gpmean);
 
-      ostringstream oss;
-      oss << outdir << "tp" << i + 1 << "_to_template-it" << itcount;
-      R.setName(oss.str());
-
-      // compute Alignment
-      //std::pair <MATRIX*, double> Md;
-      std::pair<vnl_matrix_fixed<double, 4, 4>, double> Md;
-      //int iterate = P.iterate;
-      //double epsit= P.epsit;
-      int maxres = 0;
-      // on higher iterations use subsamplesize as passed on commandline
-      int subsamp = subsamplesize;
-      // simplify first steps (only if we do not have good transforms):
-      if (!iscaleonly && !havexforms && itcount <= 4 && noxformits[itcount - 1] > 0)
-      {
-        switch (itcount)
+        ostringstream oss;
+        oss << outdir << "tp" << i + 1 << "_to_template-it" << itcount;
+        R.setName(oss.str());
+
+        // compute Alignment
+        //std::pair <MATRIX*, double> Md;
+        std::pair<vnl_matrix_fixed<double, 4, 4>, double> Md;
+        //int iterate = P.iterate;
+        //double epsit= P.epsit;
+        int maxres = 0;
+        // on higher iterations use subsamplesize as passed on commandline
+        int subsamp = subsamplesize;
+        // simplify first steps (only if we do not have good transforms):
+        if (!iscaleonly && !havexforms && itcount <= 4 && noxformits[itcount - 1] > 0)
         {
-        case 1:
-          maxres = 3;
-          break;
-        case 2:
-          maxres = 2;
-          break;
-        case 3:
-          maxres = 1;
-          break;
-        case 4:
-          subsamp = 180;
-          break;
+          switch (itcount)
+          {
+          case 1:
+            maxres = 3;
+            break;
+          case 2:
+            maxres = 2;
+            break;
+          case 3:
+            maxres = 1;
+            break;
+          case 4:
+            subsamp = 180;
+            break;
+          }
         }
-      }
 
-      R.setSubsampleSize(subsamp);
-      R.setIscaleInit(intensities[i]);
-      R.setMinitOrig(transforms[i]); // as the transforms are in the original space
-      if (satit)
-        R.findSaturation();
+        R.setSubsampleSize(subsamp);
+        R.setIscaleInit(intensities[i]);
+        R.setMinitOrig(transforms[i]); // as the transforms are in the original space
+        if (satit)
+          R.findSaturation();
 
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif 
-      if (nomulti || iscaleonly)
-      {
-        cout << " - running high-res registration on TP " << i + 1 << "..." << endl;
-        R.computeIterativeRegistration(iterate, epsit); 
-      }
-      else
-      {
-        cout << " - running multi-resolutional registration on TP " << i + 1 << "..." << endl;
-        R.computeMultiresRegistration(maxres, iterate, epsit);
-      }
+        if (nomulti || iscaleonly)
+        {
+          cout << " - running high-res registration on TP " << i + 1 << "..." << endl;
+          R.computeIterativeRegistration(iterate, epsit); 
+        }
+        else
+        {
+          cout << " - running multi-resolutional registration on TP " << i + 1 << "..." << endl;
+          R.computeMultiresRegistration(maxres, iterate, epsit);
+        }
 
-      Md.first = R.getFinalVox2Vox();
-      Md.second = R.getFinalIscale();
-      if (!R.getConverged())
-      {
+        Md.first = R.getFinalVox2Vox();
+        Md.second = R.getFinalIscale();
+        if (!R.getConverged())
+        {
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif  
-        cout << "   *** WARNING: TP " << i + 1
-            << " to template did not converge ***" << endl;
-      }
+          cout << "   *** WARNING: TP " << i + 1
+              << " to template did not converge ***" << endl;
+        }
        
-      transforms[i] = Md.first;
-      intensities[i] = Md.second;
-
-      // convert Matrix to LTA ras to ras
-      LTA * lastlta = NULL;
-      if (ltas[i])
-        lastlta = ltas[i];
-      ltas[i] = MyMatrix::VOXmatrix2LTA(Md.first, mri_mov[i], mri_mean);
-      //P.ltas[i] = LTAalloc(1,P.mri_mov[i]);
-      //P.ltas[i]->xforms[0].m_L =
-      //  MRIvoxelXformToRasXform (P.mri_mov[i],
-      //                           P.mri_mean,
-      //                           Md.first,
-      //                           P.ltas[i]->xforms[0].m_L) ;
-      //P.ltas[i]->type = LINEAR_RAS_TO_RAS ;
-      //getVolGeom(P.mri_mov[i], &P.ltas[i]->xforms[0].src);
-      //getVolGeom(P.mri_mean, &P.ltas[i]->xforms[0].dst);
-
-      // compute maxchange
-      if (lastlta)
-      {
-        LTAchangeType(lastlta, LINEAR_RAS_TO_RAS); //measure dist in RAS coords
-        LTAchangeType(ltas[i], LINEAR_RAS_TO_RAS); //measure dist in RAS coords
-        dists[i] = sqrt(
-            MyMatrix::AffineTransDistSq(lastlta->xforms[0].m_L,
-                ltas[i]->xforms[0].m_L));
-        LTAfree(&lastlta);
-        if (dists[i] > maxchange)
-          maxchange = dists[i];
+        transforms[i] = Md.first;
+        intensities[i] = Md.second;
+
+        // convert Matrix to LTA ras to ras
+        LTA * lastlta = NULL;
+        if (ltas[i])
+          lastlta = ltas[i];
+        ltas[i] = MyMatrix::VOXmatrix2LTA(Md.first, mri_mov[i], mri_mean);
+        //P.ltas[i] = LTAalloc(1,P.mri_mov[i]);
+        //P.ltas[i]->xforms[0].m_L =
+        //  MRIvoxelXformToRasXform (P.mri_mov[i],
+        //                           P.mri_mean,
+        //                           Md.first,
+        //                           P.ltas[i]->xforms[0].m_L) ;
+        //P.ltas[i]->type = LINEAR_RAS_TO_RAS ;
+        //getVolGeom(P.mri_mov[i], &P.ltas[i]->xforms[0].src);
+        //getVolGeom(P.mri_mean, &P.ltas[i]->xforms[0].dst);
+
+        // compute maxchange
+        if (lastlta)
+        {
+          LTAchangeType(lastlta, LINEAR_RAS_TO_RAS); //measure dist in RAS coords
+          LTAchangeType(ltas[i], LINEAR_RAS_TO_RAS); //measure dist in RAS coords
+          dists[i] = sqrt(
+              MyMatrix::AffineTransDistSq(lastlta->xforms[0].m_L,
+                  ltas[i]->xforms[0].m_L));
+          LTAfree(&lastlta);
+          if (dists[i] > maxchange)
+            maxchange = dists[i];
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif  
-        cout << "   tp " << i + 1 << " distance: " << dists[i] << endl;
-      }
+          cout << "   tp " << i + 1 << " distance: " << dists[i] << endl;
+        }
 
-      // create warps: warp mov to mean
-      if (mri_warps[i])
-        MRIfree(&mri_warps[i]);
-      mri_warps[i] = MRIclone(mri_mean, mri_warps[i]);
-      if (sampletype == SAMPLE_CUBIC_BSPLINE)
-      {
+        // create warps: warp mov to mean
+        if (mri_warps[i])
+          MRIfree(&mri_warps[i]);
+        mri_warps[i] = MRIclone(mri_mean, mri_warps[i]);
+        if (sampletype == SAMPLE_CUBIC_BSPLINE)
+        {
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif  
-        cout << " - mapping tp " << i + 1 << " to template (cubic bspline) ..."
-            << endl;
-        mri_warps[i] = LTAtransformBSpline(mri_bsplines[i], mri_warps[i],
-            ltas[i]);
-      }
-      else
-      {
+          cout << " - mapping tp " << i + 1 << " to template (cubic bspline) ..."
+              << endl;
+          mri_warps[i] = LTAtransformBSpline(mri_bsplines[i], mri_warps[i],
+              ltas[i]);
+        }
+        else
+        {
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif  
-        cout << " - mapping tp " << i + 1 << " to template..." << endl;
-        mri_warps[i] = LTAtransformInterp(mri_mov[i], mri_warps[i], ltas[i],
-            sampletype);
-      }
-      MRIcopyPulseParameters(mri_mov[i], mri_warps[i]);
+          cout << " - mapping tp " << i + 1 << " to template..." << endl;
+          mri_warps[i] = LTAtransformInterp(mri_mov[i], mri_warps[i], ltas[i],
+              sampletype);
+        }
+        MRIcopyPulseParameters(mri_mov[i], mri_warps[i]);
 
-      // here do scaling of intensity values
-      if (R.isIscale() && Md.second > 0)
-      {
+        // here do scaling of intensity values
+        if (R.isIscale() && Md.second > 0)
+        {
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif  
-        cout << " - adjusting intensity of mapped tp " << i + 1 << " by "
-            << Md.second << endl;
-        mri_warps[i] = MyMRI::MRIvalscale(mri_warps[i], mri_warps[i],
-            Md.second);
-      }
+          cout << " - adjusting intensity of mapped tp " << i + 1 << " by "
+              << Md.second << endl;
+          mri_warps[i] = MyMRI::MRIvalscale(mri_warps[i], mri_warps[i],
+              Md.second);
+        }
 
-      if (backupweights)
-      {
-        // copy weights (as RV will be cleared)
-        //   (info: they are in original half way space)
+        if (backupweights)
+        {
+          // copy weights (as RV will be cleared)
+          //   (info: they are in original half way space)
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif  
-        cout << " - backup weights tp " << i + 1 << " ..." << endl;
-        //if (mri_weights[i]) MRIfree(&mri_weights[i]); 
-        mri_weights[i] = MRIcopy(R.getWeights(), mri_weights[i]);
-      }
+          cout << " - backup weights tp " << i + 1 << " ..." << endl;
+          //if (mri_weights[i]) MRIfree(&mri_weights[i]); 
+          mri_weights[i] = MRIcopy(R.getWeights(), mri_weights[i]);
+        }
 
-      //cout << " LS difference after: " <<
-      //CF.leastSquares(mri_aligned,P.mri_dst) << endl;
-      //cout << " NC difference after: " <<
-      //CF.normalizedCorrelation(mri_aligned,P.mri_dst) << endl;
+        //cout << " LS difference after: " <<
+        //CF.leastSquares(mri_aligned,P.mri_dst) << endl;
+        //cout << " NC difference after: " <<
+        //CF.normalizedCorrelation(mri_aligned,P.mri_dst) << endl;
 
-      if (debug)
-      {
+        if (debug)
+        {
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif  
-        cout << " - debug tp " << i + 1 << " : writing transforms, warps, weights ..." << endl;
+          cout << " - debug tp " << i + 1 << " : writing transforms, warps, weights ..." << endl;
 
-        LTAwriteEx(ltas[i], (oss.str() + ".lta").c_str());
+          LTAwriteEx(ltas[i], (oss.str() + ".lta").c_str());
 
-        MRIwrite(mri_warps[i], (oss.str() + ".mgz").c_str());
+          MRIwrite(mri_warps[i], (oss.str() + ".mgz").c_str());
 
-        if (R.isIscale() && Md.second > 0)
-        {
-          string fn = oss.str() + "-intensity.txt";
-          ofstream f(fn.c_str(), ios::out);
-          f << Md.second;
-          f.close();
-        }
+          if (R.isIscale() && Md.second > 0)
+          {
+            string fn = oss.str() + "-intensity.txt";
+            ofstream f(fn.c_str(), ios::out);
+            f << Md.second;
+            f.close();
+          }
 
-        // if we have weights:  
-        if (mri_weights[i] != NULL)
-        {
-          std::pair<vnl_matrix_fixed<double, 4, 4>,
-              vnl_matrix_fixed<double, 4, 4> > map2weights = R.getHalfWayMaps();
-          vnl_matrix_fixed<double, 4, 4> hinv = vnl_inverse(map2weights.second);
+          // if we have weights:  
+          if (mri_weights[i] != NULL)
+          {
+            std::pair<vnl_matrix_fixed<double, 4, 4>,
+                vnl_matrix_fixed<double, 4, 4> > map2weights = R.getHalfWayMaps();
+            vnl_matrix_fixed<double, 4, 4> hinv = vnl_inverse(map2weights.second);
 
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif  
-          {
-            cout << endl;
-            cout << map2weights.first << endl;
-            cout << endl;
-            cout << map2weights.second << endl;
-            cout << endl;
-            cout << hinv << endl;
-            cout << endl;
+            {
+              cout << endl;
+              cout << map2weights.first << endl;
+              cout << endl;
+              cout << map2weights.second << endl;
+              cout << endl;
+              cout << hinv << endl;
+              cout << endl;
+            }
+            MRI * wtarg = MRIallocSequence(mri_weights[i]->width, mri_weights[i]->height,
+                mri_weights[i]->depth, MRI_FLOAT,mri_weights[i]->nframes);
+            MRIcopyHeader(mri_weights[i], wtarg);
+            MATRIX * v2r = MRIgetVoxelToRasXform(mri_mean);
+            MRIsetVoxelToRasXform(wtarg, v2r);
+            wtarg->type = MRI_FLOAT;
+            wtarg->i_to_r__ = AffineMatrixCopy(mri_mean->i_to_r__,
+                wtarg->i_to_r__);
+            wtarg->r_to_i__ = MatrixCopy(mri_mean->r_to_i__, wtarg->r_to_i__);
+
+            wtarg = MyMRI::MRIlinearTransform(mri_weights[i], wtarg, hinv);
+            MRIwrite(wtarg, (oss.str() + "-weights.mgz").c_str());
+            MRIwrite(mri_weights[i], (oss.str() + "-www.mgz").c_str());
+            MRIfree(&wtarg);
+            //MatrixFree(&hinv);
+            MatrixFree(&v2r);
           }
-          MRI * wtarg = MRIallocSequence(mri_weights[i]->width, mri_weights[i]->height,
-              mri_weights[i]->depth, MRI_FLOAT,mri_weights[i]->nframes);
-          MRIcopyHeader(mri_weights[i], wtarg);
-          MATRIX * v2r = MRIgetVoxelToRasXform(mri_mean);
-          MRIsetVoxelToRasXform(wtarg, v2r);
-          wtarg->type = MRI_FLOAT;
-          wtarg->i_to_r__ = AffineMatrixCopy(mri_mean->i_to_r__,
-              wtarg->i_to_r__);
-          wtarg->r_to_i__ = MatrixCopy(mri_mean->r_to_i__, wtarg->r_to_i__);
-
-          wtarg = MyMRI::MRIlinearTransform(mri_weights[i], wtarg, hinv);
-          MRIwrite(wtarg, (oss.str() + "-weights.mgz").c_str());
-          MRIwrite(mri_weights[i], (oss.str() + "-www.mgz").c_str());
-          MRIfree(&wtarg);
-          //MatrixFree(&hinv);
-          MatrixFree(&v2r);
-        }
-      } // if debug end
+        } // if debug end
 
-      // clear to reduce memory usage:
-      //Rv[i].clear();
-      // Rv[i].freeGPT();
+        // clear to reduce memory usage:
+        //Rv[i].clear();
+        // Rv[i].freeGPT();
 
 #ifdef HAVE_OPENMP
 #pragma omp critical
 #endif  
-      {
-        cout << endl << "Finished TP : " << i + 1 << endl;
-        cout << endl;
-        cout << "=====================================================" << endl;
-      }
+        {
+          cout << endl << "Finished TP : " << i + 1 << endl;
+          cout << endl;
+          cout << "=====================================================" << endl;
+        }
 
-    } // for loop end (all timepoints)
+      } // for loop end (all timepoints)
+    } // parallel region end
+    templatefn = "";
+    gpmean.clear(); // template changes below
 
     // if we did not have initial transforms
     // allow for more iterations on different resolutions
@@ -854,12 +878,19 @@ bool MultiRegistration::computeTemplate(int itmax, double eps, int iterate,
       ostringstream oss;
       oss << outdir << "template-it" << itcount << ".mgz";
       cout << "debug: writing template to " << oss.str() << endl;
-      MRIwrite(mri_mean, oss.str().c_str());
+      templatefn = oss.str();
       //strncpy(mri_mean->fname, oss.str().c_str(),STRLEN);
     }
 
   } // end while
 
+  // the last template has no iteration to overlap with
+  if (templatefn != "")
+    MRIwrite(mri_mean, templatefn.c_str());
+  if (debug)
+    cout << "debug: template pyramid built " << gpmean.getBuilds()
+        << " times" << endl;
+
   //strncpy(P.mri_mean->fname, P.mean.c_str(),STRLEN);
 
   cout << " DONE : computeTemplate " << endl;
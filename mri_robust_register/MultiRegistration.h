@@ -49,7 +49,7 @@ public:
       outdir("./"), transonly(false), rigid(true), robust(true), sat(4.685),
           satit(false), debug(0), iscale(false), iscaleonly(false),
           nomulti(false), subsamplesize(-1), highit(-1), fixvoxel(false),
-          keeptype(false), average(1), doubleprec(false), backupweights(false),
+          keeptype(false), average(1), doubleprec(false), normaleq(false), backupweights(false),
           sampletype(SAMPLE_CUBIC_BSPLINE), crascenter(false), mri_mean(NULL)
   {
   }
@@ -58,7 +58,7 @@ public:
       outdir("./"), transonly(false), rigid(true), robust(true), sat(4.685),
           satit(false), debug(0), iscale(false), iscaleonly(false),
           nomulti(false), subsamplesize(-1), highit(-1), fixvoxel(false),
-          keeptype(false), average(1), doubleprec(false), backupweights(false),
+          keeptype(false), average(1), doubleprec(false), normaleq(false), backupweights(false),
           sampletype(SAMPLE_CUBIC_BSPLINE), crascenter(false), mri_mean(NULL)
   {
     loadMovables(mov);
@@ -91,6 +91,7 @@ public:
     std::cout << " KeepType:      " << keeptype << std::endl;
     std::cout << " Average:       " << average << std::endl;
     std::cout << " DoublePrec:    " << doubleprec << std::endl;
+    std::cout << " NormalEq:      " << normaleq << std::endl;
     std::cout << " BackupWeights: " << backupweights << std::endl;
     std::cout << " SampleType:    " << sampletype<< std::endl;
     std::cout << " CRASCenter:    " << crascenter<< std::endl;
@@ -233,6 +234,12 @@ public:
     doubleprec = b;
   }
 
+  //! Solve normal equations instead of storing the full design matrix
+  void setNormalEquations(bool b)
+  {
+    normaleq = b;
+  }
+
   //! Specify if weights are keept
   void setBackupWeights(bool b)
   {
@@ -313,6 +320,7 @@ private:
   bool keeptype;
   int average;
   bool doubleprec;
+  bool normaleq;
   bool backupweights;
   int sampletype;
   bool crascenter;
@@ -233,8 +233,7 @@ double RegRobust::findSaturation()
   pair<int, int> limits = getGPLimits(mriS, mriT, MINS, maxsize);
   if (gpS.size() == 0)
     gpS = buildGPLimits(mriS, limits);
-  if (gpT.size() == 0)
-    gpT = buildGPLimits(mriT, limits);
+  buildTargetPyramid(mriT, limits);
   assert(gpS.size() == gpT.size());
   if (gpS[0]->width < MINS || gpS[0]->height < MINS
       || (gpS[0]->depth < MINS && gpS[0]->depth != 1))
@@ -39,7 +39,7 @@ class RegRobust: public Registration
   template<class T> friend class RegistrationStep;
 public:
   RegRobust() :
-      Registration(), sat(-1), wlimit(0.16), mri_weights(NULL), mri_hweights(
+      Registration(), sat(-1), wlimit(0.16), normaleq(false), mri_weights(NULL), mri_hweights(
           NULL), mri_indexing(NULL)
   {
   }
@@ -73,6 +73,12 @@ public:
     wlimit = d;
   }
 
+  //! Solve the normal equations instead of storing the full design matrix
+  void setNormalEquations(bool b)
+  {
+    normaleq = b;
+  }
+
   //! Get Name of Registration class
   virtual std::string getClassName() {return "RegRobust";}
   
@@ -91,6 +97,7 @@ private:
   // PRIVATE DATA
   double sat;
   double wlimit;
+  bool normaleq;
   MRI * mri_weights;
   MRI * mri_hweights;
   MRI * mri_indexing;
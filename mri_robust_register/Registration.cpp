@@ -59,7 +59,7 @@ Registration::~Registration()
   if (gpS.size() > 0)
     freeGaussianPyramid(gpS);
   if (gpT.size() > 0)
-    freeGaussianPyramid(gpT);
+    freeTargetPyramid();
   if (trans)
     delete trans;
   //std::cout << " Done " << std::endl;
@@ -734,8 +734,7 @@ void Registration::computeMultiresRegistration(int stopres, int n, double epsit)
   pair<int, int> limits = getGPLimits(mriS, mriT, MINS, maxsize);
   if (gpS.size() == 0)
     gpS = buildGPLimits(mriS, limits);
-  if (gpT.size() == 0)
-    gpT = buildGPLimits(mriT, limits);
+  buildTargetPyramid(mriT, limits);
   assert(gpS.size() == gpT.size());
   if (gpT[0]->width < MINS || gpT[0]->height < MINS
       || (gpT[0]->depth < MINS && gpT[0]->depth != 1))
@@ -3141,6 +3140,89 @@ void Registration::freeGaussianPyramid(std::vector<MRI*>& p)
   p.clear();
 }
 
+/** Builds gpT for mriT unless it exists. If a shared pyramid is set and
+ mriT is our target, the levels are taken from there (and not owned).
+ */
+void Registration::buildTargetPyramid(MRI * mriT,
+    const std::pair<int, int> & limits)
+{
+  if (gpT.size() > 0)
+    return;
+  if (sharedT && mriT == mri_target)
+  {
+    gpT = sharedT->get(*this, limits);
+    if (gpT.size() > 0)
+    {
+      gpTshared = true;
+      return;
+    }
+  }
+  gpT = buildGPLimits(mriT, limits);
+  gpTshared = false;
+}
+
+void Registration::freeTargetPyramid()
+{
+  if (gpTshared)
+    gpT.clear();
+  else
+    freeGaussianPyramid(gpT);
+  gpTshared = false;
+}
+
+void SharedPyramid::clear()
+{
+  for (uint i = 0; i < gp.size(); i++)
+    MRIfree(&gp[i]);
+  gp.clear();
+  type = -1;
+}
+
+bool SharedPyramid::matches(const Registration & R,
+    const std::pair<int, int> & limits) const
+{
+  const MRI * mri = R.mri_target;
+  if (limits != gplimits || mri->width != width || mri->height != height
+      || mri->depth != depth || mri->type != type)
+    return false;
+  if (R.Rtrg.rows() != Rtrg.rows() || R.Rtrg.cols() != Rtrg.cols())
+    return false;
+  for (unsigned int r = 0; r < Rtrg.rows(); r++)
+    for (unsigned int c = 0; c < Rtrg.cols(); c++)
+      if (R.Rtrg[r][c] != Rtrg[r][c])
+        return false;
+  return true;
+}
+
+/** The resliced target of R is the same for all registrations to the same
+ input target with the same voxel size and dimensions, which is checked via
+ the reslice matrix Rtrg, the dimensions and the type.
+ */
+std::vector<MRI*> SharedPyramid::get(Registration & R,
+    const std::pair<int, int> & limits)
+{
+  std::vector<MRI*> p;
+#ifdef HAVE_OPENMP
+#pragma omp critical (SharedPyramid)
+#endif
+  {
+    if (gp.size() == 0)
+    {
+      gp = R.buildGPLimits(R.mri_target, limits);
+      gplimits = limits;
+      Rtrg = R.Rtrg;
+      width = R.mri_target->width;
+      height = R.mri_target->height;
+      depth = R.mri_target->depth;
+      type = R.mri_target->type;
+      nbuilds++;
+    }
+    if (matches(R, limits))
+      p = gp;
+  }
+  return p;
+}
+
 void Registration::saveGaussianPyramid(std::vector<MRI*>& p,
     const std::string & prefix)
 {
@@ -3914,7 +3996,7 @@ void Registration::setSourceAndTarget(MRI * s, MRI * t, bool keeptype)
     freeGaussianPyramid(gpS);
   centroidS.clear();
   if (gpT.size() > 0)
-    freeGaussianPyramid(gpT);
+    freeTargetPyramid();
   centroidT.clear();
 
   // initialize the correct registration type:
@@ -3979,7 +4061,7 @@ void Registration::setTarget(MRI * t, bool conform, bool keeptype)
   }
 
   if (gpT.size() > 0)
-    freeGaussianPyramid(gpT);
+    freeTargetPyramid();
   centroidT.clear();
   //cout << "mri_target" << mri_target << endl;
 
@@ -47,12 +47,62 @@
 #include "MyMRI.h"
 #include "Transformation.h"
 
+class Registration;
+
+/** \class SharedPyramid
+ * \brief Gaussian pyramid of a target that is shared by several registrations
+ *
+ * When many images are registered to the same target (e.g. all time points
+ * to the current template) every Registration would build the same target
+ * pyramid. The first one builds it here, the others get the same levels
+ * (read only) if their resliced target and pyramid limits agree. The owner
+ * calls clear() whenever the target changes and after all Registrations that
+ * use it are gone.
+ */
+class SharedPyramid
+{
+public:
+  SharedPyramid() :
+      width(0), height(0), depth(0), type(-1), nbuilds(0)
+  {
+  }
+  ~SharedPyramid()
+  {
+    clear();
+  }
+
+  //! Free the pyramid
+  void clear();
+
+  //! Return pyramid of the target of R (built on first use), empty if it belongs to a different target
+  std::vector<MRI*> get(Registration & R, const std::pair<int, int> & limits);
+
+  //! Number of times a pyramid was built since construction
+  int getBuilds() const
+  {
+    return nbuilds;
+  }
+
+private:
+  SharedPyramid(const SharedPyramid &);
+  SharedPyramid & operator=(const SharedPyramid &);
+
+  bool matches(const Registration & R, const std::pair<int, int> & limits) const;
+
+  std::vector<MRI*> gp;
+  std::pair<int, int> gplimits;
+  vnl_matrix<double> Rtrg;
+  int width, height, depth, type;
+  int nbuilds;
+};
+
 /** \class Registration
  * \brief Base class for registration 
  * Implements multi resolution and iterative registration, as well as initializations
  */
 class Registration
 {
+  friend class SharedPyramid;
 public:
 
 //! The different cost functions
@@ -66,7 +116,7 @@ public:
       iscale(false), iscaleonly(false), transonly(false), rigid(true), isoscale(false),
           affine(false), trans(NULL), subsamplesize(-1), minsize(-1), maxsize(-1),
           debug(0), verbose(1),initorient(false), inittransform(true), initscaling(false),
-          highit(-1), mri_source(NULL), mri_target(NULL), iscaleinit(1.0),
+          highit(-1), mri_source(NULL), mri_target(NULL), sharedT(NULL), gpTshared(false), iscaleinit(1.0),
           iscalefinal(1.0), doubleprec(false), symmetry(true),
           sampletype(SAMPLE_TRILINEAR), resample(false), costfun(ROB), converged(false)
   {
@@ -88,7 +138,13 @@ public:
   //! Free Gaussian pyramid for target image
   void freeGPT()
   {
-    freeGaussianPyramid(gpT);
+    freeTargetPyramid();
+  }
+
+  //! Take the target pyramid from sp (if it fits) instead of building an own one
+  void setSharedTargetPyramid(SharedPyramid * sp)
+  {
+    sharedT = sp;
   }
 
   //! Allow only translation
@@ -390,6 +446,10 @@ protected:
   std::vector<MRI*> buildGPLimits(MRI *mri_in, std::pair<int, int> limits);
   //! Free a Gaussian pyramid
   void freeGaussianPyramid(std::vector<MRI*>& p);
+  //! Build (or get the shared) target pyramid gpT, if not there yet
+  void buildTargetPyramid(MRI * mriT, const std::pair<int, int> & limits);
+  //! Free target pyramid (only release it, if shared)
+  void freeTargetPyramid();
   //! Save a Gaussian pyramid
   void saveGaussianPyramid(std::vector<MRI*>& p, const std::string & prefix);
 
@@ -420,6 +480,8 @@ protected:
   std::vector<double> centroidS;
   MRI * mri_target;
   std::vector<MRI*> gpT;
+  SharedPyramid * sharedT;
+  bool gpTshared; // gpT belongs to sharedT
   std::vector<double> centroidT;
   vnl_matrix<double> Minit;
   vnl_matrix<double> Mfinal;
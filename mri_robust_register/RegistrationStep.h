@@ -28,6 +28,7 @@
 
 #include <utility>
 #include <vector>
+#include <new>
 #include <cassert>
 #include <iostream>
 #include <string>
@@ -41,6 +42,84 @@
 #include "Transformation.h"
 #include "RegRobust.h"
 
+/** \class RegistrationRows
+ * \brief Rows of the registration design matrix A, generated on demand
+ *
+ * Keeps only the voxel position and the image gradient (fx,fy,fz,ft) per
+ * row and asks the transformation model for the row when the solver needs
+ * it, instead of storing all parameters of each row in A.
+ */
+template<class T>
+class RegistrationRows: public RegressionRows<T>
+{
+public:
+  RegistrationRows(const Transformation * t, bool is) :
+      trans(t), iscale(is), nrows(0), ncols(t->getDOF() + (is ? 1 : 0))
+  {
+  }
+
+  //! Allocate n rows, returns false if out of memory
+  bool setSize(unsigned int n)
+  {
+    try
+    {
+      pos.resize(3 * (size_t) n);
+      grad.resize(4 * (size_t) n);
+    }
+    catch (std::bad_alloc &)
+    {
+      return false;
+    }
+    nrows = n;
+    return true;
+  }
+
+  void setRow(unsigned int i, unsigned int x, unsigned int y, unsigned int z,
+      float fx, float fy, float fz, float ft)
+  {
+    unsigned int * pi = &pos[3 * (size_t) i];
+    pi[0] = x;
+    pi[1] = y;
+    pi[2] = z;
+    float * gi = &grad[4 * (size_t) i];
+    gi[0] = fx;
+    gi[1] = fy;
+    gi[2] = fz;
+    gi[3] = ft;
+  }
+
+  unsigned int rows() const
+  {
+    return nrows;
+  }
+
+  unsigned int cols() const
+  {
+    return ncols;
+  }
+
+  void getRow(unsigned int i, T * row) const
+  {
+    const unsigned int * pi = &pos[3 * (size_t) i];
+    const float * gi = &grad[4 * (size_t) i];
+    vnl_vector<double> g = trans->getGradient(pi[0], gi[0], pi[1], gi[1],
+        pi[2], gi[2]);
+    unsigned int dof = g.size();
+    for (unsigned int pno = 0; pno < dof; pno++)
+      row[pno] = (T) g[pno];
+    if (iscale)
+      row[dof] = gi[3];
+  }
+
+private:
+  const Transformation * trans;
+  bool iscale;
+  unsigned int nrows;
+  unsigned int ncols;
+  std::vector<unsigned int> pos;
+  std::vector<float> grad;
+};
+
 template<class T>
 class RegistrationStep
 {
@@ -50,8 +129,8 @@ public:
   RegistrationStep(const RegRobust & R) :
       sat(R.sat), iscale(R.iscale), transonly(R.transonly), rigid(R.rigid), isoscale(
           R.isoscale), trans(R.trans), costfun(R.costfun), rtype(1), subsamplesize(
-          R.subsamplesize), debug(R.debug), verbose(R.verbose), floatsvd(false), iscalefinal(
-          R.iscalefinal), mri_weights(NULL), mri_indexing(NULL)
+          R.subsamplesize), debug(R.debug), verbose(R.verbose), floatsvd(false), normaleq(
+          R.normaleq), iscalefinal(R.iscalefinal), mri_weights(NULL), mri_indexing(NULL)
   {
   }
 
@@ -104,7 +183,10 @@ public:
 
   // only public because of resampling testing in Registration.cpp
   // should be made protected at some point.
-  void constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T> &A, vnl_vector<T> &b);
+  void constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T> &A, vnl_vector<T> &b)
+  {
+    constructAb(mriS, mriT, &A, NULL, b);
+  }
 
   // called from computeRegistrationStepW
   // and externally from RegPowell (not anymore, now use transformation model)
@@ -115,6 +197,10 @@ protected:
 
   vnl_matrix<T> constructR(const vnl_vector<T> & p);
 
+  // fills either A or the compact rows Ar
+  void constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T> *A,
+      RegistrationRows<T> *Ar, vnl_vector<T> &b);
+
 private:
 // in:
 
@@ -130,6 +216,7 @@ private:
   int debug;
   int verbose;
   bool floatsvd; // should be removed
+  bool normaleq; // solve normal equations without storing A
   double iscalefinal; // from the last step, used in constructAB
 
 // out:
@@ -165,6 +252,8 @@ std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRe
 
   vnl_matrix<T> A;
   vnl_vector<T> b;
+  RegistrationRows<T> Ar(trans, iscale);
+  bool userows = normaleq && !(rigid && rtype == 2);
 
   if (rigid && rtype == 2)
   {
@@ -193,6 +282,10 @@ std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRe
     }
     A = A * R.transpose();
   }
+  else if (userows)
+  {
+    constructAb(mriS, mriT, NULL, &Ar, b);
+  }
   else
   {
     //std::cout << "Rtype  " << rtype << std::endl;
@@ -202,7 +295,7 @@ std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRe
 
   if (verbose > 1)
     std::cout << "   - checking A and b for nan ..." << std::flush;
-  if (!A.is_finite() || !b.is_finite())
+  if ((!userows && !A.is_finite()) || !b.is_finite())
   {
     std::cerr << " A or b constain NAN or infinity values!!" << std::endl;
     exit(1);
@@ -211,7 +304,7 @@ std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRe
   if (verbose > 1)
     std::cout << "  DONE" << std::endl;
 
-  Regression<T> R(A, b);
+  Regression<T> R = userows ? Regression<T>(Ar, b) : Regression<T>(A, b);
   R.setVerbose(verbose);
   R.setFloatSvd(floatsvd);
   if (costfun == Registration::ROB)
@@ -363,10 +456,14 @@ std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRe
 
 /** Constructs matrix A and vector b for robust regression
    (see Reuter et. al, Neuroimage 2010)
+   If A is NULL only the compact rows Ar are filled (for the normal equations).
+   Both passes run over z slices in parallel, the rows of each slice start at
+   the prefix sum of the counts of the previous slices, so the row order is
+   the same as in a serial run.
  */
 template<class T>
-void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
-    vnl_vector<T>&b)
+void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>* A,
+    RegistrationRows<T> *Ar, vnl_vector<T>&b)
 {
 
   if (verbose > 1)
@@ -396,7 +493,7 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
   }
 
   // Allocate and initialize indexing volume
-  int z, y, x, f;
+  int z;
   long int ss = mriS->width * mriS->height * mriS->depth * mriS->nframes;
   if (mri_indexing)
     MRIfree(&mri_indexing);
@@ -431,10 +528,13 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
   if (verbose > 1)
     std::cout << " done!" << std::endl;
   // initialize with -10
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
   for (z = 0; z < mriS->depth; z++)
-    for (x = 0; x < mriS->width; x++)
-      for (y = 0; y < mriS->height; y++)
-        for (f = 0; f < mriS->nframes; f++)
+    for (int x = 0; x < mriS->width; x++)
+      for (int y = 0; y < mriS->height; y++)
+        for (int f = 0; f < mriS->nframes; f++)
           if (itype == MRI_LONG)
             MRILseq_vox(mri_indexing,x,y,z,f) = -10;
           else
@@ -520,20 +620,27 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
   int fxw = fx->width;
   int fxh = fx->height;
   int fxf = fx->nframes;
-  int fxstart = 0;
-  int xp1, yp1, zp1;
   int ocount = 0, ncount = 0, zcount = 0;
-  float fzval = eps/2.0;
-  int dx, dy, dz;
-  int randpos = 0;
-  for (z = fxstart; z < fxd; z++)
-    for (x = fxstart; x < fxw; x++)
-      for (y = fxstart; y < fxh; y++)
+  // the random offsets advance by 2 (2D) or 3 per voxel, so the position in
+  // the random table can be computed from the voxel index:
+  int randstep = is2d ? 2 : 3;
+  // number of rows in each z slice, turned into the start row of each slice
+  std::vector<long int> zrows(fxd + 1, 0);
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) reduction(+:ocount,ncount,zcount)
+#endif
+  for (z = 0; z < fxd; z++)
+  {
+    int x, y, f, xp1, yp1, zp1, dx, dy, dz, randpos;
+    float fzval = eps/2.0;
+    for (x = 0; x < fxw; x++)
+      for (y = 0; y < fxh; y++)
       {
         // check if position is outside either source or target:
         if (dosubsample)
         {
           // dx,dy and dz need to agree with the subsampling above
+          randpos = (int)(((((long int) z * fxw + x) * fxh + y) * randstep) % 101);
           dx = (int)(2.0*MyMRI::getRand(randpos));
           randpos++;
           dy = (int)(2.0*MyMRI::getRand(randpos));
@@ -586,9 +693,13 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
             zcount++;
             continue;
           }
-          counti++; // found another good voxel
+          zrows[z+1]++; // found another good voxel
          }
        }
+  }
+  for (z = 0; z < fxd; z++)
+    zrows[z+1] += zrows[z];
+  counti = zrows[fxd];
       
   if (verbose > 1 && n > counti)
     std::cout << "  need only: " << counti << std::endl;
@@ -632,11 +743,14 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
     pnum++;
   //cout << " pnum: " << pnum << "  counti: " << counti<<  endl;
   double amu = ((double) counti * (pnum + 1)) * sizeof(T) / (1024.0 * 1024.0); // +1 =  rowpointer vector
+  if (!A)
+    amu = ((double) counti * (3 * sizeof(unsigned int) + 4 * sizeof(float)))
+        / (1024.0 * 1024.0);
   double bmu = (double) counti * sizeof(T) / (1024.0 * 1024.0);
   if (verbose > 1)
     std::cout << "     -- allocating " << amu + bmu << "Mb mem for A and b ... "
         << std::flush;
-  bool OK = A.set_size(counti, pnum);
+  bool OK = A ? A->set_size(counti, pnum) : Ar->setSize(counti);
   OK = OK && b.set_size(counti);
   if (!OK)
   {
@@ -648,7 +762,12 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
     std::cout << " done! " << std::endl;
   double maxmu = 5 * amu + 7 * bmu;
   string fstr = "";
-  if (floatsvd)
+  if (!A)
+  {
+    maxmu = amu + 7 * bmu;
+    fstr = " (normal equations)";
+  }
+  else if (floatsvd)
   {
     maxmu = amu + 3 * bmu + 2 * (amu + bmu);
     fstr = "-float";
@@ -670,19 +789,22 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
 //        std::cin  >> ch;
 
   // Loop and construct A and b
-  long int count = 0;
-  ocount = 0;
-  randpos = 0;
-  fzval = eps/2.0;
-
-  for (z = fxstart; z < fxd; z++)
-    for (x = fxstart; x < fxw; x++)
-      for (y = fxstart; y < fxh; y++)
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (z = 0; z < fxd; z++)
+  {
+    int x, y, f, xp1, yp1, zp1, dx, dy, dz, randpos;
+    float fzval = eps/2.0;
+    long int count = zrows[z];
+    for (x = 0; x < fxw; x++)
+      for (y = 0; y < fxh; y++)
       {
         // check if position is outside either source or target:
         if (dosubsample)
         {
           // dx,dy and dz need to agree with the subsampling above
+          randpos = (int)(((((long int) z * fxw + x) * fxh + y) * randstep) % 101);
           dx = (int)(2.0*MyMRI::getRand(randpos));
           randpos++;
           dy = (int)(2.0*MyMRI::getRand(randpos));
@@ -718,8 +840,6 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
             outval = -5;
           for (f=0;f<fxf;f++)
             MRILseq_vox(mri_indexing, xp1, yp1, zp1,f) = outval;
-          ocount+=fxf;
-          //cout << " " << ocount << flush;
           continue;
         }
         
@@ -745,10 +865,20 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
             continue;
           }
 
-          assert(counti > count);
+          assert(zrows[z+1] > count);
 
           MRILseq_vox(mri_indexing, xp1, yp1, zp1, f) = count;
 
+          // A p = b = IS - IT
+          b[count] = MRIFseq_vox(SmT, x, y, z, f);
+
+          if (!A)
+          {
+            Ar->setRow(count, x, y, z, fxval, fyval, fzval, ftval);
+            count++;
+            continue;
+          }
+
           //cout << "x: " << x << " y: " << y << " z: " << z << " count: "<< count << std::endl;
           //cout << " " << count << " mrifx: " << MRIFvox(mri_fx, x, y, z) << " mrifx int: " << (int)MRIvox(mri_fx,x,y,z) <<endl;
 
@@ -757,7 +887,7 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
           int dof = grad.size();
           for (int pno = 0; pno < dof; pno++)
           {
-            A[count][pno] = grad[pno];
+            (*A)[count][pno] = grad[pno];
           }
 
 //         if (transonly)
@@ -880,18 +1010,14 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
           // intensity model: R(s,IS,IT) = exp(-0.5 s) IT - exp(0.5 s) IS
           //                  R'  = -0.5 ( exp(-0.5 s) IT + exp(0.5 s) IS)
           //   ft = 0.5 ( exp(-0.5s) IT + exp(0.5s) IS)  (average of intensity adjusted images)
-          if (iscale) A[count][dof] = ftval;
-
-          // A p = b = IS - IT
-          b[count] = MRIFseq_vox(SmT, x, y, z, f);
+          if (iscale) (*A)[count][dof] = ftval;
 
           count++;// start with 0 above
 
         }
       }
-        //cout << " ocount : " << ocount << endl;    
-        //cout << " counti: " << counti << " count : " << count<< endl;    
-  assert(counti == count);
+    assert(zrows[z+1] == count);
+  }
 
 //   vnl_matlab_print(vcl_cerr,A,"A",vnl_matlab_print_format_long);std::cerr << std::endl;    
 //   vnl_matlab_print(vcl_cerr,b,"b",vnl_matlab_print_format_long);std::cerr << std::endl;    
@@ -27,6 +27,7 @@
 #include <cassert>
 #include <math.h>
 #include <limits>
+#include <algorithm>
 #include <vector>
 #include <fstream>
 #include "RobustGaussian.h"
@@ -79,7 +80,7 @@ template<class T>
 vnl_vector<T> Regression<T>::getRobustEstW(vnl_vector<T>& w, double sat,
     double sig)
 {
-  if (A)
+  if (A || Arows)
     return getRobustEstWAB(w, sat, sig);
   else
     return vnl_vector<T>(1, getRobustEstWB(w, sat, sig));
@@ -197,7 +198,8 @@ vnl_vector<T> Regression<T>::getRobustEstWAB(vnl_vector<T>& wfinal, double sat,
   if (verbose > 1)
   {
     cout << "  Regression<T>::getRobustEstWAB( "<<sat<<" , "<<sig<<" ) " ;
-    if (floatsvd) cout << "  FLOAT version " ;
+    if (Arows) cout << "  NORMAL EQUATIONS " ;
+    else if (floatsvd) cout << "  FLOAT version " ;
     else cout << "  DOUBLE version " ;
     cout << endl;
   }
@@ -213,8 +215,8 @@ vnl_vector<T> Regression<T>::getRobustEstWAB(vnl_vector<T>& wfinal, double sat,
   err[1] = 1e20;
   double sigma;
 
-  int arows = A->rows(); // large (voxels)
-  int acols = A->cols(); // small (parameters)
+  int arows = Arows ? Arows->rows() : A->rows(); // large (voxels)
+  int acols = Arows ? Arows->cols() : A->cols(); // small (parameters)
 
   //pre-alocate vectors
   // init residuals (based on zero p, so r := b )
@@ -271,13 +273,15 @@ vnl_vector<T> Regression<T>::getRobustEstWAB(vnl_vector<T>& wfinal, double sat,
     r->clear();
 
     // compute weighted least squares
-    if (floatsvd)
+    if (Arows)
+      *p = getWeightedNormalEst(*w);
+    else if (floatsvd)
       *p = getWeightedLSEstFloat(*w);
     else
       *p = getWeightedLSEst(*w);
 
     // compute new residuals
-    *r = *b - (*A * *p);
+    getResiduals(*p, *r);
 
     // and total errors (using new r)
     // err = sum (w r^2) / sum (w)
@@ -433,6 +437,117 @@ vnl_vector<T> Regression<T>::getWeightedLSEstFloat(const vnl_vector<T> & w)
   return pd;
 }
 
+/** Solving \f$ p = [A^T W A]^{-1} A^T W b\f$     (with \f$ W = diag(w_i^2) \f$ )
+ by accumulating the small system \f$ A^T W A \f$ and \f$ A^T W b \f$ directly
+ from the row generator, so A is never stored. Sums are formed in double
+ over fixed blocks of rows and the blocks are added in order, so the result
+ does not depend on the number of threads. The normal equations square the
+ condition number, which is harmless for the few well-scaled registration
+ parameters.
+ \param w vector representing a diagnoal matrix with the sqrt of the weights as elements
+ */
+template<class T>
+vnl_vector<T> Regression<T>::getWeightedNormalEst(const vnl_vector<T> & w)
+{
+  assert(Arows != NULL);
+  assert(w.size() == Arows->rows());
+
+  const int BLOCK = 16384;
+  const int n = Arows->rows();
+  const int m = Arows->cols();
+  const int mm = m * (m + 1);
+  const int nblocks = (n + BLOCK - 1) / BLOCK;
+
+  // per block: upper triangle of AtWA (m x m) followed by AtWb (m)
+  std::vector<double> partial((size_t) nblocks * mm, 0.0);
+
+  int bl;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (bl = 0; bl < nblocks; bl++)
+  {
+    std::vector<T> row(m);
+    double * AtA = &partial[(size_t) bl * mm];
+    double * Atb = AtA + m * m;
+    int rend = std::min(n, (bl + 1) * BLOCK);
+    for (int rr = bl * BLOCK; rr < rend; rr++)
+    {
+      Arows->getRow(rr, &row[0]);
+      double wi = w[rr];
+      wi *= wi;
+      if (wi == 0.0)
+        continue;
+      for (int ii = 0; ii < m; ii++)
+      {
+        double wa = wi * row[ii];
+        for (int jj = ii; jj < m; jj++)
+          AtA[ii * m + jj] += wa * row[jj];
+        Atb[ii] += wa * b->operator[](rr);
+      }
+    }
+  }
+
+  vnl_matrix<double> AtWA(m, m, 0.0);
+  vnl_vector<double> AtWb(m, 0.0);
+  for (bl = 0; bl < nblocks; bl++)
+  {
+    const double * AtA = &partial[(size_t) bl * mm];
+    const double * Atb = AtA + m * m;
+    for (int ii = 0; ii < m; ii++)
+    {
+      for (int jj = ii; jj < m; jj++)
+        AtWA(ii, jj) += AtA[ii * m + jj];
+      AtWb[ii] += Atb[ii];
+    }
+  }
+  for (int ii = 0; ii < m; ii++)
+    for (int jj = 0; jj < ii; jj++)
+      AtWA(ii, jj) = AtWA(jj, ii);
+
+  vnl_qr<double> QR(AtWA);
+  vnl_vector<double> pd = QR.solve(AtWb);
+
+  vnl_vector<T> p(m);
+  for (int ii = 0; ii < m; ii++)
+    p[ii] = (T) pd[ii];
+  return p;
+}
+
+/** Computes the residuals r = b - A p, either from A or from the row generator.
+ */
+template<class T>
+void Regression<T>::getResiduals(const vnl_vector<T>& p, vnl_vector<T>& r)
+{
+  if (!Arows)
+  {
+    r = *b - (*A * p);
+    return;
+  }
+
+  const int n = Arows->rows();
+  const int m = Arows->cols();
+  r.set_size(n);
+#ifdef HAVE_OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<T> row(m);
+    int rr;
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(static)
+#endif
+    for (rr = 0; rr < n; rr++)
+    {
+      Arows->getRow(rr, &row[0]);
+      T ap = 0;
+      for (int ii = 0; ii < m; ii++)
+        ap += row[ii] * p[ii];
+      r[rr] = b->operator[](rr) - ap;
+    }
+  }
+}
+
 // template <class T>
 // vnl_vector< T >  Regression<T>::getWeightedLSEst(const vnl_vector< T > & w)
 // // w is a vector representing a diagnoal matrix with the sqrt of the weights as elements
@@ -531,7 +646,7 @@ vnl_vector<T> Regression<T>::getLSEst()
   //cout << " Regression<T>::getLSEst " << endl;
   lastweight = -1;
   lastzero = -1;
-  if (A == NULL) // LS solution is just the mean of B
+  if (A == NULL && Arows == NULL) // LS solution is just the mean of B
   {
     assert(b!=NULL);
     T d = 0;
@@ -543,6 +658,19 @@ vnl_vector<T> Regression<T>::getLSEst()
     return p;
   }
 
+  if (Arows) // A is not stored, solve the normal equations
+  {
+    vnl_vector<T> w(Arows->rows(), 1.0);
+    vnl_vector<T> p = getWeightedNormalEst(w);
+    vnl_vector<T> R;
+    getResiduals(p, R);
+    double serror = 0;
+    for (unsigned int rr = 0; rr < R.size(); rr++)
+      serror += R[rr] * R[rr];
+    lasterror = serror;
+    return p;
+  }
+
 //    vnl_matrix< float > vnlX( ioA->data, ioA->rows, ioA->cols );
   vnl_svd<T> svdMatrix(*A);
   if (!svdMatrix.valid())
@@ -38,7 +38,27 @@
 #include <vnl/vnl_vector.h>
 #include <vnl/vnl_matrix.h>
 
-/** \class Transform3dTranslate
+/** \class RegressionRows
+ * \brief Interface to a design matrix A that is generated row by row
+ *
+ * Lets Regression solve A p = b through the normal equations without
+ * storing A. getRow is called concurrently from several threads.
+ */
+template<class T>
+class RegressionRows
+{
+public:
+  virtual ~RegressionRows()
+  {}
+  //! Number of rows of A (same as the length of b)
+  virtual unsigned int rows() const =0;
+  //! Number of columns of A (number of parameters)
+  virtual unsigned int cols() const =0;
+  //! Write row i of A into row (length cols())
+  virtual void getRow(unsigned int i, T * row) const =0;
+};
+
+/** \class Regression
  * \brief Templated class for iteratively reweighted least squares
  */
 template<class T>
@@ -48,14 +68,21 @@ public:
 
   //! Constructor initializing A and b
   Regression(vnl_matrix<T> & Ap, vnl_vector<T> & bp) :
-      A(&Ap), b(&bp), lasterror(-1), lastweight(-1), lastzero(-1), verbose(1), floatsvd(false)
+      A(&Ap), Arows(NULL), b(&bp), lasterror(-1), lastweight(-1), lastzero(-1), verbose(1), floatsvd(false)
   {}
 
   //! Constructor initializing b (for simple case where x is single variable and A is (...1...)^T
   Regression(vnl_vector<T> & bp) :
-      A(NULL), b(&bp), lasterror(-1), lastweight(-1), lastzero(-1), verbose(1), floatsvd(false)
+      A(NULL), Arows(NULL), b(&bp), lasterror(-1), lastweight(-1), lastzero(-1), verbose(1), floatsvd(false)
   {}
 
+  //! Constructor with a row generator for A (solves via the normal equations)
+  Regression(const RegressionRows<T> & Ap, vnl_vector<T> & bp) :
+      A(NULL), Arows(&Ap), b(&bp), lasterror(-1), lastweight(-1), lastzero(-1), verbose(1), floatsvd(false)
+  {
+    assert(Ap.rows() == bp.size());
+  }
+
   //! Robust solver
   vnl_vector<T> getRobustEst(double sat = SATr, double sig=1.4826);
   //! Robust solver (returning also the sqrtweights)
@@ -67,6 +94,8 @@ public:
   vnl_vector<T> getWeightedLSEst(const vnl_vector<T> & sqrtweights);
   //! Weighted least squares in float (only for the T=double version)
   vnl_vector<T> getWeightedLSEstFloat(const vnl_vector<T> & sqrtweights);
+  //! Weighted least squares via normal equations (needs the row generator)
+  vnl_vector<T> getWeightedNormalEst(const vnl_vector<T> & sqrtweights);
 
   double getLastError()
   {
@@ -113,8 +142,11 @@ protected:
   void getTukeyBiweight(const vnl_vector<T>& r, vnl_vector<T> &w, double sat = SATr);
   double getTukeyPartialSat(const vnl_vector<T>& r, double sat = SATr);
 
+  void getResiduals(const vnl_vector<T>& p, vnl_vector<T>& r);
+
 private:
   vnl_matrix<T> * A;
+  const RegressionRows<T> * Arows;
   vnl_vector<T> * b;
   double lasterror, lastweight, lastzero;
   int verbose;
@@ -127,6 +127,7 @@ struct Parameters
   bool whitebgmov;
   bool whitebgdst;
   bool uchartype;
+  bool normaleq;
 };
 static struct Parameters P =
 { "", "", "", "", "", "", "", "", "", "", "", false, false, false, false, false, false,
@@ -134,7 +135,7 @@ static struct Parameters P =
     NULL, NULL, false, false, true, false, 1, -1, false, 0.16, true, true, "",
     "", -1, -1, Registration::ROB,
 //  256,
-    SAMPLE_CUBIC_BSPLINE, false, ERADIUS, "", "", false, false, 1e-5, false, false,false};
+    SAMPLE_CUBIC_BSPLINE, false, ERADIUS, "", "", false, false, 1e-5, false, false,false, false};
 
 static void printUsage(void);
 static bool parseCommandLine(int argc, char *argv[], Parameters & P);
@@ -1453,6 +1454,7 @@ static void initRegistration(Registration & R, Parameters & P)
   {
     dynamic_cast<RegRobust*>(&R)->setSaturation(P.sat);
     dynamic_cast<RegRobust*>(&R)->setWLimit(P.wlimit);
+    dynamic_cast<RegRobust*>(&R)->setNormalEquations(P.normaleq);
   }
   if (R.getClassName() == "RegPowell")
   {
@@ -2074,6 +2076,14 @@ static int parseNextCommand(int argc, char *argv[], Parameters & P)
         << "--doubleprec: Will perform algorithm with double precision (higher mem usage)!"
         << endl;
   }
+  else if (!strcmp(option, "NORMALEQ"))
+  {
+    P.normaleq = true;
+    nargs = 0;
+    cout
+        << "--normaleq: Will solve normal equations without storing the full system (lower mem usage)!"
+        << endl;
+  }
   else if (!strcmp(option, "DEBUG"))
   {
     P.debug = 1;
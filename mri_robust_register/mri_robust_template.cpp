@@ -118,6 +118,7 @@ struct Parameters
   bool crascenter;
   int pairiterate;
   double pairepsit;
+  bool normaleq;
 };
 
 // Initializations:
@@ -125,7 +126,7 @@ static struct Parameters P =
 { vector<string>(0), vector<string>(0), "", vector<string>(0), vector<string>(0), vector<string>(
     0), vector<string>(0), false, false, false, false, false, false, false, false, false,
     5, -1.0, SAT, vector<string>(0), 0, 1, -1, false, false, SSAMPLE, false, false, "", false,
-    true, vector<string>(0), vector<string>(0), SAMPLE_CUBIC_BSPLINE, -1, 0 , false, 5, 0.01};
+    true, vector<string>(0), vector<string>(0), SAMPLE_CUBIC_BSPLINE, -1, 0 , false, 5, 0.01, false};
 
 static void printUsage(void);
 static bool parseCommandLine(int argc, char *argv[], Parameters & P);
@@ -214,6 +215,7 @@ int main(int argc, char *argv[])
     MR.setKeepType(!P.floattype);
     MR.setAverage(P.average);
     MR.setDoublePrec(P.doubleprec);
+    MR.setNormalEquations(P.normaleq);
     MR.setSubsamplesize(P.subsamplesize);
     MR.setHighit(P.highit);
     if (P.nweights.size() > 0)
@@ -671,6 +673,14 @@ static int parseNextCommand(int argc, char *argv[], Parameters & P)
         << "--doubleprec: Will perform algorithm with double precision (higher mem usage)!"
         << endl;
   }
+  else if (!strcmp(option, "NORMALEQ"))
+  {
+    P.normaleq = true;
+    nargs = 0;
+    cout
+        << "--normaleq: Will solve normal equations without storing the full system (lower mem usage)!"
+        << endl;
+  }
   else if (!strcmp(option, "WEIGHTS"))
   {
     nargs = 0;
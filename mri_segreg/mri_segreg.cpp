@@ -99,6 +99,15 @@
   --1dmin : use brute force 1D minimizations instead of powell
   --n1dmin n1dmin : number of 1d minimization (default = 3)
 
+  --lbfgs : use L-BFGS with the analytic cost gradient instead of powell
+  --lbfgs-tol tol : L-BFGS gradient tolerance (def 1e-4)
+  --lbfgs-nmax nmax : max number of L-BFGS cost evaluations (def 500)
+  --benchmark-lbfgs : check the gradient against central differences,
+     run powell and L-BFGS from the same init, then exit (with status 1
+     if the gradient check fails)
+  --benchmark-lbfgs-gradtol tol : relative tolerance of the gradient
+     check (def 0.05)
+
   --mincost MinCostFile
   --param   ParamFile
   --rms     RMSDiffFile : saves Tx Ty Tz Ax Ay Az RMSDiff MinCost 
@@ -173,6 +182,9 @@
 #include "annotation.h"
 #include "transform.h"
 #include "label.h"
+#include "romp_support.h"
+#include "fs_vnl/fs_lbfgs.h"
+#include <vnl/vnl_cost_function.h>
 
 #ifdef X
 #undef X
@@ -187,6 +199,11 @@ int MinPowell(MRI *mov, MRI *notused, MATRIX *R, double *params,
 	      char *costfile, double *costs, int *niters);
 float compute_powell_cost(float *p) ;
 double RelativeSurfCost(MRI *mov, MATRIX *R0);
+double GetSurfCostsGrad(MRI *mov, MATRIX *R0, double *p, int dof,
+			double *grad, int *nhits);
+int MinLBFGS(MRI *mov, MATRIX *R, double *params, int dof, double gtol,
+	     int nmaxevals, double *costs, int *niters);
+int BenchmarkLBFGS(MRI *mov, MATRIX *R, double *params, int dof, double gradtol);
 
 char *costfile_powell = NULL;
 
@@ -206,6 +223,7 @@ static int  singledash(char *flag);
 static int istringnmatch(const char *str1, const char *str2, int n);
 double VertexCost(double vctx, double vwm, double slope, 
 		  double center, double sign, double *pct);
+double VertexCostDeriv(double d, double slope, double center, double sign);
 
 
 int main(int argc, char *argv[]) ;
@@ -256,6 +274,12 @@ int nMaxItersPowell = 36;
 double TolPowell = 1e-8;
 double LinMinTolPowell = 1e-8;
 
+int UseLBFGS = 0;
+double TolLBFGS = 1e-4;
+int nMaxEvalsLBFGS = 500;
+int DoBenchmarkLBFGS = 0;
+double GradTolLBFGS = 0.05;
+
 #define NMAX 100
 int ntx=0, nty=0, ntz=0, nax=0, nay=0, naz=0;
 double txlist[NMAX],tylist[NMAX],tzlist[NMAX];
@@ -737,10 +761,22 @@ int main(int argc, char **argv) {
     nsubsamp = nsubsampsave;
   }
 
+  if(DoBenchmarkLBFGS){
+    err = BenchmarkLBFGS(mov, R, p, dof, GradTolLBFGS);
+    printf("mri_segreg done\n");
+    exit(err == NO_ERROR ? 0 : 1);
+  }
+
   mytimer.reset() ;
-  printf("Starting Powell Minimization\n");
-  MinPowell(mov, NULL, R, p, dof, TolPowell, LinMinTolPowell,
-	    nMaxItersPowell,SegRegCostFile, costs, &nth);
+  if(UseLBFGS){
+    printf("Starting L-BFGS Minimization\n");
+    MinLBFGS(mov, R, p, dof, TolLBFGS, nMaxEvalsLBFGS, costs, &nth);
+  }
+  else {
+    printf("Starting Powell Minimization\n");
+    MinPowell(mov, NULL, R, p, dof, TolPowell, LinMinTolPowell,
+	      nMaxItersPowell,SegRegCostFile, costs, &nth);
+  }
   secCostTime = mytimer.seconds() ;
 
   // Compute relative final cost 
@@ -1213,6 +1249,26 @@ static int parse_commandline(int argc, char **argv) {
       sscanf(pargv[0],"%lf",&LinMinTolPowell);
       nargsused = 1;
     }
+    else if (!strcasecmp(option, "--lbfgs")) UseLBFGS = 1;
+    else if (!strcasecmp(option, "--benchmark-lbfgs")) DoBenchmarkLBFGS = 1;
+    else if (istringnmatch(option, "--benchmark-lbfgs-gradtol",0)) {
+      if (nargc < 1) argnerr(option,1);
+      sscanf(pargv[0],"%lf",&GradTolLBFGS);
+      DoBenchmarkLBFGS = 1;
+      nargsused = 1;
+    }
+    else if (istringnmatch(option, "--lbfgs-tol",0)) {
+      if (nargc < 1) argnerr(option,1);
+      sscanf(pargv[0],"%lf",&TolLBFGS);
+      UseLBFGS = 1;
+      nargsused = 1;
+    }
+    else if (istringnmatch(option, "--lbfgs-nmax",0)) {
+      if (nargc < 1) argnerr(option,1);
+      sscanf(pargv[0],"%d",&nMaxEvalsLBFGS);
+      UseLBFGS = 1;
+      nargsused = 1;
+    }
     else if (istringnmatch(option, "--o",0)) {
       if (nargc < 1) argnerr(option,1);
       outfile = pargv[0];
@@ -1626,6 +1682,15 @@ printf("\n");
 printf("  --1dmin : use brute force 1D minimizations instead of powell\n");
 printf("  --n1dmin n1dmin : number of 1d minimization (default = 3)\n");
 printf("\n");
+printf("  --lbfgs : use L-BFGS with the analytic cost gradient instead of powell\n");
+printf("       (trilinear interpolation only, no --vsm)\n");
+printf("  --lbfgs-tol tol : L-BFGS gradient tolerance (def %g)\n",TolLBFGS);
+printf("  --lbfgs-nmax nmax : max number of L-BFGS cost evaluations (def %d)\n",nMaxEvalsLBFGS);
+printf("  --benchmark-lbfgs : check the gradient against finite differences, run\n");
+printf("       powell and L-BFGS from the same init and report evaluations, time\n");
+printf("       and final cost of each, then exit (with status 1 if the gradient check fails)\n");
+printf("  --benchmark-lbfgs-gradtol tol : relative tolerance of the gradient check (def %g)\n",GradTolLBFGS);
+printf("\n");
 printf("  --mincost MinCostFile\n");
 printf("  --initcost InitCostFile\n");
 printf("  --param   ParamFile\n");
@@ -1678,6 +1743,11 @@ static void check_options(void)
     printf("       legal values are nearest, trilin, and sinc\n");
     exit(1);
   }
+  if((UseLBFGS || DoBenchmarkLBFGS) && (interpcode != SAMPLE_TRILINEAR || vsmfile)){
+    printf("ERROR: the analytic cost gradient needs trilinear interpolation\n");
+    printf("       and cannot be used with --vsm, so do not use --lbfgs\n");
+    exit(1);
+  }
 
   if(sumfile == NULL) {
     sprintf(tmpstr,"%s.sum",outregfile);
@@ -1729,6 +1799,10 @@ static void dump_options(FILE *fp)
   fprintf(fp,"frame  %d\n",frame);
   fprintf(fp,"TolPowell %lf\n",TolPowell);
   fprintf(fp,"nMaxItersPowell %d\n",nMaxItersPowell);
+  if(UseLBFGS){
+    fprintf(fp,"TolLBFGS %lf\n",TolLBFGS);
+    fprintf(fp,"nMaxEvalsLBFGS %d\n",nMaxEvalsLBFGS);
+  }
   fprintf(fp,"n1dmin  %d\n",n1dmin);
   if(interpcode == SAMPLE_SINC) fprintf(fp,"sinc hw  %d\n",sinchw);
   fprintf(fp,"Profile   %d\n",DoProfile);
@@ -2100,6 +2174,27 @@ double VertexCost(double vctx, double vwm, double slope,
   return(c);
 }
 
+/*------------------------------------------------------
+  VertexCostDeriv() - derivative of VertexCost() with respect
+  to the percent contrast d (same args as VertexCost())
+  --------------------------------------------------------*/
+double VertexCostDeriv(double d, double slope, double center, double sign)
+{
+  double a=0,dadd=0,t;
+  if(sign ==  0){
+    a = -fabs(slope*(d-center));
+    if(slope*(d-center) >= 0) dadd = -slope;
+    else                      dadd = +slope;
+  }
+  if(sign == -1) {a = -(slope*(d-center)); dadd = -slope;}
+  if(sign == +1) {a = +(slope*(d-center)); dadd = +slope;}
+  if(sign == -2){
+    if(d >= 0) {a = -(slope*(d-center)); dadd = -slope;}
+  }
+  t = tanh(a);
+  return((1-t*t)*dadd);
+}
+
 /*-------------------------------------------------------*/
 double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
 		     double *p, int dof, double *costs)
@@ -2388,3 +2483,597 @@ double RelativeSurfCost(MRI *mov, MATRIX *R0)
   MatrixFree(&R);
   return(rcost);
 }
+
+/*---------------------------------------------------------------
+  SegRegRotMatDeriv() - derivative of MRIangles2RotMat(angles)
+  with respect to angles[nth] (radians). The result is 4x4 with
+  a zero last row and column.
+  ---------------------------------------------------------------*/
+static MATRIX *SegRegRotMatDeriv(double *angles, int nth)
+{
+  double gamma, beta, alpha;
+  MATRIX *R, *R3, *Rx, *Ry, *Rz;
+  int r, c;
+
+  gamma = angles[0];
+  beta  = angles[1];
+  alpha = angles[2];
+
+  Rx = MatrixZero(3,3,NULL);
+  if(nth == 0){
+    Rx->rptr[2][2] = -sin(gamma);
+    Rx->rptr[2][3] = -cos(gamma);
+    Rx->rptr[3][2] = +cos(gamma);
+    Rx->rptr[3][3] = -sin(gamma);
+  }
+  else {
+    Rx->rptr[1][1] = +1;
+    Rx->rptr[2][2] = +cos(gamma);
+    Rx->rptr[2][3] = -sin(gamma);
+    Rx->rptr[3][2] = +sin(gamma);
+    Rx->rptr[3][3] = +cos(gamma);
+  }
+
+  Ry = MatrixZero(3,3,NULL);
+  if(nth == 1){
+    Ry->rptr[1][1] = -sin(beta);
+    Ry->rptr[1][3] = +cos(beta);
+    Ry->rptr[3][1] = -cos(beta);
+    Ry->rptr[3][3] = -sin(beta);
+  }
+  else {
+    Ry->rptr[1][1] = +cos(beta);
+    Ry->rptr[1][3] = +sin(beta);
+    Ry->rptr[2][2] = 1;
+    Ry->rptr[3][1] = -sin(beta);
+    Ry->rptr[3][3] = +cos(beta);
+  }
+
+  Rz = MatrixZero(3,3,NULL);
+  if(nth == 2){
+    Rz->rptr[1][1] = -sin(alpha);
+    Rz->rptr[1][2] = -cos(alpha);
+    Rz->rptr[2][1] = +cos(alpha);
+    Rz->rptr[2][2] = -sin(alpha);
+  }
+  else {
+    Rz->rptr[1][1] = +cos(alpha);
+    Rz->rptr[1][2] = -sin(alpha);
+    Rz->rptr[2][1] = +sin(alpha);
+    Rz->rptr[2][2] = +cos(alpha);
+    Rz->rptr[3][3] = +1;
+  }
+
+  // Same order as MRIangles2RotMat(): R3 = Rz*Ry*Rx
+  R3 = MatrixMultiply(Rz,Ry,NULL);
+  R3 = MatrixMultiply(R3,Rx,R3);
+
+  R = MatrixZero(4,4,NULL);
+  for(r=1; r <= 3; r++)
+    for(c=1; c <= 3; c++) R->rptr[r][c] = R3->rptr[r][c];
+
+  MatrixFree(&Rx);
+  MatrixFree(&Ry);
+  MatrixFree(&Rz);
+  MatrixFree(&R3);
+  return(R);
+}
+
+/*---------------------------------------------------------------
+  SegRegParamMatrices() - computes A = Mshear*Mscale*Mtrans*Mrot
+  from the params the same way as GetSurfCosts() (so R = A*R0)
+  and returns it. If dA is not NULL, dA[n] is set to the derivative
+  of A with respect to p[n] for each of the dof params (trans in mm,
+  rot in deg, scale, shear). The caller frees A and dA[n].
+  ---------------------------------------------------------------*/
+static MATRIX *SegRegParamMatrices(double *p, int dof, MATRIX **dA)
+{
+  MATRIX *F[4], *dF, *A;
+  double angles[3];
+  int n, k;
+
+  // F = {Mshear, Mscale, Mtrans, Mrot}
+  F[0] = MatrixIdentity(4,NULL);
+  if(dof > 9){
+    F[0]->rptr[1][2] = p[9];
+    F[0]->rptr[1][3] = p[10];
+    F[0]->rptr[2][3] = p[11];
+  }
+  F[1] = MatrixIdentity(4,NULL);
+  if(dof > 6){
+    F[1]->rptr[1][1] = p[6];
+    F[1]->rptr[2][2] = p[7];
+    F[1]->rptr[3][3] = p[8];
+  }
+  F[2] = MatrixIdentity(4,NULL);
+  if(dof > 0){
+    F[2]->rptr[1][4] = p[0];
+    F[2]->rptr[2][4] = p[1];
+    F[2]->rptr[3][4] = p[2];
+  }
+  angles[0] = angles[1] = angles[2] = 0;
+  if(dof > 3){
+    angles[0] = p[3]*(M_PI/180);
+    angles[1] = p[4]*(M_PI/180);
+    angles[2] = p[5]*(M_PI/180);
+    F[3] = MRIangles2RotMat(angles);
+  } else F[3] = MatrixIdentity(4,NULL);
+
+  A = MatrixMultiply(F[0],F[1],NULL);
+  A = MatrixMultiply(A,F[2],A);
+  A = MatrixMultiply(A,F[3],A);
+
+  if(dA != NULL){
+    for(n=0; n < dof; n++){
+      // Replace the factor that holds p[n] by its derivative
+      if(n < 3){
+	k = 2;
+	dF = MatrixZero(4,4,NULL);
+	dF->rptr[n+1][4] = 1;
+      }
+      else if(n < 6){
+	k = 3;
+	dF = SegRegRotMatDeriv(angles, n-3);
+	MatrixScalarMul(dF, M_PI/180, dF);
+      }
+      else if(n < 9){
+	k = 1;
+	dF = MatrixZero(4,4,NULL);
+	dF->rptr[n-5][n-5] = 1;
+      }
+      else {
+	k = 0;
+	dF = MatrixZero(4,4,NULL);
+	if(n ==  9) dF->rptr[1][2] = 1;
+	if(n == 10) dF->rptr[1][3] = 1;
+	if(n == 11) dF->rptr[2][3] = 1;
+      }
+      dA[n] = MatrixMultiply(k == 0 ? dF : F[0], k == 1 ? dF : F[1], NULL);
+      dA[n] = MatrixMultiply(dA[n], k == 2 ? dF : F[2], dA[n]);
+      dA[n] = MatrixMultiply(dA[n], k == 3 ? dF : F[3], dA[n]);
+      MatrixFree(&dF);
+    }
+  }
+
+  for(k=0; k < 4; k++) MatrixFree(&F[k]);
+  return(A);
+}
+
+/*---------------------------------------------------------------
+  SegRegSampleGrad() - trilinear sample of the first frame at
+  col/row/slice crs with the same clamping as MRIsampleSeqVolume(),
+  plus the gradient of the sample wrt crs. Returns 0 (no sample)
+  if the nearest voxel is out of the volume, as in MRIvol2surfVSM().
+  ---------------------------------------------------------------*/
+static int SegRegSampleGrad(const MRI *mri, const double *crs,
+			    double *val, double *grad)
+{
+  double x, y, z, xmd, ymd, zmd, xpd, ypd, zpd, gx=1, gy=1, gz=1;
+  double v000, v001, v010, v011, v100, v101, v110, v111;
+  int xm, xp, ym, yp, zm, zp;
+
+  x = crs[0];
+  y = crs[1];
+  z = crs[2];
+  if(nint(x) < 0 || nint(x) >= mri->width ||
+     nint(y) < 0 || nint(y) >= mri->height ||
+     nint(z) < 0 || nint(z) >= mri->depth) return(0);
+
+  // The sample does not change where it is clamped
+  if(x < 0.0) {x = 0.0; gx = 0;}
+  if(y < 0.0) {y = 0.0; gy = 0;}
+  if(z < 0.0) {z = 0.0; gz = 0;}
+  if(x > mri->width-1)  {x = mri->width-1;  gx = 0;}
+  if(y > mri->height-1) {y = mri->height-1; gy = 0;}
+  if(z > mri->depth-1)  {z = mri->depth-1;  gz = 0;}
+
+  xm = (int)x;
+  xp = MIN(mri->width-1,  xm+1);
+  ym = (int)y;
+  yp = MIN(mri->height-1, ym+1);
+  zm = (int)z;
+  zp = MIN(mri->depth-1,  zm+1);
+
+  xmd = x - xm;
+  ymd = y - ym;
+  zmd = z - zm;
+  xpd = 1.0 - xmd;
+  ypd = 1.0 - ymd;
+  zpd = 1.0 - zmd;
+
+  v000 = MRIgetVoxVal(mri,xm,ym,zm,0);
+  v001 = MRIgetVoxVal(mri,xm,ym,zp,0);
+  v010 = MRIgetVoxVal(mri,xm,yp,zm,0);
+  v011 = MRIgetVoxVal(mri,xm,yp,zp,0);
+  v100 = MRIgetVoxVal(mri,xp,ym,zm,0);
+  v101 = MRIgetVoxVal(mri,xp,ym,zp,0);
+  v110 = MRIgetVoxVal(mri,xp,yp,zm,0);
+  v111 = MRIgetVoxVal(mri,xp,yp,zp,0);
+
+  *val = xpd*ypd*zpd*v000 + xpd*ypd*zmd*v001 + xpd*ymd*zpd*v010 + xpd*ymd*zmd*v011 +
+         xmd*ypd*zpd*v100 + xmd*ypd*zmd*v101 + xmd*ymd*zpd*v110 + xmd*ymd*zmd*v111;
+  grad[0] = gx*(ypd*zpd*(v100-v000) + ypd*zmd*(v101-v001) +
+		ymd*zpd*(v110-v010) + ymd*zmd*(v111-v011));
+  grad[1] = gy*(xpd*zpd*(v010-v000) + xpd*zmd*(v011-v001) +
+		xmd*zpd*(v110-v100) + xmd*zmd*(v111-v101));
+  grad[2] = gz*(xpd*ypd*(v001-v000) + xpd*ymd*(v011-v010) +
+		xmd*ypd*(v101-v100) + xmd*ymd*(v111-v110));
+  return(1);
+}
+
+/*---------------------------------------------------------------
+  SegRegHemiCostGrad() - vertex sweep over one hemisphere for
+  GetSurfCostsGrad(). M maps surface xyz to mov crs and dM[k] is
+  its derivative wrt param k. Skips the same vertices as
+  GetSurfCosts() and adds the vertex costs to csum, their gradient
+  to gsum and the number of vertices used to nhits. The vertices
+  are split over threads; the gradient is summed per thread and
+  then over threads in order.
+  ---------------------------------------------------------------*/
+static void SegRegHemiCostGrad(MRI *mov, MRIS *wm, MRIS *ctx,
+			       MRI *CortexLabel, MRI *segmask, MRI *label,
+			       MRI *TargCon, double M[3][4], double dM[12][3][4],
+			       int dof, double *csum, double *gsum, int *nhits)
+{
+  static double gthread[_MAX_FS_THREADS][12];
+  double hcsum = 0;
+  int hnhits = 0, nsamp, t, k;
+
+  memset(gthread,0,sizeof(gthread));
+  nsamp = (wm->nvertices + nsubsamp - 1)/nsubsamp;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+ : hcsum, hnhits)
+#endif
+  for(int i = 0; i < nsamp; i++){
+    ROMP_PFLB_begin
+    double xyz[2][3], crs[2][3], vals[2], grads[2][3], d, c, dcdd, dddv[2], dv;
+    int n, h, k, r;
+#ifdef HAVE_OPENMP
+    int const tid = omp_get_thread_num();
+#else
+    int const tid = 0;
+#endif
+
+    n = i*nsubsamp;
+    if(wm->vertices[n].ripflag != 0) ROMP_PFLB_continue;
+    if(CortexLabel && MRIgetVoxVal(CortexLabel,n,0,0,0) < 0.5) ROMP_PFLB_continue;
+    if(segmask && MRIgetVoxVal(segmask,n,0,0,0) < 0.5) ROMP_PFLB_continue;
+    if(label && MRIgetVoxVal(label,n,0,0,0) < 0.5) ROMP_PFLB_continue;
+
+    // h=0 is the wm point, h=1 the ctx point
+    xyz[0][0] = wm->vertices[n].x;
+    xyz[0][1] = wm->vertices[n].y;
+    xyz[0][2] = wm->vertices[n].z;
+    xyz[1][0] = ctx->vertices[n].x;
+    xyz[1][1] = ctx->vertices[n].y;
+    xyz[1][2] = ctx->vertices[n].z;
+    for(h=0; h < 2; h++){
+      for(r=0; r < 3; r++)
+	crs[h][r] = M[r][0]*xyz[h][0] + M[r][1]*xyz[h][1] + M[r][2]*xyz[h][2] + M[r][3];
+      if(! SegRegSampleGrad(mov, crs[h], &vals[h], grads[h])) vals[h] = 0;
+    }
+    if(vals[0] == 0.0 || vals[1] == 0.0) ROMP_PFLB_continue;
+
+    c = VertexCost(vals[1], vals[0], PenaltySlope, PenaltyCenter, PenaltySign, &d);
+    if(TargCon){
+      dv = MRIgetVoxVal(TargCon,n,0,0,0);
+      c = (d-dv)*(d-dv);
+      dcdd = 2*(d-dv);
+    }
+    else dcdd = VertexCostDeriv(d, PenaltySlope, PenaltyCenter, PenaltySign);
+    // d = 200*(vctx-vwm)/(vctx+vwm)
+    dddv[0] = -400*vals[1]/((vals[0]+vals[1])*(vals[0]+vals[1]));
+    dddv[1] = +400*vals[0]/((vals[0]+vals[1])*(vals[0]+vals[1]));
+
+    hnhits++;
+    hcsum += c;
+    for(k=0; k < dof; k++){
+      for(h=0; h < 2; h++){
+	// derivative of the sample = image gradient . dcrs/dp
+	dv = 0;
+	for(r=0; r < 3; r++)
+	  dv += grads[h][r]*(dM[k][r][0]*xyz[h][0] + dM[k][r][1]*xyz[h][1] +
+			     dM[k][r][2]*xyz[h][2] + dM[k][r][3]);
+	gthread[tid][k] += dcdd*dddv[h]*dv;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for(t=0; t < _MAX_FS_THREADS; t++)
+    for(k=0; k < dof; k++) gsum[k] += gthread[t][k];
+  *csum += hcsum;
+  *nhits += hnhits;
+}
+
+/*---------------------------------------------------------------
+  GetSurfCostsGrad() - the BBR cost (costs[7] of GetSurfCosts())
+  and its analytic gradient wrt the dof params, both from a single
+  parallel vertex sweep. The mov is sampled trilinearly without a
+  vsm. The gradient holds the set of surface hits fixed. Returns
+  the cost; nhits may be NULL.
+  ---------------------------------------------------------------*/
+double GetSurfCostsGrad(MRI *mov, MATRIX *R0, double *p, int dof,
+			double *grad, int *nhits)
+{
+  extern int UseMask, UseLH, UseRH;
+  extern MRI *lhsegmask, *rhsegmask;
+  extern MRI *lhCortexLabel, *rhCortexLabel;
+  extern MRIS *lhwm, *rhwm, *lhctx, *rhctx;
+  MATRIX *vox2ras, *ras2vox, *A, *dA[12], *M;
+  double m[3][4], dm[12][3][4], gsum[12], csum;
+  int hits, k, r, c;
+
+  vox2ras = MRIxfmCRS2XYZtkreg(mov);
+  ras2vox = MatrixInverse(vox2ras,NULL);
+  MatrixFree(&vox2ras);
+
+  // M = ras2vox*A*R0 maps surface xyz to mov crs, dM[k] = ras2vox*dA[k]*R0
+  A = SegRegParamMatrices(p, dof, dA);
+  M = MatrixMultiply(ras2vox,A,NULL);
+  M = MatrixMultiply(M,R0,M);
+  for(r=0; r < 3; r++)
+    for(c=0; c < 4; c++) m[r][c] = M->rptr[r+1][c+1];
+  for(k=0; k < dof; k++){
+    M = MatrixMultiply(ras2vox,dA[k],M);
+    M = MatrixMultiply(M,R0,M);
+    for(r=0; r < 3; r++)
+      for(c=0; c < 4; c++) dm[k][r][c] = M->rptr[r+1][c+1];
+    MatrixFree(&dA[k]);
+  }
+  MatrixFree(&A);
+  MatrixFree(&M);
+  MatrixFree(&ras2vox);
+
+  for(k=0; k < 12; k++) gsum[k] = 0;
+  csum = 0;
+  hits = 0;
+  if(UseLH)
+    SegRegHemiCostGrad(mov, lhwm, lhctx, lhCortexLabel, UseMask ? lhsegmask : NULL,
+		       UseLabel ? lhlabel : NULL, TargConLH, m, dm, dof,
+		       &csum, gsum, &hits);
+  if(UseRH)
+    SegRegHemiCostGrad(mov, rhwm, rhctx, rhCortexLabel, UseMask ? rhsegmask : NULL,
+		       UseLabel ? rhlabel : NULL, TargConRH, m, dm, dof,
+		       &csum, gsum, &hits);
+
+  if(nhits) *nhits = hits;
+  if(hits == 0){
+    for(k=0; k < dof; k++) grad[k] = 0;
+    return(10.0);
+  }
+  for(k=0; k < dof; k++) grad[k] = gsum[k]/hits;
+  return(csum/hits);
+}
+
+/*---------------------------------------------------------------
+  SegRegLBFGSCost - cost function for the L-BFGS path. The cost
+  and its gradient come out of the same vertex sweep, so compute()
+  is overridden rather than f() and gradf(). Evaluations are
+  logged like in compute_powell_cost(). The params with the lowest
+  cost evaluated so far are kept in xopt, so the caller does not
+  depend on what the minimizer returns when it stops early.
+  ---------------------------------------------------------------*/
+class SegRegLBFGSCost : public vnl_cost_function
+{
+public:
+  SegRegLBFGSCost(int nparams) : vnl_cost_function(nparams), copt(-1) {}
+  bool has_best() const { return(copt >= 0); }
+  vnl_vector<double> const &best_params() const { return(xopt); }
+  double f(vnl_vector<double> const &x) {
+    double fx;
+    compute(x, &fx, NULL);
+    return(fx);
+  }
+  void gradf(vnl_vector<double> const &x, vnl_vector<double> &g) {
+    double fx;
+    compute(x, &fx, &g);
+  }
+  void compute(vnl_vector<double> const &x, double *fx, vnl_vector<double> *g);
+private:
+  double copt;
+  vnl_vector<double> xopt;
+};
+
+void SegRegLBFGSCost::compute(vnl_vector<double> const &x, double *fx,
+			      vnl_vector<double> *g)
+{
+  double pp[12], grad[12];
+  int n, nhits, newopt;
+  MATRIX *A, *R;
+  FILE *fp;
+
+  for(n=0; n < dof; n++) pp[n] = x[n];
+  *fx = GetSurfCostsGrad(mov, R0, pp, dof, grad, &nhits);
+  if(g != NULL)
+    for(n=0; n < dof; n++) (*g)[n] = grad[n];
+
+  newopt = 0;
+  if(copt < 0 || copt > *fx){
+    copt = *fx;
+    xopt = x;
+    newopt = 1;
+  }
+
+  if(costfile_powell != NULL){
+    // write costs to file
+    if(nCostEvaluations == 0) fp = fopen(costfile_powell,"w");
+    else                      fp = fopen(costfile_powell,"a");
+    fprintf(fp,"%4d ",nCostEvaluations);
+    fprintf(fp,"%6.3lf %6.3lf %6.3lf ",pp[0],pp[1],pp[2]);
+    fprintf(fp,"%6.3lf %6.3lf %6.3lf ",pp[3],pp[4],pp[5]);
+    if(dof > 6) fprintf(fp,"sc: %4.3lf %4.3lf %4.3lf ",pp[6],pp[7],pp[8]);
+    if(dof > 9) fprintf(fp,"sh: %6.3lf %6.3lf %6.3lf ",pp[9],pp[10],pp[11]);
+    fprintf(fp,"  %8.5lf %8.5lf %7d\n",*fx,copt,nhits);
+    fclose(fp);
+  }
+
+  if(newopt){
+    // If there is a new optimum, print it out
+    fp = stdout;
+    fprintf(fp,"%4d ",nCostEvaluations);
+    fprintf(fp,"%6.3lf %6.3lf %6.3lf ",pp[0],pp[1],pp[2]);
+    fprintf(fp,"%6.3lf %6.3lf %6.3lf ",pp[3],pp[4],pp[5]);
+    if(dof > 6) fprintf(fp,"sc: %4.3lf %4.3lf %4.3lf ",pp[6],pp[7],pp[8]);
+    if(dof > 9) fprintf(fp,"sh: %6.3lf %6.3lf %6.3lf ",pp[9],pp[10],pp[11]);
+    fprintf(fp,"  %12.10lf\n",*fx);
+    fflush(stdout);
+    if(curregfile){
+      A = SegRegParamMatrices(pp, dof, NULL);
+      R = MatrixMultiply(A,R0,NULL);
+      regio_write_register(curregfile,subject,mov->xsize,
+			   mov->zsize,intensity,R,FLT2INT_ROUND);
+      MatrixFree(&A);
+      MatrixFree(&R);
+    }
+  }
+
+  nCostEvaluations++;
+}
+
+/*---------------------------------------------------------------
+  MinLBFGS() - like MinPowell() but minimizes with L-BFGS using
+  the analytic gradient from GetSurfCostsGrad(). gtol is the
+  gradient tolerance and nmaxevals the max number of cost
+  evaluations.
+  ---------------------------------------------------------------*/
+int MinLBFGS(MRI *mov, MATRIX *R, double *params, int dof, double gtol,
+	     int nmaxevals, double *costs, int *niters)
+{
+  MATRIX *R0;
+  SegRegLBFGSCost costfunction(dof);
+  fs_lbfgs minimizer(costfunction);
+  vnl_vector<double> x(dof), x0(dof);
+  bool ok;
+  int n;
+
+  printf("Init L-BFGS Params dof = %d\n",dof);
+  for(n=0; n < dof; n++) {
+    x[n] = params[n];
+    x0[n] = params[n];
+    printf("%d %g\n",n,params[n]);
+  }
+
+  R0 = MatrixCopy(R,NULL);
+
+  minimizer.memory = 7;
+  minimizer.line_search_accuracy = 0.1;
+  minimizer.set_g_tolerance(gtol);
+  minimizer.set_max_function_evals(nmaxevals);
+  ok = minimizer.minimize(x);
+  // Use the lowest cost evaluated rather than what the minimizer
+  // returns, which may be a failed line search point. The first
+  // evaluation is at x0, so x0 is kept unless something beat it.
+  if(costfunction.has_best()) x = costfunction.best_params();
+  else                        x = x0;
+  if(!ok) printf("L-BFGS stopped early (%d), using the best params found\n",
+		 minimizer.get_failure_code());
+  *niters = minimizer.get_num_iterations();
+  printf("L-BFGS done niters = %d\n",*niters);
+
+  for(n=0; n < dof; n++) params[n] = x[n];
+  GetSurfCosts(mov, NULL, R0, R, params, dof, costs);
+
+  MatrixFree(&R0);
+  return(NO_ERROR) ;
+}
+
+/*---------------------------------------------------------------
+  BenchmarkLBFGS() - checks the analytic gradient against central
+  differences at the init params, then runs MinPowell() and
+  MinLBFGS() from the init params and reports the number of cost
+  evaluations, the time and the final cost of each. Returns
+  ERROR_BADPARM if a gradient component differs from its central
+  difference by more than gradtol (relative to the larger of the
+  two, with a floor of 1e-3 of the largest central difference).
+  ---------------------------------------------------------------*/
+int BenchmarkLBFGS(MRI *mov, MATRIX *R, double *params, int dof, double gradtol)
+{
+  double p[12], pg[12], grad[12], gtmp[12], ppowell[12], plbfgs[12], fd[12];
+  double cost, cplus, cminus, h, costs[8], tpowell, tlbfgs, cpowell, clbfgs, dmax;
+  double fdmax, relerr, errmax;
+  int n, nitpowell, nitlbfgs, nevpowell, nevlbfgs, nbad;
+  MATRIX *Rpowell, *Rlbfgs;
+  Timer mytimer;
+
+  printf("Benchmarking powell vs L-BFGS, dof = %d, nsubsamp = %d\n",dof,nsubsamp);
+
+  for(n=0; n < 12; n++) p[n] = params[n];
+  mytimer.reset();
+  GetSurfCosts(mov, NULL, R0, R, p, dof, costs);
+  printf("GetSurfCosts     %12.10lf  %8.3lf ms\n",costs[7],1000*mytimer.seconds());
+  mytimer.reset();
+  cost = GetSurfCostsGrad(mov, R0, p, dof, grad, NULL);
+  printf("GetSurfCostsGrad %12.10lf  %8.3lf ms\n",cost,1000*mytimer.seconds());
+
+  fdmax = 0;
+  for(n=0; n < dof; n++){
+    if(n < 6) h = 0.01; // mm or deg
+    else      h = 1e-4; // scale or shear
+    memcpy(pg,p,sizeof(p));
+    pg[n] = p[n] + h;
+    cplus = GetSurfCostsGrad(mov, R0, pg, dof, gtmp, NULL);
+    pg[n] = p[n] - h;
+    cminus = GetSurfCostsGrad(mov, R0, pg, dof, gtmp, NULL);
+    fd[n] = (cplus-cminus)/(2*h);
+    fdmax = MAX(fdmax,fabs(fd[n]));
+  }
+  printf("param   analytic     central diff  rel err\n");
+  nbad = 0;
+  errmax = 0;
+  for(n=0; n < dof; n++){
+    if(fdmax > 0) relerr = fabs(grad[n]-fd[n])/MAX(MAX(fabs(grad[n]),fabs(fd[n])),1e-3*fdmax);
+    else          relerr = fabs(grad[n]) > 0 ? 1 : 0;
+    errmax = MAX(errmax,relerr);
+    if(relerr > gradtol) nbad++;
+    printf("%5d  %12.8lf %12.8lf  %8.5lf %s\n",n,grad[n],fd[n],relerr,
+	   relerr > gradtol ? "FAIL" : "ok");
+  }
+  printf("gradient check: max rel err %g, tol %g, %d of %d params fail\n",
+	 errmax,gradtol,nbad,dof);
+  fflush(stdout);
+
+  Rpowell = MatrixCopy(R0,NULL);
+  memcpy(ppowell,params,sizeof(ppowell));
+  nCostEvaluations = 0;
+  mytimer.reset();
+  MinPowell(mov, NULL, Rpowell, ppowell, dof, TolPowell, LinMinTolPowell,
+	    nMaxItersPowell, SegRegCostFile, costs, &nitpowell);
+  tpowell = mytimer.seconds();
+  nevpowell = nCostEvaluations;
+  cpowell = costs[7];
+
+  Rlbfgs = MatrixCopy(R0,NULL);
+  memcpy(plbfgs,params,sizeof(plbfgs));
+  nCostEvaluations = 0;
+  mytimer.reset();
+  MinLBFGS(mov, Rlbfgs, plbfgs, dof, TolLBFGS, nMaxEvalsLBFGS, costs, &nitlbfgs);
+  tlbfgs = mytimer.seconds();
+  nevlbfgs = nCostEvaluations;
+  clbfgs = costs[7];
+
+  dmax = 0;
+  for(n=0; n < dof; n++) dmax = MAX(dmax,fabs(ppowell[n]-plbfgs[n]));
+
+  printf("\n");
+  printf("optimizer  niters  nevals  time(sec)  sec/eval    cost\n");
+  printf("powell     %6d  %6d  %9.3lf  %8.5lf  %12.10lf\n",
+	 nitpowell,nevpowell,tpowell,tpowell/MAX(nevpowell,1),cpowell);
+  printf("lbfgs      %6d  %6d  %9.3lf  %8.5lf  %12.10lf\n",
+	 nitlbfgs,nevlbfgs,tlbfgs,tlbfgs/MAX(nevlbfgs,1),clbfgs);
+  printf("powell params ");
+  for(n=0; n < dof; n++) printf("%8.5lf ",ppowell[n]);
+  printf("\n");
+  printf("lbfgs  params ");
+  for(n=0; n < dof; n++) printf("%8.5lf ",plbfgs[n]);
+  printf("\n");
+  printf("max param diff %g\n",dmax);
+
+  MatrixFree(&Rpowell);
+  MatrixFree(&Rlbfgs);
+  if(nbad > 0) return(ERROR_BADPARM);
+  return(NO_ERROR);
+}
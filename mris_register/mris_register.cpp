@@ -28,6 +28,7 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/wait.h>
 
 #include "macros.h"
 
@@ -57,6 +58,17 @@ static void print_usage(void) ;
 static void print_help(void) ;
 static void print_version(void) ;
 static int  compute_area_ratios(MRI_SURFACE *mris) ;
+static void set_base_name(char *out_fname) ;
+static MRI_SURFACE *read_surface(char *surf_fname, const std::string &cmdline) ;
+static MRI_SP *read_template(char *template_fname, MRI_SURFACE *mris) ;
+static void register_surface(MRI_SURFACE *mris, MRI_SP *mrisp_template,
+                             char *out_fname) ;
+static int  register_batch_surfaces(const std::vector<std::string> &surf_fnames,
+                                    const std::vector<std::string> &out_fnames,
+                                    char *template_fname,
+                                    const std::string &cmdline, int queue_fd) ;
+static int  register_batch(char *batch_fname, char *template_fname,
+                           const std::string &cmdline) ;
 static double gcsaSSE(MRI_SURFACE *mris, INTEGRATION_PARMS *parms) ;
 
 static const char *surface_names[] =
@@ -74,6 +86,9 @@ static const char *curvature_names[] =
 
 #define MAX_SIGMAS 10
 static int nsigmas=0 ;
+static int benchmark_blur = 0 ;
+static char *batch_fname = NULL ;
+static int batch_jobs = 1 ;
 static float sigmas[MAX_SIGMAS] ;
 
 #define IMAGES_PER_SURFACE   3   /* mean, variance, and dof */
@@ -134,8 +149,8 @@ char *regfile = NULL;
 int
 main(int argc, char *argv[])
 {
-  char **av, *surf_fname, *template_fname, *out_fname, fname[STRLEN],*cp;
-  int ac, nargs,err, msec ;
+  char **av, *surf_fname, *template_fname, *out_fname ;
+  int ac, nargs, msec ;
   MRI_SURFACE  *mris ;
   MRI_SP       *mrisp_template ;
 
@@ -205,18 +220,81 @@ main(int argc, char *argv[])
     MRISsetRegistrationSigmas(sigmas, nsigmas) ;
   }
   parms.which_norm = which_norm ;
-  if (argc < 4)
+  if (batch_fname)
   {
-    usage_exit() ;
+    if (argc < 2)
+    {
+      usage_exit() ;
+    }
+    if (single_surf || regfile || curvature_fname[0] || starting_reg_fname ||
+        jacobian_fname)
+      ErrorExit(ERROR_BADPARM,
+                "%s: -batch needs a template file and can not be combined "
+                "with -1, -C, -reg, -sreg or -jacobian", Progname) ;
+
+    std::cout << getVersion() << std::endl;
+    printf("  %s\n",getVersion().c_str());
+    fflush(stdout);
+
+    register_batch(batch_fname, argv[1], cmdline) ;
+  }
+  else
+  {
+    if (argc < 4)
+    {
+      usage_exit() ;
+    }
+
+    std::cout << getVersion() << std::endl;
+    printf("  %s\n",getVersion().c_str());
+    fflush(stdout);
+
+    surf_fname = argv[1] ;
+    template_fname = argv[2] ;
+    out_fname = argv[3] ;
+
+    set_base_name(out_fname) ;
+    mris = read_surface(surf_fname, cmdline) ;
+    mrisp_template = read_template(template_fname, mris) ;
+
+    // the multi-scale rounds blur the template to the same sigmas again
+    parms.mrisp_template_cache = MRISPblurCacheAlloc(mrisp_template) ;
+    register_surface(mris, mrisp_template, out_fname) ;
+    MRISPblurCacheFree(&parms.mrisp_template_cache) ;
+    MRISPfree(&mrisp_template) ;
   }
 
-  std::cout << getVersion() << std::endl;
-  printf("  %s\n",getVersion().c_str());
-  fflush(stdout);
+  msec = start.milliseconds() ;
+  printf("registration took %2.2f hours\n",(float)msec/(1000.0f*60.0f*60.0f));
+
+  printf("#VMPC# mris_register VmPeak  %d\n",GetVmPeak());
+
+  // Output formatted so it can be easily grepped
+#ifdef HAVE_OPENMP
+  int n_omp_threads = omp_get_max_threads();
+  printf("FSRUNTIME@ mris_register %7.4f hours %d threads\n",msec/(1000.0*60.0*60.0),n_omp_threads);
+#else
+  printf("FSRUNTIME@ mris_register %7.4f hours %d threads\n",msec/(1000.0*60.0*60.0),1);
+#endif
+
+
+  exit(0) ;
+  return(0) ;  /* for ansi */
+}
+
+
+
+/*----------------------------------------------------------------------
+  Parameters:
 
-  surf_fname = argv[1] ;
-  template_fname = argv[2] ;
-  out_fname = argv[3] ;
+  Description:
+    name the diagnostic output after the output surface unless a base
+    name was given
+----------------------------------------------------------------------*/
+static void
+set_base_name(char *out_fname)
+{
+  char fname[STRLEN], *cp ;
 
   if (parms.base_name[0] == 0)
   {
@@ -231,6 +309,18 @@ main(int argc, char *argv[])
       strcpy(parms.base_name, "sphere") ;
     }
   }
+}
+
+/*----------------------------------------------------------------------
+  Parameters:
+
+  Description:
+    read the surface to be registered and everything that goes with it
+----------------------------------------------------------------------*/
+static MRI_SURFACE *
+read_surface(char *surf_fname, const std::string &cmdline)
+{
+  MRI_SURFACE *mris ;
 
   fprintf(stderr, "reading surface from %s...\n", surf_fname) ;
   mris = MRISread(surf_fname) ;
@@ -305,6 +395,22 @@ main(int argc, char *argv[])
       MRISnonmaxSuppress(mris) ;
     }
   }
+
+  return(mris) ;
+}
+
+/*----------------------------------------------------------------------
+  Parameters:
+
+  Description:
+    read the template parameterization, or build it from a single
+    surface (-1)
+----------------------------------------------------------------------*/
+static MRI_SP *
+read_template(char *template_fname, MRI_SURFACE *mris)
+{
+  MRI_SP *mrisp_template ;
+
   if (single_surf)
   {
     char        fname[STRLEN], *cp, surf_dir[STRLEN], hemi[10]  ;
@@ -436,6 +542,31 @@ main(int argc, char *argv[])
     }
   }
 
+  if (benchmark_blur)
+  {
+    static float default_sigmas[] = { 4.0f, 2.0f, 1.0f, 0.5f } ;
+    if (nsigmas > 0)
+      MRISPblurBenchmark(mrisp_template, sigmas, nsigmas) ;
+    else
+      MRISPblurBenchmark(mrisp_template, default_sigmas,
+                         sizeof(default_sigmas)/sizeof(default_sigmas[0])) ;
+    exit(0) ;
+  }
+
+  return(mrisp_template) ;
+}
+
+/*----------------------------------------------------------------------
+  Parameters:
+
+  Description:
+    register mris to the template, write it to out_fname and free it
+----------------------------------------------------------------------*/
+static void
+register_surface(MRI_SURFACE *mris, MRI_SP *mrisp_template, char *out_fname)
+{
+  int err ;
+
   if (use_defaults)
   {
     if (*IMAGEFseq_pix(mrisp_template->Ip, 0, 0, 2) <= 1.0)  /* 1st time */
@@ -619,28 +750,189 @@ main(int argc, char *argv[])
 #endif
   }
 
-  MRISPfree(&mrisp_template) ;
   MRISfree(&mris) ;
+}
 
-  msec = start.milliseconds() ;
-  printf("registration took %2.2f hours\n",(float)msec/(1000.0f*60.0f*60.0f));
+/*----------------------------------------------------------------------
+  Parameters:
 
-  printf("#VMPC# mris_register VmPeak  %d\n",GetVmPeak());
+  Description:
+    register the surfaces of the batch list to the template, one after
+    the other with all the threads of this process. With queue_fd < 0
+    every surface is registered, otherwise the indices of the surfaces
+    are read from the queue until it is empty. The template is read and
+    blurred only once per call.
+----------------------------------------------------------------------*/
+static int
+register_batch_surfaces(const std::vector<std::string> &surf_fnames,
+                        const std::vector<std::string> &out_fnames,
+                        char *template_fname, const std::string &cmdline,
+                        int queue_fd)
+{
+  char   surf_fname[STRLEN], out_fname[STRLEN] ;
+  int    n, nsurfaces, nregistered, base_name_given ;
+  MRI_SP *mrisp_template ;
 
-  // Output formatted so it can be easily grepped
+  nsurfaces = surf_fnames.size() ;
+  mrisp_template = read_template(template_fname, NULL) ;
+  parms.mrisp_template_cache = MRISPblurCacheAlloc(mrisp_template) ;
+
+  // MRISregister changes parms, so every surface starts from a copy
+  INTEGRATION_PARMS parms_initial ;
+  INTEGRATION_PARMS_copy(&parms_initial, &parms) ;
+  base_name_given = parms.base_name[0] != 0 ;
+  for (nregistered = 0, n = 0 ; ; nregistered++, n++)
+  {
+    if (queue_fd >= 0)
+    {
+      if (read(queue_fd, &n, sizeof(n)) != sizeof(n))
+      {
+        break ;
+      }
+    }
+    else if (n >= nsurfaces)
+    {
+      break ;
+    }
+    Timer timer ;
+
+    printf("*************** registering %s (%d of %d) ***************\n",
+           surf_fnames[n].c_str(), n+1, nsurfaces) ;
+    INTEGRATION_PARMS_copy(&parms, &parms_initial) ;
+    strcpy(surf_fname, surf_fnames[n].c_str()) ;
+    strcpy(out_fname, out_fnames[n].c_str()) ;
+    if (!base_name_given)
+    {
+      set_base_name(out_fname) ;
+    }
+    register_surface(read_surface(surf_fname, cmdline), mrisp_template,
+                     out_fname) ;
+
+    // the -var_smoothness arrays read_surface() allocated for this surface
+    free(parms.vsmoothness) ;
+    free(parms.dist_error) ;
+    free(parms.area_error) ;
+    free(parms.geometry_error) ;
+    printf("registration of %s took %2.2f minutes\n",
+           surf_fname, timer.minutes()) ;
+    fflush(stdout) ;
+  }
+  INTEGRATION_PARMS_copy(&parms, &parms_initial) ;
+
+  MRISPblurCacheFree(&parms.mrisp_template_cache) ;
+  MRISPfree(&mrisp_template) ;
+  return(nregistered) ;
+}
+
+/*----------------------------------------------------------------------
+  Parameters:
+
+  Description:
+    register every surface listed in batch_fname, one
+    "<input surface> <output surface>" pair per line, to the same
+    template.
+
+    With -batch-jobs N the surfaces are registered concurrently by a pool
+    of N worker processes that take the next surface from a shared queue
+    (a pipe) as they finish, and the threads are split evenly between
+    them. Workers are processes, not threads, because MRISregister and
+    the code under it keep static state (the MRISPblur kernel tables, the
+    registration sigmas, the integration parameters). They are forked
+    before this process starts any OpenMP threads, and each reads the
+    template once.
+----------------------------------------------------------------------*/
+static int
+register_batch(char *batch_fname, char *template_fname, const std::string &cmdline)
+{
+  FILE   *fp ;
+  char   line[STRLEN], surf_fname[STRLEN], out_fname[STRLEN] ;
+  int    n, nsurfaces, njobs, nfailed, fds[2], status ;
+  std::vector<std::string> surf_fnames, out_fnames ;
+  std::vector<pid_t> pids ;
+
+  fp = fopen(batch_fname, "r") ;
+  if (fp == NULL)
+    ErrorExit(ERROR_NOFILE, "%s: could not open batch file %s",
+              Progname, batch_fname) ;
+  while (fgets(line, STRLEN, fp))
+  {
+    n = sscanf(line, "%s %s", surf_fname, out_fname) ;
+    if (n <= 0 || surf_fname[0] == '#')
+    {
+      continue ;
+    }
+    if (n != 2)
+      ErrorExit(ERROR_BADFILE, "%s: no output surface for %s in %s",
+                Progname, surf_fname, batch_fname) ;
+    surf_fnames.push_back(surf_fname) ;
+    out_fnames.push_back(out_fname) ;
+  }
+  fclose(fp) ;
+  nsurfaces = surf_fnames.size() ;
+  if (nsurfaces == 0)
+    ErrorExit(ERROR_BADFILE, "%s: no surfaces listed in %s",
+              Progname, batch_fname) ;
+
+  njobs = MIN(batch_jobs, nsurfaces) ;
+  if (njobs <= 1)
+  {
+    register_batch_surfaces(surf_fnames, out_fnames, template_fname,
+                            cmdline, -1) ;
+    return(NO_ERROR) ;
+  }
+
+  if (pipe(fds) != 0)
+    ErrorExit(ERROR_NOFILE, "%s: could not create the batch queue", Progname) ;
+  printf("registering %d surfaces with %d concurrent jobs\n", nsurfaces, njobs) ;
+  fflush(stdout) ;
+  fflush(stderr) ;
+  for (n = 0 ; n < njobs ; n++)
+  {
+    pid_t pid = fork() ;
+    if (pid < 0)
+      ErrorExit(ERROR_NOMEMORY, "%s: could not start batch job %d",
+                Progname, n) ;
+    if (pid == 0)
+    {
+      close(fds[1]) ;
 #ifdef HAVE_OPENMP
-  int n_omp_threads = omp_get_max_threads();
-  printf("FSRUNTIME@ mris_register %7.4f hours %d threads\n",msec/(1000.0*60.0*60.0),n_omp_threads);
-#else
-  printf("FSRUNTIME@ mris_register %7.4f hours %d threads\n",msec/(1000.0*60.0*60.0),1);
+      omp_set_num_threads(MAX(1, omp_get_max_threads() / njobs)) ;
 #endif
+      register_batch_surfaces(surf_fnames, out_fnames, template_fname,
+                              cmdline, fds[0]) ;
+      exit(0) ;
+    }
+    pids.push_back(pid) ;
+  }
 
+  // the workers read the queue while it is filled, so it may be longer
+  // than the pipe buffer
+  close(fds[0]) ;
+  for (n = 0 ; n < nsurfaces ; n++)
+  {
+    if (write(fds[1], &n, sizeof(n)) != sizeof(n))
+    {
+      ErrorPrintf(ERROR_BADFILE, "%s: could not queue %s",
+                  Progname, surf_fnames[n].c_str()) ;
+      break ;
+    }
+  }
+  close(fds[1]) ;
 
-  exit(0) ;
-  return(0) ;  /* for ansi */
+  for (nfailed = 0, n = 0 ; n < njobs ; n++)
+  {
+    if (waitpid(pids[n], &status, 0) < 0 ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+      nfailed++ ;
+    }
+  }
+  if (nfailed > 0)
+    ErrorExit(ERROR_BADFILE, "%s: %d of %d batch jobs failed",
+              Progname, nfailed, njobs) ;
+  return(NO_ERROR) ;
 }
 
-
 /*----------------------------------------------------------------------
   Parameters:
 
@@ -1023,6 +1315,26 @@ get_option(int argc, char *argv[])
     fprintf(stderr, "%sremoving negative triangles with iterative smoothing\n",
             remove_negative ? "" : "not ") ;
   }
+  else if (!stricmp(option, "batch"))
+  {
+    batch_fname = argv[2] ;
+    nargs = 1 ;
+    fprintf(stderr, "registering the surfaces listed in %s\n", batch_fname) ;
+  }
+  else if (!stricmp(option, "batch-jobs"))
+  {
+    batch_jobs = atoi(argv[2]) ;
+    nargs = 1 ;
+    if (batch_jobs < 1)
+      ErrorExit(ERROR_BADPARM, "%s: -batch-jobs needs a positive count",
+                Progname) ;
+    fprintf(stderr, "running %d batch registrations at a time\n", batch_jobs) ;
+  }
+  else if (!stricmp(option, "benchmark-blur"))
+  {
+    benchmark_blur = 1 ;
+    fprintf(stderr, "benchmarking the blurring of the template and exiting\n") ;
+  }
   else if (!stricmp(option, "curv"))
   {
     parms.flags |= IP_USE_CURVATURE ;
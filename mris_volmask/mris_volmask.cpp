@@ -101,7 +101,8 @@ LoadInputFiles(const IoParams& params,
 MRI* ComputeSurfaceDistanceFunction
 (MRIS* mris, //input surface
  MRI* mriInOut, //output MRI structure
- float resolution);
+ float resolution,
+ bool scanline); //sign by the scanline fill instead of the OBB tree
 
 MRI* CreateHemiMask(MRI* dpial, MRI* dwhite,
                     const unsigned char lblWhite,
@@ -146,6 +147,7 @@ struct IoParams
   int DoLH, DoRH;
   bool bLHOnly, bRHOnly;
   bool bParallel;
+  bool bScanline;
 
   float capValue;
 
@@ -247,7 +249,8 @@ main(int ac, char* av[])
   }
   else{
     printf("Running hemis serially\n");
-    omp_set_num_threads(1);
+    // the scanline fill is parallel within a surface
+    if (!params.bScanline) omp_set_num_threads(1);
   }
 #endif
 
@@ -276,7 +279,8 @@ main(int ac, char* av[])
       std::cout << "computing distance to left white surface \n" ;
       ComputeSurfaceDistanceFunction(surfLeftWhite,
 				     dLeftWhite,
-				     params.capValue);
+				     params.capValue,
+				     params.bScanline);
       // if the option is there, output distance
       if ( params.bSaveDistance )
 	MRIwrite
@@ -295,7 +299,8 @@ main(int ac, char* av[])
       std::cout << "computing distance to left pial surface \n" ;
       ComputeSurfaceDistanceFunction(surfLeftPial,
 				     dLeftPial,
-				     params.capValue);
+				     params.capValue,
+				     params.bScanline);
       if ( params.bSaveDistance )
 	MRIwrite
 	  ( dLeftPial,
@@ -328,7 +333,8 @@ main(int ac, char* av[])
       std::cout << "computing distance to right white surface \n" ;
       ComputeSurfaceDistanceFunction( surfRightWhite,
 				      dRightWhite,
-				      params.capValue);
+				      params.capValue,
+				      params.bScanline);
       if ( params.bSaveDistance )
 	MRIwrite
 	  ( dRightWhite,
@@ -346,7 +352,8 @@ main(int ac, char* av[])
       std::cout << "computing distance to right pial surface \n" ;
       ComputeSurfaceDistanceFunction(surfRightPial,
 				     dRightPial,
-				     params.capValue);
+				     params.capValue,
+				     params.bScanline);
       if(params.bSaveDistance )
 	MRIwrite( dRightPial,const_cast<char*>( (outputPath/"rh.dpial."+params.outRoot + ".mgz").c_str() ));
       // compute hemi mask
@@ -431,6 +438,7 @@ IoParams::IoParams()
   bLHOnly = false;
   bRHOnly = false;
   bParallel = false;
+  bScanline = false;
   DoLH = 1;
   DoRH = 1;
 
@@ -520,6 +528,13 @@ IoParams::parse(int ac, char* av[])
   interface.AddOptionBool( "rh-only", &bRHOnly,"only analyze the right hemi");
   interface.AddOptionBool( "parallel", &bParallel,"run hemis in parallel");
   interface.AddOptionBool
+  ( "scanline", &bScanline,
+    "determine the inside of the surfaces by filling each row of voxels "
+    "between its crossings of the surface instead of testing each voxel "
+    "with an OBB tree - much faster at high resolution, but voxels whose "
+    "center is on the surface can differ"
+  );
+  interface.AddOptionBool
   ( "edit_aseg", &bEditAseg,
     "option to edit the aseg using the ribbons and save to "
     "aseg.ribbon.mgz in the mri directory"
@@ -637,7 +652,8 @@ LoadInputFiles(const IoParams& params,
 MRI*
 ComputeSurfaceDistanceFunction(MRIS* mris,
                                MRI* mri_distfield,
-                               float thickness)
+                               float thickness,
+                               bool scanline)
 {
   int res;
   MRI *mri_visited, *_mridist;
@@ -652,6 +668,30 @@ ComputeSurfaceDistanceFunction(MRIS* mris,
   distfield->SetMaxDistance(thickness);
   distfield->Generate(); //mri_dist now has the distancefield
 
+  if (scanline)
+  {
+    // the sign of every voxel comes from a single pass over the rows
+    MRI *mri_interior = MRIcloneDifferentType(mri_distfield, MRI_UCHAR);
+    MRISfillInteriorScanline(mris, mri_interior, 1, 1);
+    for(int i=0; i< mri_distfield->width; i++)
+    {
+      for(int j=0; j< mri_distfield->height; j++)
+      {
+        for(int k=0; k< mri_distfield->depth; k++)
+        {
+          const float dist = MRIFvox(_mridist, i, j, k);
+          MRIFvox(mri_distfield, i, j, k) =
+            MRIvox(mri_interior, i, j, k) ? dist : -dist;
+        }
+      }
+    }
+    MRIfree(&mri_interior);
+    MRIfree(&mri_visited);
+    MRIfree(&_mridist);
+    delete distfield;
+    return(mri_distfield);
+  }
+
   // Construct the OBB Tree
   MRISOBBTree* OBBTree = new MRISOBBTree(mris);
   OBBTree->ConstructTree();
@@ -0,0 +1,109 @@
+# ___________________________
+# FreeSurfer Timing Framework
+#
+# Shared harness for the test_<tool>_timing benchmarks. They are not run by ctest: each one
+# times a command over a list of runs (thread counts, tolerances, ...) and checks that the
+# outputs of the runs agree. A timing script sources this file in place of test.sh, which
+# it builds on:
+#
+#     source "$(dirname $0)/../timing.sh"
+#
+# The arguments of the script are not parsed; timing_args returns them, or the given
+# defaults if there are none, as the list of runs:
+#
+#     for threads in $(timing_args 1 2 4 8); do
+#         export OMP_NUM_THREADS=$threads
+#         timing_run $threads mri_foo in.mgz out.mgz
+#         timing_compare $threads out.mgz 1
+#     done
+#     timing_report
+#
+# timing_run evaluates the command in testdata-<run>, a fresh copy of the extracted testdata,
+# with its output in testdata-<run>.log. Inputs that every run needs can be created once,
+# before the first run, with timing_setup <command>.
+#
+
+FSTEST_TIMING_ARGS=("$@")
+set --
+source "$(dirname ${BASH_SOURCE[0]})/test.sh"
+
+FSTEST_TIMING_RUNS=()
+declare -A FSTEST_TIMING_WALL FSTEST_TIMING_SAME FSTEST_TIMING_NOTE
+
+# timing_args <default runs>
+# prints the script arguments, or the defaults if the script was run without arguments
+function timing_args {
+    if [ ${#FSTEST_TIMING_ARGS[@]} -gt 0 ]; then
+        echo "${FSTEST_TIMING_ARGS[@]}"
+    else
+        echo "$@"
+    fi
+}
+
+# timing_setup [command]
+# extracts the testdata and runs an optional command in it that prepares the inputs of all runs
+function timing_setup {
+    init_testdata > /dev/null
+    if [ $# -gt 0 ]; then
+        eval_cmd "$@"
+    fi
+    cd $FSTEST_CWD
+}
+
+# timing_log <run>
+# prints the path of the log of a run
+function timing_log {
+    echo "${FSTEST_TESTDATA_DIR}-$1.log"
+}
+
+# timing_run <run> <command>
+# evaluates a command in a new copy of the testdata, and records its wall time
+function timing_run {
+    local run=$1 rundir="${FSTEST_TESTDATA_DIR}-$1" start end
+    shift
+    if [ ! -d "$FSTEST_TESTDATA_DIR" ]; then
+        timing_setup
+    fi
+    rm -rf $rundir && cp -a $FSTEST_TESTDATA_DIR $rundir
+    cd $rundir
+    export SUBJECTS_DIR=$rundir
+    echo ">> $(tput setaf 3)$@$(tput sgr 0) > $(timing_log $run)"
+    start=$(date +%s.%N)
+    eval "$@" > $(timing_log $run) 2>&1 || error_exit "run $run failed - see $(timing_log $run)"
+    end=$(date +%s.%N)
+    FSTEST_TIMING_RUNS+=("$run")
+    FSTEST_TIMING_WALL[$run]=$(echo $start $end | awk '{printf "%.1f", $2 - $1}')
+    cd $FSTEST_CWD
+}
+
+# timing_compare <run> <output> <reference run> [diff command]
+# compares an output of a run with the same output of the reference run (with cmp by default)
+function timing_compare {
+    local run=$1 output=$2 ref=$3 same
+    shift 3
+    if [ "$run" = "$ref" ]; then
+        same=reference
+    elif eval "${@:-cmp -s} ${FSTEST_TESTDATA_DIR}-${ref}/$output ${FSTEST_TESTDATA_DIR}-${run}/$output" > /dev/null 2>&1; then
+        same=identical
+    else
+        same=differs
+    fi
+    FSTEST_TIMING_SAME[$run]="${FSTEST_TIMING_SAME[$run]:+${FSTEST_TIMING_SAME[$run]}/}$same"
+}
+
+# timing_note <run> <text>
+# adds text to the notes column of a run
+function timing_note {
+    FSTEST_TIMING_NOTE[$1]="${FSTEST_TIMING_NOTE[$1]:+${FSTEST_TIMING_NOTE[$1]} }$2"
+}
+
+# timing_report [notes title]
+# prints the wall time, the comparisons and the notes of every run
+function timing_report {
+    local run
+    echo ""
+    printf "%-10s  %9s  %-20s  %s\n" run "wall (s)" output "$1"
+    for run in "${FSTEST_TIMING_RUNS[@]}"; do
+        printf "%-10s  %9s  %-20s  %s\n" $run ${FSTEST_TIMING_WALL[$run]} "${FSTEST_TIMING_SAME[$run]:--}" "${FSTEST_TIMING_NOTE[$run]}"
+    done
+}
@@ -24,6 +24,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <vector>
+
 double round(double x);
 #include "MRIio_old.h"
 #include "diag.h"
@@ -889,6 +891,170 @@ MRI *MRInormWeights(MRI *w, int sqrtFlag, int invFlag, MRI *mask, MRI *wn)
   return (wn);
 }
 
+/*---------------------------------------------------------------------
+  MRIglmAllocOutputs() - allocates the output volumes (beta, rvar,
+  gamma, F, p, etc) of the size of mriglm->y. The residual (eres) is
+  only allocated if AllocEres is non-zero. mriglm->nregtot must be set.
+  --------------------------------------------------------------------*/
+static int MRIglmAllocOutputs(MRIGLM *mriglm, int AllocEres)
+{
+  int n, nc, nr, ns, nf;
+  GLMMAT *glm = mriglm->glm;
+
+  nc = mriglm->y->width;
+  nr = mriglm->y->height;
+  ns = mriglm->y->depth;
+  nf = mriglm->y->nframes;
+
+  mriglm->beta = MRIallocSequence(nc, nr, ns, MRI_FLOAT, mriglm->nregtot);
+  MRIcopyHeader(mriglm->y, mriglm->beta);
+  if (AllocEres) {
+    mriglm->eres = MRIallocSequence(nc, nr, ns, MRI_FLOAT, nf);
+    MRIcopyHeader(mriglm->y, mriglm->eres);
+  }
+  mriglm->rvar = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+  MRIcopyHeader(mriglm->y, mriglm->rvar);
+  if (mriglm->yhatsave) {
+    mriglm->yhat = MRIallocSequence(nc, nr, ns, MRI_FLOAT, nf);
+    MRIcopyHeader(mriglm->y, mriglm->yhat);
+  }
+  if (mriglm->condsave) {
+    mriglm->cond = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+    MRIcopyHeader(mriglm->y, mriglm->cond);
+  }
+
+  for (n = 0; n < glm->ncontrasts; n++) {
+    mriglm->gamma[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, glm->C[n]->rows);
+    MRIcopyHeader(mriglm->y, mriglm->gamma[n]);
+    if (glm->C[n]->rows == 1) {
+      mriglm->gammaVar[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+      MRIcopyHeader(mriglm->y, mriglm->gammaVar[n]);
+      if (glm->DoPCC) {
+        mriglm->pcc[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+        MRIcopyHeader(mriglm->y, mriglm->pcc[n]);
+      }
+    }
+    mriglm->F[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+    MRIcopyHeader(mriglm->y, mriglm->F[n]);
+    mriglm->p[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+    MRIcopyHeader(mriglm->y, mriglm->p[n]);
+    mriglm->z[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+    MRIcopyHeader(mriglm->y, mriglm->z[n]);
+    if (glm->ypmfflag[n]) {
+      mriglm->ypmf[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, nf);
+      MRIcopyHeader(mriglm->y, mriglm->ypmf[n]);
+    }
+  }
+  return (0);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmBatchFlush() - fits and tests the first nv voxels in the batch
+  and packs the results into the output volumes at (vc,vr,vs).
+  --------------------------------------------------------------------*/
+static int MRIglmBatchFlush(MRIGLM *mriglm, GLMBATCH *gb, int nv, const int *vc, const int *vr, const int *vs)
+{
+  int v, f, j, n, J;
+  GLMMAT *glm = mriglm->glm;
+
+  GLMbatchFitAndTest(glm, gb, nv);
+  for (v = 0; v < nv; v++) {
+    MRIsetVoxVal(mriglm->rvar, vc[v], vr[v], vs[v], 0, gb->rvar[v]);
+    for (j = 0; j < gb->nregs; j++) MRIsetVoxVal(mriglm->beta, vc[v], vr[v], vs[v], j, gb->beta[j * gb->nvox + v]);
+    for (f = 0; f < gb->nframes; f++) {
+      if (gb->eres) MRIsetVoxVal(mriglm->eres, vc[v], vr[v], vs[v], f, gb->eres[f * gb->nvox + v]);
+      if (gb->yhat) MRIsetVoxVal(mriglm->yhat, vc[v], vr[v], vs[v], f, gb->yhat[f * gb->nvox + v]);
+    }
+    for (n = 0; n < glm->ncontrasts; n++) {
+      J = glm->C[n]->rows;
+      for (j = 0; j < J; j++) MRIsetVoxVal(mriglm->gamma[n], vc[v], vr[v], vs[v], j, gb->gamma[n][j * gb->nvox + v]);
+      if (J == 1) MRIsetVoxVal(mriglm->gammaVar[n], vc[v], vr[v], vs[v], 0, gb->gammaVar[n][v]);
+      MRIsetVoxVal(mriglm->F[n], vc[v], vr[v], vs[v], 0, gb->F[n][v]);
+      MRIsetVoxVal(mriglm->p[n], vc[v], vr[v], vs[v], 0, gb->p[n][v]);
+      MRIsetVoxVal(mriglm->z[n], vc[v], vr[v], vs[v], 0, gb->z[n][v]);
+      if (J == 1 && glm->DoPCC) MRIsetVoxVal(mriglm->pcc[n], vc[v], vr[v], vs[v], 0, gb->pcc[n][v]);
+      if (glm->ypmfflag[n])
+        for (j = 0; j < glm->Mpmf[n]->rows; j++)
+          MRIsetVoxVal(mriglm->ypmf[n], vc[v], vr[v], vs[v], j, gb->ypmf[n][j * gb->nvox + v]);
+    }
+  }
+  return (0);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmFitAndTestBatch() - fits and tests all the voxels in y when X
+  is the same at every voxel (Workflow 3 in fsglm.cpp). X is loaded
+  from Xg and weighted by wg (if there), so the weight is applied to X
+  once rather than at each voxel. y can be a slab of the full volume, in which case
+  (x0,y0,z0) is the location of its first voxel in the output (and
+  mask) volumes. Voxels are gathered into batches of up to
+  MRIGLM_BATCH_NVOX (and no more than y has), which are then fit and
+  tested with GLMbatchFitAndTest(). If MaxMB > 0, the batch is made
+  smaller if needed to take no more than MaxMB megabytes.
+  --------------------------------------------------------------------*/
+#define MRIGLM_BATCH_NVOX 4096
+static int MRIglmFitAndTestBatch(MRIGLM *mriglm, MRI *y, int x0, int y0, int z0, double MaxMB)
+{
+  int c, r, s, f, k, nv, nf, Weight, nvoxbatch;
+  long nvoxy;
+  double Xcond = 0;
+  GLMMAT *glm = mriglm->glm;
+  GLMBATCH *gb = NULL;
+  std::vector<int> vc, vr, vs;
+
+  nf = y->nframes;
+  Weight = (mriglm->wg != NULL && !mriglm->skipweight);
+  for (f = 1; f <= nf; f++) {
+    for (k = 1; k <= glm->X->cols; k++) {
+      glm->X->rptr[f][k] = mriglm->Xg->rptr[f][k];
+      if (Weight) glm->X->rptr[f][k] *= mriglm->wg->rptr[f][1];
+    }
+  }
+  mriglm->XgLoaded = 1;
+  GLMxMatrices(glm);
+  if (mriglm->condsave) Xcond = MatrixConditionNumber(glm->XtX);
+  if (!glm->ill_cond_flag) {
+    nvoxy = (long)y->width * y->height * y->depth;
+    nvoxbatch = (nvoxy < MRIGLM_BATCH_NVOX) ? nvoxy : MRIGLM_BATCH_NVOX;
+    if (MaxMB > 0)
+      nvoxbatch = GLMbatchNVox(glm, MaxMB, mriglm->yhatsave && mriglm->yhat, mriglm->eres != NULL, nvoxbatch);
+    gb = GLMbatchAlloc(glm, nvoxbatch, mriglm->yhatsave && mriglm->yhat, mriglm->eres != NULL);
+    if (gb == NULL) return (1);
+    vc.resize(gb->nvox);
+    vr.resize(gb->nvox);
+    vs.resize(gb->nvox);
+  }
+
+  nv = 0;
+  for (c = 0; c < y->width; c++) {
+    for (r = 0; r < y->height; r++) {
+      for (s = 0; s < y->depth; s++) {
+        if (mriglm->mask != NULL && MRIgetVoxVal(mriglm->mask, c + x0, r + y0, s + z0, 0) < 0.5) continue;
+        if (mriglm->condsave) MRIsetVoxVal(mriglm->cond, c + x0, r + y0, s + z0, 0, Xcond);
+        if (glm->ill_cond_flag) {
+          mriglm->n_ill_cond++;
+          continue;
+        }
+        for (f = 0; f < nf; f++) {
+          gb->y[f * gb->nvox + nv] = MRIgetVoxVal(y, c, r, s, f);
+          if (Weight) gb->y[f * gb->nvox + nv] *= mriglm->wg->rptr[f + 1][1];
+        }
+        vc[nv] = c + x0;
+        vr[nv] = r + y0;
+        vs[nv] = s + z0;
+        nv++;
+        if (nv == gb->nvox) {
+          MRIglmBatchFlush(mriglm, gb, nv, vc.data(), vr.data(), vs.data());
+          nv = 0;
+        }
+      }
+    }
+  }
+  if (nv > 0) MRIglmBatchFlush(mriglm, gb, nv, vc.data(), vr.data(), vs.data());
+  if (gb) GLMbatchFree(&gb);
+  return (0);
+}
+
 /*---------------------------------------------------------------------
   MRIglmFitAndTest() - fits and tests glm on a voxel-by-voxel basis.
   There are also two other related functions, MRIglmFit() and
@@ -901,7 +1067,7 @@ MRI *MRInormWeights(MRI *w, int sqrtFlag, int invFlag, MRI *mask, MRI *wn)
   --------------------------------------------------------------------*/
 int MRIglmFitAndTest(MRIGLM *mriglm)
 {
-  int c, nc, nr, ns, nf, n;
+  int c, nc, nr, ns, nf;
   long nvoxtot;
   //int c, r, s, n, nc, nr, ns, nf, pctdone;
   //float m, Xcond;
@@ -933,50 +1099,16 @@ int MRIglmFitAndTest(MRIGLM *mriglm)
   }
 
   // If beta has not been allocated, assume that no one has been alloced
-  if (mriglm->beta == NULL) {
-    mriglm->beta = MRIallocSequence(nc, nr, ns, MRI_FLOAT, mriglm->nregtot);
-    MRIcopyHeader(mriglm->y, mriglm->beta);
-    mriglm->eres = MRIallocSequence(nc, nr, ns, MRI_FLOAT, nf);
-    MRIcopyHeader(mriglm->y, mriglm->eres);
-    mriglm->rvar = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
-    MRIcopyHeader(mriglm->y, mriglm->rvar);
-    if (mriglm->yhatsave) {
-      mriglm->yhat = MRIallocSequence(nc, nr, ns, MRI_FLOAT, nf);
-      MRIcopyHeader(mriglm->y, mriglm->yhat);
-    }
-    if (mriglm->condsave) {
-      mriglm->cond = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
-      MRIcopyHeader(mriglm->y, mriglm->cond);
-    }
-
-    for (n = 0; n < glm->ncontrasts; n++) {
-      mriglm->gamma[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, glm->C[n]->rows);
-      MRIcopyHeader(mriglm->y, mriglm->gamma[n]);
-      if (glm->C[n]->rows == 1) {
-        mriglm->gammaVar[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
-        MRIcopyHeader(mriglm->y, mriglm->gammaVar[n]);
-        if (glm->DoPCC) {
-          mriglm->pcc[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
-          MRIcopyHeader(mriglm->y, mriglm->pcc[n]);
-        }
-      }
-      mriglm->F[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
-      MRIcopyHeader(mriglm->y, mriglm->F[n]);
-      mriglm->p[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
-      MRIcopyHeader(mriglm->y, mriglm->p[n]);
-      mriglm->z[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
-      MRIcopyHeader(mriglm->y, mriglm->z[n]);
-      if (glm->ypmfflag[n]) {
-        mriglm->ypmf[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, nf);
-        MRIcopyHeader(mriglm->y, mriglm->ypmf[n]);
-      }
-    }
-  }
+  if (mriglm->beta == NULL) MRIglmAllocOutputs(mriglm, 1);
 
   //--------------------------------------------
   //pctdone = 0;
   //nthvox = 0;
   mriglm->n_ill_cond = 0;
+
+  // Same X everywhere, so do all the voxels in batches
+  if (!mriglm->pervoxflag && mriglm->yffxvar == NULL) return (MRIglmFitAndTestBatch(mriglm, mriglm->y, 0, 0, 0, 0));
+
   long n_ill_cond = 0;
 
   // Parallel does not work yet because need separate glm for each thread
@@ -1055,6 +1187,293 @@ int MRIglmFitAndTest(MRIGLM *mriglm)
   return (0);
 }
 
+/*---------------------------------------------------------------------
+  MRIstreamSlabs() - splits a volume with the dimensions of the header
+  yhdr into slabs of slices (or rows or columns for 2D/1D data such as
+  surface overlays) that span all frames, each holding at most MaxMB
+  megabytes. The float copy of the slab and the type conversion (if any)
+  are what count against the budget. nvoxunit is set to the number of
+  voxels per slice of a slab. Returns the number of slabs; the slab at
+  a given start is then given by MRIstreamSlabRegion().
+  --------------------------------------------------------------------*/
+static int MRIstreamSlabs(MRI *yhdr, double MaxMB, int *paxis, int *pdimlen, int *pnper, long *pnvoxunit)
+{
+  int axis, dimlen, nper;
+  long nvoxmax, nvoxunit;
+
+  // Slab along the slowest-varying dimension that has more than one element
+  if (yhdr->depth > 1) {
+    axis = 2;
+    dimlen = yhdr->depth;
+    nvoxunit = (long)yhdr->width * yhdr->height;
+  }
+  else if (yhdr->height > 1) {
+    axis = 1;
+    dimlen = yhdr->height;
+    nvoxunit = yhdr->width;
+  }
+  else {
+    axis = 0;
+    dimlen = yhdr->width;
+    nvoxunit = 1;
+  }
+  nvoxmax = (long)(MaxMB * 1024 * 1024 / (2.0 * sizeof(float) * yhdr->nframes));
+  nper = nvoxmax / nvoxunit;
+  if (nper < 1) nper = 1;
+  if (nper > dimlen) nper = dimlen;
+
+  *paxis = axis;
+  *pdimlen = dimlen;
+  *pnper = nper;
+  *pnvoxunit = nvoxunit;
+  return ((dimlen + nper - 1) / nper);
+}
+
+/*---------------------------------------------------------------------
+  MRIstreamSlabRegion() - region of the slab starting at start along
+  axis (see MRIstreamSlabs()).
+  --------------------------------------------------------------------*/
+static void MRIstreamSlabRegion(MRI *yhdr, int axis, int dimlen, int nper, int start, MRI_REGION *region)
+{
+  region->x = region->y = region->z = 0;
+  region->dx = yhdr->width;
+  region->dy = yhdr->height;
+  region->dz = yhdr->depth;
+  if (axis == 2) {
+    region->z = start;
+    region->dz = MIN(nper, dimlen - start);
+  }
+  else if (axis == 1) {
+    region->y = start;
+    region->dy = MIN(nper, dimlen - start);
+  }
+  else {
+    region->x = start;
+    region->dx = MIN(nper, dimlen - start);
+  }
+}
+
+/*---------------------------------------------------------------------
+  MRIstreamReadSlab() - reads the given region of all frames of yfile
+  as float, checking that it has the nf frames of the header. Returns
+  NULL on error.
+  --------------------------------------------------------------------*/
+static MRI *MRIstreamReadSlab(const char *yfile, MRI_REGION *region, int nf)
+{
+  MRI *ychunk, *mritmp;
+
+  ychunk = MRIreadRegion(yfile, region, -1, -1);
+  if (ychunk == NULL) return (NULL);
+  if (ychunk->nframes != nf) {
+    printf("ERROR: %s has %d frames, expected %d\n", yfile, ychunk->nframes, nf);
+    MRIfree(&ychunk);
+    return (NULL);
+  }
+  if (ychunk->type != MRI_FLOAT) {
+    mritmp = MRISeqchangeType(ychunk, MRI_FLOAT, 0, 0, 0);
+    MRIfree(&ychunk);
+    ychunk = mritmp;
+  }
+  return (ychunk);
+}
+
+/*---------------------------------------------------------------------
+  MRIframeBinarizeStream() - same as MRIframeBinarize() but reads y
+  from yfile in slabs of at most MaxMB megabytes instead of having all
+  of it in memory. yhdr is a header-only volume describing yfile (eg,
+  from MRIreadHeader()). Returns the mask (allocated if mask is NULL),
+  or NULL on error.
+  --------------------------------------------------------------------*/
+MRI *MRIframeBinarizeStream(const char *yfile, MRI *yhdr, double MaxMB, double thresh, MRI *mask)
+{
+  int c, r, s, f, n, axis, dimlen, nper, start, premask;
+  long nvoxunit;
+  MRI *ychunk;
+  MRI_REGION region;
+
+  premask = (mask != NULL);
+  if (!premask) {
+    mask = MRIcloneBySpace(yhdr, MRI_FLOAT, 1);
+    MRIclear(mask);
+  }
+
+  MRIstreamSlabs(yhdr, MaxMB, &axis, &dimlen, &nper, &nvoxunit);
+  for (start = 0; start < dimlen; start += nper) {
+    MRIstreamSlabRegion(yhdr, axis, dimlen, nper, start, &region);
+    ychunk = MRIstreamReadSlab(yfile, &region, yhdr->nframes);
+    if (ychunk == NULL) {
+      if (!premask) MRIfree(&mask);
+      return (NULL);
+    }
+    // c, r, s index the slab; the mask is at c+x, r+y, s+z
+    for (c = 0; c < region.dx; c++) {
+      for (r = 0; r < region.dy; r++) {
+        for (s = 0; s < region.dz; s++) {
+          if (premask && MRIgetVoxVal(mask, c + region.x, r + region.y, s + region.z, 0) < 0.5) continue;
+          n = 0;
+          for (f = 0; f < ychunk->nframes; f++)
+            if (fabs(MRIFseq_vox(ychunk, c, r, s, f)) > thresh) n++;
+          MRIsetVoxVal(mask, c + region.x, r + region.y, s + region.z, 0, n == ychunk->nframes);
+        }
+      }
+    }
+    MRIfree(&ychunk);
+  }
+  return (mask);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmFitAndTestStream() - same as MRIglmFitAndTest() but without
+  ever having all of y in memory. mriglm->y must be a header-only
+  volume (eg, from MRIreadHeader()) describing yfile. y is read from
+  yfile in slabs (see MRIstreamSlabs()), and each slab is fit and
+  tested before the next is read. The slab and the batch of voxels
+  being fit each take at most half of MaxMB megabytes. The design
+  matrix must be the same at all voxels (no weight volume, per-voxel
+  regressors, frame mask, or ffx), so the voxels of each slab are fit
+  and tested in batches with MRIglmFitAndTestBatch(). The residual is
+  not kept (and so neither yhat nor eres can be saved). The outputs are
+  allocated at full size. Pruning has to be done beforehand, eg, with
+  MRIframeBinarizeStream(). Returns 0 on success, 1 on error.
+  --------------------------------------------------------------------*/
+int MRIglmFitAndTestStream(MRIGLM *mriglm, const char *yfile, double MaxMB)
+{
+  int nf, axis, dimlen, nper, start, nslabs;
+  long nvoxunit;
+  MRI *yhdr, *ychunk;
+  MRI_REGION region;
+  GLMMAT *glm = mriglm->glm;
+
+  if (mriglm->w != NULL || mriglm->npvr != 0 || mriglm->FrameMask != NULL || mriglm->yffxvar != NULL ||
+      mriglm->yhatsave) {
+    printf("ERROR: MRIglmFitAndTestStream(): cannot stream with per-voxel X, ffx, or yhat\n");
+    return (1);
+  }
+
+  yhdr = mriglm->y;
+  nf = yhdr->nframes;
+  mriglm->nregtot = MRIglmNRegTot(mriglm);
+  mriglm->pervoxflag = 0;
+
+  GLMcMatrices(glm);
+  GLMallocX(glm, nf, mriglm->nregtot);
+  GLMallocY(glm);
+
+  if (mriglm->beta == NULL) MRIglmAllocOutputs(mriglm, 0);
+
+  // half of the budget for the slab, half for the batch being fit
+  nslabs = MRIstreamSlabs(yhdr, MaxMB / 2, &axis, &dimlen, &nper, &nvoxunit);
+  printf("Streaming y in %d slabs of %d (%g MB each)\n",
+         nslabs,
+         nper,
+         nper * nvoxunit * sizeof(float) * nf / (1024.0 * 1024.0));
+
+  mriglm->n_ill_cond = 0;
+  for (start = 0; start < dimlen; start += nper) {
+    MRIstreamSlabRegion(yhdr, axis, dimlen, nper, start, &region);
+    ychunk = MRIstreamReadSlab(yfile, &region, nf);
+    if (ychunk == NULL) {
+      mriglm->y = yhdr;
+      return (1);
+    }
+    mriglm->y = ychunk;
+
+    if (MRIglmFitAndTestBatch(mriglm, ychunk, region.x, region.y, region.z, MaxMB / 2)) {
+      MRIfree(&ychunk);
+      mriglm->y = yhdr;
+      return (1);
+    }
+    MRIfree(&ychunk);
+    if (Gdiag_no > 0) {
+      printf("%d/%d ", MIN(start + nper, dimlen), dimlen);
+      fflush(stdout);
+    }
+  }
+  if (Gdiag_no > 0) printf("\n");
+  mriglm->y = yhdr;
+
+  return (0);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmCopyDesign() - creates a new MRIGLM with the same inputs and
+  design as src so that it can be fit and tested independently of src,
+  eg, in another thread. The input volumes (y, mask, w, pvr, FrameMask,
+  yffxvar) are shared with src. Xg, wg, and the contrasts are copied.
+  No outputs are allocated. Free with MRIglmFreeCopy().
+  --------------------------------------------------------------------*/
+MRIGLM *MRIglmCopyDesign(MRIGLM *src)
+{
+  int n;
+  MRIGLM *mriglm;
+  GLMMAT *glm;
+
+  mriglm = (MRIGLM *)calloc(sizeof(MRIGLM), 1);
+  mriglm->y = src->y;
+  mriglm->Xg = MatrixCopy(src->Xg, NULL);
+  mriglm->npvr = src->npvr;
+  for (n = 0; n < src->npvr; n++) mriglm->pvr[n] = src->pvr[n];
+  mriglm->nregtot = src->nregtot;
+  mriglm->w = src->w;
+  if (src->wg) mriglm->wg = MatrixCopy(src->wg, NULL);
+  mriglm->skipweight = src->skipweight;
+  mriglm->mask = src->mask;
+  mriglm->yffxvar = src->yffxvar;
+  mriglm->ffxdof = src->ffxdof;
+  mriglm->condsave = src->condsave;
+  mriglm->yhatsave = src->yhatsave;
+  mriglm->FrameMask = src->FrameMask;
+
+  mriglm->glm = glm = GLMalloc();
+  glm->X = MatrixCopy(src->Xg, NULL);
+  glm->dof = src->glm->dof;
+  glm->AllowZeroDOF = src->glm->AllowZeroDOF;
+  glm->ffxdof = src->glm->ffxdof;
+  glm->ReScaleX = src->glm->ReScaleX;
+  glm->DoPCC = src->glm->DoPCC;
+  glm->ncontrasts = src->glm->ncontrasts;
+  for (n = 0; n < glm->ncontrasts; n++) {
+    glm->C[n] = MatrixCopy(src->glm->C[n], NULL);
+    glm->Cname[n] = src->glm->Cname[n];
+    glm->ypmfflag[n] = src->glm->ypmfflag[n];
+    glm->UseGamma0[n] = src->glm->UseGamma0[n];
+    if (src->glm->gamma0[n]) glm->gamma0[n] = MatrixCopy(src->glm->gamma0[n], NULL);
+  }
+  return (mriglm);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmFreeCopy() - frees an MRIGLM created by MRIglmCopyDesign()
+  along with any outputs it has. The shared inputs are not freed.
+  --------------------------------------------------------------------*/
+int MRIglmFreeCopy(MRIGLM **pmriglm)
+{
+  int n;
+  MRIGLM *mriglm = *pmriglm;
+
+  if (mriglm->beta) MRIfree(&mriglm->beta);
+  if (mriglm->eres) MRIfree(&mriglm->eres);
+  if (mriglm->rvar) MRIfree(&mriglm->rvar);
+  if (mriglm->yhat) MRIfree(&mriglm->yhat);
+  if (mriglm->cond) MRIfree(&mriglm->cond);
+  for (n = 0; n < mriglm->glm->ncontrasts; n++) {
+    if (mriglm->gamma[n]) MRIfree(&mriglm->gamma[n]);
+    if (mriglm->gammaVar[n]) MRIfree(&mriglm->gammaVar[n]);
+    if (mriglm->F[n]) MRIfree(&mriglm->F[n]);
+    if (mriglm->p[n]) MRIfree(&mriglm->p[n]);
+    if (mriglm->z[n]) MRIfree(&mriglm->z[n]);
+    if (mriglm->pcc[n]) MRIfree(&mriglm->pcc[n]);
+    if (mriglm->ypmf[n]) MRIfree(&mriglm->ypmf[n]);
+    mriglm->glm->Cname[n] = NULL;  // shared with the source
+  }
+  MatrixFree(&mriglm->Xg);
+  if (mriglm->wg) MatrixFree(&mriglm->wg);
+  GLMfree(&mriglm->glm);
+  free(mriglm);
+  *pmriglm = NULL;
+  return (0);
+}
+
 /*---------------------------------------------------------------------
   MRIglmFit() - fits glm (beta and rvar) on a voxel-by-voxel basis.
   Made to be followed by MRIglmTest(). See notes on MRIglmFitandTest()
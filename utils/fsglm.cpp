@@ -115,6 +115,19 @@
   End voxel loop
   12. GLMfree(&glm);
 
+  Workflow 3: X fixed for all y, many y's at once
+  1-6. As in Workflow 1
+  7. gb = GLMbatchAlloc(glm,nvox,SaveYhat,SaveEres) - precomputes
+  everything that does not depend on y (eg, inv(X'*X)*X'). Use
+  GLMbatchNVox() to size the batch to a memory budget.
+  For each batch of up to nvox voxels:
+  8. Fill gb->y (one column per voxel)
+  9. GLMbatchFitAndTest(glm,gb,nv) - same results as GLMfit() and
+  GLMtest() for each column, computed with matrix-matrix products
+  10. Save your results
+  End batch loop
+  11. GLMbatchFree(&gb); GLMfree(&glm);
+
   Notes:
   1. Any weighting of y and X must be done prior to GLMfit().
 
@@ -123,6 +136,7 @@
 #include <string>
 #include <sstream>
 #include <iomanip>
+#include <vector>
 
 #include <float.h>
 #include <math.h>
@@ -133,6 +147,7 @@
 
 #include "diag.h"
 #include "fsglm.h"
+#include "romp_support.h"
 #include "timer.h"
 #include "numerics.h"
 #include "randomfields.h"
@@ -217,6 +232,7 @@ GLMMAT *GLMalloc(void)
     glm->igCVM[n] = NULL;
     glm->gammat[n] = NULL;
     glm->gtigCVM[n] = NULL;
+    glm->Fm[n] = NULL;
   }
   return (glm);
 }
@@ -319,6 +335,7 @@ int GLMfree(GLMMAT **pglm)
     if (glm->gamma0[n]) MatrixFree(&glm->gamma0[n]);
     if (glm->gammat[n]) MatrixFree(&glm->gammat[n]);
     if (glm->gtigCVM[n]) MatrixFree(&glm->gtigCVM[n]);
+    if (glm->Fm[n]) MatrixFree(&glm->Fm[n]);
     if (glm->XCt[n]) MatrixFree(&glm->XCt[n]);
     if (glm->Dt[n]) MatrixFree(&glm->Dt[n]);
     if (glm->XDt[n]) MatrixFree(&glm->XDt[n]);
@@ -492,13 +509,7 @@ int GLMtest(GLMMAT *glm)
 {
   int n;
   double dtmp;
-  static MATRIX *F = NULL, *mtmp = NULL;
-  static RFS *rfs = NULL;
-
-  if (rfs == NULL) {
-    rfs = RFspecInit(0, NULL);
-    rfs->name = strcpyalloc("z");
-  }
+  MATRIX *mtmp;
 
   if (glm->ill_cond_flag) {
     // If it's ill cond, just return F=0
@@ -537,11 +548,11 @@ int GLMtest(GLMMAT *glm)
     if (mtmp != NULL && glm->rvar > FLT_MIN) {
       glm->igCVM[n] = MatrixScalarMul(glm->igCVM[n], 1.0 / dtmp, glm->igCVM[n]);
       glm->gtigCVM[n] = MatrixMultiplyD(glm->gammat[n], glm->igCVM[n], glm->gtigCVM[n]);
-      F = MatrixMultiplyD(glm->gtigCVM[n], glm->gamma[n], F);
-      if(F->rptr[1][1] >= 0){
-	glm->F[n] = F->rptr[1][1];
+      glm->Fm[n] = MatrixMultiplyD(glm->gtigCVM[n], glm->gamma[n], glm->Fm[n]);
+      if(glm->Fm[n]->rptr[1][1] >= 0){
+	glm->F[n] = glm->Fm[n]->rptr[1][1];
 	glm->p[n] = sc_cdf_fdist_Q(glm->F[n], glm->C[n]->rows, glm->dof);
-	glm->z[n] = RFp2StatVal(rfs, glm->p[n] / 2.0);
+	glm->z[n] = sc_cdf_gaussian_Qinv(glm->p[n] / 2.0, 1);  // the "z" random field
       }
       else {
 	// Neg F can sometimes happen when the design matrix is ill-cond. One example
@@ -588,7 +599,7 @@ int GLMtestFFx(GLMMAT *glm)
 {
   double val;
   int n, r, c;
-  static MATRIX *F = NULL, *mtmp = NULL;
+  MATRIX *mtmp;
   MATRIX *Xs = NULL, *Xst = NULL, *CiXtXXs = NULL, *CiXtXXst = NULL;
 
   if (glm->ill_cond_flag) {
@@ -620,8 +631,8 @@ int GLMtestFFx(GLMMAT *glm)
     mtmp = MatrixInverse(glm->gCVM[n], glm->igCVM[n]);
     if (mtmp != NULL) {
       glm->gtigCVM[n] = MatrixMultiplyD(glm->gammat[n], glm->igCVM[n], glm->gtigCVM[n]);
-      F = MatrixMultiplyD(glm->gtigCVM[n], glm->gamma[n], F);
-      glm->F[n] = F->rptr[1][1];
+      glm->Fm[n] = MatrixMultiplyD(glm->gtigCVM[n], glm->gamma[n], glm->Fm[n]);
+      glm->F[n] = glm->Fm[n]->rptr[1][1];
       glm->p[n] = sc_cdf_fdist_Q(glm->F[n], glm->C[n]->rows, glm->ffxdof);
       glm->igCVM[n] = mtmp;
     }
@@ -641,17 +652,307 @@ int GLMtestFFx(GLMMAT *glm)
   return (0);
 }
 
+/*---------------------------------------------------------------
+  GLMbatchAlloc() - allocates a batch of nvox voxels for a GLM whose
+  X is the same for all voxels and precomputes everything that does
+  not depend on y. GLMcMatrices() and GLMxMatrices() must have been
+  run (and glm->X must not be ill-conditioned). yhat and eres are
+  only kept if SaveYhat and SaveEres are set.
+  ---------------------------------------------------------------*/
+GLMBATCH *GLMbatchAlloc(GLMMAT *glm, int nvox, int SaveYhat, int SaveEres)
+{
+  GLMBATCH *gb;
+  MATRIX *P, *M, *R, *Mtmp;
+  int n, nf, np, J, f, k, j;
+
+  if (glm->ill_cond_flag) {
+    printf("ERROR: GLMbatchAlloc(): X is ill-conditioned\n");
+    return (NULL);
+  }
+
+  gb = (GLMBATCH *)calloc(sizeof(GLMBATCH), 1);
+  gb->nvox = nvox;
+  gb->nframes = nf = glm->X->rows;
+  gb->nregs = np = glm->X->cols;
+  gb->ncontrasts = glm->ncontrasts;
+
+  gb->y = (double *)calloc((size_t)nf * nvox, sizeof(double));
+  gb->beta = (double *)calloc((size_t)np * nvox, sizeof(double));
+  if (SaveYhat) gb->yhat = (double *)calloc((size_t)nf * nvox, sizeof(double));
+  if (SaveEres) gb->eres = (double *)calloc((size_t)nf * nvox, sizeof(double));
+  gb->rvar = (double *)calloc(nvox, sizeof(double));
+
+  gb->X = (double *)calloc((size_t)nf * np, sizeof(double));
+  for (f = 0; f < nf; f++)
+    for (k = 0; k < np; k++) gb->X[f * np + k] = glm->X->rptr[f + 1][k + 1];
+
+  P = MatrixMultiplyD(glm->iXtX, glm->Xt, NULL);
+  gb->P = (double *)calloc((size_t)np * nf, sizeof(double));
+  for (k = 0; k < np; k++)
+    for (f = 0; f < nf; f++) gb->P[k * nf + f] = P->rptr[k + 1][f + 1];
+  MatrixFree(&P);
+
+  for (n = 0; n < glm->ncontrasts; n++) {
+    J = glm->C[n]->rows;
+    gb->gamma[n] = (double *)calloc((size_t)J * nvox, sizeof(double));
+    if (J == 1) gb->gammaVar[n] = (double *)calloc(nvox, sizeof(double));
+    gb->F[n] = (double *)calloc(nvox, sizeof(double));
+    gb->p[n] = (double *)calloc(nvox, sizeof(double));
+    gb->z[n] = (double *)calloc(nvox, sizeof(double));
+
+    gb->C[n] = (double *)calloc((size_t)J * np, sizeof(double));
+    for (j = 0; j < J; j++)
+      for (k = 0; k < np; k++) gb->C[n][j * np + k] = glm->C[n]->rptr[j + 1][k + 1];
+    gb->CiXtXCt[n] = (double *)calloc((size_t)J * J, sizeof(double));
+    for (j = 0; j < J * J; j++) gb->CiXtXCt[n][j] = glm->CiXtXCt[n]->rptr[j / J + 1][j % J + 1];
+    M = MatrixInverse(glm->CiXtXCt[n], NULL);
+    if (M != NULL) {
+      gb->iCiXtXCt[n] = (double *)calloc((size_t)J * J, sizeof(double));
+      for (j = 0; j < J * J; j++) gb->iCiXtXCt[n][j] = M->rptr[j / J + 1][j % J + 1];
+      MatrixFree(&M);
+    }
+    if (glm->UseGamma0[n]) {
+      gb->gamma0[n] = (double *)calloc(J, sizeof(double));
+      for (j = 0; j < J; j++) gb->gamma0[n][j] = glm->gamma0[n]->rptr[j + 1][1];
+    }
+    if (glm->ypmfflag[n]) {
+      gb->ypmf[n] = (double *)calloc((size_t)glm->Mpmf[n]->rows * nvox, sizeof(double));
+      gb->Mpmf[n] = (double *)calloc((size_t)glm->Mpmf[n]->rows * np, sizeof(double));
+      for (j = 0; j < glm->Mpmf[n]->rows; j++)
+        for (k = 0; k < np; k++) gb->Mpmf[n][j * np + k] = glm->Mpmf[n]->rptr[j + 1][k + 1];
+    }
+    if (J == 1 && glm->Dt[n] != NULL) {
+      gb->pcc[n] = (double *)calloc(nvox, sizeof(double));
+      R = MatrixMultiplyD(glm->RD[n], glm->X, NULL);
+      Mtmp = MatrixMultiplyD(glm->Xcdt[n], R, NULL);
+      gb->pccw[n] = (double *)calloc(np, sizeof(double));
+      gb->pccs[n] = (double *)calloc(np, sizeof(double));
+      gb->pccG[n] = (double *)calloc((size_t)np * np, sizeof(double));
+      for (k = 0; k < np; k++) {
+        gb->pccw[n][k] = Mtmp->rptr[1][k + 1];
+        for (f = 0; f < nf; f++) gb->pccs[n][k] += R->rptr[f + 1][k + 1];
+      }
+      MatrixFree(&Mtmp);
+      Mtmp = MatrixTranspose(R, NULL);
+      M = MatrixMultiplyD(Mtmp, R, NULL);
+      for (j = 0; j < np * np; j++) gb->pccG[n][j] = M->rptr[j / np + 1][j % np + 1];
+      MatrixFree(&M);
+      MatrixFree(&Mtmp);
+      MatrixFree(&R);
+    }
+  }
+  return (gb);
+}
+
+/*---------------------------------------------------------------
+  GLMbatchNVox() - number of voxels in a batch from GLMbatchAlloc()
+  (with the same glm, SaveYhat, and SaveEres) that takes at most MaxMB
+  megabytes, limited to 1 to nvoxmax. Everything allocated per voxel
+  is counted; what only depends on X and C is small and is not.
+  ---------------------------------------------------------------*/
+int GLMbatchNVox(GLMMAT *glm, double MaxMB, int SaveYhat, int SaveEres, int nvoxmax)
+{
+  int n, J;
+  long ndouble, nvox;
+
+  // y, beta, yhat, eres, rvar
+  ndouble = (long)glm->X->rows * (1 + (SaveYhat != 0) + (SaveEres != 0)) + glm->X->cols + 1;
+  for (n = 0; n < glm->ncontrasts; n++) {
+    // gamma, F, p, z, gammaVar, pcc, ypmf
+    J = glm->C[n]->rows;
+    ndouble += J + 3;
+    if (J == 1) ndouble += 1 + (glm->Dt[n] != NULL);
+    if (glm->ypmfflag[n]) ndouble += glm->Mpmf[n]->rows;
+  }
+
+  nvox = (long)(MaxMB * 1024 * 1024 / (sizeof(double) * ndouble));
+  if (nvox > nvoxmax) nvox = nvoxmax;
+  if (nvox < 1) nvox = 1;
+  return ((int)nvox);
+}
+
+/*---------------------------------------------------------------
+  GLMbatchFree() - frees everything allocated by GLMbatchAlloc()
+  ---------------------------------------------------------------*/
+int GLMbatchFree(GLMBATCH **pgb)
+{
+  int n;
+  GLMBATCH *gb = *pgb;
+
+  free(gb->y);
+  free(gb->beta);
+  free(gb->yhat);
+  free(gb->eres);
+  free(gb->rvar);
+  free(gb->X);
+  free(gb->P);
+  for (n = 0; n < gb->ncontrasts; n++) {
+    free(gb->gamma[n]);
+    free(gb->gammaVar[n]);
+    free(gb->F[n]);
+    free(gb->p[n]);
+    free(gb->z[n]);
+    free(gb->pcc[n]);
+    free(gb->ypmf[n]);
+    free(gb->C[n]);
+    free(gb->CiXtXCt[n]);
+    free(gb->iCiXtXCt[n]);
+    free(gb->Mpmf[n]);
+    free(gb->gamma0[n]);
+    free(gb->pccw[n]);
+    free(gb->pccs[n]);
+    free(gb->pccG[n]);
+  }
+  free(gb);
+  *pgb = NULL;
+  return (0);
+}
+
+/*---------------------------------------------------------------
+  GLMbatchFitAndTest() - fits and tests the first nv columns of
+  gb->y. Gives the same results as running GLMfit() and GLMtest()
+  on each column (within float precision), but beta, yhat, and eres
+  are computed as matrix-matrix products over blocks of voxels and
+  everything that only depends on X and C is done once in
+  GLMbatchAlloc(). Blocks are processed in parallel.
+  ---------------------------------------------------------------*/
+int GLMbatchFitAndTest(GLMMAT *glm, GLMBATCH *gb, int nv)
+{
+  int nblocks, b;
+  int nf = gb->nframes, np = gb->nregs, N = gb->nvox;
+
+  if (nv > gb->nvox) {
+    printf("ERROR: GLMbatchFitAndTest(): nv=%d > nvox=%d\n", nv, gb->nvox);
+    return (1);
+  }
+
+  nblocks = (nv + GLMBATCH_BLOCK - 1) / GLMBATCH_BLOCK;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (b = 0; b < nblocks; b++) {
+    ROMP_PFLB_begin
+    int v, v0, v1, f, k, n, i, j, J;
+    double a, dtmp, q, yh[GLMBATCH_BLOCK];
+    double *bk, *yf;
+    std::vector<double> g(np);  // gamma of one voxel (C rows <= cols of X)
+
+    v0 = b * GLMBATCH_BLOCK;
+    v1 = MIN(v0 + GLMBATCH_BLOCK, nv);
+
+    // beta = inv(X'*X)*X'*y
+    for (k = 0; k < np; k++) {
+      bk = &gb->beta[k * N];
+      for (v = v0; v < v1; v++) bk[v] = 0;
+      for (f = 0; f < nf; f++) {
+        a = gb->P[k * nf + f];
+        yf = &gb->y[f * N];
+        for (v = v0; v < v1; v++) bk[v] += a * yf[v];
+      }
+    }
+
+    // yhat = X*beta, eres = y - yhat, rvar = eres'*eres/dof
+    for (v = v0; v < v1; v++) gb->rvar[v] = 0;
+    for (f = 0; f < nf; f++) {
+      for (v = v0; v < v1; v++) yh[v - v0] = 0;
+      for (k = 0; k < np; k++) {
+        a = gb->X[f * np + k];
+        bk = &gb->beta[k * N];
+        for (v = v0; v < v1; v++) yh[v - v0] += a * bk[v];
+      }
+      yf = &gb->y[f * N];
+      for (v = v0; v < v1; v++) {
+        a = yf[v] - yh[v - v0];
+        gb->rvar[v] += a * a;
+        if (gb->yhat) gb->yhat[f * N + v] = yh[v - v0];
+        if (gb->eres) gb->eres[f * N + v] = a;
+      }
+    }
+    for (v = v0; v < v1; v++) {
+      gb->rvar[v] /= glm->dof;
+      if (gb->rvar[v] < FLT_MIN) gb->rvar[v] = FLT_MIN;
+    }
+
+    // Contrasts, see GLMtest()
+    for (n = 0; n < gb->ncontrasts; n++) {
+      J = glm->C[n]->rows;
+      for (v = v0; v < v1; v++) {
+        for (j = 0; j < J; j++) {
+          g[j] = 0;
+          for (k = 0; k < np; k++) g[j] += gb->C[n][j * np + k] * gb->beta[k * N + v];
+          if (gb->gamma0[n]) g[j] -= gb->gamma0[n][j];
+          gb->gamma[n][j * N + v] = g[j];
+        }
+        if (gb->rvar[v] < 2 * FLT_MIN)
+          dtmp = 1e10 * J;
+        else
+          dtmp = gb->rvar[v] * J;
+        if (J == 1) gb->gammaVar[n][v] = gb->CiXtXCt[n][0] * dtmp;
+
+        gb->F[n][v] = 0;
+        gb->p[n][v] = 1;
+        gb->z[n][v] = 0;
+        if (gb->pcc[n]) gb->pcc[n][v] = 0;
+        if (gb->iCiXtXCt[n] != NULL && gb->rvar[v] > FLT_MIN) {
+          q = 0;
+          for (i = 0; i < J; i++)
+            for (j = 0; j < J; j++) q += g[i] * gb->iCiXtXCt[n][i * J + j] * g[j];
+          q /= dtmp;
+          if (q >= 0) {
+            gb->F[n][v] = q;
+            gb->p[n][v] = sc_cdf_fdist_Q(q, J, glm->dof);
+            gb->z[n][v] = sc_cdf_gaussian_Qinv(gb->p[n][v] / 2.0, 1);
+          }
+          if (J == 1 && g[0] < 0) gb->z[n][v] *= -1;
+
+          if (gb->pcc[n]) {
+            double xy = 0, sy = 0, sy2 = 0, sx = glm->sumXcd[n]->rptr[1][1], sx2 = glm->sumXcd2[n]->rptr[1][1];
+            for (k = 0; k < np; k++) {
+              a = gb->beta[k * N + v];
+              xy += gb->pccw[n][k] * a;
+              sy += gb->pccs[n][k] * a;
+              for (i = 0; i < np; i++) sy2 += a * gb->pccG[n][k * np + i] * gb->beta[i * N + v];
+            }
+            sy2 += glm->dof * gb->rvar[v];
+            gb->pcc[n][v] = (xy - sx * sy) / sqrt((sx2 - sx * sx) * (sy2 - sy * sy));
+          }
+        }
+        if (gb->ypmf[n]) {
+          for (j = 0; j < glm->Mpmf[n]->rows; j++) {
+            a = 0;
+            for (k = 0; k < np; k++) a += gb->Mpmf[n][j * np + k] * gb->beta[k * N + v];
+            gb->ypmf[n][j * N + v] = a;
+          }
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (0);
+}
+
 /*-----------------------------------------------------------
   GLMprofile() - this can be used as both a profile and
   a memory leak tester. Design matrix is nrows-by-ncols
   (which forces y to be nrows-by-1). ncon contrasts are
   tested, where each contrast matrix is 2-by-ncols. Returns
-  the number of msec used.
+  the number of msec used. It then benchmarks the shared-X case
+  by fitting and testing niters voxels with one X, both one voxel
+  at a time (GLMfit()/GLMtest()) and batched (GLMbatchFitAndTest()),
+  and reports voxels/sec for each along with the largest relative
+  difference in F between the two.
   -----------------------------------------------------------*/
 int GLMprofile(int nrows, int ncols, int ncon, int niters)
 {
-  int n, c, msec;
+  int n, c, msec, v, f, v0, nv;
+  double msecvox, msecbatch, d, dmax;
   GLMMAT *glm;
+  GLMBATCH *gb;
+  MATRIX *Y;
+  float *Fvox;
   Timer then;
 
   for (n = 0; n < niters; n++) {
@@ -681,6 +982,56 @@ int GLMprofile(int nrows, int ncols, int ncon, int niters)
       msec,
       (float)msec / niters);
 
+  // Shared X: niters voxels, per-voxel vs batched
+  glm = GLMalloc();
+  glm->X = MatrixDRand48(nrows, ncols, NULL);
+  glm->ncontrasts = ncon;
+  for (c = 0; c < glm->ncontrasts; c++) {
+    glm->C[c] = MatrixDRand48(2, ncols, NULL);
+    glm->ypmfflag[c] = 1;
+  }
+  GLMcMatrices(glm);
+  GLMallocY(glm);
+  GLMxMatrices(glm);
+  Y = MatrixDRand48(nrows, niters, NULL);
+  Fvox = (float *)calloc(niters, sizeof(float));
+
+  then.reset();
+  for (v = 0; v < niters; v++) {
+    for (f = 0; f < nrows; f++) glm->y->rptr[f + 1][1] = Y->rptr[f + 1][v + 1];
+    GLMfit(glm);
+    GLMtest(glm);
+    if (ncon > 0) Fvox[v] = glm->F[0];
+  }
+  msecvox = then.milliseconds();
+
+  then.reset();
+  gb = GLMbatchAlloc(glm, MIN(niters, 4096), 0, 0);
+  dmax = 0;
+  for (v0 = 0; v0 < niters; v0 += gb->nvox) {
+    nv = MIN(gb->nvox, niters - v0);
+    for (f = 0; f < nrows; f++)
+      for (v = 0; v < nv; v++) gb->y[f * gb->nvox + v] = Y->rptr[f + 1][v0 + v + 1];
+    GLMbatchFitAndTest(glm, gb, nv);
+    for (v = 0; v < nv && ncon > 0; v++) {
+      d = fabs(gb->F[0][v] - Fvox[v0 + v]) / (fabs(Fvox[v0 + v]) + FLT_MIN);
+      if (d > dmax) dmax = d;
+    }
+  }
+  msecbatch = then.milliseconds();
+  GLMbatchFree(&gb);
+
+  printf("GLMprofile: shared X, %d voxels: per-voxel %g vox/sec, batched %g vox/sec (%d threads), maxFdiff=%g\n",
+         niters,
+         niters / (MAX(msecvox, 1) / 1000.0),
+         niters / (MAX(msecbatch, 1) / 1000.0),
+         omp_get_max_threads(),
+         dmax);
+
+  MatrixFree(&Y);
+  free(Fvox);
+  GLMfree(&glm);
+
   return (msec);
 }
 
@@ -28,9 +28,16 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
 
 #include "faster_variants.h"
 #include "romp_support.h"
@@ -48,6 +55,7 @@
 #include "mrimorph.h"
 #include "mrisegment.h"
 #include "numerics.h"
+#include "pgzip.h"
 #include "proto.h"
 #include "tags.h"
 #include "talairachex.h"
@@ -186,6 +194,16 @@ float getPrior(GCA_PRIOR *gcap, int label);
 GCA_PRIOR *getGCAP(GCA *gca, MRI *mri, TRANSFORM *transform, int xv, int yv, int zv);
 GCA_PRIOR *getGCAPfloat(GCA *gca, MRI *mri, TRANSFORM *transform, float xv, float yv, float zv);
 static int gcaNodeToPrior(const GCA *gca, int xn, int yn, int zn, int *pxp, int *pyp, int *pzp);
+static void gcaFree(const GCA *gca, void *p);
+static void gcaFreeGCs(const GCA *gca, GC1D *gcs, int nlabels);
+static int gcaInvertCovariance(const float *covars, int ninputs, double *inv_covars, double *phalf_log_det);
+static double gcaMahDistInverse(const double *inv_covars, const float *means, const float *vals, int ninputs);
+static double gcaMahDistMatrix(const GC1D *gc, const float *vals, int ninputs);
+static int gcaInvertSampleCovariance(const float *covars, int ninputs, double *inv_covars, double *phalf_log_det);
+static double gcaSampleMahDistInverse(const double *inv_covars, const float *means, const float *vals, int ninputs);
+static void gcaDensitiesCache(GCA *gca);
+static double gcaNodeClassLogDensity(GCA *gca, int xn, int yn, int zn, int n, float *vals);
+static void gcaFlatRelease(GCA *gca);
 static HISTOGRAM *gcaHistogramSamples(
     GCA *gca, GCA_SAMPLE *gcas, MRI *mri, TRANSFORM *transform, int nsamples, HISTOGRAM *histo, int frame);
 int GCApriorToNode(const GCA *gca, int xp, int yp, int zp, int *pxn, int *pyn, int *pzn);
@@ -1612,7 +1630,7 @@ int GCAfree(GCA **pgca)
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
-        GCANfree(&gca->nodes[x][y][z], gca->ninputs);
+        GCANfree(gca, &gca->nodes[x][y][z]);
       }
       free(gca->nodes[x][y]);
     }
@@ -1623,8 +1641,8 @@ int GCAfree(GCA **pgca)
   for (x = 0; x < gca->prior_width; x++) {
     for (y = 0; y < gca->prior_height; y++) {
       for (z = 0; z < gca->prior_depth; z++) {
-        free(gca->priors[x][y][z].labels);
-        free(gca->priors[x][y][z].priors);
+        gcaFree(gca, gca->priors[x][y][z].labels);
+        gcaFree(gca, gca->priors[x][y][z].priors);
       }
       free(gca->priors[x][y]);
     }
@@ -1632,6 +1650,8 @@ int GCAfree(GCA **pgca)
   }
 
   free(gca->priors);
+  GCAdensitiesFree(&gca->densities);
+  gcaFlatRelease(gca);
   GCAcleanup(gca);
 
   free(gca);
@@ -1639,11 +1659,11 @@ int GCAfree(GCA **pgca)
   return (NO_ERROR);
 }
 
-int GCANfree(GCA_NODE *gcan, int ninputs)
+int GCANfree(const GCA *gca, GCA_NODE *gcan)
 {
   if (gcan->nlabels) {
-    free(gcan->labels);
-    free_gcs(gcan->gcs, gcan->nlabels, ninputs);
+    gcaFree(gca, gcan->labels);
+    gcaFreeGCs(gca, gcan->gcs, gcan->nlabels);
   }
   return (NO_ERROR);
 }
@@ -1651,8 +1671,8 @@ int GCANfree(GCA_NODE *gcan, int ninputs)
 int GCAPfree(GCA_PRIOR *gcap)
 {
   if (gcap->nlabels) {
-    free(gcap->labels);
-    free(gcap->priors);
+    gcaFree(NULL, gcap->labels);
+    gcaFree(NULL, gcap->priors);
   }
   return (NO_ERROR);
 }
@@ -1703,6 +1723,7 @@ int GCAtrainCovariances(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *t
   int xp, yp, zp, holes_filled = 0;
   MRI *mri_mapped;
 
+  GCAdensitiesInvalidate(gca);
   /* convert transform to voxel coordinates */
 
   /* go through each voxel in the input volume and find the canonical
@@ -1847,6 +1868,7 @@ int GCAtrain(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform, G
   GCA_NODE *gcan;
   MRI *mri_mapped;
 
+  GCAdensitiesInvalidate(gca);
   gca->total_training++;
   mri_mapped = MRIalloc(gca->prior_width, gca->prior_height, gca->prior_depth, MRI_UCHAR);
   if (first_time) {
@@ -2067,6 +2089,741 @@ int GCAtrain(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform, G
   return (NO_ERROR);
 }
 
+/*-----------------------------------------------------------------------
+  Contiguous storage of the node and prior arrays.
+
+  A GCA read from disk keeps the per-node and per-prior label, class and
+  gibbs arrays in one image (compressed-row layout, node/prior n at
+  (x*height + y)*depth + z) instead of in millions of small allocations.
+  The GCA_NODE/GCA_PRIOR/GC1D pointers point into the image so none of
+  the accessors change. Code that grows a node or prior reallocates it on
+  the heap as before; gcaFree() knows not to free pointers that still
+  point into an image. The same image is the on-disk .gcaf format, which
+  is mmapped by GCAread().
+  -----------------------------------------------------------------------*/
+#define GCA_FLAT_MAGIC "GCAFLAT"
+#define GCA_FLAT_VERSION 1
+#define GCA_FLAT_BYTEORDER 0x01020304
+
+#define GCA_FLAT_HEAP 0
+#define GCA_FLAT_MMAP 1
+
+enum {
+  GCA_FLAT_NODE_OFFSET = 0,
+  GCA_FLAT_NODE_TRAINING,
+  GCA_FLAT_NODE_LABELS,
+  GCA_FLAT_MEANS,
+  GCA_FLAT_COVARS,
+  GCA_FLAT_GIBBS_NLABELS,
+  GCA_FLAT_GIBBS_LABELS,
+  GCA_FLAT_GIBBS_PRIORS,
+  GCA_FLAT_PRIOR_OFFSET,
+  GCA_FLAT_PRIOR_TRAINING,
+  GCA_FLAT_PRIOR_LABELS,
+  GCA_FLAT_PRIORS,
+  GCA_FLAT_CTAB,
+  GCA_FLAT_NARRAYS
+};
+
+typedef struct
+{
+  char magic[8];
+  int32_t version;
+  int32_t byteorder;  // images are in native byte order
+  float prior_spacing, node_spacing;
+  int32_t prior_width, prior_height, prior_depth;
+  int32_t node_width, node_height, node_depth;
+  int32_t ninputs, flags, type, max_label;
+  int32_t width, height, depth;
+  float xsize, ysize, zsize;
+  float dircos[12];  // x_ras, y_ras, z_ras, c_ras
+  float TRs[MAX_GCA_INPUTS], FAs[MAX_GCA_INPUTS], TEs[MAX_GCA_INPUTS];
+  int64_t nnodes, ngcs, ngibbs, npriors, nprior_labels;
+  int64_t offset[GCA_FLAT_NARRAYS];  // byte offset of each array from the header
+  int64_t bytes[GCA_FLAT_NARRAYS];
+  int64_t total_bytes;
+} GCA_FLAT_HEADER;
+
+struct GCA_FLAT
+{
+  char *image;
+  size_t nbytes;
+  int source;  // GCA_FLAT_HEAP or GCA_FLAT_MMAP
+  std::vector<GC1D> gcs;
+  std::vector<unsigned short *> gibbs_labels;
+  std::vector<float *> gibbs_priors;
+};
+
+// the arrays of an image as they are accumulated
+typedef struct
+{
+  std::vector<int64_t> node_offset, prior_offset;
+  std::vector<int32_t> node_training, prior_training;
+  std::vector<unsigned short> node_labels, gibbs_labels, prior_labels;
+  std::vector<float> means, covars, gibbs_priors, priors;
+  std::vector<short> gibbs_nlabels;
+} GCA_FLAT_BUILDER;
+
+static bool gcaFlatRange(const void *p, const void *start, size_t nbytes)
+{
+  uintptr_t u = (uintptr_t)p, s = (uintptr_t)start;
+  return (u >= s && u < s + nbytes);
+}
+
+static bool gcaFlatOwns(const GCA_FLAT *flat, const void *p)
+{
+  return (gcaFlatRange(p, flat->image, flat->nbytes) ||
+          gcaFlatRange(p, flat->gcs.data(), flat->gcs.size() * sizeof(GC1D)) ||
+          gcaFlatRange(p, flat->gibbs_labels.data(), flat->gibbs_labels.size() * sizeof(unsigned short *)) ||
+          gcaFlatRange(p, flat->gibbs_priors.data(), flat->gibbs_priors.size() * sizeof(float *)));
+}
+
+/*
+  free() for the node, prior and class arrays of gca, which may live in
+  its flat image. Arrays of a gca without an image, or of no gca (NULL),
+  are freed without any lookup.
+*/
+static void gcaFree(const GCA *gca, void *p)
+{
+  if (p && !(gca && gca->flat && gcaFlatOwns(gca->flat, p))) {
+    free(p);
+  }
+}
+
+void GCAfreeArray(const GCA *gca, void *p) { gcaFree(gca, p); }
+
+static void gcaFlatRelease(GCA *gca)
+{
+  GCA_FLAT *flat = gca->flat;
+
+  if (flat == NULL) {
+    return;
+  }
+  gca->flat = NULL;
+  if (flat->source == GCA_FLAT_MMAP) {
+    munmap(flat->image, flat->nbytes);
+  }
+  else {
+    free(flat->image);
+  }
+  delete flat;
+}
+
+static void gcaFlatAddNode(GCA *gca, GCA_FLAT_BUILDER &fb, GCA_NODE *gcan)
+{
+  int n, r, i, j, ncov;
+  GC1D *gc;
+
+  ncov = gca->ninputs * (gca->ninputs + 1) / 2;
+  fb.node_offset.push_back(fb.node_labels.size());
+  fb.node_training.push_back(gcan->total_training);
+  for (n = 0; n < gcan->nlabels; n++) {
+    gc = &gcan->gcs[n];
+    fb.node_labels.push_back(gcan->labels[n]);
+    for (r = 0; r < gca->ninputs; r++) {
+      fb.means.push_back(gc->means[r]);
+    }
+    for (r = 0; r < ncov; r++) {
+      fb.covars.push_back(gc->covars[r]);
+    }
+    if (gca->flags & GCA_NO_MRF) {
+      continue;
+    }
+    for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+      fb.gibbs_nlabels.push_back(gc->nlabels[i]);
+      for (j = 0; j < gc->nlabels[i]; j++) {
+        fb.gibbs_labels.push_back(gc->labels[i][j]);
+        fb.gibbs_priors.push_back(gc->label_priors[i][j]);
+      }
+    }
+  }
+}
+
+static void gcaFlatAddPrior(GCA_FLAT_BUILDER &fb, GCA_PRIOR *gcap)
+{
+  int n;
+
+  fb.prior_offset.push_back(fb.prior_labels.size());
+  fb.prior_training.push_back(gcap->total_training);
+  for (n = 0; n < gcap->nlabels; n++) {
+    fb.prior_labels.push_back(gcap->labels[n]);
+    fb.priors.push_back(gcap->priors[n]);
+  }
+}
+
+static void gcaFlatFromGCA(GCA *gca, GCA_FLAT_BUILDER &fb)
+{
+  int x, y, z;
+
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        gcaFlatAddNode(gca, fb, &gca->nodes[x][y][z]);
+      }
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        gcaFlatAddPrior(fb, &gca->priors[x][y][z]);
+      }
+}
+
+/*
+  Packs the accumulated arrays and the header fields of gca into a single
+  malloc'ed image. The builder is emptied as it is copied.
+*/
+static char *gcaFlatPack(GCA *gca, GCA_FLAT_BUILDER &fb, size_t *pnbytes)
+{
+  GCA_FLAT_HEADER hdr;
+  char *image, *ctab = NULL;
+  size_t ctab_bytes = 0;
+  int64_t off;
+  int i;
+
+  fb.node_offset.push_back(fb.node_labels.size());
+  fb.prior_offset.push_back(fb.prior_labels.size());
+
+  if (gca->ct) {
+    FILE *fp = open_memstream(&ctab, &ctab_bytes);
+    if (fp == NULL || CTABwriteIntoBinary(gca->ct, fp) != NO_ERROR) {
+      if (fp) fclose(fp);
+      free(ctab);
+      ErrorReturn(NULL, (ERROR_NOMEMORY, "gcaFlatPack: could not serialize colortable"));
+    }
+    fclose(fp);
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  strcpy(hdr.magic, GCA_FLAT_MAGIC);
+  hdr.version = GCA_FLAT_VERSION;
+  hdr.byteorder = GCA_FLAT_BYTEORDER;
+  hdr.prior_spacing = gca->prior_spacing;
+  hdr.node_spacing = gca->node_spacing;
+  hdr.prior_width = gca->prior_width;
+  hdr.prior_height = gca->prior_height;
+  hdr.prior_depth = gca->prior_depth;
+  hdr.node_width = gca->node_width;
+  hdr.node_height = gca->node_height;
+  hdr.node_depth = gca->node_depth;
+  hdr.ninputs = gca->ninputs;
+  hdr.flags = gca->flags;
+  hdr.type = gca->type;
+  hdr.max_label = gca->max_label;
+  hdr.width = gca->width;
+  hdr.height = gca->height;
+  hdr.depth = gca->depth;
+  hdr.xsize = gca->xsize;
+  hdr.ysize = gca->ysize;
+  hdr.zsize = gca->zsize;
+  float dircos[12] = {gca->x_r, gca->x_a, gca->x_s, gca->y_r, gca->y_a, gca->y_s,
+                      gca->z_r, gca->z_a, gca->z_s, gca->c_r, gca->c_a, gca->c_s};
+  memmove(hdr.dircos, dircos, sizeof(dircos));
+  memmove(hdr.TRs, gca->TRs, sizeof(hdr.TRs));
+  memmove(hdr.FAs, gca->FAs, sizeof(hdr.FAs));
+  memmove(hdr.TEs, gca->TEs, sizeof(hdr.TEs));
+  hdr.nnodes = fb.node_training.size();
+  hdr.ngcs = fb.node_labels.size();
+  hdr.ngibbs = fb.gibbs_labels.size();
+  hdr.npriors = fb.prior_training.size();
+  hdr.nprior_labels = fb.prior_labels.size();
+
+  const void *src[GCA_FLAT_NARRAYS] = {fb.node_offset.data(),
+                                       fb.node_training.data(),
+                                       fb.node_labels.data(),
+                                       fb.means.data(),
+                                       fb.covars.data(),
+                                       fb.gibbs_nlabels.data(),
+                                       fb.gibbs_labels.data(),
+                                       fb.gibbs_priors.data(),
+                                       fb.prior_offset.data(),
+                                       fb.prior_training.data(),
+                                       fb.prior_labels.data(),
+                                       fb.priors.data(),
+                                       ctab};
+  hdr.bytes[GCA_FLAT_NODE_OFFSET] = fb.node_offset.size() * sizeof(int64_t);
+  hdr.bytes[GCA_FLAT_NODE_TRAINING] = fb.node_training.size() * sizeof(int32_t);
+  hdr.bytes[GCA_FLAT_NODE_LABELS] = fb.node_labels.size() * sizeof(unsigned short);
+  hdr.bytes[GCA_FLAT_MEANS] = fb.means.size() * sizeof(float);
+  hdr.bytes[GCA_FLAT_COVARS] = fb.covars.size() * sizeof(float);
+  hdr.bytes[GCA_FLAT_GIBBS_NLABELS] = fb.gibbs_nlabels.size() * sizeof(short);
+  hdr.bytes[GCA_FLAT_GIBBS_LABELS] = fb.gibbs_labels.size() * sizeof(unsigned short);
+  hdr.bytes[GCA_FLAT_GIBBS_PRIORS] = fb.gibbs_priors.size() * sizeof(float);
+  hdr.bytes[GCA_FLAT_PRIOR_OFFSET] = fb.prior_offset.size() * sizeof(int64_t);
+  hdr.bytes[GCA_FLAT_PRIOR_TRAINING] = fb.prior_training.size() * sizeof(int32_t);
+  hdr.bytes[GCA_FLAT_PRIOR_LABELS] = fb.prior_labels.size() * sizeof(unsigned short);
+  hdr.bytes[GCA_FLAT_PRIORS] = fb.priors.size() * sizeof(float);
+  hdr.bytes[GCA_FLAT_CTAB] = ctab_bytes;
+
+  // every array starts on an 8 byte boundary
+  off = (sizeof(hdr) + 7) & ~7;
+  for (i = 0; i < GCA_FLAT_NARRAYS; i++) {
+    hdr.offset[i] = off;
+    off = (off + hdr.bytes[i] + 7) & ~7;
+  }
+  hdr.total_bytes = off;
+
+  image = (char *)calloc(hdr.total_bytes, 1);
+  if (image == NULL) {
+    free(ctab);
+    ErrorReturn(NULL, (ERROR_NOMEMORY, "gcaFlatPack: could not allocate %lld bytes", (long long)hdr.total_bytes));
+  }
+  memmove(image, &hdr, sizeof(hdr));
+  for (i = 0; i < GCA_FLAT_NARRAYS; i++)
+    if (hdr.bytes[i] > 0) {
+      memmove(image + hdr.offset[i], src[i], hdr.bytes[i]);
+    }
+  free(ctab);
+  fb = GCA_FLAT_BUILDER();
+
+  *pnbytes = hdr.total_bytes;
+  return (image);
+}
+
+/*
+  Checks the header of a flat image of nbytes bytes: the magic, version
+  and byte order, the counts, and that every array lies inside the image,
+  is aligned and has the size its count implies. Nothing past the header
+  is dereferenced, so it is safe on any file.
+*/
+static int gcaFlatCheckHeader(const char *image, size_t nbytes)
+{
+  const GCA_FLAT_HEADER *hdr = (const GCA_FLAT_HEADER *)image;
+  int64_t expected[GCA_FLAT_NARRAYS], ncov, nmrf;
+  int i;
+
+  if (nbytes < sizeof(GCA_FLAT_HEADER) || memcmp(hdr->magic, GCA_FLAT_MAGIC, sizeof(hdr->magic)) ||
+      hdr->version != GCA_FLAT_VERSION || hdr->byteorder != GCA_FLAT_BYTEORDER)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "gcaFlatCheckHeader: not a flat gca of this version and byte order"));
+  if (hdr->total_bytes < (int64_t)sizeof(GCA_FLAT_HEADER) || hdr->total_bytes > (int64_t)nbytes)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "gcaFlatCheckHeader: image is truncated"));
+  if (hdr->ninputs < 1 || hdr->ninputs > MAX_GCA_INPUTS || hdr->node_width < 1 || hdr->node_height < 1 ||
+      hdr->node_depth < 1 || hdr->prior_width < 1 || hdr->prior_height < 1 || hdr->prior_depth < 1)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "gcaFlatCheckHeader: bad dimensions"));
+
+  // bounding every count by the image size keeps the products below from overflowing
+  if (hdr->nnodes != (int64_t)hdr->node_width * hdr->node_height * hdr->node_depth ||
+      hdr->npriors != (int64_t)hdr->prior_width * hdr->prior_height * hdr->prior_depth ||
+      hdr->nnodes > hdr->total_bytes || hdr->npriors > hdr->total_bytes || hdr->ngcs < 0 ||
+      hdr->ngcs > hdr->total_bytes || hdr->ngibbs < 0 || hdr->ngibbs > hdr->total_bytes ||
+      hdr->nprior_labels < 0 || hdr->nprior_labels > hdr->total_bytes)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "gcaFlatCheckHeader: bad node, prior or class counts"));
+
+  ncov = hdr->ninputs * (hdr->ninputs + 1) / 2;
+  nmrf = (hdr->flags & GCA_NO_MRF) ? 0 : hdr->ngcs * GIBBS_NEIGHBORS;
+  expected[GCA_FLAT_NODE_OFFSET] = (hdr->nnodes + 1) * sizeof(int64_t);
+  expected[GCA_FLAT_NODE_TRAINING] = hdr->nnodes * sizeof(int32_t);
+  expected[GCA_FLAT_NODE_LABELS] = hdr->ngcs * sizeof(unsigned short);
+  expected[GCA_FLAT_MEANS] = hdr->ngcs * hdr->ninputs * sizeof(float);
+  expected[GCA_FLAT_COVARS] = hdr->ngcs * ncov * sizeof(float);
+  expected[GCA_FLAT_GIBBS_NLABELS] = nmrf * sizeof(short);
+  expected[GCA_FLAT_GIBBS_LABELS] = hdr->ngibbs * sizeof(unsigned short);
+  expected[GCA_FLAT_GIBBS_PRIORS] = hdr->ngibbs * sizeof(float);
+  expected[GCA_FLAT_PRIOR_OFFSET] = (hdr->npriors + 1) * sizeof(int64_t);
+  expected[GCA_FLAT_PRIOR_TRAINING] = hdr->npriors * sizeof(int32_t);
+  expected[GCA_FLAT_PRIOR_LABELS] = hdr->nprior_labels * sizeof(unsigned short);
+  expected[GCA_FLAT_PRIORS] = hdr->nprior_labels * sizeof(float);
+  expected[GCA_FLAT_CTAB] = hdr->bytes[GCA_FLAT_CTAB];  // any size
+
+  for (i = 0; i < GCA_FLAT_NARRAYS; i++) {
+    if (hdr->offset[i] < (int64_t)sizeof(GCA_FLAT_HEADER) || hdr->offset[i] % 8 != 0 || hdr->bytes[i] < 0 ||
+        hdr->bytes[i] != expected[i] || hdr->bytes[i] > hdr->total_bytes - hdr->offset[i])
+      ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "gcaFlatCheckHeader: array %d is out of bounds or has the wrong size", i));
+  }
+  return (NO_ERROR);
+}
+
+/*
+  Checks the contents that pointers are built from: the node and prior
+  offsets must start at 0, never decrease and end at the number of
+  classes and prior labels, and the gibbs label counts must be
+  non-negative and add up to the number of gibbs entries.
+*/
+static int gcaFlatCheckArrays(const char *image)
+{
+  const GCA_FLAT_HEADER *hdr = (const GCA_FLAT_HEADER *)image;
+  const int64_t *node_offset = (const int64_t *)(image + hdr->offset[GCA_FLAT_NODE_OFFSET]);
+  const int64_t *prior_offset = (const int64_t *)(image + hdr->offset[GCA_FLAT_PRIOR_OFFSET]);
+  const short *gibbs_nlabels = (const short *)(image + hdr->offset[GCA_FLAT_GIBBS_NLABELS]);
+  int64_t n, gibbs, nmrf;
+
+  if (node_offset[0] != 0 || node_offset[hdr->nnodes] != hdr->ngcs) {
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "gcaFlatCheckArrays: bad node offsets"));
+  }
+  for (n = 0; n < hdr->nnodes; n++)
+    if (node_offset[n + 1] < node_offset[n]) {
+      ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "gcaFlatCheckArrays: node offsets decrease at %lld", (long long)n));
+    }
+
+  if (prior_offset[0] != 0 || prior_offset[hdr->npriors] != hdr->nprior_labels) {
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "gcaFlatCheckArrays: bad prior offsets"));
+  }
+  for (n = 0; n < hdr->npriors; n++)
+    if (prior_offset[n + 1] < prior_offset[n]) {
+      ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "gcaFlatCheckArrays: prior offsets decrease at %lld", (long long)n));
+    }
+
+  nmrf = (hdr->flags & GCA_NO_MRF) ? 0 : hdr->ngcs * GIBBS_NEIGHBORS;
+  for (gibbs = n = 0; n < nmrf; n++) {
+    if (gibbs_nlabels[n] < 0 || gibbs_nlabels[n] > hdr->ngibbs - gibbs) {
+      ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "gcaFlatCheckArrays: inconsistent gibbs arrays"));
+    }
+    gibbs += gibbs_nlabels[n];
+  }
+  if (gibbs != hdr->ngibbs) {
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "gcaFlatCheckArrays: inconsistent gibbs arrays"));
+  }
+  return (NO_ERROR);
+}
+
+/*
+  Points the nodes, priors and classifiers of gca (allocated with no
+  labels) into image, which gca takes ownership of.
+*/
+static int gcaFlatAttach(GCA *gca, char *image, size_t nbytes, int source)
+{
+  GCA_FLAT_HEADER *hdr = (GCA_FLAT_HEADER *)image;
+  GCA_FLAT *flat;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+  int64_t g, n, gibbs, ncov;
+  int x, y, z, i;
+
+  // validate everything before building a single pointer into the image
+  if (gcaFlatCheckHeader(image, nbytes) != NO_ERROR || gcaFlatCheckArrays(image) != NO_ERROR) {
+    return (ERROR_BADFILE);
+  }
+  if (hdr->ninputs != gca->ninputs || (hdr->flags & GCA_NO_MRF) != (gca->flags & GCA_NO_MRF) ||
+      hdr->node_width != gca->node_width || hdr->node_height != gca->node_height ||
+      hdr->node_depth != gca->node_depth || hdr->prior_width != gca->prior_width ||
+      hdr->prior_height != gca->prior_height || hdr->prior_depth != gca->prior_depth)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "gcaFlatAttach: image does not match gca dimensions"));
+
+  const int64_t *node_offset = (const int64_t *)(image + hdr->offset[GCA_FLAT_NODE_OFFSET]);
+  const int32_t *node_training = (const int32_t *)(image + hdr->offset[GCA_FLAT_NODE_TRAINING]);
+  unsigned short *node_labels = (unsigned short *)(image + hdr->offset[GCA_FLAT_NODE_LABELS]);
+  float *means = (float *)(image + hdr->offset[GCA_FLAT_MEANS]);
+  float *covars = (float *)(image + hdr->offset[GCA_FLAT_COVARS]);
+  short *gibbs_nlabels = (short *)(image + hdr->offset[GCA_FLAT_GIBBS_NLABELS]);
+  unsigned short *gibbs_labels = (unsigned short *)(image + hdr->offset[GCA_FLAT_GIBBS_LABELS]);
+  float *gibbs_priors = (float *)(image + hdr->offset[GCA_FLAT_GIBBS_PRIORS]);
+  const int64_t *prior_offset = (const int64_t *)(image + hdr->offset[GCA_FLAT_PRIOR_OFFSET]);
+  const int32_t *prior_training = (const int32_t *)(image + hdr->offset[GCA_FLAT_PRIOR_TRAINING]);
+  unsigned short *prior_labels = (unsigned short *)(image + hdr->offset[GCA_FLAT_PRIOR_LABELS]);
+  float *priors = (float *)(image + hdr->offset[GCA_FLAT_PRIORS]);
+
+  flat = new GCA_FLAT;
+  flat->image = image;
+  flat->nbytes = nbytes;
+  flat->source = source;
+  flat->gcs.resize(hdr->ngcs);
+  if (!(gca->flags & GCA_NO_MRF)) {
+    flat->gibbs_labels.resize(hdr->ngcs * GIBBS_NEIGHBORS);
+    flat->gibbs_priors.resize(hdr->ngcs * GIBBS_NEIGHBORS);
+  }
+
+  ncov = gca->ninputs * (gca->ninputs + 1) / 2;
+  for (gibbs = g = 0; g < hdr->ngcs; g++) {
+    gc = &flat->gcs[g];
+    gc->means = means + g * gca->ninputs;
+    gc->covars = covars + g * ncov;
+    if (gca->flags & GCA_NO_MRF) {
+      continue;
+    }
+    gc->nlabels = gibbs_nlabels + g * GIBBS_NEIGHBORS;
+    gc->labels = &flat->gibbs_labels[g * GIBBS_NEIGHBORS];
+    gc->label_priors = &flat->gibbs_priors[g * GIBBS_NEIGHBORS];
+    for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+      if (gc->nlabels[i] > 0) {
+        gc->labels[i] = gibbs_labels + gibbs;
+        gc->label_priors[i] = gibbs_priors + gibbs;
+        gibbs += gc->nlabels[i];
+      }
+    }
+  }
+
+  for (n = x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++, n++) {
+        gcan = &gca->nodes[x][y][z];
+        gcan->nlabels = gcan->max_labels = node_offset[n + 1] - node_offset[n];
+        gcan->total_training = node_training[n];
+        if (gcan->nlabels > 0) {
+          gcan->labels = node_labels + node_offset[n];
+          gcan->gcs = &flat->gcs[node_offset[n]];
+        }
+      }
+
+  for (n = x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++, n++) {
+        gcap = &gca->priors[x][y][z];
+        gcap->nlabels = gcap->max_labels = prior_offset[n + 1] - prior_offset[n];
+        gcap->total_training = prior_training[n];
+        if (gcap->nlabels > 0) {
+          gcap->labels = prior_labels + prior_offset[n];
+          gcap->priors = priors + prior_offset[n];
+        }
+      }
+
+  gca->flat = flat;
+  return (NO_ERROR);
+}
+
+/* sets the training count of each classifier from the node and prior counts */
+static void gcaSetClassTraining(GCA *gca)
+{
+  int x, y, z, n, xp, yp, zp;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+
+  for (x = 0; x < gca->node_width; x++) {
+    for (y = 0; y < gca->node_height; y++) {
+      for (z = 0; z < gca->node_depth; z++) {
+        if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
+          DiagBreak();
+        }
+        gcan = &gca->nodes[x][y][z];
+        if (gcaNodeToPrior(gca, x, y, z, &xp, &yp, &zp) == NO_ERROR) {
+          gcap = &gca->priors[xp][yp][zp];
+          if (gcap == NULL) {
+            continue;
+          }
+          for (n = 0; n < gcan->nlabels; n++) {
+            gc = &gcan->gcs[n];
+            gc->ntraining = gcan->total_training * getPrior(gcap, gcan->labels[n]);
+          }
+        }
+      }
+    }
+  }
+}
+
+/*
+  Builds a GCA around a flat image (read or mapped from a .gcaf file),
+  taking ownership of the image.
+*/
+static GCA *gcaFlatToGCA(char *image, size_t nbytes, int source, const char *fname)
+{
+  GCA_FLAT_HEADER *hdr = (GCA_FLAT_HEADER *)image;
+  GCA *gca;
+
+  if (gcaFlatCheckHeader(image, nbytes) != NO_ERROR) {
+    if (source == GCA_FLAT_MMAP) {
+      munmap(image, nbytes);
+    }
+    else {
+      free(image);
+    }
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAread(%s): corrupt flat gca", fname));
+  }
+  gca = gcaAllocMax(hdr->ninputs,
+                    hdr->prior_spacing,
+                    hdr->node_spacing,
+                    hdr->node_spacing * hdr->node_width,
+                    hdr->node_spacing * hdr->node_height,
+                    hdr->node_spacing * hdr->node_depth,
+                    0,
+                    hdr->flags);
+  if (!gca) {
+    ErrorReturn(NULL, (Gerror, "GCAread(%s): could not allocate gca", fname));
+  }
+  if (gcaFlatAttach(gca, image, nbytes, source) != NO_ERROR) {
+    if (source == GCA_FLAT_MMAP) {
+      munmap(image, nbytes);
+    }
+    else {
+      free(image);
+    }
+    GCAfree(&gca);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAread(%s): corrupt flat gca", fname));
+  }
+
+  gca->type = hdr->type;
+  gca->max_label = hdr->max_label;
+  gca->width = hdr->width;
+  gca->height = hdr->height;
+  gca->depth = hdr->depth;
+  gca->xsize = hdr->xsize;
+  gca->ysize = hdr->ysize;
+  gca->zsize = hdr->zsize;
+  gca->x_r = hdr->dircos[0];
+  gca->x_a = hdr->dircos[1];
+  gca->x_s = hdr->dircos[2];
+  gca->y_r = hdr->dircos[3];
+  gca->y_a = hdr->dircos[4];
+  gca->y_s = hdr->dircos[5];
+  gca->z_r = hdr->dircos[6];
+  gca->z_a = hdr->dircos[7];
+  gca->z_s = hdr->dircos[8];
+  gca->c_r = hdr->dircos[9];
+  gca->c_a = hdr->dircos[10];
+  gca->c_s = hdr->dircos[11];
+  memmove(gca->TRs, hdr->TRs, sizeof(hdr->TRs));
+  memmove(gca->FAs, hdr->FAs, sizeof(hdr->FAs));
+  memmove(gca->TEs, hdr->TEs, sizeof(hdr->TEs));
+
+  if (hdr->bytes[GCA_FLAT_CTAB] > 0) {
+    FILE *fp = fmemopen(image + hdr->offset[GCA_FLAT_CTAB], hdr->bytes[GCA_FLAT_CTAB], "rb");
+    if (fp) {
+      gca->ct = CTABreadFromBinary(fp);
+      fclose(fp);
+    }
+  }
+
+  gcaSetClassTraining(gca);
+  GCAsetup(gca);
+  return (gca);
+}
+
+int GCAisFlat(const char *fname)
+{
+  char magic[8];
+  FILE *fp;
+  int flat;
+
+  fp = fopen(fname, "rb");
+  if (fp == NULL) {
+    return (0);
+  }
+  flat = (fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && !memcmp(magic, GCA_FLAT_MAGIC, sizeof(magic)));
+  fclose(fp);
+  return (flat);
+}
+
+static GCA *gcaReadFlat(const char *fname)
+{
+  GCA_FLAT_HEADER hdr;
+  struct stat st;
+  char *image;
+  int fd;
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    ErrorReturn(NULL, (ERROR_NOFILE, "GCAread(%s): could not open file", fname));
+  }
+  if (fstat(fd, &st) != 0 || read(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) {
+    close(fd);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAread(%s): could not read header", fname));
+  }
+  if (hdr.byteorder != GCA_FLAT_BYTEORDER || hdr.version != GCA_FLAT_VERSION || hdr.total_bytes > st.st_size) {
+    close(fd);
+    ErrorReturn(NULL,
+                (ERROR_BADFILE,
+                 "GCAread(%s): flat gca version %d was written on an incompatible "
+                 "machine or is truncated - rewrite it with GCAwriteFlat",
+                 fname,
+                 hdr.version));
+  }
+
+  // private mapping: pages are shared until written, and writes stay in this process
+  image = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    ErrorReturn(NULL, (ERROR_NOMEMORY, "GCAread(%s): could not map file", fname));
+  }
+  return (gcaFlatToGCA(image, st.st_size, GCA_FLAT_MMAP, fname));
+}
+
+/*
+  Decompressed atlas cache. When FS_GCA_CACHE names a directory, GCAread()
+  of a .gca/.gcz file looks for <dir>/<key>.gcaf, where key is derived from
+  the device, inode, size and modification time of the file, and maps it
+  instead of decompressing and parsing. On a miss the file is read as usual
+  and its flat image is stored in the cache for the next reader. The cached
+  image is mapped copy-on-write, so every process reading the same atlas
+  shares its pages; keep the cache on /dev/shm to hold it in memory. The
+  directory is created private to the user, and one that is owned by
+  someone else or writable by group or others is not used. Cached images
+  are validated like any other .gcaf file when they are mapped.
+*/
+static int gcaCacheName(const char *fname, char *cache_name)
+{
+  const char *cache_dir = getenv("FS_GCA_CACHE");
+  struct stat st, dst;
+
+  if (cache_dir == NULL || *cache_dir == 0 || !strcmp(cache_dir, "0")) {
+    return (0);
+  }
+  if (stat(fname, &st) != 0) {
+    return (0);
+  }
+
+  mkdir(cache_dir, 0700);  // may already exist
+  if (lstat(cache_dir, &dst) != 0 || !S_ISDIR(dst.st_mode) || dst.st_uid != getuid() ||
+      (dst.st_mode & (S_IWGRP | S_IWOTH))) {
+    ErrorPrintf(ERROR_BADPARM,
+                "GCAread: FS_GCA_CACHE %s is not a directory owned by and only writable by this user - not using it\n",
+                cache_dir);
+    return (0);
+  }
+  snprintf(cache_name,
+           STRLEN,
+           "%s/%llx-%llx-%llx-%llx.%09ld.gcaf",
+           cache_dir,
+           (unsigned long long)st.st_dev,
+           (unsigned long long)st.st_ino,
+           (unsigned long long)st.st_size,
+           (unsigned long long)st.st_mtim.tv_sec,
+           (long)st.st_mtim.tv_nsec);
+  return (1);
+}
+
+/* stores the flat image of gca in the cache, replacing it atomically */
+static int gcaCacheWrite(GCA *gca, const char *cache_name)
+{
+  char tmp_name[STRLEN];
+  FILE *fp;
+  int ok;
+
+  if (gca->flat == NULL) {
+    return (ERROR_BADPARM);
+  }
+  snprintf(tmp_name, STRLEN, "%s.%d.tmp", cache_name, (int)getpid());
+  fp = fopen(tmp_name, "wb");
+  if (fp == NULL) {
+    ErrorReturn(ERROR_NOFILE, (ERROR_NOFILE, "GCAread: could not write atlas cache %s", tmp_name));
+  }
+  ok = (fwrite(gca->flat->image, 1, gca->flat->nbytes, fp) == gca->flat->nbytes);
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok || rename(tmp_name, cache_name) != 0) {
+    unlink(tmp_name);
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCAread: could not write atlas cache %s", cache_name));
+  }
+  return (NO_ERROR);
+}
+
+/*
+  Writes gca as a flat image (.gcaf) that GCAread() maps instead of
+  parsing. Flat files are in native byte order.
+*/
+int GCAwriteFlat(GCA *gca, const char *fname)
+{
+  GCA_FLAT_BUILDER fb;
+  size_t nbytes;
+  char *image;
+  FILE *fp;
+
+  gcaFlatFromGCA(gca, fb);
+  image = gcaFlatPack(gca, fb, &nbytes);
+  if (image == NULL) {
+    return (Gerror);
+  }
+  fp = fopen(fname, "wb");
+  if (fp == NULL) {
+    free(image);
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAwriteFlat(%s): could not open file", fname));
+  }
+  if (fwrite(image, 1, nbytes, fp) != nbytes) {
+    fclose(fp);
+    free(image);
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCAwriteFlat(%s): write failed", fname));
+  }
+  fclose(fp);
+  free(image);
+  return (NO_ERROR);
+}
+
 int GCAwrite(GCA *gca, const char *fname)
 {
   znzFile file;
@@ -2076,11 +2833,15 @@ int GCAwrite(GCA *gca, const char *fname)
   GC1D *gc;
   int gzipped = 0;
 
+  if (strstr(fname, ".gcaf")) {
+    return (GCAwriteFlat(gca, fname));
+  }
+
   if (strstr(fname, ".gcz")) {
     gzipped = 1;
   }
 
-  file = znzopen(fname, "wb", gzipped);
+  file = pgzopen(fname, "wb", gzipped);
   if (znz_isnull(file)) {
     errno = 0;
     ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAwrite(%s): could not open file", fname));
@@ -2221,7 +2982,6 @@ GCA *GCAread(const char *fname)
   int x, y, z, n, i, j;
   GCA *gca;
   GCA_NODE *gcan;
-  GCA_PRIOR *gcap;
   GC1D *gc;
   float version, node_spacing, prior_spacing;
   int node_width, node_height, node_depth, ninputs, flags;
@@ -2229,12 +2989,28 @@ GCA *GCAread(const char *fname)
   int tag;
   int gzipped = 0;
   int tempZNZ;
+  int flat = 0, cached;
+  GCA_FLAT_BUILDER fb;
+  char cache_name[STRLEN];
+
+  if (GCAisFlat(fname)) {
+    return (gcaReadFlat(fname));
+  }
+
+  cached = gcaCacheName(fname, cache_name);
+  if (cached && GCAisFlat(cache_name)) {
+    gca = gcaReadFlat(cache_name);
+    if (gca) {
+      printf("GCAread(%s): using cached atlas %s\n", fname, cache_name);
+      return (gca);
+    }
+  }
 
   if (strstr(fname, ".gcz")) {
     gzipped = 1;
   }
 
-  file = znzopen(fname, "rb", gzipped);
+  file = pgzopen(fname, "rb", gzipped);
   if (znz_isnull(file)) {
     ErrorReturn(NULL, (ERROR_BADPARM, "GCAread(%s): could not open file", fname));
   }
@@ -2389,88 +3165,42 @@ GCA *GCAread(const char *fname)
       ErrorReturn(NULL, (Gdiag, NULL));
     }
 
+    // read into the arrays of a flat image rather than allocating every node
     for (x = 0; x < gca->node_width; x++) {
       for (y = 0; y < gca->node_height; y++) {
         for (z = 0; z < gca->node_depth; z++) {
+          int nlabels, r, ncov = gca->ninputs * (gca->ninputs + 1) / 2;
+
           if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
             DiagBreak();
           }
-          gcan = &gca->nodes[x][y][z];
-          gcan->nlabels = znzreadInt(file);
-          gcan->total_training = znzreadInt(file);
-          if (gcan->nlabels) {
-            gcan->labels = (unsigned short *)calloc(gcan->nlabels, sizeof(unsigned short));
-            if (!gcan->labels)
-              ErrorExit(ERROR_NOMEMORY,
-                        "GCAread(%s): could not "
-                        "allocate %d "
-                        "labels @ (%d,%d,%d)",
-                        fname,
-                        gcan->nlabels,
-                        x,
-                        y,
-                        z);
-            gcan->gcs = alloc_gcs(gcan->nlabels, flags, gca->ninputs);
-            if (!gcan->gcs)
-              ErrorExit(ERROR_NOMEMORY,
-                        "GCAread(%s); could not allocated %d gcs "
-                        "@ (%d,%d,%d)",
-                        fname,
-                        gcan->nlabels,
-                        x,
-                        y,
-                        z);
-          }
-          else  // no labels at this node
-          {
-            gcan->labels = 0;
-            gcan->gcs = 0;
-          }
-          for (n = 0; n < gcan->nlabels; n++) {
-            int r, c;
-
-            gc = &gcan->gcs[n];
-
+          fb.node_offset.push_back(fb.node_labels.size());
+          nlabels = znzreadInt(file);
+          fb.node_training.push_back(znzreadInt(file));
+          for (n = 0; n < nlabels; n++) {
             if (version == GCA_UCHAR_VERSION) {
-              // gcan->labels[n] = (unsigned short)znzread1(file) ;
               znzread1(&tempZNZ, file);
-              gcan->labels[n] = (unsigned short)tempZNZ;
+              fb.node_labels.push_back((unsigned short)tempZNZ);
             }
             else {
-              gcan->labels[n] = (unsigned short)znzreadInt(file);
+              fb.node_labels.push_back((unsigned short)znzreadInt(file));
             }
 
             for (r = 0; r < gca->ninputs; r++) {
-              gc->means[r] = znzreadFloat(file);
+              fb.means.push_back(znzreadFloat(file));
+            }
+            for (r = 0; r < ncov; r++) {
+              fb.covars.push_back(znzreadFloat(file));
             }
-            for (i = r = 0; r < gca->ninputs; r++)
-              for (c = r; c < gca->ninputs; c++, i++) {
-                gc->covars[i] = znzreadFloat(file);
-              }
             if (gca->flags & GCA_NO_MRF) {
               continue;
             }
             for (i = 0; i < GIBBS_NEIGHBORS; i++) {
-              gc->nlabels[i] = znzreadInt(file);
-
-              /* allocate new ones */
-              gc->label_priors[i] = (float *)calloc(gc->nlabels[i], sizeof(float));
-              if (!gc->label_priors[i])
-                ErrorExit(ERROR_NOMEMORY,
-                          "GCAread(%s): "
-                          "couldn't expand gcs to %d",
-                          fname,
-                          gc->nlabels);
-              gc->labels[i] = (unsigned short *)calloc(gc->nlabels[i], sizeof(unsigned short));
-              if (!gc->labels)
-                ErrorExit(ERROR_NOMEMORY,
-                          "GCAread(%s): couldn't expand "
-                          "labels to %d",
-                          fname,
-                          gc->nlabels[i]);
-              for (j = 0; j < gc->nlabels[i]; j++) {
-                gc->labels[i][j] = (unsigned short)znzreadInt(file);
-                gc->label_priors[i][j] = znzreadFloat(file);
+              int gibbs_nlabels = znzreadInt(file);
+              fb.gibbs_nlabels.push_back(gibbs_nlabels);
+              for (j = 0; j < gibbs_nlabels; j++) {
+                fb.gibbs_labels.push_back((unsigned short)znzreadInt(file));
+                fb.gibbs_priors.push_back(znzreadFloat(file));
               }
             }
           }
@@ -2481,81 +3211,31 @@ GCA *GCAread(const char *fname)
     for (x = 0; x < gca->prior_width; x++) {
       for (y = 0; y < gca->prior_height; y++) {
         for (z = 0; z < gca->prior_depth; z++) {
+          int nlabels;
+          unsigned short label;
+
           if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
             DiagBreak();
           }
-          gcap = &gca->priors[x][y][z];
-          if (gcap == NULL) {
-            continue;
-          }
-          gcap->nlabels = znzreadInt(file);
-          gcap->total_training = znzreadInt(file);
-          if (gcap->nlabels) {
-            gcap->labels = (unsigned short *)calloc(gcap->nlabels, sizeof(unsigned short));
-            if (!gcap->labels)
-              ErrorExit(ERROR_NOMEMORY,
-                        "GCAread(%s): could not "
-                        "allocate %d "
-                        "labels @ (%d,%d,%d)",
-                        fname,
-                        gcap->nlabels,
-                        x,
-                        y,
-                        z);
-            gcap->priors = (float *)calloc(gcap->nlabels, sizeof(float));
-            if (!gcap->priors)
-              ErrorExit(ERROR_NOMEMORY,
-                        "GCAread(%s): could "
-                        "not allocate %d "
-                        "priors @ (%d,%d,%d)",
-                        fname,
-                        gcap->nlabels,
-                        x,
-                        y,
-                        z);
-          }
-          else  // no labels assigned to this priors
-          {
-            gcap->labels = 0;
-            gcap->priors = 0;
-          }
-          for (n = 0; n < gcap->nlabels; n++) {
+          fb.prior_offset.push_back(fb.prior_labels.size());
+          nlabels = znzreadInt(file);
+          fb.prior_training.push_back(znzreadInt(file));
+          for (n = 0; n < nlabels; n++) {
             if (version == GCA_UCHAR_VERSION) {
               znzread1(&tempZNZ, file);
-              gcap->labels[n] = (unsigned short)tempZNZ;
+              label = (unsigned short)tempZNZ;
             }
             else {
-              gcap->labels[n] = (unsigned short)znzreadInt(file);
+              label = (unsigned short)znzreadInt(file);
             }
-            if (gcap->labels[n] > gca->max_label) gca->max_label = gcap->labels[n];
-            gcap->priors[n] = znzreadFloat(file);
-          }
-        }
-      }
-    }
-  }
-
-  for (x = 0; x < gca->node_width; x++) {
-    for (y = 0; y < gca->node_height; y++) {
-      for (z = 0; z < gca->node_depth; z++) {
-        int xp, yp, zp;
-
-        if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
-          DiagBreak();
-        }
-        gcan = &gca->nodes[x][y][z];
-        if (gcaNodeToPrior(gca, x, y, z, &xp, &yp, &zp) == NO_ERROR) {
-          gcap = &gca->priors[xp][yp][zp];
-          if (gcap == NULL) {
-            continue;
-          }
-          for (n = 0; n < gcan->nlabels; n++) {
-            gc = &gcan->gcs[n];
-            gc->ntraining = gcan->total_training * getPrior(gcap, gcan->labels[n]);
+            if (label > gca->max_label) gca->max_label = label;
+            fb.prior_labels.push_back(label);
+            fb.priors.push_back(znzreadFloat(file));
           }
         }
       }
     }
+    flat = 1;
   }
 
   while (znzreadIntEx(&tag, file)) {
@@ -2647,10 +3327,23 @@ GCA *GCAread(const char *fname)
     }
   }
 
-  GCAsetup(gca);
-
   znzclose(file);
 
+  if (flat) {
+    size_t nbytes;
+    char *image = gcaFlatPack(gca, fb, &nbytes);
+    if (image == NULL || gcaFlatAttach(gca, image, nbytes, GCA_FLAT_HEAP) != NO_ERROR) {
+      free(image);
+      GCAfree(&gca);
+      ErrorReturn(NULL, (ERROR_NOMEMORY, "GCAread(%s): could not build node and prior arrays", fname));
+    }
+    if (cached) {
+      gcaCacheWrite(gca, cache_name);
+    }
+  }
+  gcaSetClassTraining(gca);
+  GCAsetup(gca);
+
   return (gca);
 }
 
@@ -2702,8 +3395,8 @@ static int GCAupdatePrior(GCA *gca, MRI *mri, int xn, int yn, int zn, int label)
       memmove(gcap->labels, old_labels, old_max_labels * sizeof(unsigned short));
 
       /* free the old ones */
-      free(old_priors);
-      free(old_labels);
+      gcaFree(gca, old_priors);
+      gcaFree(gca, old_labels);
     }
     // add one
     gcap->nlabels++;
@@ -2850,8 +3543,8 @@ static int GCAupdateNode(GCA *gca, MRI *mri, int xn, int yn, int zn, float *vals
       memmove(gcan->labels, old_labels, old_max_labels * sizeof(unsigned short));
 
       /* free the old ones */
-      free(old_gcs);
-      free(old_labels);
+      gcaFree(gca, old_gcs);
+      gcaFree(gca, old_labels);
     }
     gcan->nlabels++;
   }
@@ -2889,6 +3582,7 @@ int GCAcompleteMeanTraining(GCA *gca)
   GCA_PRIOR *gcap;
   GC1D *gc;
 
+  GCAdensitiesInvalidate(gca);
   total_nodes = gca->node_width * gca->node_height * gca->node_depth;
   total_brain_nodes = total_gcs = total_brain_gcs = 0;
   for (x = 0; x < gca->node_width; x++) {
@@ -3014,6 +3708,7 @@ int GCAcompleteCovarianceTraining(GCA *gca)
   GCA_NODE *gcan;
   GC1D *gc;
 
+  GCAdensitiesInvalidate(gca);
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -3168,6 +3863,7 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
   height = mri_inputs->height;
   depth = mri_inputs->depth;
   num_pv = 0;
+  gcaDensitiesCache(gca);
   // if 0
   // ifdef HAVE_OPENMP
   // pragma omp parallel for if_ROMP(experimental) reduction(+: num_pv)
@@ -3179,6 +3875,7 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
     GCA_NODE *gcan;
     GCA_PRIOR *gcap;
     GC1D *gc;
+    std::vector<double> node_log_p;
     // GC1D *max_gc;
 
     for (y = 0; y < height; y++) {
@@ -3203,21 +3900,28 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
           // max_n = -1;
           // max_gc = NULL;
           max_p = 2 * GIBBS_NEIGHBORS * BIG_AND_NEGATIVE;
+          // class densities of all the labels at this node at once
+          node_log_p.resize(gcan->nlabels);
+          GCAnodeLogDensities(gca, xn, yn, zn, vals, node_log_p.data());
           // going through gcap labels
           for (n = 0; n < gcap->nlabels; n++) {
             gc = GCAfindGC(gca, xn, yn, zn, gcap->labels[n]);
-            if (gc == NULL) {
-              gc = GCAfindClosestValidGC(gca, xn, yn, zn, gcap->labels[n], 0);
+            if (gc) {
+              p = node_log_p[gc - gcan->gcs];
             }
-            if (gc == NULL) {
-              MRIsetVoxVal(mri_dst, x, y, z, 0, 0);  // unknown
-              continue;
+            else {
+              gc = GCAfindClosestValidGC(gca, xn, yn, zn, gcap->labels[n], 0);
+              if (gc == NULL) {
+                MRIsetVoxVal(mri_dst, x, y, z, 0, 0);  // unknown
+                continue;
+              }
+              p = GCAcomputeConditionalLogDensity(gc, vals, gca->ninputs, gcap->labels[n]);
             }
 #if INTERP_PRIOR
             prior = gcaComputePrior(gca, mri_inputs, transform, x, y, z, gcap->labels[n]);
-            p = gcaComputeLogDensity(gc, vals, gca->ninputs, prior, gcap->labels[n]);
+            p += log(prior);
 #else
-            p = gcaComputeLogDensity(gc, vals, gca->ninputs, gcap->priors[n], gcap->labels[n]);
+            p += log(gcap->priors[n]);
 #endif
             // look for largest p
             if (p > max_p) {
@@ -4131,36 +4835,157 @@ float GCAcomputeLogSampleProbability(
       }
       if (log_p < -clamp) log_p = -clamp;
     }
-    else {               // outside the voxel
-      log_p = -1000000;  // BIG_AND_NEGATIVE;
-      // log(VERY_UNLIKELY); // BIG_AND_NEGATIVE;
-      //      outside_log_p += log_p;
+    else {               // outside the voxel
+      log_p = -1000000;  // BIG_AND_NEGATIVE;
+      // log(VERY_UNLIKELY); // BIG_AND_NEGATIVE;
+      //      outside_log_p += log_p;
+    }
+    gcas[i].log_p = log_p;
+    total_log_p += log_p;
+
+#ifdef BEVIN_GCACOMPUTELOGSAMPLEPROBABILITY_REPRODUCIBLE
+
+    #undef total_log_p
+  #include "romp_for_end.h"
+  
+#else
+
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+#endif
+
+  fflush(stdout);
+
+  { int tid;
+    for (tid = 0; tid < nthreads; tid++) {
+      VectorFree(&v_src[tid]);
+      VectorFree(&v_dst[tid]);
+  } }
+  
+  if (m_prior2source_voxel_nonconst) MatrixFree(&m_prior2source_voxel_nonconst);
+  return ((float)total_log_p / nsamples);
+}
+
+/*
+  1 if d' inverse(U) d > 0 for every d != 0, i.e. if the symmetric part of
+  the packed upper triangle inv_covars is positive definite, in which case
+  a sample density is largest at the sample mean.
+*/
+static int gcaSampleFormIsPositive(const double *inv_covars, int ninputs)
+{
+  float sym[GCA_DENSITY_MAX_INPUTS * (GCA_DENSITY_MAX_INPUTS + 1) / 2];
+  double inv_sym[GCA_DENSITY_MAX_INPUTS * (GCA_DENSITY_MAX_INPUTS + 1) / 2];
+  double half_log_det;
+  int r, c, i;
+
+  for (i = r = 0; r < ninputs; r++)
+    for (c = r; c < ninputs; c++, i++) {
+      sym[i] = (r == c ? 1.0 : 0.5) * inv_covars[i];
+    }
+  return (gcaInvertCovariance(sym, ninputs, inv_sym, &half_log_det));
+}
+
+/*
+  upper bounds on the per-sample terms of GCAcomputeLogSampleProbability:
+  the log density of each sample at its class mean, clamped the same way
+  the sample loop clamps. ubound[i] gets the sum of the bounds of samples
+  i..nsamples-1 (ubound has nsamples+1 entries, the last one 0). Returns 1
+  if every sample density can be evaluated without the static temporaries
+  of the singular covariance fallback, i.e. if
+  GCAcomputeLogSampleProbabilityMatrix may be called from several threads.
+*/
+int GCAlogSampleProbabilityBounds(GCA *gca, GCA_SAMPLE *gcas, int nsamples, double clamp, double *ubound)
+{
+  double inv_covars[GCA_DENSITY_MAX_INPUTS * (GCA_DENSITY_MAX_INPUTS + 1) / 2];
+  double ub, half_log_det;
+  int i, reentrant = 1;
+
+  ubound[nsamples] = 0.0;
+  for (i = nsamples - 1; i >= 0; i--) {
+    if (gca->ninputs == 1) {
+      ub = gcas[i].covars[0] > 0 ? -log(sqrt(gcas[i].covars[0])) : HUGE_VAL;
+    }
+    else if (gcaInvertSampleCovariance(gcas[i].covars, gca->ninputs, inv_covars, &half_log_det)) {
+      ub = gcaSampleFormIsPositive(inv_covars, gca->ninputs) ? half_log_det : HUGE_VAL;
+    }
+    else {
+      ub = HUGE_VAL;
+      reentrant = 0;
+    }
+    ub += gcas_getPriorLog(gcas[i]);
+    if (!std::isfinite(ub)) ub = HUGE_VAL;
+    if (ub < -clamp) ub = -clamp;
+    if (ub < -1000000) ub = -1000000;
+    ubound[i] = ubound[i + 1] + ub;
+  }
+  return (reentrant);
+}
+
+/*
+  GCAcomputeLogSampleProbability for a linear transform given directly as
+  the 3x4 prior->source voxel matrix m (row major), with the prior
+  coordinates of the samples in the contiguous array prior_coords. gcas is
+  only read and the samples are summed in order, so the result is the
+  single-threaded GCAcomputeLogSampleProbability value and the function can
+  be called concurrently for many candidate transforms (see
+  GCAlogSampleProbabilityBounds for the multi-input caveat).
+
+  If ubound is given the evaluation is abandoned as soon as the samples
+  left cannot lift the mean above prune_below, and the (smaller) bound is
+  returned instead.
+*/
+float GCAcomputeLogSampleProbabilityMatrix(GCA *gca,
+                                           GCA_SAMPLE *gcas,
+                                           const float *prior_coords,
+                                           MRI *mri_inputs,
+                                           const float *m,
+                                           int nsamples,
+                                           double clamp,
+                                           const double *ubound,
+                                           double prune_below)
+{
+  double total_log_p = 0.0, log_p, prune_total;
+  float xv, yv, zv, vals[MAX_GCA_INPUTS];
+  int i, x, y, z;
+
+  // keep well clear of the float rounding of the returned mean
+  prune_total = nsamples * (prune_below - 1e-5 * (1 + fabs(prune_below)));
+  for (i = 0; i < nsamples; i++) {
+    if (ubound && (i & 31) == 0 && total_log_p + ubound[i] < prune_total)
+      return ((float)((total_log_p + ubound[i]) / nsamples));
+
+    // same float arithmetic as the MatrixMultiply in GCAcomputeLogSampleProbability
+    const float *p = &prior_coords[3 * i];
+    xv = 0; xv += m[0] * p[0]; xv += m[1] * p[1]; xv += m[2] * p[2];  xv += m[3];
+    yv = 0; yv += m[4] * p[0]; yv += m[5] * p[1]; yv += m[6] * p[2];  yv += m[7];
+    zv = 0; zv += m[8] * p[0]; zv += m[9] * p[1]; zv += m[10] * p[2]; zv += m[11];
+    x = nint(xv);
+    y = nint(yv);
+    z = nint(zv);
+    if (MRIindexNotInVolume(mri_inputs, x, y, z) == 0) {
+#ifdef FASTER_MRI_EM_REGISTER
+      if (gca->ninputs > 1)
+        load_vals_xyzInt(mri_inputs, x, y, z, vals, gca->ninputs);
+      else
+#endif
+        load_vals(mri_inputs, x, y, z, vals, gca->ninputs);
+
+#ifdef FASTER_MRI_EM_REGISTER
+      if (gca->ninputs == 1)
+        log_p = gcaComputeSampleLogDensity_1_input(&gcas[i], vals[0]);
+      else
+#endif
+        log_p = gcaComputeSampleLogDensity(&gcas[i], vals, gca->ninputs);
+      if (log_p < -clamp) log_p = -clamp;
+    }
+    else {
+      log_p = -1000000;
     }
-    gcas[i].log_p = log_p;
     total_log_p += log_p;
-
-#ifdef BEVIN_GCACOMPUTELOGSAMPLEPROBABILITY_REPRODUCIBLE
-
-    #undef total_log_p
-  #include "romp_for_end.h"
-  
-#else
-
-    ROMP_PFLB_end
   }
-  ROMP_PF_end
-
-#endif
-
-  fflush(stdout);
 
-  { int tid;
-    for (tid = 0; tid < nthreads; tid++) {
-      VectorFree(&v_src[tid]);
-      VectorFree(&v_dst[tid]);
-  } }
-  
-  if (m_prior2source_voxel_nonconst) MatrixFree(&m_prior2source_voxel_nonconst);
   return ((float)total_log_p / nsamples);
 }
 
@@ -6021,8 +6846,8 @@ static int GCAupdateNodeGibbsPriors(GCA *gca, MRI *mri, int xn, int yn, int zn,
         memmove(gc->labels[i], old_labels, gc->nlabels[i] * sizeof(unsigned short));
 
         /* free the old ones */
-        free(old_label_priors);
-        free(old_labels);
+        gcaFree(gca, old_label_priors);
+        gcaFree(gca, old_labels);
       }
       gc->labels[i][gc->nlabels[i]++] = nbr_label;
     }
@@ -6207,6 +7032,7 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
   }
 
   mri_changed = MRIclone(mri_dst, NULL);
+  gcaDensitiesCache(gca);
 
   /* go through each voxel in the input volume and find the canonical
      voxel (and hence the classifier) to which it maps. Then update the
@@ -6767,7 +7593,12 @@ double GCAvoxelGibbsLogPosterior(
     }
 
     /* compute 1-d Mahalanobis distance */
-    log_posterior = GCAcomputeConditionalLogDensity(gc, vals, gca->ninputs, label);
+    if (n < gcan->nlabels) {
+      log_posterior = gcaNodeClassLogDensity(gca, xn, yn, zn, n, vals);
+    }
+    else {
+      log_posterior = GCAcomputeConditionalLogDensity(gc, vals, gca->ninputs, label);
+    }
     if (check_finite("GCAvoxelGibbsLogPosterior: conditional log density", log_posterior) == 0) {
       DiagBreak();
     }
@@ -6857,7 +7688,6 @@ double GCAvoxelLogPosterior(GCA *gca, MRI *mri_labels, MRI *mri_inputs, int x, i
   int xn, yn, zn, label, n;
   GCA_NODE *gcan = 0;
   GCA_PRIOR *gcap = 0;
-  GC1D *gc = 0;
   float vals[MAX_GCA_INPUTS];
 #if INTERP_PRIOR
   float prior;
@@ -6918,10 +7748,8 @@ double GCAvoxelLogPosterior(GCA *gca, MRI *mri_labels, MRI *mri_inputs, int x, i
       // return(log(VERY_UNLIKELY)) ;
     }
 
-    gc = &gcan->gcs[n];
-
     /* compute 1-d Mahalanobis distance */
-    log_posterior = GCAcomputeConditionalLogDensity(gc, vals, gca->ninputs, gcan->labels[n]);
+    log_posterior = gcaNodeClassLogDensity(gca, xn, yn, zn, n, vals);
     if (check_finite("GCAvoxelGibbsLogPosterior: conditional log density", log_posterior) == 0) {
       DiagBreak();
     }
@@ -10417,6 +11245,7 @@ int GCArenormalize(MRI *mri_in, MRI *mri_labeled, GCA *gca, TRANSFORM *transform
   GCA_SAMPLE *gcas;
   GC1D *gc;
 
+  GCAdensitiesInvalidate(gca);
   if (gca->ninputs > 1) ErrorExit(ERROR_UNSUPPORTED, "GCArenormalize: can only renormalize scalars");
 
   /* first build a list of all labels that exist */
@@ -10569,6 +11398,7 @@ int GCArenormalizeAdaptive(MRI *mri_in, MRI *mri_labeled, GCA *gca, TRANSFORM *t
   float fmin, fmax;
   int nsamples = 0;
 
+  GCAdensitiesInvalidate(gca);
   orig_wsize = wsize;
   MRIvalRange(mri_in, &fmin, &fmax);
   histo = HISTOalloc((int)(fmax - fmin + 1));
@@ -10652,6 +11482,7 @@ int GCArenormalizeLabels(MRI *mri_in, MRI *mri_labeled, GCA *gca, TRANSFORM *tra
   MRI *mri_means, *mri_control, *mri_tmp;
   char fname[STRLEN];
 
+  GCAdensitiesInvalidate(gca);
   if (gca->ninputs > 1) ErrorExit(ERROR_UNSUPPORTED, "GCArenormalizeLabels: can only renormalize scalars");
 
   /* first build a list of all labels that exist */
@@ -10848,6 +11679,7 @@ int GCArenormalizeIntensities(GCA *gca, int *labels, float *intensities, int num
   GCA_NODE *gcan;
   GC1D *gc;
 
+  GCAdensitiesInvalidate(gca);
   if (gca->ninputs > 1) ErrorExit(ERROR_UNSUPPORTED, "GCArenormalizeIntensities: can only renormalize scalars");
 
   scales = (float *)calloc(num, sizeof(float));
@@ -10919,6 +11751,7 @@ int GCAunifyVariance(GCA *gca)
   GCA_NODE *gcan;
   GC1D *gc;
 
+  GCAdensitiesInvalidate(gca);
   for (zn = 0; zn < gca->node_depth; zn++) {
     for (yn = 0; yn < gca->node_height; yn++) {
       for (xn = 0; xn < gca->node_width; xn++) {
@@ -11222,6 +12055,7 @@ int GCAregularizeConditionalDensities(GCA *gca, float smooth)
   double **means, *wts;
   float prior;
 
+  GCAdensitiesInvalidate(gca);
   means = (double **)calloc(gca->ninputs, sizeof(double *));
   wts = (double *)calloc(MAX_GCA_LABELS, sizeof(double));
   if (!means || !wts)
@@ -11337,6 +12171,7 @@ int GCAmeanFilterConditionalDensities(GCA *gca, float navgs)
   MRI *mri_means;
   float prior;
 
+  GCAdensitiesInvalidate(gca);
   mri_means = MRIallocSequence(gca->node_width, gca->node_height, gca->node_depth, MRI_FLOAT, gca->ninputs);
 
   mri_means->xsize = gca->node_spacing;
@@ -12252,6 +13087,9 @@ double GCAcomputeConditionalDensity(GC1D *gc, float *vals, int ninputs, int labe
 
 /* compute 1-d Mahalanobis distance */
   {
+    if (ninputs > 1) {
+      return (exp(GCAcomputeConditionalLogDensity(gc, vals, ninputs, label)) / pow(2 * M_PI, ninputs / 2.0));
+    }
     dist = GCAmahDist(gc, vals, ninputs);
     p = (1.0 / (pow(2 * M_PI, ninputs / 2.0) * sqrt(covariance_determinant(gc, ninputs)))) * exp(-0.5 * dist);
   }
@@ -12301,7 +13139,13 @@ static double gcaComputeLogDensity(GC1D *gc, float *vals, int ninputs, float pri
 
 double GCAcomputeConditionalLogDensity(const GC1D *gc, float *vals, int ninputs, int label)
 {
-  double log_p, det;
+  double log_p, det, half_log_det, dsq;
+  double inv_covars[GCA_DENSITY_MAX_INPUTS * (GCA_DENSITY_MAX_INPUTS + 1) / 2];
+
+  if (ninputs > 1 && gcaInvertCovariance(gc->covars, ninputs, inv_covars, &half_log_det)) {
+    dsq = gcaMahDistInverse(inv_covars, gc->means, vals, ninputs);
+    return (half_log_det - .5 * dsq);
+  }
 
 /* compute 1-d Mahalanobis distance */
   {
@@ -12311,6 +13155,502 @@ double GCAcomputeConditionalLogDensity(const GC1D *gc, float *vals, int ninputs,
   return (log_p);
 }
 
+/*-----------------------------------------------------------------------
+  Class log densities without MATRIX temporaries.
+
+  The covariance of a class is inverted once with a Cholesky factorization
+  (in double) instead of with MatrixInverse/MatrixSVDInverse on every call,
+  and GCAdensitiesAlloc() does that for every node class up front so that
+  the labeling loops can evaluate all the classes of a node with one
+  vectorized kernel. Covariances that are not positive definite, or GCAs
+  with more than GCA_DENSITY_MAX_INPUTS inputs, use the MATRIX code.
+  -----------------------------------------------------------------------*/
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+// one clone of the kernel per instruction set, chosen at load time for this cpu
+#define GCA_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define GCA_TARGET_CLONES
+#endif
+
+/*
+  Packed upper triangle of the inverse of the packed covariance matrix,
+  and -log(sqrt(det)). Returns 0 if covars is not positive definite.
+*/
+static int gcaInvertCovariance(const float *covars, int ninputs, double *inv_covars, double *phalf_log_det)
+{
+  double A[GCA_DENSITY_MAX_INPUTS][GCA_DENSITY_MAX_INPUTS];
+  double L[GCA_DENSITY_MAX_INPUTS][GCA_DENSITY_MAX_INPUTS], Linv[GCA_DENSITY_MAX_INPUTS][GCA_DENSITY_MAX_INPUTS];
+  double s, half_log_det;
+  int r, c, k, i;
+
+  if (ninputs > GCA_DENSITY_MAX_INPUTS) {
+    return (0);
+  }
+  for (i = r = 0; r < ninputs; r++)
+    for (c = r; c < ninputs; c++, i++) {
+      A[r][c] = A[c][r] = covars[i];
+    }
+
+  // A = L L'
+  for (half_log_det = 0.0, c = 0; c < ninputs; c++) {
+    for (s = A[c][c], k = 0; k < c; k++) {
+      s -= L[c][k] * L[c][k];
+    }
+    if (!(s > 0)) {
+      return (0);
+    }
+    L[c][c] = sqrt(s);
+    half_log_det -= log(L[c][c]);
+    for (r = c + 1; r < ninputs; r++) {
+      for (s = A[r][c], k = 0; k < c; k++) {
+        s -= L[r][k] * L[c][k];
+      }
+      L[r][c] = s / L[c][c];
+    }
+  }
+  if (!std::isfinite(half_log_det)) {
+    return (0);
+  }
+
+  for (c = 0; c < ninputs; c++) {
+    Linv[c][c] = 1.0 / L[c][c];
+    for (r = c + 1; r < ninputs; r++) {
+      for (s = 0.0, k = c; k < r; k++) {
+        s -= L[r][k] * Linv[k][c];
+      }
+      Linv[r][c] = s / L[r][r];
+    }
+  }
+
+  // inverse(A) = Linv' Linv
+  for (i = r = 0; r < ninputs; r++)
+    for (c = r; c < ninputs; c++, i++) {
+      for (s = 0.0, k = c; k < ninputs; k++) {
+        s += Linv[k][r] * Linv[k][c];
+      }
+      inv_covars[i] = s;
+    }
+  *phalf_log_det = half_log_det;
+  return (1);
+}
+
+/* squared Mahalanobis distance given the packed inverse covariance */
+static double gcaMahDistInverse(const double *inv_covars, const float *means, const float *vals, int ninputs)
+{
+  double dsq;
+  int r, c, i;
+
+  for (dsq = 0.0, i = r = 0; r < ninputs; r++)
+    for (c = r; c < ninputs; c++, i++) {
+      dsq += (r == c ? 1 : 2) * inv_covars[i] * (vals[r] - means[r]) * (vals[c] - means[c]);
+    }
+  return (dsq);
+}
+
+/*
+  GCA_SAMPLE covariances are loaded into the upper triangle of the matrix
+  only (see load_sample_covariance_matrix), and the sample densities have
+  always used that triangular matrix U: det(U) is the product of its
+  diagonal and the distance is d' inverse(U) d. Computes the packed upper
+  triangle of inverse(U) by back substitution and -log(sqrt(det(U)))
+  without the static MATRIX temporaries. Returns 0 if a diagonal element
+  is not positive, which is left to the MATRIX code.
+*/
+static int gcaInvertSampleCovariance(const float *covars, int ninputs, double *inv_covars, double *phalf_log_det)
+{
+  double U[GCA_DENSITY_MAX_INPUTS][GCA_DENSITY_MAX_INPUTS], Uinv[GCA_DENSITY_MAX_INPUTS][GCA_DENSITY_MAX_INPUTS];
+  double s, half_log_det;
+  int r, c, k, i;
+
+  if (ninputs > GCA_DENSITY_MAX_INPUTS) {
+    return (0);
+  }
+  for (half_log_det = 0.0, i = r = 0; r < ninputs; r++)
+    for (c = r; c < ninputs; c++, i++) {
+      U[r][c] = covars[i];
+      if (r == c) {
+        if (!(U[r][r] > 0)) {
+          return (0);
+        }
+        half_log_det -= 0.5 * log(U[r][r]);
+      }
+    }
+  if (!std::isfinite(half_log_det)) {
+    return (0);
+  }
+
+  for (c = 0; c < ninputs; c++) {
+    Uinv[c][c] = 1.0 / U[c][c];
+    for (r = c - 1; r >= 0; r--) {
+      for (s = 0.0, k = r + 1; k <= c; k++) {
+        s += U[r][k] * Uinv[k][c];
+      }
+      Uinv[r][c] = -s / U[r][r];
+    }
+  }
+  for (i = r = 0; r < ninputs; r++)
+    for (c = r; c < ninputs; c++, i++) {
+      inv_covars[i] = Uinv[r][c];
+    }
+  *phalf_log_det = half_log_det;
+  return (1);
+}
+
+/* d' inverse(U) d given the packed upper triangle of inverse(U) */
+static double gcaSampleMahDistInverse(const double *inv_covars, const float *means, const float *vals, int ninputs)
+{
+  double dsq;
+  int r, c, i;
+
+  for (dsq = 0.0, i = r = 0; r < ninputs; r++)
+    for (c = r; c < ninputs; c++, i++) {
+      dsq += inv_covars[i] * (vals[r] - means[r]) * (vals[c] - means[c]);
+    }
+  return (dsq);
+}
+
+/*
+  Log densities of nlabels classes, stored component-major so that the
+  loops over classes vectorize. The inverse covariances and the sums are
+  kept in double like GCAcomputeConditionalLogDensity, since labels are
+  chosen by comparing these values and nearly tied classes must not
+  change order with the code path.
+*/
+GCA_TARGET_CLONES
+static void gcaLogDensityKernel(int nlabels,
+                                int ninputs,
+                                const float *means,
+                                const double *inv_covars,
+                                const double *half_log_det,
+                                const float *vals,
+                                double *log_p)
+{
+  int r, c, i, n;
+
+  for (n = 0; n < nlabels; n++) {
+    log_p[n] = 0.0;
+  }
+  for (i = r = 0; r < ninputs; r++) {
+    const float *mr = means + r * nlabels;
+    for (c = r; c < ninputs; c++, i++) {
+      const float *mc = means + c * nlabels;
+      const double *inv = inv_covars + i * nlabels;
+      const double vr = vals[r], vc = vals[c], w = (r == c) ? 1.0 : 2.0;
+      for (n = 0; n < nlabels; n++) {
+        log_p[n] += w * inv[n] * (vr - mr[n]) * (vc - mc[n]);
+      }
+    }
+  }
+  for (n = 0; n < nlabels; n++) {
+    log_p[n] = half_log_det[n] - 0.5 * log_p[n];
+  }
+}
+
+/*
+  the original MATRIX-based density, for classes the kernels cannot handle
+  and as the baseline of GCAprofileDensities
+*/
+static double gcaConditionalLogDensityMatrix(const GC1D *gc, float *vals, int ninputs)
+{
+  double det;
+
+  det = covariance_determinant(gc, ninputs);
+  return (-log(sqrt(det)) - .5 * gcaMahDistMatrix(gc, vals, ninputs));
+}
+
+GCA_DENSITIES *GCAdensitiesAlloc(GCA *gca)
+{
+  GCA_DENSITIES *gd;
+  size_t nnodes, nclasses, n;
+  int x, y, z, ncov;
+
+  if (gca->ninputs > GCA_DENSITY_MAX_INPUTS)
+    ErrorReturn(NULL,
+                (ERROR_BADPARM,
+                 "GCAdensitiesAlloc: %d inputs not supported (max %d)",
+                 gca->ninputs,
+                 GCA_DENSITY_MAX_INPUTS));
+
+  gd = (GCA_DENSITIES *)calloc(1, sizeof(GCA_DENSITIES));
+  if (!gd) {
+    ErrorExit(ERROR_NOMEMORY, "GCAdensitiesAlloc: could not allocate struct");
+  }
+  gd->ninputs = gca->ninputs;
+  gd->node_width = gca->node_width;
+  gd->node_height = gca->node_height;
+  gd->node_depth = gca->node_depth;
+  ncov = gca->ninputs * (gca->ninputs + 1) / 2;
+
+  nnodes = (size_t)gca->node_width * gca->node_height * gca->node_depth;
+  gd->offset = (size_t *)calloc(nnodes + 1, sizeof(size_t));
+  if (!gd->offset) {
+    ErrorExit(ERROR_NOMEMORY, "GCAdensitiesAlloc: could not allocate %d offsets", (int)nnodes);
+  }
+  for (n = x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++, n++) {
+        gd->offset[n + 1] = gd->offset[n] + gca->nodes[x][y][z].nlabels;
+      }
+  nclasses = gd->offset[nnodes];
+
+  gd->means = (float *)calloc(nclasses * gca->ninputs + 1, sizeof(float));
+  gd->inv_covars = (double *)calloc(nclasses * ncov + 1, sizeof(double));
+  gd->half_log_det = (double *)calloc(nclasses + 1, sizeof(double));
+  if (!gd->means || !gd->inv_covars || !gd->half_log_det) {
+    ErrorExit(ERROR_NOMEMORY, "GCAdensitiesAlloc: could not allocate %d classes", (int)nclasses);
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (x = 0; x < gca->node_width; x++) {
+    ROMP_PFLB_begin
+    int y, z, k, r, i, nlabels;
+    size_t node, off;
+    double inv_covars[GCA_DENSITY_MAX_INPUTS * (GCA_DENSITY_MAX_INPUTS + 1) / 2];
+    double half_log_det;
+    GCA_NODE *gcan;
+    GC1D *gc;
+
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        node = ((size_t)x * gca->node_height + y) * gca->node_depth + z;
+        off = gd->offset[node];
+        gcan = &gca->nodes[x][y][z];
+        nlabels = gcan->nlabels;
+        for (k = 0; k < nlabels; k++) {
+          gc = &gcan->gcs[k];
+          for (r = 0; r < gca->ninputs; r++) {
+            gd->means[off * gca->ninputs + r * nlabels + k] = gc->means[r];
+          }
+          if (gcaInvertCovariance(gc->covars, gca->ninputs, inv_covars, &half_log_det)) {
+            for (i = 0; i < ncov; i++) {
+              gd->inv_covars[off * ncov + i * nlabels + k] = inv_covars[i];
+            }
+            gd->half_log_det[off + k] = half_log_det;
+          }
+          else {
+            gd->half_log_det[off + k] = NAN;
+          }
+        }
+      }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (gd);
+}
+
+int GCAdensitiesFree(GCA_DENSITIES **pgd)
+{
+  GCA_DENSITIES *gd = *pgd;
+
+  *pgd = NULL;
+  if (gd == NULL) {
+    return (NO_ERROR);
+  }
+  free(gd->offset);
+  free(gd->means);
+  free(gd->inv_covars);
+  free(gd->half_log_det);
+  free(gd);
+  return (NO_ERROR);
+}
+
+/*
+  Builds gca->densities unless it is already cached. The table is kept
+  across labeling passes and dropped by GCAdensitiesInvalidate(), which
+  every function that changes the node classes calls.
+*/
+static void gcaDensitiesCache(GCA *gca)
+{
+  if (gca->densities == NULL && gca->ninputs <= GCA_DENSITY_MAX_INPUTS) {
+    gca->densities = GCAdensitiesAlloc(gca);
+  }
+}
+
+void GCAdensitiesInvalidate(GCA *gca)
+{
+  if (gca->densities) {
+    GCAdensitiesFree(&gca->densities);
+  }
+}
+
+/*
+  Class conditional log densities of all the labels at node (xn,yn,zn),
+  log_p must have room for gcan->nlabels values.
+*/
+int GCAnodeLogDensities(GCA *gca, int xn, int yn, int zn, const float *vals, double *log_p)
+{
+  GCA_DENSITIES *gd = gca->densities;
+  GCA_NODE *gcan = &gca->nodes[xn][yn][zn];
+  size_t node, off;
+  int n, ncov;
+
+  if (gd) {
+    node = ((size_t)xn * gd->node_height + yn) * gd->node_depth + zn;
+    off = gd->offset[node];
+    if (gd->offset[node + 1] - off != (size_t)gcan->nlabels) {
+      gd = NULL;  // node changed since the table was built
+    }
+  }
+  if (gd == NULL) {
+    for (n = 0; n < gcan->nlabels; n++) {
+      log_p[n] = GCAcomputeConditionalLogDensity(&gcan->gcs[n], (float *)vals, gca->ninputs, gcan->labels[n]);
+    }
+    return (NO_ERROR);
+  }
+
+  ncov = gca->ninputs * (gca->ninputs + 1) / 2;
+  gcaLogDensityKernel(gcan->nlabels,
+                      gca->ninputs,
+                      gd->means + off * gca->ninputs,
+                      gd->inv_covars + off * ncov,
+                      gd->half_log_det + off,
+                      vals,
+                      log_p);
+  for (n = 0; n < gcan->nlabels; n++)
+    if (std::isnan(log_p[n])) {
+      log_p[n] = gcaConditionalLogDensityMatrix(&gcan->gcs[n], (float *)vals, gca->ninputs);
+    }
+  return (NO_ERROR);
+}
+
+/* class conditional log density of the nth label at node (xn,yn,zn) */
+static double gcaNodeClassLogDensity(GCA *gca, int xn, int yn, int zn, int n, float *vals)
+{
+  GCA_DENSITIES *gd = gca->densities;
+  GCA_NODE *gcan = &gca->nodes[xn][yn][zn];
+  size_t node, off;
+  int nlabels, r, c, i;
+  double dsq;
+
+  if (gd) {
+    node = ((size_t)xn * gd->node_height + yn) * gd->node_depth + zn;
+    off = gd->offset[node];
+    nlabels = gd->offset[node + 1] - off;
+    if (nlabels == gcan->nlabels && !std::isnan(gd->half_log_det[off + n])) {
+      const float *means = gd->means + off * gca->ninputs + n;
+      const double *inv_covars = gd->inv_covars + off * (gca->ninputs * (gca->ninputs + 1) / 2) + n;
+      for (dsq = 0.0, i = r = 0; r < gca->ninputs; r++)
+        for (c = r; c < gca->ninputs; c++, i++) {
+          dsq += (r == c ? 1 : 2) * inv_covars[i * nlabels] * (vals[r] - means[r * nlabels]) *
+                 (vals[c] - means[c * nlabels]);
+        }
+      return (gd->half_log_det[off + n] - 0.5 * dsq);
+    }
+  }
+  return (GCAcomputeConditionalLogDensity(&gcan->gcs[n], vals, gca->ninputs, gcan->labels[n]));
+}
+
+/*
+  Times the class log densities of nnodes randomly chosen nodes computed
+  one class at a time with the original MATRIX code (MatrixInverse and
+  MatrixSVDInverse per call) against the table kernel, and reports how
+  far apart the two are and at how many nodes they pick different labels.
+  Run by utils/test/mris_benchmark.
+*/
+int GCAprofileDensities(GCA *gca, int nnodes)
+{
+  std::vector<int> xn(nnodes), yn(nnodes), zn(nnodes);
+  std::vector<float> vals((size_t)nnodes * gca->ninputs);
+  std::vector<double> log_p, log_p_table;
+  double t_matrix, t_table, t_build, max_diff = 0;
+  long nclasses = 0, ntries = 0, nflips = 0;
+  int i, n, r, max_labels = 0;
+  const char *isa = "default";
+  Timer timer;
+
+  if (nnodes <= 0 || gca->ninputs > GCA_DENSITY_MAX_INPUTS) {
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAprofileDensities: %d nodes, %d inputs", nnodes, gca->ninputs));
+  }
+
+  // pick nodes with at least two classes and an intensity near one of them
+  srand(53);
+  for (i = 0; i < nnodes;) {
+    GCA_NODE *gcan;
+    xn[i] = rand() % gca->node_width;
+    yn[i] = rand() % gca->node_height;
+    zn[i] = rand() % gca->node_depth;
+    gcan = &gca->nodes[xn[i]][yn[i]][zn[i]];
+    if (gcan->nlabels < 2 && ++ntries < 100 * (long)nnodes) {
+      continue;
+    }
+    if (gcan->nlabels < 1) {
+      continue;
+    }
+    for (r = 0; r < gca->ninputs; r++) {
+      vals[(size_t)i * gca->ninputs + r] = gcan->gcs[0].means[r] + 2.0 * (drand48() - 0.5) * sqrt(gcan->gcs[0].covars[0]);
+    }
+    nclasses += gcan->nlabels;
+    max_labels = MAX(max_labels, gcan->nlabels);
+    i++;
+  }
+  log_p.resize(max_labels);
+  log_p_table.resize(max_labels);
+
+  timer.reset();
+  for (i = 0; i < nnodes; i++) {
+    GCA_NODE *gcan = &gca->nodes[xn[i]][yn[i]][zn[i]];
+    for (n = 0; n < gcan->nlabels; n++) {
+      log_p[n] = gcaConditionalLogDensityMatrix(&gcan->gcs[n], &vals[(size_t)i * gca->ninputs], gca->ninputs);
+    }
+  }
+  t_matrix = timer.seconds();
+
+  timer.reset();
+  GCAdensitiesInvalidate(gca);  // time a fresh build
+  gcaDensitiesCache(gca);
+  t_build = timer.seconds();
+  timer.reset();
+  for (i = 0; i < nnodes; i++) {
+    GCAnodeLogDensities(gca, xn[i], yn[i], zn[i], &vals[(size_t)i * gca->ninputs], log_p_table.data());
+  }
+  t_table = timer.seconds();
+
+  // largest difference, and nodes where the most likely class differs
+  for (i = 0; i < nnodes; i++) {
+    GCA_NODE *gcan = &gca->nodes[xn[i]][yn[i]][zn[i]];
+    int max_n = 0, max_n_table = 0;
+    GCAnodeLogDensities(gca, xn[i], yn[i], zn[i], &vals[(size_t)i * gca->ninputs], log_p_table.data());
+    for (n = 0; n < gcan->nlabels; n++) {
+      log_p[n] = gcaConditionalLogDensityMatrix(&gcan->gcs[n], &vals[(size_t)i * gca->ninputs], gca->ninputs);
+      if (std::isfinite(log_p[n]) && fabs(log_p[n] - log_p_table[n]) > max_diff) {
+        max_diff = fabs(log_p[n] - log_p_table[n]);
+      }
+      if (log_p[n] > log_p[max_n]) {
+        max_n = n;
+      }
+      if (log_p_table[n] > log_p_table[max_n_table]) {
+        max_n_table = n;
+      }
+    }
+    if (max_n != max_n_table) {
+      nflips++;
+    }
+  }
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+  if (__builtin_cpu_supports("avx512f")) {
+    isa = "avx512f";
+  }
+  else if (__builtin_cpu_supports("avx2")) {
+    isa = "avx2";
+  }
+#endif
+  printf("GCAprofileDensities: %d nodes, %ld classes, %d inputs\n", nnodes, nclasses, gca->ninputs);
+  printf("  matrix: %g classes/sec\n", nclasses / (t_matrix > 0 ? t_matrix : 1e-9));
+  printf("  table (%s): %g classes/sec, table built in %2.2f sec, max |diff| = %g, %ld of %d nodes change label\n",
+         isa,
+         nclasses / (t_table > 0 ? t_table : 1e-9),
+         t_build,
+         max_diff,
+         nflips,
+         nnodes);
+  return (NO_ERROR);
+}
+
 GCA_SAMPLE *GCAfindAllSamples(GCA *gca, int *pnsamples, int *exclude_list, int unknown_nbr_spacing)
 {
   GCA_SAMPLE *gcas;
@@ -12627,34 +13967,40 @@ GC1D *alloc_gcs(int nlabels, int flags, int ninputs)
 }
 
 int free_gcs(GC1D *gcs, int nlabels, int ninputs)
+{
+  gcaFreeGCs(NULL, gcs, nlabels);
+  return (NO_ERROR);
+}
+
+/* frees nlabels classes of gca (NULL for classes on the heap) */
+static void gcaFreeGCs(const GCA *gca, GC1D *gcs, int nlabels)
 {
   int i, j;
 
   for (i = 0; i < nlabels; i++) {
     if (gcs[i].means) {
-      free(gcs[i].means);
+      gcaFree(gca, gcs[i].means);
     }
     if (gcs[i].covars) {
-      free(gcs[i].covars);
+      gcaFree(gca, gcs[i].covars);
     }
     if (gcs[i].nlabels) /* gibbs stuff allocated */
     {
       for (j = 0; j < GIBBS_NEIGHBORHOOD; j++) {
         if (gcs[i].labels[j]) {
-          free(gcs[i].labels[j]);
+          gcaFree(gca, gcs[i].labels[j]);
         }
         if (gcs[i].label_priors[j]) {
-          free(gcs[i].label_priors[j]);
+          gcaFree(gca, gcs[i].label_priors[j]);
         }
       }
-      free(gcs[i].nlabels);
-      free(gcs[i].labels);
-      free(gcs[i].label_priors);
+      gcaFree(gca, gcs[i].nlabels);
+      gcaFree(gca, gcs[i].labels);
+      gcaFree(gca, gcs[i].label_priors);
     }
   }
 
-  free(gcs);
-  return (NO_ERROR);
+  gcaFree(gca, gcs);
 }
 
 int copy_gcs(int nlabels, GC1D *gcs_src, GC1D *gcs_dst, int ninputs)
@@ -12707,14 +14053,14 @@ int GCAfreeGibbs(GCA *gca)
         for (n = 0; n < gcan->nlabels; n++) {
           gc = &gcan->gcs[n];
           for (i = 0; i < GIBBS_NEIGHBORS; i++) {
-            free(gc->label_priors[i]);
-            free(gc->labels[i]);
+            gcaFree(gca, gc->label_priors[i]);
+            gcaFree(gca, gc->labels[i]);
             gc->label_priors[i] = NULL;
             gc->labels[i] = NULL;
           }
-          free(gc->nlabels);
-          free(gc->labels);
-          free(gc->label_priors);
+          gcaFree(gca, gc->nlabels);
+          gcaFree(gca, gc->labels);
+          gcaFree(gca, gc->label_priors);
           gc->nlabels = NULL;
           gc->labels = NULL;
           gc->label_priors = NULL;
@@ -12788,6 +14134,7 @@ int GCArenormalizeFromAtlas(GCA *gca, GCA *gca_template)
   GCA_NODE *gcan;
   GC1D *gc, *gct;
 
+  GCAdensitiesInvalidate(gca);
   scale = (float)gca_template->node_width / (float)gca->node_width;
 
   for (xs = 0; xs < gca->node_width; xs++) {
@@ -12840,6 +14187,29 @@ static void load_vals_xyzInt(const MRI *mri_inputs, int x, int y, int z, float *
 #endif
 
 double GCAmahDist(const GC1D *gc, const float *vals, const int ninputs)
+{
+  double dsq;
+
+  if (ninputs == 1) {
+    float v;
+    v = vals[0] - gc->means[0];
+    dsq = v * v / gc->covars[0];
+    return (dsq);
+  }
+  {
+    double inv_covars[GCA_DENSITY_MAX_INPUTS * (GCA_DENSITY_MAX_INPUTS + 1) / 2];
+    double half_log_det;
+
+    if (gcaInvertCovariance(gc->covars, ninputs, inv_covars, &half_log_det)) {
+      dsq = gcaMahDistInverse(inv_covars, gc->means, vals, ninputs);
+      return (dsq);
+    }
+  }
+  return (gcaMahDistMatrix(gc, vals, ninputs));
+}
+
+/* the original MATRIX-based distance, for covariances Cholesky rejects */
+static double gcaMahDistMatrix(const GC1D *gc, const float *vals, int ninputs)
 {
   static VECTOR *v_means = NULL, *v_vals = NULL;
   static MATRIX *m_cov = NULL, *m_cov_inv;
@@ -13077,7 +14447,14 @@ static double gcaComputeSampleLogDensity_1_input(GCA_SAMPLE *gcas, float val)
 
 static double gcaComputeSampleConditionalLogDensity(GCA_SAMPLE *gcas, float *vals, int ninputs, int label)
 {
-  double log_p, det;
+  double log_p, det, half_log_det, dsq;
+  double inv_covars[GCA_DENSITY_MAX_INPUTS * (GCA_DENSITY_MAX_INPUTS + 1) / 2];
+
+  // the static MATRIX temporaries below are not safe in the parallel sample loop
+  if (ninputs > 1 && gcaInvertSampleCovariance(gcas->covars, ninputs, inv_covars, &half_log_det)) {
+    dsq = gcaSampleMahDistInverse(inv_covars, gcas->means, vals, ninputs);
+    return (half_log_det - .5 * dsq);
+  }
 
   {
     det = sample_covariance_determinant(gcas, ninputs);
@@ -13340,8 +14717,8 @@ GCA *GCAcreateWeightedFlashGCAfromParameterGCA(
           continue;
         }
         if (gcap_src->nlabels > gcap_dst->max_labels) {
-          free(gcap_dst->priors);
-          free(gcap_dst->labels);
+          gcaFree(gca_flash, gcap_dst->priors);
+          gcaFree(gca_flash, gcap_dst->labels);
 
           gcap_dst->labels = (unsigned short *)calloc(gcap_src->nlabels, sizeof(unsigned short));
           if (!gcap_dst->labels)
@@ -13380,8 +14757,8 @@ GCA *GCAcreateWeightedFlashGCAfromParameterGCA(
         gcan_dst->nlabels = gcan_src->nlabels;
         gcan_dst->total_training = gcan_src->total_training;
         if (gcan_src->nlabels > gcan_dst->max_labels) {
-          free(gcan_dst->labels);
-          free_gcs(gcan_dst->gcs, gcan_dst->max_labels, gca_flash->ninputs);
+          gcaFree(gca_flash, gcan_dst->labels);
+          gcaFreeGCs(gca_flash, gcan_dst->gcs, gcan_dst->max_labels);
 
           gcan_dst->labels = (unsigned short *)calloc(gcan_src->nlabels, sizeof(unsigned short));
           if (!gcan_dst->labels)
@@ -13538,8 +14915,8 @@ GCA *GCAcreateFlashGCAfromParameterGCA(GCA *gca_T1PD, double *TR, double *fa, do
         }
         gcap_dst->nlabels = gcap_src->nlabels;
         if (gcap_src->nlabels > gcap_dst->max_labels) {
-          free(gcap_dst->priors);
-          free(gcap_dst->labels);
+          gcaFree(gca_flash, gcap_dst->priors);
+          gcaFree(gca_flash, gcap_dst->labels);
 
           gcap_dst->labels = (unsigned short *)calloc(gcap_src->nlabels, sizeof(unsigned short));
           if (!gcap_dst->labels)
@@ -13578,8 +14955,8 @@ GCA *GCAcreateFlashGCAfromParameterGCA(GCA *gca_T1PD, double *TR, double *fa, do
         gcan_dst->nlabels = gcan_src->nlabels;
         gcan_dst->total_training = gcan_src->total_training;
         if (gcan_src->nlabels > gcan_dst->max_labels) {
-          free(gcan_dst->labels);
-          free_gcs(gcan_dst->gcs, gcan_dst->max_labels, gca_flash->ninputs);
+          gcaFree(gca_flash, gcan_dst->labels);
+          gcaFreeGCs(gca_flash, gcan_dst->gcs, gcan_dst->max_labels);
 
           gcan_dst->labels = (unsigned short *)calloc(gcan_src->nlabels, sizeof(unsigned short));
           if (!gcan_dst->labels)
@@ -13705,6 +15082,7 @@ int GCAfixSingularCovarianceMatrices(GCA *gca)
   double det, vars[MAX_GCA_INPUTS], min_det;
   MATRIX *m_cov_inv, *m_cov = NULL;
 
+  GCAdensitiesInvalidate(gca);
   nparams = (gca->ninputs * (gca->ninputs + 1)) / 2 + gca->ninputs;
   /* covariance matrix and means */
 
@@ -13891,6 +15269,7 @@ int GCAregularizeCovarianceMatrices(GCA *gca, double lambda)
   double det, vars[MAX_GCA_INPUTS], min_det;
   MATRIX *m_cov = NULL;
 
+  GCAdensitiesInvalidate(gca);
   nparams = (gca->ninputs * (gca->ninputs + 1)) / 2 + gca->ninputs;
   /* covariance matrix and means */
 
@@ -14037,8 +15416,8 @@ GCA *GCAcreateFlashGCAfromFlashGCA(GCA *gca_flash_src, double *TR, double *fa, d
         }
         gcap_dst->nlabels = gcap_src->nlabels;
         if (gcap_src->nlabels > gcap_dst->max_labels) {
-          free(gcap_dst->priors);
-          free(gcap_dst->labels);
+          gcaFree(gca_flash_dst, gcap_dst->priors);
+          gcaFree(gca_flash_dst, gcap_dst->labels);
 
           gcap_dst->labels = (unsigned short *)calloc(gcap_src->nlabels, sizeof(unsigned short));
           if (!gcap_dst->labels)
@@ -14077,25 +15456,25 @@ GCA *GCAcreateFlashGCAfromFlashGCA(GCA *gca_flash_src, double *TR, double *fa, d
         gcan_dst->nlabels = gcan_src->nlabels;
         gcan_dst->total_training = gcan_src->total_training;
         if (gcan_src->nlabels > gcan_dst->max_labels) {
-          free(gcan_dst->labels);
+          gcaFree(gca_flash_dst, gcan_dst->labels);
           for (n = 0; n < gcan_dst->max_labels; n++) {
             gc_dst = &gcan_dst->gcs[n];
             for (i = 0; i < GIBBS_NEIGHBORS; i++) {
               if (gc_dst->label_priors[i]) {
-                free(gc_dst->label_priors[i]);
+                gcaFree(gca_flash_dst, gc_dst->label_priors[i]);
               }
               if (gc_dst->labels[i]) {
-                free(gc_dst->labels[i]);
+                gcaFree(gca_flash_dst, gc_dst->labels[i]);
               }
             }
             if (gc_dst->nlabels) {
-              free(gc_dst->nlabels);
+              gcaFree(gca_flash_dst, gc_dst->nlabels);
             }
             if (gc_dst->labels) {
-              free(gc_dst->labels);
+              gcaFree(gca_flash_dst, gc_dst->labels);
             }
             if (gc_dst->label_priors) {
-              free(gc_dst->label_priors);
+              gcaFree(gca_flash_dst, gc_dst->label_priors);
             }
           }
 
@@ -14250,6 +15629,7 @@ int GCAnormalizeMeans(GCA *gca, float target)
   GCA_NODE *gcan;
   GC1D *gc;
 
+  GCAdensitiesInvalidate(gca);
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -14282,6 +15662,7 @@ int GCAregularizeCovariance(GCA *gca, float regularize)
   double det, vars[MAX_GCA_INPUTS];
   MATRIX *m_cov = NULL;
 
+  GCAdensitiesInvalidate(gca);
   nparams = (gca->ninputs * (gca->ninputs + 1)) / 2 + gca->ninputs;
   /* covariance matrix and means */
   memset(vars, 0, sizeof(vars));
@@ -17174,6 +18555,7 @@ int GCAapplyRenormalization(GCA *gca, float *label_scales, float *label_offsets,
   GCA_NODE *gcan;
   GC1D *gc;
 
+  GCAdensitiesInvalidate(gca);
   for (xn = 0; xn < gca->node_width; xn++) {
     double means_before[MAX_GCA_LABELS], means_after[MAX_GCA_LABELS];
     // double scales[MAX_GCA_LABELS];
@@ -17327,6 +18709,7 @@ int GCAmapRenormalize(GCA *gca, MRI *mri, TRANSFORM *transform)
   MATRIX *m_cov;
   MRI *mri_fsamples = NULL;  // diag volume
 
+  GCAdensitiesInvalidate(gca);
 /* for each class, build a histogram of values
    (weighted by priors) to determine
    p(I|u,c) p(c).
@@ -17673,6 +19056,7 @@ int GCAmapRenormalizeByClass(GCA *gca, MRI *mri, TRANSFORM *transform)
   GC1D *gc;
   double p, max_p;
 
+  GCAdensitiesInvalidate(gca);
   /* for each class, build a histogram of values
      (weighted by priors) to determine
      p(I|u,c) p(c).
@@ -18225,6 +19609,7 @@ int GCAreplaceLabels(GCA *gca, int in_label, int out_label)
   GCA_NODE *gcan;
   GCA_PRIOR *gcap;
 
+  GCAdensitiesInvalidate(gca);
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -18458,6 +19843,7 @@ GCA *GCAcompactify(GCA *gca)
   int i, j, k;
   double byteSaved = 0.;
 
+  GCAdensitiesInvalidate(gca);
   width = gca->prior_width;
   height = gca->prior_height;
   depth = gca->prior_depth;
@@ -18494,8 +19880,8 @@ GCA *GCAcompactify(GCA *gca)
             memmove(gcap->labels, old_labels, n * sizeof(unsigned short));
 
             /* free the old ones */
-            free(old_priors);
-            free(old_labels);
+            gcaFree(gca, old_priors);
+            gcaFree(gca, old_labels);
             gcap->max_labels = gcap->nlabels;
 
             byteSaved += (sizeof(float) + sizeof(unsigned short)) * (nmax - n);
@@ -18538,8 +19924,8 @@ GCA *GCAcompactify(GCA *gca)
             memmove(gcan->labels, old_labels, n * sizeof(unsigned short));
 
             /* free the old ones */
-            free(old_gcs);
-            free(old_labels);
+            gcaFree(gca, old_gcs);
+            gcaFree(gca, old_labels);
             gcan->max_labels = n;
             byteSaved += (sizeof(float) + sizeof(unsigned short)) * (nmax - n);
           }
@@ -20395,6 +21781,7 @@ static int gcaScale(GCA *gca, int *labels, int *contra_labels, float *scales, in
   GCA_NODE *gcan;
   float scale;
 
+  GCAdensitiesInvalidate(gca);
   for (i = 0; i <= MAX_CMA_LABEL; i++) {
     label_indices[i] = -1;
   }
@@ -20624,6 +22011,7 @@ int GCArenormalizeClass(GCA *gca, int classnum, float scale_to_wm)
   int x, y, z, n, same_class, r;
   GCA_NODE *gcan;
 
+  GCAdensitiesInvalidate(gca);
   GCAclassMode(gca, WM_CLASS, &wm_mode);
   GCAclassMode(gca, classnum, &class_mode);
 
@@ -21263,7 +22651,7 @@ MRI *GCAreclassifyUnlikelyVoxels(GCA *gca,
                   MRIsetVoxVal(mri_aseg_changed, x, y, z, 0, max_label);
                 }
               }
-              GCANfree(gcan_total, gca->ninputs);
+              GCANfree(NULL, gcan_total);
               free(gcan_total);
               GCAPfree(gcap_total);
               free(gcap_total);
@@ -21428,7 +22816,7 @@ MRI *GCAcomputeOptimalScale(GCA *gca,
                 best_sigma = sigma;
               }
 
-              GCANfree(gcan_total, gca->ninputs);
+              GCANfree(NULL, gcan_total);
               free(gcan_total);
               GCAPfree(gcap_total);
               free(gcap_total);
@@ -21537,7 +22925,7 @@ MRI *GCAreclassifyVoxelsAtOptimalScale(
                     max_label);
               MRIsetVoxVal(mri_aseg_changed, x, y, z, 0, max_label);
             }
-            GCANfree(gcan_total, gca->ninputs);
+            GCANfree(NULL, gcan_total);
             free(gcan_total);
             GCAPfree(gcap_total);
             free(gcap_total);
@@ -21638,12 +23026,12 @@ GCA *GCAsmooth(GCA *gca, double sigma)
           gcan_total->gcs[0].covars[0] = 25;
         }
         if (gcan->max_labels < gcan_total->nlabels) {
-          free(gcan->labels);
+          gcaFree(gca_smooth, gcan->labels);
           gcan->labels = (unsigned short *)calloc(gcan_total->nlabels, sizeof(unsigned short));
           if (gcan->labels == NULL)
             ErrorExit(ERROR_NOMEMORY, "GCAsmooth(%2.2f) couldn't allocate %d label node", sigma, gcan_total->nlabels);
         }
-        free_gcs(gcan->gcs, gcan->nlabels, gca->ninputs);
+        gcaFreeGCs(gca_smooth, gcan->gcs, gcan->nlabels);
         gcan->gcs = alloc_gcs(gcan_total->nlabels, gca->flags, gca->ninputs);
         copy_gcs(gcan_total->nlabels, gcan_total->gcs, gcan->gcs, gca->ninputs);
         gcan->nlabels = gcan_total->nlabels;
@@ -21664,7 +23052,7 @@ GCA *GCAsmooth(GCA *gca, double sigma)
           gcan->gcs[n].covars[0] = 25;
         }
         gcan->total_training = gcan_total->total_training;
-        GCANfree(gcan_total, gca->ninputs);
+        GCANfree(NULL, gcan_total);
         free(gcan_total);
       }
     }
@@ -21683,8 +23071,8 @@ GCA *GCAsmooth(GCA *gca, double sigma)
         gcap = &gca_smooth->priors[xp][yp][zp];
         gcap->nlabels = gcap_total->nlabels;
         if (gcap_total->nlabels > gcap->max_labels) {
-          free(gcap->labels);
-          free(gcap->priors);
+          gcaFree(gca_smooth, gcap->labels);
+          gcaFree(gca_smooth, gcap->priors);
           gcap->labels = (unsigned short *)calloc(gcap->nlabels, sizeof(unsigned short));
           if (!gcap->labels)
             ErrorExit(ERROR_NOMEMORY,
@@ -21770,12 +23158,12 @@ GCA *GCAnodeDownsample2(GCA *gca)
           gcan_total->gcs[0].covars[0] = 25;
         }
         if (gcan->max_labels < gcan_total->nlabels) {
-          free(gcan->labels);
+          gcaFree(gca_smooth, gcan->labels);
           gcan->labels = (unsigned short *)calloc(gcan_total->nlabels, sizeof(unsigned short));
           if (gcan->labels == NULL)
             ErrorExit(ERROR_NOMEMORY, "GCAsmooth(%2.2f) couldn't allocate %d label node", sigma, gcan_total->nlabels);
         }
-        free_gcs(gcan->gcs, gcan->nlabels, gca->ninputs);
+        gcaFreeGCs(gca_smooth, gcan->gcs, gcan->nlabels);
         gcan->gcs = alloc_gcs(gcan_total->nlabels, gca->flags, gca->ninputs);
         copy_gcs(gcan_total->nlabels, gcan_total->gcs, gcan->gcs, gca->ninputs);
         gcan->nlabels = gcan_total->nlabels;
@@ -21796,7 +23184,7 @@ GCA *GCAnodeDownsample2(GCA *gca)
           gcan->gcs[n].covars[0] = 25;
         }
         gcan->total_training = gcan_total->total_training;
-        GCANfree(gcan_total, gca->ninputs);
+        GCANfree(NULL, gcan_total);
         free(gcan_total);
       }
     }
@@ -21815,8 +23203,8 @@ GCA *GCAnodeDownsample2(GCA *gca)
         gcap = &gca_smooth->priors[xp][yp][zp];
         gcap->nlabels = gcap_total->nlabels;
         if (gcap_total->nlabels > gcap->max_labels) {
-          free(gcap->labels);
-          free(gcap->priors);
+          gcaFree(gca_smooth, gcap->labels);
+          gcaFree(gca_smooth, gcap->priors);
           gcap->labels = (unsigned short *)calloc(gcap->nlabels, sizeof(unsigned short));
           if (!gcap->labels)
             ErrorExit(ERROR_NOMEMORY,
@@ -21950,6 +23338,7 @@ int GCAinsertLabels(GCA *gca,
   GCA_NODE *gcan;
   GCA_PRIOR *gcap;
 
+  GCAdensitiesInvalidate(gca);
   for (l = 0; l < ninsertions; l++) {
     whalf = insert_whalf[l];
     label = insert_labels[l];
@@ -22008,7 +23397,7 @@ int GCAinsertLabels(GCA *gca,
                 }
               }
               copy_gcs(gcan->nlabels, gcan->gcs, gcs, gca->ninputs);
-              free_gcs(gcan->gcs, gcan->nlabels, gca->ninputs);
+              gcaFreeGCs(gca, gcan->gcs, gcan->nlabels);
               gc->ntraining = gcan->total_training;  // arbitrary
               gcan->total_training *= 2;
               gcan->gcs = gcs;
@@ -22177,6 +23566,7 @@ int GCAremoveHemi(GCA *gca, int lh)
   GCA_NODE *gcan;
   GCA_PRIOR *gcap;
 
+  GCAdensitiesInvalidate(gca);
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -22246,6 +23636,7 @@ int GCAupdateDistributions(GCA *gca, MRI *mri, TRANSFORM *transform)
   float vals[MAX_GCA_INPUTS], *all_vals, med;
   GCA_NODE *gcan;
 
+  GCAdensitiesInvalidate(gca);
   all_vals = (float *)calloc(gca->node_width * gca->node_height * gca->node_depth, sizeof(float));
   for (label = 0; label <= MAX_CMA_LABEL; label++) {
     //    printf("updating means for label %s\n", cma_label_to_name(label)) ;
@@ -22295,6 +23686,7 @@ int GCAremoveLabel(GCA *gca, int label)
   GCA_NODE *gcan;
   GCA_PRIOR *gcap;
 
+  GCAdensitiesInvalidate(gca);
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -22913,6 +24305,7 @@ void GCAinitLabelsFromMRI(GCA *gca, MRI *mri_labels)
   GCA_PRIOR *gcap;
   GCA_NODE *gcan;
 
+  GCAdensitiesInvalidate(gca);
   if (gca->width != mri_labels->width || gca->height != mri_labels->height || gca->depth != mri_labels->depth)
     ErrorExit(ERROR_BADPARM, "GCAinitLabelsFromMRI: GCA and MRI must have same dimensions");
 
@@ -424,13 +424,14 @@ void GCAlinearNode::ScorchNodes(GCA *targ) const
   for (int ix = 0; ix < targ->node_width; ix++) {
     for (int iy = 0; iy < targ->node_height; iy++) {
       for (int iz = 0; iz < targ->node_depth; iz++) {
-        GCANfree(&(targ->nodes[ix][iy][iz]), targ->ninputs);
+        GCANfree(targ, &(targ->nodes[ix][iy][iz]));
       }
       free(targ->nodes[ix][iy]);
     }
     free(targ->nodes[ix]);
   }
   free(targ->nodes);
+  GCAdensitiesInvalidate(targ);
 }
 
 // ###############################################################
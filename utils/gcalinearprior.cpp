@@ -240,8 +240,8 @@ void GCAlinearPrior::ScorchPriors(GCA *targ) const
   for (int ix = 0; ix < targ->prior_width; ix++) {
     for (int iy = 0; iy < targ->prior_height; iy++) {
       for (int iz = 0; iz < targ->prior_depth; iz++) {
-        free(targ->priors[ix][iy][iz].labels);
-        free(targ->priors[ix][iy][iz].priors);
+        GCAfreeArray(targ, targ->priors[ix][iy][iz].labels);
+        GCAfreeArray(targ, targ->priors[ix][iy][iz].priors);
       }
       free(targ->priors[ix][iy]);
     }
@@ -28,6 +28,7 @@
 #include <string>
 #include <sstream>
 #include <iomanip>
+#include <vector>
 
 #define SHOW_EXEC_LOC 0
 
@@ -1296,35 +1297,27 @@ GCA_MORPH *GCAMalloc(const int width, const int height, const int depth)
     ErrorExit(ERROR_NOMEMORY, "GCAMalloc: could not allocate nodes");
   }
 
+  // all the nodes live in a single block, x-major, so that the loops over
+  // the whole morph (which is what the energy and gradient terms do) walk
+  // through memory linearly. nodes[0][0] is the start of the block.
+  GCA_MORPH_NODE *buf = (GCA_MORPH_NODE *)calloc((size_t)width * height * depth, sizeof(GCA_MORPH_NODE));
+  if (!buf) {
+    ErrorExit(ERROR_NOMEMORY,
+              "GCAMalloc(%d, %d, %d): could not allocate %zu bytes for nodes",
+              width,
+              height,
+              depth,
+              (size_t)width * height * depth * sizeof(GCA_MORPH_NODE));
+  }
+
   for (x = 0; x < gcam->width; x++) {
     gcam->nodes[x] = (GCA_MORPH_NODE **)calloc(gcam->height, sizeof(GCA_MORPH_NODE *));
     if (!gcam->nodes[x]) {
       ErrorExit(ERROR_NOMEMORY, "GCAMalloc: could not allocate %dth **", x);
     }
 
-#define ELECTRIC_FENCE 0
-#if ELECTRIC_FENCE
-    {
-      GCA_MORPH_NODE *buf;
-
-      buf = (GCA_MORPH_NODE *)calloc(gcam->depth * gcam->height, sizeof(GCA_MORPH_NODE));
-      if (buf == NULL)
-        ErrorExit(ERROR_NO_MEMORY,
-                  "GCAMalloc(%d, %d, %d): could not allocate "
-                  "%d bytes for %dth bslice\n",
-                  height,
-                  width,
-                  depth,
-                  (gcam->depth * gcam->height * sizeof(GCA_MORPH_NODE)),
-                  x);
-      for (y = 0; y < gcam->height; y++) {
-        gcam->nodes[x][y] = buf + (y * gcam->depth);
-      }
-    }
-#else
     for (y = 0; y < gcam->height; y++) {
-      gcam->nodes[x][y] = (GCA_MORPH_NODE *)calloc(gcam->depth, sizeof(GCA_MORPH_NODE));
-      if (!gcam->nodes[x][y]) ErrorExit(ERROR_NOMEMORY, "GCAMalloc: could not allocate %d,%dth *", x, y);
+      gcam->nodes[x][y] = buf + ((size_t)x * height + y) * depth;
       for (z = 0; z < gcam->depth; z++) {
         gcam->nodes[x][y][z].origx = x;
         gcam->nodes[x][y][z].origy = y;
@@ -1334,7 +1327,6 @@ GCA_MORPH *GCAMalloc(const int width, const int height, const int depth)
         gcam->nodes[x][y][z].z = z;
       }
     }
-#endif
   }
   initVolGeom(&gcam->image);
   initVolGeom(&gcam->atlas);
@@ -1675,8 +1667,12 @@ int GCAMfreeContents(GCA_MORPH *gcam)
           free_gcs(gcamn->gc, 1, gcam->ninputs);
         }
       }
-      free(gcam->nodes[x][y]);
     }
+  }
+  if (gcam->width > 0 && gcam->height > 0) {
+    free(gcam->nodes[0][0]);  // the single block of nodes (see GCAMalloc)
+  }
+  for (x = 0; x < gcam->width; x++) {
     free(gcam->nodes[x]);
   }
   free(gcam->nodes);
@@ -5895,15 +5891,17 @@ int gcamLimitGradientMagnitude(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms, MRI *mri
 /*!
   \fn int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothness)
   \brief Compute derivative of mesh smoothness cost. Derivatives are approximate.
-  Consumes a lot of time in mri_ca_register. Can be sped up by about a factor of 6.
+  Consumes a lot of time in mri_ca_register. The displacements and validity
+  of all the nodes are first gathered into flat arrays (25 bytes per node,
+  written on every call), so that the 26-neighbor stencil reads three packed
+  doubles and a flag per neighbor instead of a cache line of each node. The
+  sums are formed in the same order and precision as before, so the gradient
+  is unchanged bit for bit; GCAMprofileSmoothness checks this against the
+  node loop it replaced. The Jacobian and likelihood terms still walk the
+  nodes.
  */
 int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothness)
 {
-  double vx = 0.0, vy = 0.0, vz = 0.0, vnx = 0.0, vny = 0.0, vnz = 0.0;
-  double dx = 0.0, dy = 0.0, dz = 0.0;
-  int x = 0, y = 0, z = 0, xk = 0, yk = 0, zk = 0, xn = 0, yn = 0, zn = 0;
-  int width, height, depth, num = 0;
-  GCA_MORPH_NODE *gcamn = NULL, *gcamn_nbr = NULL;
   extern int gcamSmoothnessTerm_nCalls;
   extern double gcamSmoothnessTerm_tsec;
   Timer timer;
@@ -5914,65 +5912,91 @@ int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothnes
 
   gcamSmoothnessTerm_nCalls ++;
 
-  width = gcam->width;
-  height = gcam->height;
-  depth = gcam->depth;
+  int const width = gcam->width;
+  int const height = gcam->height;
+  int const depth = gcam->depth;
+  size_t const nnodes = (size_t)width * height * depth;
+
+  // x-major like the node block, so index(x,y,z) = (x*height + y)*depth + z
+  std::vector<double> disp_x(nnodes), disp_y(nnodes), disp_z(nnodes);
+  std::vector<char> valid(nnodes);
+
   ROMP_PF_begin
 #ifdef HAVE_OPENMP
-  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(                                                          \
-    y, z, gcamn, vx, vy, vz, dx, dy, dz, num, xk, xn, yk, yn, zk, zn, gcamn_nbr, vnx, vny, vnz) \
-    shared(gcam, Gx, Gy, Gz) schedule(static, 1)
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static, 1)
 #endif
-  for (x = 0; x < gcam->width; x++) {
+  for (int x = 0; x < width; x++) {
+    ROMP_PFLB_begin
+    for (int y = 0; y < height; y++) {
+      size_t const row = ((size_t)x * height + y) * depth;
+      GCA_MORPH_NODE const *const nodes = gcam->nodes[x][y];
+      for (int z = 0; z < depth; z++) {
+        GCA_MORPH_NODE const *const gcamn = &nodes[z];
+        valid[row + z] = (gcamn->invalid != GCAM_POSITION_INVALID);
+        disp_x[row + z] = gcamn->x - gcamn->origx;
+        disp_y[row + z] = gcamn->y - gcamn->origy;
+        disp_z[row + z] = gcamn->z - gcamn->origz;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) shared(gcam, Gx, Gy, Gz) schedule(static, 1)
+#endif
+  for (int x = 0; x < width; x++) {
     ROMP_PFLB_begin
     
-    for (y = 0; y < gcam->height; y++) {
-      for (z = 0; z < gcam->depth; z++) {
+    for (int y = 0; y < height; y++) {
+      for (int z = 0; z < depth; z++) {
         if (x == Gx && y == Gy && z == Gz) {
           DiagBreak();
         }
-        gcamn = &gcam->nodes[x][y][z];
+        size_t const index = ((size_t)x * height + y) * depth + z;
 
-        if (gcamn->invalid == GCAM_POSITION_INVALID) {
+        if (!valid[index]) {
           continue;
         }
 
-        vx = gcamn->x - gcamn->origx;
-        vy = gcamn->y - gcamn->origy;
-        vz = gcamn->z - gcamn->origz;
-        dx = dy = dz = 0.0f;
+        double const vx = disp_x[index];
+        double const vy = disp_y[index];
+        double const vz = disp_z[index];
+        double dx = 0.0, dy = 0.0, dz = 0.0;
         if (x == Gx && y == Gy && z == Gz)
           printf("l_smoo: node(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f)\n", x, y, z, vx, vy, vz);
-        num = 0;
+        int num = 0;
 
-        for (xk = -1; xk <= 1; xk++) {
-          xn = x + xk;
+        for (int xk = -1; xk <= 1; xk++) {
+          int xn = x + xk;
           xn = MAX(0, xn);
           xn = MIN(width - 1, xn);
 
-          for (yk = -1; yk <= 1; yk++) {
-            yn = y + yk;
+          for (int yk = -1; yk <= 1; yk++) {
+            int yn = y + yk;
             yn = MAX(0, yn);
             yn = MIN(height - 1, yn);
 
-            for (zk = -1; zk <= 1; zk++) {
+            size_t const row = ((size_t)xn * height + yn) * depth;
+
+            for (int zk = -1; zk <= 1; zk++) {
               if (!zk && !yk && !xk) {
                 continue;
               }
 
-              zn = z + zk;
+              int zn = z + zk;
               zn = MAX(0, zn);
               zn = MIN(depth - 1, zn);
 
-              gcamn_nbr = &gcam->nodes[xn][yn][zn];
-
-              if (gcamn_nbr->invalid == GCAM_POSITION_INVALID) {
+              size_t const nbr = row + zn;
+              if (!valid[nbr]) {
                 continue;
               }
 
-              vnx = gcamn_nbr->x - gcamn_nbr->origx;
-              vny = gcamn_nbr->y - gcamn_nbr->origy;
-              vnz = gcamn_nbr->z - gcamn_nbr->origz;
+              double const vnx = disp_x[nbr];
+              double const vny = disp_y[nbr];
+              double const vnz = disp_z[nbr];
 
               dx += (vnx - vx);
               dy += (vny - vy);
@@ -5998,6 +6022,7 @@ int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothnes
           printf("l_smoo: node(%d,%d,%d): DX=(%2.2f,%2.2f,%2.2f)\n", x, y, z, dx, dy, dz);
         }
 
+        GCA_MORPH_NODE *const gcamn = &gcam->nodes[x][y][z];
         gcamn->dx += dx;
         gcamn->dy += dy;
         gcamn->dz += dz;
@@ -6013,6 +6038,151 @@ int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothnes
   return (NO_ERROR);
 }
 
+/*
+  The smoothness gradient as gcamSmoothnessTerm computed it before the
+  displacements were gathered into flat arrays, reading every neighbor from
+  its node. Kept as the reference for GCAMprofileSmoothness.
+*/
+static void gcamSmoothnessTermNodes(GCA_MORPH *gcam, const double l_smoothness)
+{
+  int const width = gcam->width;
+  int const height = gcam->height;
+  int const depth = gcam->depth;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static, 1)
+#endif
+  for (int x = 0; x < width; x++) {
+    ROMP_PFLB_begin
+    for (int y = 0; y < height; y++) {
+      for (int z = 0; z < depth; z++) {
+        GCA_MORPH_NODE *const gcamn = &gcam->nodes[x][y][z];
+        if (gcamn->invalid == GCAM_POSITION_INVALID) {
+          continue;
+        }
+
+        double const vx = gcamn->x - gcamn->origx;
+        double const vy = gcamn->y - gcamn->origy;
+        double const vz = gcamn->z - gcamn->origz;
+        double dx = 0.0, dy = 0.0, dz = 0.0;
+        int num = 0;
+
+        for (int xk = -1; xk <= 1; xk++) {
+          int const xn = MIN(width - 1, MAX(0, x + xk));
+          for (int yk = -1; yk <= 1; yk++) {
+            int const yn = MIN(height - 1, MAX(0, y + yk));
+            for (int zk = -1; zk <= 1; zk++) {
+              if (!zk && !yk && !xk) {
+                continue;
+              }
+              int const zn = MIN(depth - 1, MAX(0, z + zk));
+              GCA_MORPH_NODE const *const gcamn_nbr = &gcam->nodes[xn][yn][zn];
+              if (gcamn_nbr->invalid == GCAM_POSITION_INVALID) {
+                continue;
+              }
+              dx += ((gcamn_nbr->x - gcamn_nbr->origx) - vx);
+              dy += ((gcamn_nbr->y - gcamn_nbr->origy) - vy);
+              dz += ((gcamn_nbr->z - gcamn_nbr->origz) - vz);
+              num++;
+            }
+          }
+        }
+        if (num) {
+          dx = dx * l_smoothness / num;
+          dy = dy * l_smoothness / num;
+          dz = dz * l_smoothness / num;
+        }
+        gcamn->dx += dx;
+        gcamn->dy += dy;
+        gcamn->dz += dz;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+/*
+  Times ntimes smoothness gradients of gcam computed by the node loop
+  gcamSmoothnessTerm used to run and by gcamSmoothnessTerm, and sets
+  *pmax_diff to the largest difference between the two gradients (0 when
+  they agree bit for bit). The gradient of gcam is left as it was. Run by
+  utils/test/test_gcam_smoothness and utils/test/mris_benchmark.
+*/
+int GCAMprofileSmoothness(GCA_MORPH *gcam, int ntimes, double *pmax_diff)
+{
+  size_t const nnodes = (size_t)gcam->width * gcam->height * gcam->depth;
+  std::vector<float> saved(3 * nnodes), ref(3 * nnodes);
+  double t_nodes, t_gathered, max_diff = 0;
+  int i, x, y, z;
+  size_t index;
+  Timer timer;
+
+  if (ntimes <= 0) {
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMprofileSmoothness: ntimes %d", ntimes));
+  }
+
+  for (index = 0, x = 0; x < gcam->width; x++)
+    for (y = 0; y < gcam->height; y++)
+      for (z = 0; z < gcam->depth; z++, index++) {
+        GCA_MORPH_NODE const *gcamn = &gcam->nodes[x][y][z];
+        saved[3 * index] = gcamn->dx;
+        saved[3 * index + 1] = gcamn->dy;
+        saved[3 * index + 2] = gcamn->dz;
+      }
+
+  // one pass of each from a cleared gradient to compare, then the timed passes
+  gcamClearGradient(gcam);
+  gcamSmoothnessTermNodes(gcam, 1.0);
+  for (index = 0, x = 0; x < gcam->width; x++)
+    for (y = 0; y < gcam->height; y++)
+      for (z = 0; z < gcam->depth; z++, index++) {
+        GCA_MORPH_NODE const *gcamn = &gcam->nodes[x][y][z];
+        ref[3 * index] = gcamn->dx;
+        ref[3 * index + 1] = gcamn->dy;
+        ref[3 * index + 2] = gcamn->dz;
+      }
+  gcamClearGradient(gcam);
+  gcamSmoothnessTerm(gcam, NULL, 1.0);
+  for (index = 0, x = 0; x < gcam->width; x++)
+    for (y = 0; y < gcam->height; y++)
+      for (z = 0; z < gcam->depth; z++, index++) {
+        GCA_MORPH_NODE const *gcamn = &gcam->nodes[x][y][z];
+        max_diff = MAX(max_diff, fabs(gcamn->dx - ref[3 * index]));
+        max_diff = MAX(max_diff, fabs(gcamn->dy - ref[3 * index + 1]));
+        max_diff = MAX(max_diff, fabs(gcamn->dz - ref[3 * index + 2]));
+      }
+
+  timer.reset();
+  for (i = 0; i < ntimes; i++) {
+    gcamSmoothnessTermNodes(gcam, 1.0);
+  }
+  t_nodes = timer.seconds();
+  timer.reset();
+  for (i = 0; i < ntimes; i++) {
+    gcamSmoothnessTerm(gcam, NULL, 1.0);
+  }
+  t_gathered = timer.seconds();
+
+  for (index = 0, x = 0; x < gcam->width; x++)
+    for (y = 0; y < gcam->height; y++)
+      for (z = 0; z < gcam->depth; z++, index++) {
+        GCA_MORPH_NODE *gcamn = &gcam->nodes[x][y][z];
+        gcamn->dx = saved[3 * index];
+        gcamn->dy = saved[3 * index + 1];
+        gcamn->dz = saved[3 * index + 2];
+      }
+
+  printf("GCAMprofileSmoothness: %d x %d x %d nodes, %d passes\n", gcam->width, gcam->height, gcam->depth, ntimes);
+  printf("  node loop: %2.3f sec/pass\n", t_nodes / ntimes);
+  printf("  gathered:  %2.3f sec/pass, max |diff| = %g\n", t_gathered / ntimes, max_diff);
+  if (pmax_diff) {
+    *pmax_diff = max_diff;
+  }
+  return (NO_ERROR);
+}
+
 #define GCAM_SMOOTHNESS_OUTPUT 0
 
 double gcamElasticEnergy(const GCA_MORPH *gcam, GCA_MORPH_PARMS *parms)
@@ -7618,6 +7788,9 @@ int gcamReadMRI(GCA_MORPH *gcam, MRI *mri, int which)
   if (Gdiag & DIAG_WRITE && DIAG_VERBOSE_ON) {
     MRIwrite(mri, "m.mgz");
   }
+  if (gcam->gca && (which == GCAM_MEANS || which == GCAM_COVARS)) {
+    GCAdensitiesInvalidate(gcam->gca);  // the node classes point into the atlas
+  }
   for (x = 0; x < gcam->width; x++)
     for (y = 0; y < gcam->height; y++)
       for (z = 0; z < gcam->depth; z++) {
@@ -11739,6 +11912,9 @@ int GCAMsetVariances(GCA_MORPH *gcam, float var)
   int x, y, z, r;
   GCA_MORPH_NODE *gcamn;
 
+  if (gcam->gca) {
+    GCAdensitiesInvalidate(gcam->gca);  // the node classes point into the atlas
+  }
   for (x = 0; x < gcam->width; x++) {
     for (y = 0; y < gcam->height; y++) {
       for (z = 0; z < gcam->depth; z++) {
@@ -13534,6 +13710,9 @@ int GCAMnormalizeIntensities(GCA_MORPH *gcam, MRI *mri_target)
       }
     }
   }
+  if (gcam->gca) {
+    GCAdensitiesInvalidate(gcam->gca);  // the node classes point into the atlas
+  }
   return (NO_ERROR);
 }
 
@@ -13752,6 +13931,9 @@ int GCAMsetMeansForLabel(GCA_MORPH *gcam, MRI *mri_labels, MRI *mri_vals, int la
   int x, y, z, l, r, xv, yv, zv;
   GCA_MORPH_NODE *gcamn;
 
+  if (gcam->gca) {
+    GCAdensitiesInvalidate(gcam->gca);  // the node classes point into the atlas
+  }
   for (x = 0; x < gcam->width; x++) {
     for (y = 0; y < gcam->height; y++) {
       for (z = 0; z < gcam->depth; z++) {
@@ -17192,7 +17374,6 @@ MRI *GCAMtoMRI(GCAM *gcam, MRI *mri)
 
 GCA_MORPH *GCAMcopy(const GCA_MORPH *gcamsrc, GCA_MORPH *gcamdst)
 {
-  int c, r, s;
   if (gcamdst && (gcamdst->width != gcamsrc->width ||
                   gcamdst->height != gcamsrc->height ||
                   gcamdst->depth != gcamsrc->depth) ) {
@@ -17225,12 +17406,11 @@ GCA_MORPH *GCAMcopy(const GCA_MORPH *gcamsrc, GCA_MORPH *gcamdst)
   gcamdst->det = gcamsrc->det;
   gcamdst->type = gcamsrc->type;
   // Only GC1D pointer in node, target doesn't not get saved.
-  for (c=0; c<gcamsrc->width; c++) {
-    for (r=0; r<gcamsrc->height; r++) {
-      for (s=0; s<gcamsrc->depth; s++) {
-        memcpy(&gcamdst->nodes[c][r][s], &gcamsrc->nodes[c][r][s], sizeof(GMN));
-      }
-    }
+  // The nodes are a single block (see GCAMalloc) so copy them in one go.
+  if (gcamsrc->width > 0 && gcamsrc->height > 0) {
+    memcpy(gcamdst->nodes[0][0],
+           gcamsrc->nodes[0][0],
+           (size_t)gcamsrc->width * gcamsrc->height * gcamsrc->depth * sizeof(GMN));
   }
   gcamdst->vgcam_ms = gcamsrc->vgcam_ms; // Not saved.
   return (gcamdst);
@@ -25,6 +25,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <atomic>
+#include <vector>
+
 #include "mrisurf.h"
 #include "mrisurf_project.h"
 
@@ -38,6 +41,7 @@
 #include "macros.h"
 #include "mrishash.h"
 #include "proto.h"
+#include "romp_support.h"
 #include "tags.h"
 #include "transform.h"
 #include "utils.h"
@@ -59,6 +63,54 @@ static int GCSANclassify(
 static double gcsaNbhdGibbsLogLikelihood(
     GCSA *gcsa, MRI_SURFACE *mris, double *v_inputs, int vno, double gibbs_coef, int label);
 static double gcsaVertexGibbsLogLikelihood(GCSA *gcsa, MRI_SURFACE *mris, double const *v_inputs, int vno, double gibbs_coef);
+static int GCSANclassifyWork(GCSA_NODE *gcsan,
+                             CP_NODE *cpn,
+                             double *v_inputs,
+                             int ninputs,
+                             double *pprob,
+                             int *exclude_list,
+                             int nexcluded,
+                             MATRIX **pm_cov_inv,
+                             VECTOR **pv_tmp,
+                             VECTOR **pv_x);
+
+/*
+  Everything the Gibbs log-likelihood of a vertex needs that does not depend
+  on the current labeling: the prior and classifier node of every surface
+  vertex, found once with batched hash table queries instead of twice per
+  evaluation, and the inverse and determinant of each class covariance at the
+  classifier nodes in use, inverted on first use (see gcsaGibbsCacheInvert)
+  instead of on every evaluation.  The likelihoods are bitwise the same as
+  without the cache.
+*/
+typedef struct
+{
+  GCSA *gcsa;
+  std::vector<int> vno_prior;       // per surface vertex
+  std::vector<int> vno_classifier;  // per surface vertex
+  std::vector<int> gcs_offset;      // per classifier node, -1 if no vertex uses it
+  std::vector<MATRIX *> m_cov_inv;  // per class at the used nodes, NULL if singular
+  std::vector<double> det;
+  std::vector<std::atomic<bool> > inverted;  // m_cov_inv and det are set
+  VECTOR *v_x[_MAX_FS_THREADS], *v_tmp[_MAX_FS_THREADS];
+} GCSA_GIBBS_CACHE;
+
+static void gcsaFindVertexNodes(GCSA *gcsa, MRI_SURFACE *mris, std::vector<int> &vno_prior, std::vector<int> &vno_classifier);
+static GCSA_GIBBS_CACHE *gcsaGibbsCacheAlloc(GCSA *gcsa, MRI_SURFACE *mris);
+static void gcsaGibbsCacheFree(GCSA_GIBBS_CACHE **pcache);
+static void gcsaGibbsCacheInvert(GCSA_GIBBS_CACHE *cache, GCS *gcs, int offset);
+static double gcsaVertexGibbsLogLikelihoodNodes(GCSA *gcsa,
+                                                GCSA_GIBBS_CACHE *cache,
+                                                MRI_SURFACE *mris,
+                                                double const *v_inputs,
+                                                int vno,
+                                                int vno_prior,
+                                                int vno_classifier,
+                                                double gibbs_coef);
+static double gcsaNbhdGibbsLogLikelihoodCached(
+    GCSA_GIBBS_CACHE *cache, MRI_SURFACE *mris, double *v_inputs, int vno, double gibbs_coef, int label);
+static int gcsaRelabelVertexUsingGibbsPriors(GCSA_GIBBS_CACHE *cache, MRI_SURFACE *mris, int vno);
+static int gcsaColorVerticesDistance2(MRI_SURFACE *mris, std::vector<std::vector<int> > &colors);
 static int add_gc_to_gcsan(GCSA_NODE *gcsan_src, int nsrc, GCSA_NODE *gcsan_dst);
 #if 0
 static int add_cp_to_cpn(CP_NODE *cpn_src, int nsrc, CP_NODE *cpn_dst) ;
@@ -165,6 +217,10 @@ GCSA *GCSAalloc(int ninputs, int icno_priors, int icno_classifiers)
   MRIScomputeVertexSpacingStats(gcsa->mris_priors, NULL, NULL, &max_len, NULL, NULL, CURRENT_VERTICES);
   gcsa->mht_priors = MHTcreateVertexTable_Resolution(gcsa->mris_priors, CURRENT_VERTICES, 2 * max_len);
 
+  // the atlas surfaces never move, so the tables can be queried from many threads
+  MHTfreeze(gcsa->mht_classifiers);
+  MHTfreeze(gcsa->mht_priors);
+
   return (gcsa);
 }
 
@@ -781,30 +837,80 @@ int GCSAbuildMostLikelyLabels(GCSA *gcsa, MRI_SURFACE *mris)
 }
 
 static int Gvno = -1;
+
+/*
+  Find the prior and classifier node of every vertex of mris (the classifier
+  node is the one closest to the prior node, as in GCSAsourceToClassifierVertex).
+  The atlas hash tables are frozen, so the queries run in parallel.
+*/
+static void gcsaFindVertexNodes(GCSA *gcsa, MRI_SURFACE *mris, std::vector<int> &vno_prior, std::vector<int> &vno_classifier)
+{
+  int const nvertices = mris->nvertices;
+  std::vector<float> xyz(3 * nvertices);
+
+  cheapAssert(MHTwhich(gcsa->mht_priors) == CURRENT_VERTICES);
+  cheapAssert(MHTwhich(gcsa->mht_classifiers) == CURRENT_VERTICES);
+
+  for (int vno = 0; vno < nvertices; vno++) {
+    VERTEX const *v = &mris->vertices[vno];
+    xyz[3 * vno + 0] = v->x;
+    xyz[3 * vno + 1] = v->y;
+    xyz[3 * vno + 2] = v->z;
+  }
+  vno_prior.resize(nvertices);
+  MHTfindClosestVertexNoXYZBatch(gcsa->mht_priors, gcsa->mris_priors, nvertices, xyz.data(), vno_prior.data(), NULL);
+
+  for (int vno = 0; vno < nvertices; vno++) {
+    VERTEX const *v_prior = &gcsa->mris_priors->vertices[vno_prior[vno]];
+    xyz[3 * vno + 0] = v_prior->x;
+    xyz[3 * vno + 1] = v_prior->y;
+    xyz[3 * vno + 2] = v_prior->z;
+  }
+  vno_classifier.resize(nvertices);
+  MHTfindClosestVertexNoXYZBatch(
+      gcsa->mht_classifiers, gcsa->mris_classifiers, nvertices, xyz.data(), vno_classifier.data(), NULL);
+}
+
 int GCSAlabel(GCSA *gcsa, MRI_SURFACE *mris)
 {
-  int vno, vno_classifier, label, vno_prior;
-  VERTEX *v, *v_classifier, *v_prior;
-  GCSA_NODE *gcsan;
-  CP_NODE *cpn;
-  double v_inputs[100], p;
+  std::vector<int> vno_priors, vno_classifiers;
+  MATRIX *m_cov_inv[_MAX_FS_THREADS] = {NULL};
+  VECTOR *v_tmp[_MAX_FS_THREADS] = {NULL}, *v_x[_MAX_FS_THREADS] = {NULL};
+
+  gcsaFindVertexNodes(gcsa, mris, vno_priors, vno_classifiers);
+
+  // every vertex is classified on its own, so the labeling does not depend on the number of threads
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 256)
+#endif
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    int vno_classifier, label, vno_prior;
+    VERTEX *v;
+    GCSA_NODE *gcsan;
+    CP_NODE *cpn;
+    double v_inputs[100], p;
+#ifdef HAVE_OPENMP
+    int const tid = omp_get_thread_num();
+#else
+    int const tid = 0;
+#endif
 
-  for (vno = 0; vno < mris->nvertices; vno++) {
     v = &mris->vertices[vno];
-    if (v->ripflag) continue;
+    if (v->ripflag) ROMP_PFLB_continue;
     if (vno == Gdiag_no) DiagBreak();
     load_inputs(v, v_inputs, gcsa->ninputs);
 
-    v_prior = GCSAsourceToPriorVertex(gcsa, v);
-    vno_prior = v_prior - gcsa->mris_priors->vertices;
+    vno_prior = vno_priors[vno];
     if (vno_prior == Gdiag_no) DiagBreak();
-    v_classifier = GCSAsourceToClassifierVertex(gcsa, v_prior);
-    vno_classifier = v_classifier - gcsa->mris_classifiers->vertices;
+    vno_classifier = vno_classifiers[vno];
     if (vno_classifier == Gdiag_no) DiagBreak();
     gcsan = &gcsa->gc_nodes[vno_classifier];
 
     cpn = &gcsa->cp_nodes[vno_prior];
-    label = GCSANclassify(gcsan, cpn, v_inputs, gcsa->ninputs, &p, NULL, 0);
+    label = GCSANclassifyWork(
+        gcsan, cpn, v_inputs, gcsa->ninputs, &p, NULL, 0, &m_cov_inv[tid], &v_tmp[tid], &v_x[tid]);
     v->annotation = label;
     // O.Hinds needs this for vertex probability feature (mris_ca_label -p) but it breaks mris_ca_label    v->val = p ;
     if (vno == Gdiag_no) {
@@ -831,20 +937,49 @@ int GCSAlabel(GCSA *gcsa, MRI_SURFACE *mris)
         MatrixPrint(stdout, gcs->v_means);
       }
     }
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
 
+  for (int tid = 0; tid < _MAX_FS_THREADS; tid++) {
+    if (m_cov_inv[tid]) MatrixFree(&m_cov_inv[tid]);
+    if (v_tmp[tid]) VectorFree(&v_tmp[tid]);
+    if (v_x[tid]) VectorFree(&v_x[tid]);
+  }
   return (NO_ERROR);
 }
 
 static int GCSANclassify(
     GCSA_NODE *gcsan, CP_NODE *cpn, double *v_inputs, int ninputs, double *pprob, int *exclude_list, int nexcluded)
+{
+  static MATRIX *m_cov_inv = NULL;
+  static VECTOR *v_tmp = NULL, *v_x = NULL;
+
+  return (GCSANclassifyWork(
+      gcsan, cpn, v_inputs, ninputs, pprob, exclude_list, nexcluded, &m_cov_inv, &v_tmp, &v_x));
+}
+
+/*
+  GCSANclassify with caller-owned scratch matrices, so that several threads
+  can classify at once.
+*/
+static int GCSANclassifyWork(GCSA_NODE *gcsan,
+                             CP_NODE *cpn,
+                             double *v_inputs,
+                             int ninputs,
+                             double *pprob,
+                             int *exclude_list,
+                             int nexcluded,
+                             MATRIX **pm_cov_inv,
+                             VECTOR **pv_tmp,
+                             VECTOR **pv_x)
 {
   int n, best_label, i, j, skip;
   double p, ptotal, max_p, det;
   CP *cp;
   GCS *gcs;
-  static MATRIX *m_cov_inv = NULL;
-  static VECTOR *v_tmp = NULL, *v_x = NULL;
+  MATRIX *m_cov_inv = *pm_cov_inv;
+  VECTOR *v_tmp = *pv_tmp, *v_x = *pv_x;
 
   if (v_x && ninputs != v_x->rows) {
     MatrixFree(&m_cov_inv);
@@ -901,6 +1036,9 @@ static int GCSANclassify(
   }
   if (pprob) *pprob = max_p / ptotal;
 
+  *pm_cov_inv = m_cov_inv;
+  *pv_tmp = v_tmp;
+  *pv_x = v_x;
   return (best_label);
 }
 
@@ -1109,16 +1247,185 @@ static int edge_to_index(VERTEX const * const v, VERTEX const * const vn)
 int gcsa_write_iterations = 0;
 char *gcsa_write_fname = NULL;
 
-int GCSAreclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris)
+/*
+  Relabel vno with the label that maximizes the Gibbs likelihood of its
+  neighborhood.  Only vno's annotation and marked are written, and only the
+  annotations of vertices at most two edges away are read.  Returns 1 if the
+  label changed, 0 if it did not and -1 if vno was not examined.
+*/
+static int gcsaRelabelVertexUsingGibbsPriors(GCSA_GIBBS_CACHE *cache, MRI_SURFACE *mris, int vno)
 {
-  int *indices;
-  int n, vno, i, nchanged, label, best_label, old_label, vno_prior, vno_classifier, niter, examined;
+  GCSA *gcsa = cache->gcsa;
+  int n, label, best_label, old_label, vno_prior, vno_classifier;
   double ll, max_ll;
-  // GCSA_NODE *gcsan;
   CP_NODE *cpn;
   double v_inputs[100];
 
-  indices = (int *)calloc(mris->nvertices, sizeof(int));
+  VERTEX *const v = &mris->vertices[vno];
+  if (v->marked == 0) return (-1);
+  v->marked = 0;
+
+  if (vno == Gdiag_no) DiagBreak();
+
+  load_inputs(v, v_inputs, gcsa->ninputs);
+
+  vno_prior = cache->vno_prior[vno];
+  if (vno_prior == Gdiag_no) DiagBreak();
+  cpn = &gcsa->cp_nodes[vno_prior];
+  if (cpn->nlabels <= 1) return (0);
+
+  vno_classifier = cache->vno_classifier[vno];
+  if (vno_classifier == Gdiag_no) DiagBreak();
+
+  best_label = old_label = v->annotation;
+  if (vno == Gdiag_no) printf("reclassifying vertex %d...\n", vno);
+  max_ll = gcsaNbhdGibbsLogLikelihoodCached(cache, mris, v_inputs, vno, 1.0, old_label);
+  for (n = 0; n < cpn->nlabels; n++) {
+    label = cpn->labels[n];
+    ll = gcsaNbhdGibbsLogLikelihoodCached(cache, mris, v_inputs, vno, 1.0, label);
+    if (vno == Gdiag_no)
+      printf("\tlabel %s (%d, %d): ll=%2.3f\n",
+             annotation_to_name(label, NULL),
+             label,
+             annotation_to_index(label),
+             ll);
+    if (ll > max_ll) {
+      max_ll = ll;
+      best_label = label;
+      if (vno == Gdiag_no) printf("\tlabel %s NEW MAX\n", annotation_to_name(label, NULL));
+    }
+  }
+  if (best_label == old_label) return (0);
+
+  if (vno == Gdiag_no)
+    printf("v %d: label changed from %s (%d) to %s (%d)\n",
+           vno,
+           annotation_to_name(old_label, NULL),
+           old_label,
+           annotation_to_name(best_label, NULL),
+           best_label);
+  v->marked = 1;
+  v->annotation = best_label;
+  return (1);
+}
+
+/*
+  Greedy distance-2 coloring of the surface: no two vertices within two edges
+  of each other get the same color.  Relabeling a vertex only reads labels
+  within two edges of it and only writes its own, so all the vertices of one
+  color can be relabeled at once with the same result as one after the other.
+*/
+static int gcsaColorVerticesDistance2(MRI_SURFACE *mris, std::vector<std::vector<int> > &colors)
+{
+  std::vector<int> color(mris->nvertices, -1), used_by;
+
+  colors.clear();
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY const *const vt = &mris->vertices_topology[vno];
+
+    // used_by[c] == vno marks color c as taken in the neighborhood of vno
+    for (int n = 0; n < vt->vnum; n++) {
+      int const vno1 = vt->v[n];
+      VERTEX_TOPOLOGY const *const vt1 = &mris->vertices_topology[vno1];
+      if (color[vno1] >= 0) used_by[color[vno1]] = vno;
+      for (int m = 0; m < vt1->vnum; m++) {
+        int const vno2 = vt1->v[m];
+        if (color[vno2] >= 0) used_by[color[vno2]] = vno;
+      }
+    }
+
+    int c = 0;
+    while (c < (int)colors.size() && used_by[c] == vno) c++;
+    if (c == (int)colors.size()) {
+      colors.push_back(std::vector<int>());
+      used_by.push_back(-1);
+    }
+    color[vno] = c;
+    colors[c].push_back(vno);
+  }
+
+  return ((int)colors.size());
+}
+
+static GCSA_GIBBS_CACHE *gcsaGibbsCacheAlloc(GCSA *gcsa, MRI_SURFACE *mris)
+{
+  GCSA_GIBBS_CACHE *cache = new GCSA_GIBBS_CACHE();
+
+  cache->gcsa = gcsa;
+  gcsaFindVertexNodes(gcsa, mris, cache->vno_prior, cache->vno_classifier);
+
+  int nclasses = 0;
+  cache->gcs_offset.assign(gcsa->mris_classifiers->nvertices, -1);
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    int const vno_classifier = cache->vno_classifier[vno];
+    if (cache->gcs_offset[vno_classifier] >= 0) continue;
+    cache->gcs_offset[vno_classifier] = nclasses;
+    nclasses += gcsa->gc_nodes[vno_classifier].nlabels;
+  }
+
+  cache->m_cov_inv.assign(nclasses, (MATRIX *)NULL);
+  cache->det.assign(nclasses, 0.0);
+  cache->inverted = std::vector<std::atomic<bool> >(nclasses);
+
+  return (cache);
+}
+
+/*
+  Invert the covariance of a class the first time a likelihood needs it.  Most
+  classes at a node are never a candidate label of any vertex, so they are
+  never inverted.
+*/
+static void gcsaGibbsCacheInvert(GCSA_GIBBS_CACHE *cache, GCS *gcs, int offset)
+{
+#ifdef HAVE_OPENMP
+  #pragma omp critical(gcsaGibbsCacheInvert)
+#endif
+  {
+    if (!cache->inverted[offset].load(std::memory_order_relaxed)) {
+      cache->m_cov_inv[offset] = MatrixInverse(gcs->m_cov, NULL);
+      cache->det[offset] = MatrixDeterminant(gcs->m_cov);
+      cache->inverted[offset].store(true, std::memory_order_release);
+    }
+  }
+}
+
+static void gcsaGibbsCacheFree(GCSA_GIBBS_CACHE **pcache)
+{
+  GCSA_GIBBS_CACHE *cache = *pcache;
+  *pcache = NULL;
+
+  for (size_t i = 0; i < cache->m_cov_inv.size(); i++)
+    if (cache->m_cov_inv[i]) MatrixFree(&cache->m_cov_inv[i]);
+  for (int tid = 0; tid < _MAX_FS_THREADS; tid++) {
+    if (cache->v_x[tid]) VectorFree(&cache->v_x[tid]);
+    if (cache->v_tmp[tid]) VectorFree(&cache->v_tmp[tid]);
+  }
+  delete cache;
+}
+
+/*
+  By default vertices are visited in a random order, one at a time.  Setting
+  FS_PARALLEL_GCSA visits them color by color (see gcsaColorVerticesDistance2)
+  with the vertices of each color relabeled in parallel.  That is a fixed,
+  thread-count independent order, so it converges to an ICM fixed point that
+  does not depend on the number of threads, but not necessarily the same one
+  the random order finds.
+*/
+int GCSAreclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris)
+{
+  int *indices = NULL;
+  int n, vno, i, nchanged, niter, examined;
+  bool const parallel = getenv("FS_PARALLEL_GCSA") != NULL;
+  std::vector<std::vector<int> > colors;
+  GCSA_GIBBS_CACHE *cache;
+
+  cache = gcsaGibbsCacheAlloc(gcsa, mris);
+  if (parallel) {
+    gcsaColorVerticesDistance2(mris, colors);
+    printf("relabeling %d colors of vertices in parallel\n", (int)colors.size());
+  }
+  else
+    indices = (int *)calloc(mris->nvertices, sizeof(int));
 
   niter = 0;
   if (gcsa_write_iterations != 0) {
@@ -1133,58 +1440,31 @@ int GCSAreclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris)
   do {
     nchanged = 0;
     examined = 0;
-    MRIScomputeVertexPermutation(mris, indices);
-    for (i = 0; i < mris->nvertices; i++) {
-      vno = indices[i];
-      VERTEX* const v = &mris->vertices[vno];
-      if (v->marked == 0) continue;
-      v->marked = 0;
-      examined++;
-
-      if (vno == Gdiag_no) DiagBreak();
-
-      load_inputs(v, v_inputs, gcsa->ninputs);
-
-      VERTEX const * const v_prior = GCSAsourceToPriorVertex(gcsa, v);
-      vno_prior = v_prior - gcsa->mris_priors->vertices;
-      if (vno_prior == Gdiag_no) DiagBreak();
-      cpn = &gcsa->cp_nodes[vno_prior];
-      if (cpn->nlabels <= 1) continue;
-
-      VERTEX const * const v_classifier = GCSAsourceToClassifierVertex(gcsa, v_prior);
-      vno_classifier = v_classifier - gcsa->mris_classifiers->vertices;
-      // gcsan = &gcsa->gc_nodes[vno_classifier];
-      if (vno_classifier == Gdiag_no) DiagBreak();
-
-      best_label = old_label = v->annotation;
-      if (vno == Gdiag_no) printf("reclassifying vertex %d...\n", vno);
-      max_ll = gcsaNbhdGibbsLogLikelihood(gcsa, mris, v_inputs, vno, 1.0, old_label);
-      for (n = 0; n < cpn->nlabels; n++) {
-        label = cpn->labels[n];
-        ll = gcsaNbhdGibbsLogLikelihood(gcsa, mris, v_inputs, vno, 1.0, label);
-        if (vno == Gdiag_no)
-          printf("\tlabel %s (%d, %d): ll=%2.3f\n",
-                 annotation_to_name(label, NULL),
-                 label,
-                 annotation_to_index(label),
-                 ll);
-        if (ll > max_ll) {
-          max_ll = ll;
-          best_label = label;
-          if (vno == Gdiag_no) printf("\tlabel %s NEW MAX\n", annotation_to_name(label, NULL));
+    if (parallel) {
+      for (size_t c = 0; c < colors.size(); c++) {
+        std::vector<int> const &vnos = colors[c];
+        int const nvnos = (int)vnos.size();
+
+        ROMP_PF_begin
+#ifdef HAVE_OPENMP
+        #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+ : nchanged, examined) schedule(dynamic, 64)
+#endif
+        for (int k = 0; k < nvnos; k++) {
+          ROMP_PFLB_begin
+          int const changed = gcsaRelabelVertexUsingGibbsPriors(cache, mris, vnos[k]);
+          if (changed >= 0) examined++;
+          if (changed > 0) nchanged++;
+          ROMP_PFLB_end
         }
+        ROMP_PF_end
       }
-      if (best_label != old_label) {
-        if (vno == Gdiag_no)
-          printf("v %d: label changed from %s (%d) to %s (%d)\n",
-                 vno,
-                 annotation_to_name(old_label, NULL),
-                 old_label,
-                 annotation_to_name(best_label, NULL),
-                 best_label);
-        v->marked = 1;
-        nchanged++;
-        v->annotation = best_label;
+    }
+    else {
+      MRIScomputeVertexPermutation(mris, indices);
+      for (i = 0; i < mris->nvertices; i++) {
+        int const changed = gcsaRelabelVertexUsingGibbsPriors(cache, mris, indices[i]);
+        if (changed >= 0) examined++;
+        if (changed > 0) nchanged++;
       }
     }
     printf("%03d: %6d changed, %d examined...\n", niter, nchanged, examined);
@@ -1207,7 +1487,8 @@ int GCSAreclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris)
     }
   } while (nchanged > MIN_CHANGED);
 
-  free(indices);
+  if (indices) free(indices);
+  gcsaGibbsCacheFree(&cache);
   return (NO_ERROR);
 }
 
@@ -1251,17 +1532,70 @@ static double gcsaNbhdGibbsLogLikelihood(
   return (total_ll);
 }
 
+static double gcsaNbhdGibbsLogLikelihoodCached(
+    GCSA_GIBBS_CACHE *cache, MRI_SURFACE *mris, double *v_inputs, int const vno, double gibbs_coef, int label)
+{
+  VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+  VERTEX                * const v  = &mris->vertices[vno];
+
+  int old_annotation = v->annotation;
+  v->annotation = label;
+
+  double total_ll = gcsaVertexGibbsLogLikelihoodNodes(
+      cache->gcsa, cache, mris, v_inputs, vno, cache->vno_prior[vno], cache->vno_classifier[vno], gibbs_coef);
+
+  int n;
+  for (n = 0; n < vt->vnum; n++) {
+    int const vno1 = vt->v[n];
+    double ll = gcsaVertexGibbsLogLikelihoodNodes(
+        cache->gcsa, cache, mris, v_inputs, vno1, cache->vno_prior[vno1], cache->vno_classifier[vno1], gibbs_coef);
+    total_ll += ll;
+  }
+
+  v->annotation = old_annotation;
+
+  return (total_ll);
+}
+
 static double gcsaVertexGibbsLogLikelihood(
     GCSA         * const gcsa, 
     MRI_SURFACE  * const mris, 
     double const * const v_inputs, 
     int            const vno, 
     double  	   const gibbs_coef)
+{
+  VERTEX const * const v = &mris->vertices[vno];
+
+  VERTEX const * const v_prior = GCSAsourceToPriorVertex(gcsa, v);
+  int const vno_prior = v_prior - gcsa->mris_priors->vertices;
+
+  VERTEX const * const v_classifier = 
+    GCSAsourceToClassifierVertex(gcsa, v_prior);
+    
+  int const vno_classifier = v_classifier - gcsa->mris_classifiers->vertices;
+
+  return (gcsaVertexGibbsLogLikelihoodNodes(gcsa, NULL, mris, v_inputs, vno, vno_prior, vno_classifier, gibbs_coef));
+}
+
+/*
+  The Gibbs log-likelihood of the current label of vno given its prior and
+  classifier nodes.  With a cache the cached covariance inverses and
+  per-thread scratch vectors are used, so it may be called from many threads.
+*/
+static double gcsaVertexGibbsLogLikelihoodNodes(
+    GCSA             * const gcsa, 
+    GCSA_GIBBS_CACHE * const cache, 
+    MRI_SURFACE      * const mris, 
+    double const     * const v_inputs, 
+    int                const vno, 
+    int                const vno_prior, 
+    int                const vno_classifier, 
+    double  	       const gibbs_coef)
 {
   static MATRIX *m_cov_inv = NULL;
   static VECTOR *v_tmp = NULL, *v_x = NULL;
 
-  if (v_x && gcsa->ninputs != v_x->cols) {
+  if (!cache && v_x && gcsa->ninputs != v_x->cols) {
     MatrixFree(&m_cov_inv);
     MatrixFree(&v_tmp);
     VectorFree(&v_x);
@@ -1270,16 +1604,10 @@ static double gcsaVertexGibbsLogLikelihood(
   VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
   VERTEX          const * const v  = &mris->vertices         [vno];
 
-  VERTEX const * const v_prior = GCSAsourceToPriorVertex(gcsa, v);
-  int const vno_prior = v_prior - gcsa->mris_priors->vertices;
   if (vno_prior == Gdiag_no) DiagBreak();
 
   CP_NODE * const cpn = &gcsa->cp_nodes[vno_prior];
 
-  VERTEX const * const v_classifier = 
-    GCSAsourceToClassifierVertex(gcsa, v_prior);
-    
-  int const vno_classifier = v_classifier - gcsa->mris_classifiers->vertices;
   if (vno_classifier == Gdiag_no) DiagBreak();
 
   GCSA_NODE * const gcsan = &gcsa->gc_nodes[vno_classifier];
@@ -1303,17 +1631,40 @@ static double gcsaVertexGibbsLogLikelihood(
   CP  * const cp  = &cpn->cps[np];
 
   /* compute Mahalanobis distance */
-  v_x = VectorCopy(gcs->v_means, v_x);
+  MATRIX *m_inv;
+  VECTOR **pv_x, **pv_tmp;
+  double det;
+  if (cache) {
+#ifdef HAVE_OPENMP
+    int const tid = omp_get_thread_num();
+#else
+    int const tid = 0;
+#endif
+    int const offset = cache->gcs_offset[vno_classifier] + nc;
+    if (!cache->inverted[offset].load(std::memory_order_acquire)) gcsaGibbsCacheInvert(cache, gcs, offset);
+    pv_x = &cache->v_x[tid];
+    pv_tmp = &cache->v_tmp[tid];
+    m_inv = cache->m_cov_inv[offset];
+    det = cache->det[offset];
+  }
+  else {
+    pv_x = &v_x;
+    pv_tmp = &v_tmp;
+    m_cov_inv = MatrixInverse(gcs->m_cov, m_cov_inv);
+    m_inv = m_cov_inv;
+    det = 0;
+  }
+
+  *pv_x = VectorCopy(gcs->v_means, *pv_x);
   { int i;
-    for (i = 0; i < gcsa->ninputs; i++) VECTOR_ELT(v_x, i + 1) -= v_inputs[i];
+    for (i = 0; i < gcsa->ninputs; i++) VECTOR_ELT(*pv_x, i + 1) -= v_inputs[i];
   }
-  m_cov_inv = MatrixInverse(gcs->m_cov, m_cov_inv);
-  if (!m_cov_inv) ErrorExit(ERROR_BADPARM, "GCSAvertexLogLikelihood: could not invert matrix");
+  if (!m_inv) ErrorExit(ERROR_BADPARM, "GCSAvertexLogLikelihood: could not invert matrix");
 
-  double const det = MatrixDeterminant(gcs->m_cov);
-  v_tmp = MatrixMultiply(m_cov_inv, v_x, v_tmp);
+  if (!cache) det = MatrixDeterminant(gcs->m_cov);
+  *pv_tmp = MatrixMultiply(m_inv, *pv_x, *pv_tmp);
 
-  double ll = -0.5 * VectorDot(v_x, v_tmp) - 0.5 * log(det);
+  double ll = -0.5 * VectorDot(*pv_x, *pv_tmp) - 0.5 * log(det);
   double nbr_prior = 0.0;
   
   int n;
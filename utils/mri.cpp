@@ -27,6 +27,7 @@ extern const char *Progname;
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "faster_variants.h"
 #include "romp_support.h"
@@ -309,6 +310,7 @@ MRI::~MRI()
     }
   } else {
     if (owndata) free(chunk);
+    if (mapping) munmap(mapping, mapping_bytes);
     if (slices) {
       for (int slice = 0; slice < depth * nframes; slice++)
         if (slices[slice]) free(slices[slice]);
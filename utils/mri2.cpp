@@ -40,6 +40,7 @@
 #include "stats.h"
 #include "mrimorph.h"
 #include "mri2.h"
+#include "mrisbvh.h"
 
 //#define MRI2_TIMERS
 
@@ -4368,6 +4369,19 @@ COLOR_TABLE *CTABpruneCTab(const COLOR_TABLE *ct0, MRI *seg)
   return (ct);
 }
 
+/*
+  mri2FindClosestVertex() - closest vertex of surf to (x,y,z), from its
+  vertex tree when one was built (FS_SURFACE_BVH is set), otherwise from
+  its hash table with a search of the whole surface if the hash misses.
+*/
+static int mri2FindClosestVertex(MRIS *surf, MHT *hash, MRIS_BVH const *bvh, float x, float y, float z, float *pdist)
+{
+  if (bvh) return (MRISbvhFindClosestVertex(bvh, x, y, z, pdist));
+  int vno = MHTfindClosestVertexNoXYZ(hash, surf, x, y, z, pdist);
+  if (vno < 0) vno = MRISfindClosestVertex(surf, x, y, z, pdist, CURRENT_VERTICES);
+  return (vno);
+}
+
 /*
   \fn MRI *MRIannot2CorticalSeg(MRI *seg, MRIS *lhw, MRIS *lhp, MRIS *rhw, MRIS *rhp, LTA *anat2seg, MRI *ctxseg)
   \brief Creates a segmentation of the cortical labels
@@ -4388,6 +4402,7 @@ MRI *MRIannot2CorticalSeg(MRI *seg, MRIS *lhw, MRIS *lhp, MRIS *rhw, MRIS *rhp,
   MATRIX *AnatVox2SurfRAS, *SegVox2SurfRAS;
   float hashres = 16;
   MHT *lhw_hash = NULL, *rhw_hash = NULL, *lhp_hash = NULL, *rhp_hash = NULL;
+  MRIS_BVH *lhw_bvh = NULL, *rhw_bvh = NULL, *lhp_bvh = NULL, *rhp_bvh = NULL;
   LTA *lta;
   MRI *anat;
   int c, nunknown;
@@ -4428,11 +4443,23 @@ MRI *MRIannot2CorticalSeg(MRI *seg, MRIS *lhw, MRIS *lhp, MRIS *rhw, MRIS *rhp,
   // Segmentation Vox to Surface RAS
   SegVox2SurfRAS = MatrixMultiplyD(AnatVox2SurfRAS, lta->inv_xforms[0].m_L, NULL);
 
-  // Create the hash for faster service
-  lhw_hash = MHTcreateVertexTable_Resolution(lhw, CURRENT_VERTICES, hashres);
-  lhp_hash = MHTcreateVertexTable_Resolution(lhp, CURRENT_VERTICES, hashres);
-  rhw_hash = MHTcreateVertexTable_Resolution(rhw, CURRENT_VERTICES, hashres);
-  rhp_hash = MHTcreateVertexTable_Resolution(rhp, CURRENT_VERTICES, hashres);
+  // Create the hash (or the trees) for faster service
+  if (MRISbvhRequested()) {
+    lhw_bvh = MRISbvhCreateVertexTree(lhw, CURRENT_VERTICES);
+    lhp_bvh = MRISbvhCreateVertexTree(lhp, CURRENT_VERTICES);
+    rhw_bvh = MRISbvhCreateVertexTree(rhw, CURRENT_VERTICES);
+    rhp_bvh = MRISbvhCreateVertexTree(rhp, CURRENT_VERTICES);
+  }
+  else {
+    lhw_hash = MHTcreateVertexTable_Resolution(lhw, CURRENT_VERTICES, hashres);
+    lhp_hash = MHTcreateVertexTable_Resolution(lhp, CURRENT_VERTICES, hashres);
+    rhw_hash = MHTcreateVertexTable_Resolution(rhw, CURRENT_VERTICES, hashres);
+    rhp_hash = MHTcreateVertexTable_Resolution(rhp, CURRENT_VERTICES, hashres);
+    MHTfreeze(lhw_hash);
+    MHTfreeze(lhp_hash);
+    MHTfreeze(rhw_hash);
+    MHTfreeze(rhp_hash);
+  }
 
   // Check whether the seg has an extracerebral CSF segmentation
   HasXCSF = MRIcountMatches(seg, CSF_ExtraCerebral, 0, seg);
@@ -4459,6 +4486,7 @@ MRI *MRIannot2CorticalSeg(MRI *seg, MRIS *lhw, MRIS *lhp, MRIS *rhw, MRIS *rhp,
     float wdw, pdw;
     MRIS *wsurf, *psurf;
     MHT *whash = NULL, *phash = NULL;
+    MRIS_BVH const *wbvh = NULL, *pbvh = NULL;
     CRS = MatrixAlloc(4, 1, MATRIX_REAL);
     CRS->rptr[4][1] = 1;
     for (r = 0; r < seg->height; r++) {
@@ -4474,14 +4502,18 @@ MRI *MRIannot2CorticalSeg(MRI *seg, MRIS *lhw, MRIS *lhp, MRIS *rhw, MRIS *rhp,
         if (asegv == Left_Cerebral_Cortex) {
           wsurf = lhw;
           whash = lhw_hash;
+          wbvh = lhw_bvh;
           phash = lhp_hash;
+          pbvh = lhp_bvh;
           psurf = lhp;
           // wmval = Left_Cerebral_White_Matter;
         }
         else {
           wsurf = rhw;
           whash = rhw_hash;
+          wbvh = rhw_bvh;
           phash = rhp_hash;
+          pbvh = rhp_bvh;
           psurf = rhp;
           // wmval = Right_Cerebral_White_Matter;
         }
@@ -4496,12 +4528,10 @@ MRI *MRIannot2CorticalSeg(MRI *seg, MRIS *lhw, MRIS *lhp, MRIS *rhw, MRIS *rhp,
         vtx.z = RAS->rptr[3][1];
 
         // Find closest white surface vertex and compute distance
-        wvtxno = MHTfindClosestVertexNoXYZ(whash, wsurf, vtx.x, vtx.y, vtx.z, &wdw);
-        if (wvtxno < 0) wvtxno = MRISfindClosestVertex(wsurf, vtx.x, vtx.y, vtx.z, &wdw, CURRENT_VERTICES);
+        wvtxno = mri2FindClosestVertex(wsurf, whash, wbvh, vtx.x, vtx.y, vtx.z, &wdw);
 
         // Find closest pial surface vertex and compute distance
-        pvtxno = MHTfindClosestVertexNoXYZ(phash, psurf, vtx.x, vtx.y, vtx.z, &pdw);
-        if (pvtxno < 0) pvtxno = MRISfindClosestVertex(psurf, vtx.x, vtx.y, vtx.z, &pdw, CURRENT_VERTICES);
+        pvtxno = mri2FindClosestVertex(psurf, phash, pbvh, vtx.x, vtx.y, vtx.z, &pdw);
 
         // Use the vertex that is closest
         if (wdw <= pdw)
@@ -4537,6 +4567,10 @@ MRI *MRIannot2CorticalSeg(MRI *seg, MRIS *lhw, MRIS *lhp, MRIS *rhw, MRIS *rhp,
   MHTfree(&rhw_hash);
   MHTfree(&rhp_hash);
   MHTfree(&lhp_hash);
+  MRISbvhFree(&lhw_bvh);
+  MRISbvhFree(&rhw_bvh);
+  MRISbvhFree(&rhp_bvh);
+  MRISbvhFree(&lhp_bvh);
   MatrixFree(&SegVox2SurfRAS);
   MatrixFree(&AnatVox2SurfRAS);
   MRIfree(&anat);
@@ -4568,6 +4602,7 @@ MRI *MRIannot2CerebralWMSeg(MRI *seg, MRIS *lhw, MRIS *rhw, double DistThresh, L
   MATRIX *AnatVox2SurfRAS, *SegVox2SurfRAS;
   float hashres = 16;
   MHT *lhw_hash = NULL, *rhw_hash = NULL;
+  MRIS_BVH *lhw_bvh = NULL, *rhw_bvh = NULL;
   LTA *lta;
   MRI *anat;
   int c;
@@ -4607,9 +4642,17 @@ MRI *MRIannot2CerebralWMSeg(MRI *seg, MRIS *lhw, MRIS *rhw, double DistThresh, L
   // Segmentation Vox to Surface RAS
   SegVox2SurfRAS = MatrixMultiplyD(AnatVox2SurfRAS, lta->inv_xforms[0].m_L, NULL);
 
-  // Create the hash for faster service
-  lhw_hash = MHTcreateVertexTable_Resolution(lhw, CURRENT_VERTICES, hashres);
-  rhw_hash = MHTcreateVertexTable_Resolution(rhw, CURRENT_VERTICES, hashres);
+  // Create the hash (or the trees) for faster service
+  if (MRISbvhRequested()) {
+    lhw_bvh = MRISbvhCreateVertexTree(lhw, CURRENT_VERTICES);
+    rhw_bvh = MRISbvhCreateVertexTree(rhw, CURRENT_VERTICES);
+  }
+  else {
+    lhw_hash = MHTcreateVertexTable_Resolution(lhw, CURRENT_VERTICES, hashres);
+    rhw_hash = MHTcreateVertexTable_Resolution(rhw, CURRENT_VERTICES, hashres);
+    MHTfreeze(lhw_hash);
+    MHTfreeze(rhw_hash);
+  }
 
   printf("  MRIannot2CerebralWMSeg(): looping over volume\n");
   fflush(stdout);
@@ -4627,6 +4670,7 @@ MRI *MRIannot2CerebralWMSeg(MRI *seg, MRIS *lhw, MRIS *rhw, double DistThresh, L
     float wdw;
     MRIS *wsurf;
     MHT *whash = NULL;
+    MRIS_BVH const *wbvh = NULL;
     CRS = MatrixAlloc(4, 1, MATRIX_REAL);
     CRS->rptr[4][1] = 1;
     for (r = 0; r < seg->height; r++) {
@@ -4642,11 +4686,13 @@ MRI *MRIannot2CerebralWMSeg(MRI *seg, MRIS *lhw, MRIS *rhw, double DistThresh, L
         if (asegv == Left_Cerebral_White_Matter) {
           wsurf = lhw;
           whash = lhw_hash;
+          wbvh = lhw_bvh;
           wmunknown = 5001;
         }
         else {
           wsurf = rhw;
           whash = rhw_hash;
+          wbvh = rhw_bvh;
           wmunknown = 5002;
         }
 
@@ -4660,8 +4706,7 @@ MRI *MRIannot2CerebralWMSeg(MRI *seg, MRIS *lhw, MRIS *rhw, double DistThresh, L
         vtx.z = RAS->rptr[3][1];
 
         // Find closest white surface vertex and compute distance
-        wvtxno = MHTfindClosestVertexNoXYZ(whash, wsurf, vtx.x, vtx.y, vtx.z, &wdw);
-        if (wvtxno < 0) wvtxno = MRISfindClosestVertex(wsurf, vtx.x, vtx.y, vtx.z, &wdw, CURRENT_VERTICES);
+        wvtxno = mri2FindClosestVertex(wsurf, whash, wbvh, vtx.x, vtx.y, vtx.z, &wdw);
 
         if (wdw <= DistThresh || DistThresh < 0) {
           // From the surface annotation, get the annotation number
@@ -4687,6 +4732,8 @@ MRI *MRIannot2CerebralWMSeg(MRI *seg, MRIS *lhw, MRIS *rhw, double DistThresh, L
 
   MHTfree(&lhw_hash);
   MHTfree(&rhw_hash);
+  MRISbvhFree(&lhw_bvh);
+  MRISbvhFree(&rhw_bvh);
   MatrixFree(&SegVox2SurfRAS);
   MatrixFree(&AnatVox2SurfRAS);
   MRIfree(&anat);
@@ -4707,6 +4754,7 @@ MRI *MRIunsegmentWM(MRI *seg, MRIS *lhw, MRIS *rhw, int *segidlist, int nlist, L
   MATRIX *AnatVox2SurfRAS, *SegVox2SurfRAS;
   float hashres = 16;
   MHT *lhw_hash = NULL, *rhw_hash = NULL;
+  MRIS_BVH *lhw_bvh = NULL, *rhw_bvh = NULL;
   LTA *lta;
   MRI *anat;
   int c;
@@ -4746,9 +4794,17 @@ MRI *MRIunsegmentWM(MRI *seg, MRIS *lhw, MRIS *rhw, int *segidlist, int nlist, L
   // Segmentation Vox to Surface RAS
   SegVox2SurfRAS = MatrixMultiplyD(AnatVox2SurfRAS, lta->inv_xforms[0].m_L, NULL);
 
-  // Create the hash for faster service
-  lhw_hash = MHTcreateVertexTable_Resolution(lhw, CURRENT_VERTICES, hashres);
-  rhw_hash = MHTcreateVertexTable_Resolution(rhw, CURRENT_VERTICES, hashres);
+  // Create the hash (or the trees) for faster service
+  if (MRISbvhRequested()) {
+    lhw_bvh = MRISbvhCreateVertexTree(lhw, CURRENT_VERTICES);
+    rhw_bvh = MRISbvhCreateVertexTree(rhw, CURRENT_VERTICES);
+  }
+  else {
+    lhw_hash = MHTcreateVertexTable_Resolution(lhw, CURRENT_VERTICES, hashres);
+    rhw_hash = MHTcreateVertexTable_Resolution(rhw, CURRENT_VERTICES, hashres);
+    MHTfreeze(lhw_hash);
+    MHTfreeze(rhw_hash);
+  }
 
   printf("  MRIunsegmentWM(): looping over volume\n");
   fflush(stdout);
@@ -4760,7 +4816,7 @@ MRI *MRIunsegmentWM(MRI *seg, MRIS *lhw, MRIS *rhw, int *segidlist, int nlist, L
   for (c = 0; c < seg->width; c++) {
     ROMP_PFLB_begin
     
-    int n, r, s, asegv, segv, hit, lhvtxno, rhvtxno;
+    int n, r, s, asegv, segv, hit;
     struct { float x,y,z; } vtx;
     MATRIX *RAS = NULL, *CRS = NULL;
     float lhd, rhd;
@@ -4790,11 +4846,8 @@ MRI *MRIunsegmentWM(MRI *seg, MRIS *lhw, MRIS *rhw, int *segidlist, int nlist, L
         vtx.y = RAS->rptr[2][1];
         vtx.z = RAS->rptr[3][1];
 
-        lhvtxno = MHTfindClosestVertexNoXYZ(lhw_hash, lhw, vtx.x, vtx.y, vtx.z, &lhd);
-        if (lhvtxno < 0) lhvtxno = MRISfindClosestVertex(lhw, vtx.x, vtx.y, vtx.z, &lhd, CURRENT_VERTICES);
-
-        rhvtxno = MHTfindClosestVertexNoXYZ(rhw_hash, rhw, vtx.x, vtx.y, vtx.z, &rhd);
-        if (rhvtxno < 0) rhvtxno = MRISfindClosestVertex(rhw, vtx.x, vtx.y, vtx.z, &rhd, CURRENT_VERTICES);
+        mri2FindClosestVertex(lhw, lhw_hash, lhw_bvh, vtx.x, vtx.y, vtx.z, &lhd);
+        mri2FindClosestVertex(rhw, rhw_hash, rhw_bvh, vtx.x, vtx.y, vtx.z, &rhd);
 
         if (lhd < rhd)
           segv = Left_Cerebral_White_Matter;
@@ -4812,6 +4865,8 @@ MRI *MRIunsegmentWM(MRI *seg, MRIS *lhw, MRIS *rhw, int *segidlist, int nlist, L
 
   MHTfree(&lhw_hash);
   MHTfree(&rhw_hash);
+  MRISbvhFree(&lhw_bvh);
+  MRISbvhFree(&rhw_bvh);
   MatrixFree(&SegVox2SurfRAS);
   MatrixFree(&AnatVox2SurfRAS);
   MRIfree(&anat);
@@ -4834,6 +4889,7 @@ MRI *MRIrelabelHypoHemi(MRI *seg, MRIS *lhw, MRIS *rhw, LTA *anat2seg, MRI *wmse
   MATRIX *AnatVox2SurfRAS, *SegVox2SurfRAS;
   float hashres = 16;
   MHT *lhw_hash = NULL, *rhw_hash = NULL;
+  MRIS_BVH *lhw_bvh = NULL, *rhw_bvh = NULL;
   LTA *lta;
   MRI *anat;
   int c;
@@ -4873,9 +4929,17 @@ MRI *MRIrelabelHypoHemi(MRI *seg, MRIS *lhw, MRIS *rhw, LTA *anat2seg, MRI *wmse
   // Segmentation Vox to Surface RAS
   SegVox2SurfRAS = MatrixMultiplyD(AnatVox2SurfRAS, lta->inv_xforms[0].m_L, NULL);
 
-  // Create the hash for faster service
-  lhw_hash = MHTcreateVertexTable_Resolution(lhw, CURRENT_VERTICES, hashres);
-  rhw_hash = MHTcreateVertexTable_Resolution(rhw, CURRENT_VERTICES, hashres);
+  // Create the hash (or the trees) for faster service
+  if (MRISbvhRequested()) {
+    lhw_bvh = MRISbvhCreateVertexTree(lhw, CURRENT_VERTICES);
+    rhw_bvh = MRISbvhCreateVertexTree(rhw, CURRENT_VERTICES);
+  }
+  else {
+    lhw_hash = MHTcreateVertexTable_Resolution(lhw, CURRENT_VERTICES, hashres);
+    rhw_hash = MHTcreateVertexTable_Resolution(rhw, CURRENT_VERTICES, hashres);
+    MHTfreeze(lhw_hash);
+    MHTfreeze(rhw_hash);
+  }
 
   printf("  MRIrelabelHypoHemi(): looping over volume\n");
   fflush(stdout);
@@ -4887,7 +4951,7 @@ MRI *MRIrelabelHypoHemi(MRI *seg, MRIS *lhw, MRIS *rhw, LTA *anat2seg, MRI *wmse
   for (c = 0; c < seg->width; c++) {
     ROMP_PFLB_begin
     
-    int r, s, asegv, segv, lhvtxno, rhvtxno;
+    int r, s, asegv, segv;
     struct { float x,y,z; } vtx;
     MATRIX *RAS = NULL, *CRS = NULL;
     float lhd, rhd;
@@ -4909,11 +4973,8 @@ MRI *MRIrelabelHypoHemi(MRI *seg, MRIS *lhw, MRIS *rhw, LTA *anat2seg, MRI *wmse
         vtx.y = RAS->rptr[2][1];
         vtx.z = RAS->rptr[3][1];
 
-        lhvtxno = MHTfindClosestVertexNoXYZ(lhw_hash, lhw, vtx.x, vtx.y, vtx.z, &lhd);
-        if (lhvtxno < 0) lhvtxno = MRISfindClosestVertex(lhw, vtx.x, vtx.y, vtx.z, &lhd, CURRENT_VERTICES);
-
-        rhvtxno = MHTfindClosestVertexNoXYZ(rhw_hash, rhw, vtx.x, vtx.y, vtx.z, &rhd);
-        if (rhvtxno < 0) rhvtxno = MRISfindClosestVertex(rhw, vtx.x, vtx.y, vtx.z, &rhd, CURRENT_VERTICES);
+        mri2FindClosestVertex(lhw, lhw_hash, lhw_bvh, vtx.x, vtx.y, vtx.z, &lhd);
+        mri2FindClosestVertex(rhw, rhw_hash, rhw_bvh, vtx.x, vtx.y, vtx.z, &rhd);
 
         if (lhd < rhd)
           segv = Left_WM_hypointensities;
@@ -4931,6 +4992,8 @@ MRI *MRIrelabelHypoHemi(MRI *seg, MRIS *lhw, MRIS *rhw, LTA *anat2seg, MRI *wmse
 
   MHTfree(&lhw_hash);
   MHTfree(&rhw_hash);
+  MRISbvhFree(&lhw_bvh);
+  MRISbvhFree(&rhw_bvh);
   MatrixFree(&SegVox2SurfRAS);
   MatrixFree(&AnatVox2SurfRAS);
   MRIfree(&anat);
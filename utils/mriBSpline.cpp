@@ -2450,14 +2450,14 @@ MRI *LTAtransformBSpline(const MRI_BSPLINE *bspline, MRI *mri_dst, LTA *lta)
 
 extern MRI *MRIdownsample2BSpline(const MRI *mri_src, MRI *mri_dst)
 {
-  double *InBuffer;  /* Input buffer to 1D process */
-  double *OutBuffer; /* Output buffer to 1D process */
+  double *InBuffer[_MAX_FS_THREADS];  /* Input buffers to 1D process (one per thread) */
+  double *OutBuffer[_MAX_FS_THREADS]; /* Output buffers to 1D process */
   double g[MAXF];    /* Coefficients of the reduce filter */
   long ng;           /* Number of coefficients of the reduce filter */
   double h[MAXF];    /* Coefficients of the expansion filter */
   long nh;           /* Number of coefficients of the expansion filter */
   short IsCentered;  /* Equal TRUE if the filter is a centered spline, FALSE otherwise */
-  int kx, ky, kz, kf;
+  int kx, ky, kz, kf, i, nthreads;
 
   /* Get the filter coefficients for the Spline (order = 3) filter*/
   if (!GetPyramidFilter(SPLINE_CENT, 3, g, &ng, h, &nh, &IsCentered)) {
@@ -2476,113 +2476,126 @@ extern MRI *MRIdownsample2BSpline(const MRI *mri_src, MRI *mri_dst)
   int NzOut = NzIn / 2;
   if (NzOut < 1) NzOut = 1;
 
+  // every line is reduced independently, so the passes below run in
+  // parallel with one pair of line buffers (long enough for any axis) per thread
+  int NmaxIn = NxIn;
+  if (NyIn > NmaxIn) NmaxIn = NyIn;
+  if (NzIn > NmaxIn) NmaxIn = NzIn;
+#ifdef HAVE_OPENMP
+  nthreads = omp_get_max_threads();
+#else
+  nthreads = 1;
+#endif
+  for (i = 0; i < nthreads; i++) {
+    InBuffer[i] = (double *)malloc((size_t)(NmaxIn * (long)sizeof(double)));
+    OutBuffer[i] = (double *)malloc((size_t)(NmaxIn * (long)sizeof(double)));
+    if (InBuffer[i] == (double *)NULL || OutBuffer[i] == (double *)NULL)
+      ErrorExit(ERROR_NO_MEMORY, "MRIdownsample2BSpline: could not allocate line buffers\n");
+  }
+
   // MRIwrite(mri_src,"mrisrc.mgz");
   /* --- X processing --- */
   MRI *mri_tmp = MRIallocSequence(NxOut, NyIn, NzIn, MRI_FLOAT, NfIn);
   if (!mri_tmp) ErrorExit(ERROR_NO_MEMORY, "MRIdownsample2BSpline: could not allocate tmp mri\n");
-  InBuffer = (double *)malloc((size_t)(NxIn * (long)sizeof(double)));
-  if (InBuffer == (double *)NULL) {
-    MRIfree(&mri_tmp);
-    ErrorExit(ERROR_NO_MEMORY, "MRIdownsample2BSpline: could not allocate inbuffer mem\n");
-  }
-  OutBuffer = (double *)malloc((size_t)(NxOut * (long)sizeof(double)));
-  if (OutBuffer == (double *)NULL) {
-    MRIfree(&mri_tmp);
-    free(InBuffer);
-    ErrorExit(ERROR_NO_MEMORY, "MRIdownsample2BSpline: could not allocate outbuffer mem\n");
-  }
-  for (kf = 0; kf < NfIn; kf++)
-    for (kz = 0; kz < NzIn; kz++)
+  for (kf = 0; kf < NfIn; kf++) {
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) private(ky)
+#endif
+    for (kz = 0; kz < NzIn; kz++) {
+      ROMP_PFLB_begin
+#ifdef HAVE_OPENMP
+      int const tid = omp_get_thread_num();
+#else
+      int const tid = 0;
+#endif
       for (ky = 0; ky < NyIn; ky++) {
+        getXLine(mri_src, ky, kz, kf, InBuffer[tid]);
         if (NxIn > 1) {
-          getXLine(mri_src, ky, kz, kf, InBuffer);
-          Reduce_1D(InBuffer, NxIn, OutBuffer, g, ng, IsCentered);
+          Reduce_1D(InBuffer[tid], NxIn, OutBuffer[tid], g, ng, IsCentered);
           // printf(" f %i  z %i  y %i  NxOut %i  width %i\n",kf,kz,ky,NxOut,mri_tmp->width);
-          setXLine(mri_tmp, ky, kz, kf, OutBuffer);
-        }
-        else {
-          getXLine(mri_src, ky, kz, kf, InBuffer);
-          setXLine(mri_tmp, ky, kz, kf, InBuffer);
+          setXLine(mri_tmp, ky, kz, kf, OutBuffer[tid]);
         }
+        else
+          setXLine(mri_tmp, ky, kz, kf, InBuffer[tid]);
       }
-  free(InBuffer);
-  free(OutBuffer);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
   // MRIwrite(mri_tmp,"mri_tmp1.mgz");
 
   /* --- Y processing --- */
   MRI *mri_tmp2 = MRIallocSequence(NxOut, NyOut, NzIn, MRI_FLOAT, NfIn);
   if (!mri_tmp2) ErrorExit(ERROR_NO_MEMORY, "MRIdownsample2BSpline: could not allocate tmp mri\n");
-  InBuffer = (double *)malloc((size_t)(NyIn * (long)sizeof(double)));
-  if (InBuffer == (double *)NULL) {
-    MRIfree(&mri_tmp);
-    MRIfree(&mri_tmp2);
-    ErrorExit(ERROR_NO_MEMORY, "MRIdownsample2BSpline: could not allocate inbuffer mem\n");
-  }
-  OutBuffer = (double *)malloc((size_t)(NyOut * (long)sizeof(double)));
-  if (OutBuffer == (double *)NULL) {
-    MRIfree(&mri_tmp);
-    MRIfree(&mri_tmp2);
-    free(InBuffer);
-    ErrorExit(ERROR_NO_MEMORY, "MRIdownsample2BSpline: could not allocate outbuffer mem\n");
-  }
-  for (kf = 0; kf < NfIn; kf++)
-    for (kz = 0; kz < NzIn; kz++)
+  for (kf = 0; kf < NfIn; kf++) {
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) private(kx)
+#endif
+    for (kz = 0; kz < NzIn; kz++) {
+      ROMP_PFLB_begin
+#ifdef HAVE_OPENMP
+      int const tid = omp_get_thread_num();
+#else
+      int const tid = 0;
+#endif
       for (kx = 0; kx < NxOut; kx++) {
+        getYLine(mri_tmp, kx, kz, kf, InBuffer[tid]);
         if (NyIn > 1) {
-          getYLine(mri_tmp, kx, kz, kf, InBuffer);
-          Reduce_1D(InBuffer, NyIn, OutBuffer, g, ng, IsCentered);
-          setYLine(mri_tmp2, kx, kz, kf, OutBuffer);
-        }
-        else {
-          getYLine(mri_tmp, kx, kz, kf, InBuffer);
-          setYLine(mri_tmp2, kx, kz, kf, InBuffer);
+          Reduce_1D(InBuffer[tid], NyIn, OutBuffer[tid], g, ng, IsCentered);
+          setYLine(mri_tmp2, kx, kz, kf, OutBuffer[tid]);
         }
+        else
+          setYLine(mri_tmp2, kx, kz, kf, InBuffer[tid]);
       }
-  free(InBuffer);
-  free(OutBuffer);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
   MRIfree(&mri_tmp);
   // MRIwrite(mri_tmp2,"mri_tmp2.mgz");
 
   /* --- Z processing --- */
-  int allocdst = 0;
   if (!mri_dst) {
     mri_dst = MRIallocSequence(NxOut, NyOut, NzOut, mri_src->type, NfIn);
     // mri_dst = MRIallocSequence(NxOut, NyOut, NzOut, MRI_FLOAT, NfIn) ;
     MRIcopyHeader(mri_src, mri_dst);
-    allocdst = 1;
   }
   if (mri_dst->width != NxOut || mri_dst->height != NyOut || mri_dst->depth != NzOut || mri_dst->nframes != NfIn) {
     printf("ERROR MRIupsample2BSpline: MRI Dest dimensions not correct!\n");
     exit(1);
   }
-  InBuffer = (double *)malloc((size_t)(NzIn * (long)sizeof(double)));
-  if (InBuffer == (double *)NULL) {
-    MRIfree(&mri_tmp2);
-    if (allocdst == 1) MRIfree(&mri_dst);
-    ErrorExit(ERROR_NO_MEMORY, "MRIdownsample2BSpline: could not allocate inbuffer mem\n");
-  }
-  OutBuffer = (double *)malloc((size_t)(NzOut * (long)sizeof(double)));
-  if (OutBuffer == (double *)NULL) {
-    MRIfree(&mri_tmp2);
-    if (allocdst == 1) MRIfree(&mri_dst);
-    free(InBuffer);
-    ErrorExit(ERROR_NO_MEMORY, "MRIdownsample2BSpline: could not allocate outbuffer mem\n");
-  }
-  for (kf = 0; kf < NfIn; kf++)
-    for (ky = 0; ky < NyOut; ky++)
+  // one thread per row of z-lines: neighbouring kx share the cache lines of each slice
+  for (kf = 0; kf < NfIn; kf++) {
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) private(kx)
+#endif
+    for (ky = 0; ky < NyOut; ky++) {
+      ROMP_PFLB_begin
+#ifdef HAVE_OPENMP
+      int const tid = omp_get_thread_num();
+#else
+      int const tid = 0;
+#endif
       for (kx = 0; kx < NxOut; kx++) {
+        getZLine(mri_tmp2, kx, ky, kf, InBuffer[tid]);
         if (NzIn > 1) {
-          getZLine(mri_tmp2, kx, ky, kf, InBuffer);
-          Reduce_1D(InBuffer, NzIn, OutBuffer, g, ng, IsCentered);
-          setZLine(mri_dst, kx, ky, kf, OutBuffer);
-        }
-        else {
-          getZLine(mri_tmp2, kx, ky, kf, InBuffer);
-          setZLine(mri_dst, kx, ky, kf, InBuffer);
+          Reduce_1D(InBuffer[tid], NzIn, OutBuffer[tid], g, ng, IsCentered);
+          setZLine(mri_dst, kx, ky, kf, OutBuffer[tid]);
         }
+        else
+          setZLine(mri_dst, kx, ky, kf, InBuffer[tid]);
       }
-  free(InBuffer);
-  free(OutBuffer);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+  for (i = 0; i < nthreads; i++) {
+    free(InBuffer[i]);
+    free(OutBuffer[i]);
+  }
   MRIfree(&mri_tmp2);
 
   mri_dst->imnr0 = mri_src->imnr0;
@@ -20,6 +20,10 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
 #include "cma.h"
 #include "diag.h"
 #include "fsenv.h"
@@ -28,6 +32,7 @@
 #include "mrisurf.h"
 #include "mrisurf_metricProperties.h"
 #include "region.h"
+#include "romp_support.h"
 #include "timer.h"
 
 #define IMGSIZE 256
@@ -1487,7 +1492,9 @@ MRI *MRISmakeBoundingVolume(MRIS *mris, double resolution)
 \brief Fills in the interior of a surface by creating a "watertight"
 shell and filling everything outside of the shell. This is much faster
 but slightly less accurate than a ray-tracing algorithm.  See also
-MRISfillInteriorOld() and MRISfillInteriorRibbonTest().
+MRISfillInteriorOld() and MRISfillInteriorRibbonTest(). If
+FS_FILL_INTERIOR_SCANLINE is set, MRISfillInteriorScanline() is used
+instead.
 \param mris - input surface
 \param resolution - only used if mri_dst is NULL
 \param mri_dst - output
@@ -1530,6 +1537,12 @@ MRI *MRISfillInterior(MRI_SURFACE *mris, double resolution, MRI *mri_dst)
   }
   MRIclear(mri_dst);
 
+  // the scanline fill is exact at the voxel centers but changes the
+  // voxels along the surface, so it is only used when asked for
+  if (getenv("FS_FILL_INTERIOR_SCANLINE")) {
+    return (MRISfillInteriorScanline(mris, mri_dst, 1, 0));
+  }
+
   dcol = mri_dst->xsize;
   drow = mri_dst->ysize;
   dslc = mri_dst->zsize;
@@ -1719,6 +1732,255 @@ MRI *MRISfillInterior(MRI_SURFACE *mris, double resolution, MRI *mri_dst)
   return (mri_dst);
 }
 
+/*
+  The scanline fill casts rays along the column (x) axis of the volume
+  through the centers of the voxel rows and fills the voxels between
+  pairs of crossings of the surface. The faces are bucketed by slice
+  and then by row so that each ray only visits the faces whose bounding
+  box it passes through, and the slices are independent so they are
+  filled in parallel.
+
+  A ray that passes exactly through an edge or a vertex of the mesh is
+  treated as if it had been displaced by an infinitesimal amount, and
+  the edge functions are evaluated with the vertices of each edge in
+  vertex number order, so that the faces sharing an edge always agree
+  on which of them the ray crosses. A closed surface is then crossed an
+  even number of times by every ray, no matter how it is tessellated.
+*/
+
+// sign of the edge function of edge a->b (in the row/slice plane)
+// at (y,z), with the ties broken by a displacement of (d, d*d)
+static int mrisScanlineEdgeSign(double ay, double az, double by, double bz, double y, double z)
+{
+  double const e = (by - ay) * (z - az) - (bz - az) * (y - ay);
+  if (e > 0) return (1);
+  if (e < 0) return (-1);
+  if (bz != az) return (bz > az ? -1 : 1);
+  if (by != ay) return (by > ay ? 1 : -1);
+  return (0);
+}
+
+// signed edge function of the edge between vertices n0 and n1 of a face,
+// evaluated with the vertices in vertex number order
+static double mrisScanlineEdge(const double *vy, const double *vz, int n0, int n1, double y, double z, int *psign)
+{
+  int a = n0, b = n1, flip = 1;
+  if (a > b) {
+    a = n1;
+    b = n0;
+    flip = -1;
+  }
+  *psign = flip * mrisScanlineEdgeSign(vy[a], vz[a], vy[b], vz[b], y, z);
+  return (flip * ((vy[b] - vy[a]) * (z - vz[a]) - (vz[b] - vz[a]) * (y - vy[a])));
+}
+
+// x coordinate at which the ray (y,z) crosses face fno, or false if it
+// misses the face
+static bool mrisScanlineCrossing(
+    MRIS const *mris, const double *vx, const double *vy, const double *vz, int fno, double y, double z, double *px)
+{
+  FACE const * const f = &mris->faces[fno];
+  int const n0 = f->v[0], n1 = f->v[1], n2 = f->v[2];
+  int s0, s1, s2;
+
+  double const w2 = mrisScanlineEdge(vy, vz, n0, n1, y, z, &s2);
+  double const w0 = mrisScanlineEdge(vy, vz, n1, n2, y, z, &s0);
+  double const w1 = mrisScanlineEdge(vy, vz, n2, n0, y, z, &s1);
+  if (s0 == 0 || s0 != s1 || s0 != s2) {
+    return (false);
+  }
+  double const w = w0 + w1 + w2;
+  if (w == 0) {  // face is edge-on to the ray
+    return (false);
+  }
+  *px = (w0 * vx[n0] + w1 * vx[n1] + w2 * vx[n2]) / w;
+  return (true);
+}
+
+/*!
+\fn MRI *MRISfillInteriorScanline(MRI_SURFACE *mris, MRI *mri_dst, int nsub, int coords_are_voxels)
+\brief Fills the interior of a closed surface by intersecting each row of
+voxels with the surface and filling by crossing parity. Unlike
+MRISfillInterior() this is exact at the voxel centers and does not need a
+watertight shell, and unlike a point inclusion test per voxel it only
+intersects each row once with the faces that it passes through.
+\param mris - input surface
+\param mri_dst - output, its geometry determines the voxel grid
+\param nsub - 1 sets voxels whose center is inside to 1 and all others
+to 0. Otherwise nsub x nsub rays are cast through each row and each voxel
+is set to the fraction of its volume that is inside (partial volume).
+\param coords_are_voxels - if set, the vertex coordinates are already in
+the voxel coordinates of mri_dst (see Math::ConvertSurfaceRASToVoxel()),
+otherwise they are surface RAS
+*/
+MRI *MRISfillInteriorScanline(MRI_SURFACE *mris, MRI *mri_dst, int nsub, int coords_are_voxels)
+{
+  Timer start;
+
+  if (mri_dst == NULL) {
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRISfillInteriorScanline: output volume must be given"));
+  }
+  if (nsub < 1) {
+    nsub = 1;
+  }
+  int const width = mri_dst->width, height = mri_dst->height, depth = mri_dst->depth;
+  MRIclear(mri_dst);
+
+  // vertex coordinates in voxels
+  std::vector<double> vx(mris->nvertices), vy(mris->nvertices), vz(mris->nvertices);
+  MRIS_SurfRAS2VoxelMap *map = NULL;
+  if (!coords_are_voxels) {
+    map = MRIS_makeRAS2VoxelMap(mri_dst, mris);
+    MRIS_loadRAS2VoxelMap(map, mri_dst, mris);
+  }
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const * const v = &mris->vertices[vno];
+    if (map) {
+      MRIS_useRAS2VoxelMap(map, mri_dst, v->x, v->y, v->z, &vx[vno], &vy[vno], &vz[vno]);
+    }
+    else {
+      vx[vno] = v->x;
+      vy[vno] = v->y;
+      vz[vno] = v->z;
+    }
+  }
+  if (map) {
+    MRIS_freeRAS2VoxelMap(&map);
+  }
+
+  // the rays of voxel (c,r,s) are at r+off[i], s+off[j], and with nsub == 1
+  // the single ray goes through the voxel center
+  std::vector<double> off(nsub);
+  for (int i = 0; i < nsub; i++) {
+    off[i] = (i + 0.5) / nsub - 0.5;
+  }
+  double const offlo = off[0], offhi = off[nsub - 1];
+
+  // bucket the faces by the slices whose rays their bounding box spans
+  std::vector<int> slice_start(depth + 1, 0);
+  std::vector<int> face_slo(mris->nfaces), face_shi(mris->nfaces);
+  for (int fno = 0; fno < mris->nfaces; fno++) {
+    FACE const * const f = &mris->faces[fno];
+    double zlo = vz[f->v[0]], zhi = zlo;
+    for (int n = 1; n < VERTICES_PER_FACE; n++) {
+      zlo = MIN(zlo, vz[f->v[n]]);
+      zhi = MAX(zhi, vz[f->v[n]]);
+    }
+    face_slo[fno] = MAX(0, (int)ceil(zlo - offhi));
+    face_shi[fno] = MIN(depth - 1, (int)floor(zhi - offlo));
+    for (int s = face_slo[fno]; s <= face_shi[fno]; s++) {
+      slice_start[s + 1]++;
+    }
+  }
+  for (int s = 0; s < depth; s++) {
+    slice_start[s + 1] += slice_start[s];
+  }
+  std::vector<int> slice_faces(slice_start[depth] + 1);
+  {
+    std::vector<int> next(slice_start.begin(), slice_start.end() - 1);
+    for (int fno = 0; fno < mris->nfaces; fno++) {
+      for (int s = face_slo[fno]; s <= face_shi[fno]; s++) {
+        slice_faces[next[s]++] = fno;
+      }
+    }
+  }
+
+  double const scale = 1.0 / (nsub * nsub);
+  int slc;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (slc = 0; slc < depth; slc++) {
+    ROMP_PFLB_begin
+    if (slice_start[slc] == slice_start[slc + 1]) {
+      ROMP_PFLB_continue;
+    }
+
+    // bucket the faces of this slice by row
+    std::vector<std::vector<int> > row_faces(height);
+    for (int k = slice_start[slc]; k < slice_start[slc + 1]; k++) {
+      int const fno = slice_faces[k];
+      FACE const * const f = &mris->faces[fno];
+      double ylo = vy[f->v[0]], yhi = ylo;
+      for (int n = 1; n < VERTICES_PER_FACE; n++) {
+        ylo = MIN(ylo, vy[f->v[n]]);
+        yhi = MAX(yhi, vy[f->v[n]]);
+      }
+      int const rlo = MAX(0, (int)ceil(ylo - offhi));
+      int const rhi = MIN(height - 1, (int)floor(yhi - offlo));
+      for (int r = rlo; r <= rhi; r++) {
+        row_faces[r].push_back(fno);
+      }
+    }
+
+    std::vector<double> xs;
+    std::vector<float> frac(nsub > 1 ? width : 0);
+    for (int row = 0; row < height; row++) {
+      if (row_faces[row].empty()) {
+        continue;
+      }
+      if (nsub > 1) {
+        std::fill(frac.begin(), frac.end(), 0.0f);
+      }
+      for (int j = 0; j < nsub; j++) {
+        double const z = slc + off[j];
+        for (int i = 0; i < nsub; i++) {
+          double const y = row + off[i];
+
+          xs.clear();
+          for (int fno : row_faces[row]) {
+            double x;
+            if (mrisScanlineCrossing(mris, vx.data(), vy.data(), vz.data(), fno, y, z, &x)) {
+              xs.push_back(x);
+            }
+          }
+          std::sort(xs.begin(), xs.end());
+
+          // an odd crossing is left over only if the surface is not closed
+          for (size_t k = 0; k + 1 < xs.size(); k += 2) {
+            double const x0 = xs[k], x1 = xs[k + 1];
+            if (nsub == 1) {
+              // voxel centers in [x0,x1)
+              int const c0 = MAX(0, (int)ceil(x0));
+              int const c1 = MIN(width - 1, (int)ceil(x1) - 1);
+              for (int col = c0; col <= c1; col++) {
+                MRIsetVoxVal(mri_dst, col, row, slc, 0, 1);
+              }
+            }
+            else {
+              // length of [x0,x1] inside each voxel [col-0.5,col+0.5]
+              int const c0 = MAX(0, (int)floor(x0 + 0.5));
+              int const c1 = MIN(width - 1, (int)floor(x1 + 0.5));
+              for (int col = c0; col <= c1; col++) {
+                double const len = MIN(x1, col + 0.5) - MAX(x0, col - 0.5);
+                if (len > 0) {
+                  frac[col] += len;
+                }
+              }
+            }
+          }
+        }
+      }
+      if (nsub > 1) {
+        for (int col = 0; col < width; col++) {
+          if (frac[col] > 0) {
+            MRIsetVoxVal(mri_dst, col, row, slc, 0, MIN(1.0, frac[col] * scale));
+          }
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (Gdiag_no > 0) {
+    printf("  MRISfillInteriorScanline t = %g\n", start.seconds());
+  }
+
+  return (mri_dst);
+}
+
 /*!
 \fn int MRISfillInteriorRibbonTest(char *subject, int UseNew, FILE *fp)
 \brief Runs a test on MRISfillInterior() by comparing its results to
@@ -37,6 +37,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
@@ -69,6 +70,7 @@
 #include "mri_identify.h"
 #include "nifti1.h"
 #include "nifti1_io.h"
+#include "pgzip.h"
 #include "proto.h"
 #include "region.h"
 #include "signa.h"
@@ -89,7 +91,7 @@ static int niiPrintHdr(FILE *fp, struct nifti_1_header *hdr);
 #define INFO_FNAME "COR-.info"
 
 
-MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int end_frame);
+MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int end_frame, const MRI_REGION *region);
 static MRI *corRead(const char *fname, int read_volume);
 static int corWrite(MRI *mri, const char *fname);
 static MRI *siemensRead(const char *fname, int read_volume);
@@ -133,7 +135,7 @@ static MRI *ximgRead(const char *fname, int read_volume);
 
 static MRI *nifti1Read(const char *fname, int read_volume);
 static int nifti1Write(MRI *mri, const char *fname);
-static MRI *niiRead(const char *fname, int read_volume);
+static MRI *niiRead(const char *fname, int read_volume, const MRI_REGION *region, int start_frame, int end_frame);
 static int niiWrite(MRI *mri, const char *fname);
 static int itkMorphWrite(MRI *mri, const char *fname);
 static int niftiQformToMri(MRI *mri, struct nifti_1_header *hdr);
@@ -159,7 +161,7 @@ static void float_local_buffer_to_image(float *buf, MRI *mri, int slice, int fra
 static void local_buffer_to_image(BUFTYPE *buf, MRI *mri, int slice, int frame);
 
 static MRI *sdtRead(const char *fname, int read_volume);
-static MRI *mghRead(const char *fname, int read_volume, int frame);
+static MRI *mghRead(const char *fname, int read_volume, const MRI_REGION *region, int start_frame, int end_frame);
 static int mghWrite(MRI *mri, const char *fname, int frame);
 static int mghAppend(MRI *mri, const char *fname, int frame);
 
@@ -450,6 +452,78 @@ void mriio_set_gdf_crop_flag(int new_gdf_crop_flag)
 
 } /* end mriio_set_gdf_crop_flag() */
 
+// -1 means not yet set, in which case the FS_MGH_MMAP env var decides
+static int mgh_mmap_flag = -1;
+
+/*!
+\fn void mriio_set_mgh_mmap_flag(int new_mgh_mmap_flag)
+\brief Turns memory-mapped reading of uncompressed .mgh files on (1) or
+off (0). When on, the voxel buffer of a volume read by mghRead() points
+directly into a private mapping of the file instead of being copied in,
+for MRI_UCHAR, MRI_SHORT, MRI_INT and MRI_FLOAT volumes (see mghMapVolume);
+other volumes are read as usual. The same can be enabled for any binary
+by setting FS_MGH_MMAP.
+*/
+void mriio_set_mgh_mmap_flag(int new_mgh_mmap_flag)
+{
+  mgh_mmap_flag = new_mgh_mmap_flag;
+} /* end mriio_set_mgh_mmap_flag() */
+
+static int mghMmapEnabled(void)
+{
+  if (mgh_mmap_flag < 0) {
+    const char *s = getenv("FS_MGH_MMAP");
+    mgh_mmap_flag = (s != NULL && strcmp(s, "0") != 0);
+  }
+  return (mgh_mmap_flag);
+}
+
+/*!
+\fn static int mriCheckRegion(const MRI_REGION *region, int width, int height, int depth, MRI_REGION *box)
+\brief Copies region into box, or the whole width x height x depth volume
+if region is NULL. Returns ERROR_BADPARM if the region is empty or does not
+lie inside the volume.
+*/
+static int mriCheckRegion(const MRI_REGION *region, int width, int height, int depth, MRI_REGION *box)
+{
+  if (region == NULL) {
+    box->x = box->y = box->z = 0;
+    box->dx = width;
+    box->dy = height;
+    box->dz = depth;
+    return (NO_ERROR);
+  }
+  *box = *region;
+  if (box->x < 0 || box->y < 0 || box->z < 0 || box->dx < 1 || box->dy < 1 || box->dz < 1 ||
+      box->x + box->dx > width || box->y + box->dy > height || box->z + box->dz > depth) {
+    errno = 0;
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM,
+                 "region (%d, %d, %d) + (%d, %d, %d) is outside of the %dx%dx%d volume",
+                 box->x, box->y, box->z, box->dx, box->dy, box->dz, width, height, depth));
+  }
+  return (NO_ERROR);
+}
+
+/*!
+\fn static void mriCropGeometry(MRI *mri, int width, int height, int depth, const MRI_REGION *region)
+\brief Adjusts the c_ras of mri, whose header geometry describes a
+width x height x depth volume, so that its vox2ras is correct for the
+given region of that volume. The direction cosines and voxel sizes are
+unchanged. See also MRIcalcCRASforExtractedVolume().
+*/
+static void mriCropGeometry(MRI *mri, int width, int height, int depth, const MRI_REGION *region)
+{
+  // shift of the center voxel in the voxel coords of the full volume
+  double sx = (region->x + region->dx / 2.0 - width / 2.0) * mri->xsize;
+  double sy = (region->y + region->dy / 2.0 - height / 2.0) * mri->ysize;
+  double sz = (region->z + region->dz / 2.0 - depth / 2.0) * mri->zsize;
+
+  mri->c_r += mri->x_r * sx + mri->y_r * sy + mri->z_r * sz;
+  mri->c_a += mri->x_a * sx + mri->y_a * sy + mri->z_a * sz;
+  mri->c_s += mri->x_s * sx + mri->y_s * sy + mri->z_s * sz;
+}
+
 int MRIgetVolumeName(const char *string, char *name_only)
 {
   char *at, *pound;
@@ -466,7 +540,14 @@ int MRIgetVolumeName(const char *string, char *name_only)
 
 } /* end MRIgetVolumeName() */
 
-MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int end_frame)
+/*
+  mri_read() - reads frames start_frame to end_frame (all if -1) of a
+  volume of the given type. If region is not NULL, only the voxels inside
+  it are returned, with the vox2ras adjusted accordingly. The mgh and nii
+  readers only read the requested frames and region from the file; for
+  all other formats the volume is read in full and then cropped.
+*/
+MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int end_frame, const MRI_REGION *region)
 {
   MRI *mri, *mri2;
   IMAGE *I;
@@ -476,6 +557,7 @@ MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int
   char *ep;
   int i, j, k, t;
   int volume_frames;
+  int frames_read = 0;  // the reader returned just the requested frames
 
   // sanity-checks
   if (fname == NULL) {
@@ -632,7 +714,9 @@ MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int
     mri = sdtRead(fname_copy, volume_flag);
   }
   else if (type == MRI_MGH_FILE) {
-    mri = mghRead(fname_copy, volume_flag, -1);
+    mri = mghRead(fname_copy, volume_flag, region, start_frame, end_frame);
+    region = NULL;
+    frames_read = 1;
   }
   else if (type == MGH_MORPH) {
     int which = start_frame ;
@@ -702,7 +786,9 @@ MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int
     mri = nifti1Read(fname_copy, volume_flag);
   }
   else if (type == NII_FILE) {
-    mri = niiRead(fname_copy, volume_flag);
+    mri = niiRead(fname_copy, volume_flag, region, start_frame, end_frame);
+    region = NULL;
+    frames_read = 1;
   }
   else if (type == NRRD_FILE) {
     mri = mriNrrdRead(fname_copy, volume_flag);
@@ -744,8 +830,37 @@ MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int
   /* Compute the FOV from the vox2ras matrix (don't rely on what
      may or may not be in the file).*/
 
+  if (region != NULL) {
+    // this format could not read just the region, so crop it now
+    MRI_REGION box;
+    if (mriCheckRegion(region, mri->width, mri->height, mri->depth, &box) != NO_ERROR) {
+      MRIfree(&mri);
+      return (NULL);
+    }
+    if (volume_flag)
+      mri2 = MRIextractRegion(mri, NULL, &box);
+    else {
+      mri2 = MRIallocHeader(box.dx, box.dy, box.dz, mri->type, mri->nframes);
+      MRIcopyHeader(mri, mri2);
+      mriCropGeometry(mri2, mri->width, mri->height, mri->depth, &box);
+      MRIreInitCache(mri2);
+    }
+    MRIfree(&mri);
+    mri = mri2;
+  }
+
   if (start_frame == -1) return (mri);
 
+  if (frames_read) {
+    // the reader only read frames start_frame to end_frame and has
+    // already checked them against the number of frames in the file
+    if (volume_flag && nan_inf_check(mri) != NO_ERROR) {
+      MRIfree(&mri);
+      return (NULL);
+    }
+    return (mri);
+  }
+
   /* --- select frames --- */
 
   if (start_frame >= mri->nframes) {
@@ -888,7 +1003,7 @@ MRI *MRIreadType(const char *fname, int type)
 
   chklc();
 
-  mri = mri_read(fname, type, TRUE, -1, -1);
+  mri = mri_read(fname, type, TRUE, -1, -1, NULL);
 
   return (mri);
 
@@ -906,7 +1021,7 @@ MRI *MRIread(const char *fname)
   int nstart = global_progress_range[0];
   int nend = global_progress_range[1];
   global_progress_range[1] = nstart + (nend - nstart) * 2 / 3;
-  mri = mri_read(fname, MRI_VOLUME_TYPE_UNKNOWN, TRUE, -1, -1);
+  mri = mri_read(fname, MRI_VOLUME_TYPE_UNKNOWN, TRUE, -1, -1, NULL);
 
   /* some volume format needs to read many
      different files for slices (GE DICOM or COR).
@@ -933,7 +1048,7 @@ MRI *MRIreadEx(const char *fname, int nthframe)
 
   FileNameFromWildcard(fname, buf);
   fname = buf;
-  mri = mri_read(fname, MRI_VOLUME_TYPE_UNKNOWN, TRUE, nthframe, nthframe);
+  mri = mri_read(fname, MRI_VOLUME_TYPE_UNKNOWN, TRUE, nthframe, nthframe, NULL);
 
   /* some volume format needs to read many
      different files for slices (GE DICOM or COR).
@@ -945,11 +1060,35 @@ MRI *MRIreadEx(const char *fname, int nthframe)
 
 } /* end MRIread() */
 
+/*!
+\fn MRI *MRIreadRegion(const char *fname, const MRI_REGION *region, int start_frame, int end_frame)
+\brief Reads frames start_frame to end_frame (all frames if start_frame
+is -1) and only the voxels inside region (the whole volume if NULL) of a
+volume. For .mgh/.mgz and .nii/.nii.gz files only those voxels are read
+from disk. The vox2ras of the returned volume is that of the region.
+*/
+MRI *MRIreadRegion(const char *fname, const MRI_REGION *region, int start_frame, int end_frame)
+{
+  char buf[STRLEN];
+  MRI *mri = NULL;
+
+  chklc();
+
+  FileNameFromWildcard(fname, buf);
+  fname = buf;
+  mri = mri_read(fname, MRI_VOLUME_TYPE_UNKNOWN, TRUE, start_frame, end_frame, region);
+  if (mri == NULL) return NULL;
+
+  MRIremoveNaNs(mri, mri);
+  return (mri);
+
+} /* end MRIreadRegion() */
+
 MRI *MRIreadInfo(const char *fname)
 {
   MRI *mri = NULL;
 
-  mri = mri_read(fname, MRI_VOLUME_TYPE_UNKNOWN, FALSE, -1, -1);
+  mri = mri_read(fname, MRI_VOLUME_TYPE_UNKNOWN, FALSE, -1, -1, NULL);
 
   return (mri);
 
@@ -995,7 +1134,7 @@ MRI *MRIreadHeader(const char *fname, int type)
       return (NULL);
     }
   }
-  mri = mri_read(modFname, usetype, FALSE, -1, -1);
+  mri = mri_read(modFname, usetype, FALSE, -1, -1, NULL);
 
   return (mri);
 
@@ -8197,9 +8336,14 @@ static int nifti1Write(MRI *mri0, const char *fname)
 /*------------------------------------------------------------------
   niiRead() - note: there is also an nifti1Read(). Make sure to
   edit both. Automatically detects whether an input is Ico7
-  and reshapes.
+  and reshapes. Only frames start_frame to end_frame are read
+  (all frames if start_frame is -1), and only the voxels inside
+  region (all if NULL), row by row, seeking past the rest in
+  uncompressed files and inflating and discarding it in gzipped
+  ones. A region of an Ico7 surface refers to the reshaped
+  163842x1x1 surface.
   -----------------------------------------------------------------*/
-static MRI *niiRead(const char *fname, int read_volume)
+static MRI *niiRead(const char *fname, int read_volume, const MRI_REGION *region, int start_frame, int end_frame)
 {
   znzFile fp;
   MRI *mri, *mritmp;
@@ -8212,6 +8356,7 @@ static MRI *niiRead(const char *fname, int read_volume)
   int bytes_per_voxel, time_units, space_units;
   int use_compression, fnamelen;
   int ncols, IsIco7 = 0;
+  long file_bpv;
 
   use_compression = 0;
   fnamelen = strlen(fname);
@@ -8374,8 +8519,42 @@ static MRI *niiRead(const char *fname, int read_volume)
 
   if (ncols * hdr.dim[2] * hdr.dim[3] == 163842) IsIco7 = 1;
 
+  if (start_frame < 0) {
+    start_frame = 0;
+    end_frame = nslices - 1;
+  }
+  if (start_frame >= nslices || end_frame >= nslices || end_frame < start_frame) {
+    errno = 0;
+    ErrorReturn(NULL,
+                (ERROR_BADPARM,
+                 "niiRead(): frames %d to %d out of range (%d frames in %s)",
+                 start_frame,
+                 end_frame,
+                 nslices,
+                 fname));
+  }
+  nslices = end_frame - start_frame + 1;
+
+  // dimensions of the voxel data in the file; the voxels of an Ico7
+  // surface are in vertex order, so a region of the reshaped surface is
+  // read as if the file were 163842x1x1, which needs no reshape
+  int fwidth = ncols, fheight = hdr.dim[2], fdepth = hdr.dim[3];
+  int ico7_direct = (IsIco7 && region != NULL);
+  if (ico7_direct) {
+    fwidth = 163842;
+    fheight = fdepth = 1;
+  }
+  MRI_REGION box;
+  if (mriCheckRegion(region, fwidth, fheight, fdepth, &box) != NO_ERROR)
+    ErrorReturn(NULL, (ERROR_BADPARM, "niiRead(%s): region out of bounds", fname));
+  int cropped = (box.dx != fwidth || box.dy != fheight || box.dz != fdepth);
+
   if (read_volume)
-    mri = MRIallocSequence(ncols, hdr.dim[2], hdr.dim[3], fs_type, nslices);
+    mri = MRIallocSequence(box.dx, box.dy, box.dz, fs_type, nslices);
+  else if (cropped) {
+    mri = MRIallocHeader(box.dx, box.dy, box.dz, fs_type, nslices);
+    mri->nframes = nslices;
+  }
   else {
     if (!IsIco7)
       mri = MRIallocHeader(ncols, hdr.dim[2], hdr.dim[3], fs_type, nslices);
@@ -8428,6 +8607,18 @@ static MRI *niiRead(const char *fname, int read_volume)
     mri->c_s = mri->zsize * mri->depth / 2.0;
     mri->ras_good_flag = 0;
   }
+  if (cropped) {
+    // the sform and qform put voxel 0 of the region at voxel 0 of the
+    // file, while the default geometry is centered on the whole volume
+    if (mri->ras_good_flag)
+      mriCropGeometry(mri, box.dx, box.dy, box.dz, &box);
+    else {
+      mri->c_r = mri->xsize * fwidth / 2.0;
+      mri->c_a = mri->ysize * fheight / 2.0;
+      mri->c_s = mri->zsize * fdepth / 2.0;
+      mriCropGeometry(mri, fwidth, fheight, fdepth, &box);
+    }
+  }
 
   mri->xsize = mri->xsize * space_units_factor;
   mri->ysize = mri->ysize * space_units_factor;
@@ -8453,20 +8644,40 @@ static MRI *niiRead(const char *fname, int read_volume)
 
   if (!read_volume) return (mri);
 
-  fp = znzopen(fname, "r", use_compression);
+  fp = pgzopen(fname, "r", use_compression);
   if (fp == NULL) {
     MRIfree(&mri);
     errno = 0;
     ErrorReturn(NULL, (ERROR_BADFILE, "niiRead(): error opening file %s", fname));
   }
 
-  if (znzseek(fp, (long)(hdr.vox_offset), SEEK_SET) == -1) {
-    znzclose(fp);
-    MRIfree(&mri);
-    errno = 0;
-    ErrorReturn(NULL, (ERROR_BADFILE, "niiRead(): error finding voxel data in %s", fname));
+  // bytes per voxel in the file, to find the rows of the region
+  switch (hdr.datatype) {
+    case DT_UNSIGNED_CHAR:
+    case DT_INT8:
+      file_bpv = 1;
+      break;
+    case DT_SIGNED_SHORT:
+    case DT_UINT16:
+      file_bpv = 2;
+      break;
+    case DT_DOUBLE:
+      file_bpv = 8;
+      break;
+    default:
+      file_bpv = 4;
+      break;
   }
 
+  // moves fp to row j of slice k of frame t of the region, unless it is
+  // already there (the rows of a full-width region follow each other)
+  long data_offset = (long)(hdr.vox_offset);
+  auto seek_row = [&](int j, int k, int t) {
+    long offset = box.x + (long)fwidth * (box.y + j + (long)fheight * (box.z + k + (long)fdepth * (start_frame + t)));
+    offset = data_offset + offset * file_bpv;
+    return (znztell(fp) == offset || znzseek(fp, offset, SEEK_SET) != -1);
+  };
+
   if (!scaledata) {
     // no voxel value scaling needed
     void *buf;
@@ -8482,9 +8693,9 @@ static MRI *niiRead(const char *fname, int read_volume)
           buf = &MRIseq_vox(mri, 0, j, k, t);
 
           if (hdr.datatype != DT_DOUBLE)
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
+            n_read = !seek_row(j, k, t) ? 0 : znzread(buf, bytes_per_voxel, mri->width, fp);
           else
-            n_read = znzread(dbuf, bytes_per_voxel, mri->width, fp);
+            n_read = !seek_row(j, k, t) ? 0 : znzread(dbuf, bytes_per_voxel, mri->width, fp);
           if (n_read != mri->width) {
             printf("ERROR: Read %d, expected %d\n", n_read, mri->width);
             znzclose(fp);
@@ -8518,7 +8729,7 @@ static MRI *niiRead(const char *fname, int read_volume)
       for (t = 0; t < mri->nframes; t++)
         for (k = 0; k < mri->depth; k++) {
           for (j = 0; j < mri->height; j++) {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
+            n_read = !seek_row(j, k, t) ? 0 : znzread(buf, bytes_per_voxel, mri->width, fp);
             if (n_read != mri->width) {
               free(buf);
               znzclose(fp);
@@ -8541,7 +8752,7 @@ static MRI *niiRead(const char *fname, int read_volume)
       for (t = 0; t < mri->nframes; t++)
         for (k = 0; k < mri->depth; k++) {
           for (j = 0; j < mri->height; j++) {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
+            n_read = !seek_row(j, k, t) ? 0 : znzread(buf, bytes_per_voxel, mri->width, fp);
             if (n_read != mri->width) {
               free(buf);
               znzclose(fp);
@@ -8565,7 +8776,7 @@ static MRI *niiRead(const char *fname, int read_volume)
       for (t = 0; t < mri->nframes; t++)
         for (k = 0; k < mri->depth; k++) {
           for (j = 0; j < mri->height; j++) {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
+            n_read = !seek_row(j, k, t) ? 0 : znzread(buf, bytes_per_voxel, mri->width, fp);
             if (n_read != mri->width) {
               free(buf);
               znzclose(fp);
@@ -8589,7 +8800,7 @@ static MRI *niiRead(const char *fname, int read_volume)
       for (t = 0; t < mri->nframes; t++)
         for (k = 0; k < mri->depth; k++) {
           for (j = 0; j < mri->height; j++) {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
+            n_read = !seek_row(j, k, t) ? 0 : znzread(buf, bytes_per_voxel, mri->width, fp);
             if (n_read != mri->width) {
               free(buf);
               znzclose(fp);
@@ -8614,7 +8825,7 @@ static MRI *niiRead(const char *fname, int read_volume)
       for (t = 0; t < mri->nframes; t++)
         for (k = 0; k < mri->depth; k++) {
           for (j = 0; j < mri->height; j++) {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
+            n_read = !seek_row(j, k, t) ? 0 : znzread(buf, bytes_per_voxel, mri->width, fp);
             if (n_read != mri->width) {
               free(buf);
               znzclose(fp);
@@ -8651,7 +8862,7 @@ static MRI *niiRead(const char *fname, int read_volume)
       for (t = 0; t < mri->nframes; t++)
         for (k = 0; k < mri->depth; k++) {
           for (j = 0; j < mri->height; j++) {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
+            n_read = !seek_row(j, k, t) ? 0 : znzread(buf, bytes_per_voxel, mri->width, fp);
             if (n_read != mri->width) {
               free(buf);
               znzclose(fp);
@@ -8674,7 +8885,7 @@ static MRI *niiRead(const char *fname, int read_volume)
       for (t = 0; t < mri->nframes; t++)
         for (k = 0; k < mri->depth; k++) {
           for (j = 0; j < mri->height; j++) {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
+            n_read = !seek_row(j, k, t) ? 0 : znzread(buf, bytes_per_voxel, mri->width, fp);
             if (n_read != mri->width) {
               free(buf);
               znzclose(fp);
@@ -8698,7 +8909,7 @@ static MRI *niiRead(const char *fname, int read_volume)
       for (t = 0; t < mri->nframes; t++)
         for (k = 0; k < mri->depth; k++) {
           for (j = 0; j < mri->height; j++) {
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
+            n_read = !seek_row(j, k, t) ? 0 : znzread(buf, bytes_per_voxel, mri->width, fp);
             if (n_read != mri->width) {
               free(buf);
               znzclose(fp);
@@ -8718,7 +8929,7 @@ static MRI *niiRead(const char *fname, int read_volume)
   znzclose(fp);
 
   // Check for ico7 surface
-  if (IsIco7) {
+  if (IsIco7 && !ico7_direct) {
     //   printf("niiRead: reshaping\n");
     mritmp = mri_reshape(mri, 163842, 1, 1, mri->nframes);
     MRIfree(&mri);
@@ -8867,7 +9078,7 @@ static int niiWrite(MRI *mri0, const char *fname)
 
   memmove(hdr.magic, NII_MAGIC, 4);
 
-  fp = znzopen(fname, "w", use_compression);
+  fp = pgzopen(fname, "w", use_compression);
   if (fp == NULL) {
     errno = 0;
     ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "niiWrite(): error opening file %s", fname));
@@ -10139,16 +10350,182 @@ int znzTAGreadMRIframes(znzFile fp, MRI *mri, long len)
 // declare function pointer
 // static int (*myclose)(FILE *stream);
 
-static MRI *mghRead(const char *fname, int read_volume, int frame)
+/*!
+\fn static void mghSwapMappedVoxels(MRI *mri)
+\brief Converts the big-endian voxels of a mapped MRI_SHORT, MRI_INT or
+MRI_FLOAT volume to host order in place. The buffer is split into blocks
+that are swapped in parallel; the inner loops are plain 16/32 bit byte
+swaps that the compiler turns into vector shuffles.
+*/
+static void mghSwapMappedVoxels(MRI *mri)
+{
+  if (mri->type == MRI_UCHAR) return;
+  size_t const bpv = mri->type == MRI_SHORT ? sizeof(short) : sizeof(int);
+
+  size_t const nvox = mri->bytes_total / bpv;
+  size_t const block = 1 << 20;  // voxels per parallel block
+  long const nblocks = (nvox + block - 1) / block;
+  long b;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (b = 0; b < nblocks; b++) {
+    ROMP_PFLB_begin
+    size_t const begin = b * block;
+    size_t const end = begin + block < nvox ? begin + block : nvox;
+    size_t i;
+    if (bpv == sizeof(short)) {
+      uint16_t *v = (uint16_t *)mri->chunk;
+      for (i = begin; i < end; i++) v[i] = __builtin_bswap16(v[i]);
+    }
+    else {
+      uint32_t *v = (uint32_t *)mri->chunk;
+      for (i = begin; i < end; i++) v[i] = __builtin_bswap32(v[i]);
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+/*!
+\fn static int mghMapVolume(MRI *mri, const char *fname, long offset)
+\brief Points the image buffer of a header-only MRI (as returned by
+MRIallocHeader) into a mapping of the uncompressed .mgh file fname,
+starting at byte offset of the voxel data. Pages are faulted in lazily
+by the kernel and shared with the page cache until written; the mapping
+is private (copy-on-write), so voxels can be modified without touching
+the file. MRI_UCHAR, MRI_SHORT, MRI_INT and MRI_FLOAT volumes are mapped.
+MGH data is big-endian and callers read the buffer directly through the
+voxel macros, so on little-endian hosts the multi-byte types are converted
+to host order in one parallel pass over the mapping (mghSwapMappedVoxels).
+That pass pages the whole volume in and makes its pages private, so for
+those types the gain is skipping the read copy rather than lazy page-ins;
+MRI_UCHAR volumes, and all types on big-endian hosts, stay lazily mapped.
+The MRI does not own the buffer (owndata=false) and the mapping is
+released by MRIfree(). Returns NO_ERROR on success, otherwise the caller
+should fall back to a regular read.
+*/
+static int mghMapVolume(MRI *mri, const char *fname, long offset)
+{
+  if (mri->type != MRI_UCHAR && mri->type != MRI_SHORT && mri->type != MRI_INT && mri->type != MRI_FLOAT)
+    return (ERROR_UNSUPPORTED);
+
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0) return (ERROR_NOFILE);
+
+  // mmap offsets must be page aligned, so map from the start of the page
+  // containing the first voxel and step into it
+  long pagesize = sysconf(_SC_PAGESIZE);
+  long pageoffset = offset - (offset % pagesize);
+  size_t mapping_bytes = mri->bytes_total + (offset - pageoffset);
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < pageoffset + mapping_bytes) {
+    close(fd);
+    return (ERROR_BADFILE);
+  }
+
+  void *mapping = mmap(NULL, mapping_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, pageoffset);
+  close(fd);  // the mapping keeps its own reference to the file
+  if (mapping == MAP_FAILED) return (ERROR_NOMEMORY);
+
+  mri->mapping = mapping;
+  mri->mapping_bytes = mapping_bytes;
+  mri->chunk = (char *)mapping + (offset - pageoffset);
+  mri->ischunked = true;
+  mri->owndata = false;
+  mri->initSlices();
+  mri->initIndices();
+
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+  mghSwapMappedVoxels(mri);
+#endif
+
+  return (NO_ERROR);
+}
+
+/*!
+\fn static int mghReadVoxels(znzFile fp, MRI *mri, int bpv, int width, int height, int depth, const MRI_REGION *region, int start_frame, long data_offset)
+\brief Reads the voxels inside region of frames start_frame to
+start_frame + mri->nframes - 1 from the big-endian voxel data of a
+width x height x depth .mgh file that starts at data_offset. The data are
+read in runs that are contiguous in the file - whole slices when the region
+covers the full slice and single rows otherwise - and the bytes between
+runs are skipped with znzseek(), which seeks in uncompressed files and
+inflates and discards in gzipped ones.
+*/
+static int mghReadVoxels(
+    znzFile fp, MRI *mri, int bpv, int width, int height, int depth, const MRI_REGION *region, int start_frame, long data_offset)
+{
+  int fullslice = (region->dx == width && region->dy == height);
+  int nrows = fullslice ? height : 1;  // rows per run
+  long runlen = (long)region->dx * nrows;
+  BUFTYPE *buf = (BUFTYPE *)calloc(runlen, bpv);
+  int f, x, y, z, r;
+
+  for (f = 0; f < mri->nframes; f++) {
+    for (z = 0; z < region->dz; z++) {
+      for (y = 0; y < region->dy; y += nrows) {
+        long offset = region->x + (long)width * (region->y + y + (long)height * (region->z + z + (long)depth * (start_frame + f)));
+        offset = data_offset + offset * bpv;
+        if ((znztell(fp) != offset && znzseek(fp, offset, SEEK_SET) == -1) || (long)znzread(buf, bpv, runlen, fp) != runlen) {
+          free(buf);
+          ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mghRead: could not read %ld bytes at slice %d", runlen * bpv, z));
+        }
+        for (r = 0; r < nrows; r++) {
+          long i = (long)r * region->dx;
+          switch (mri->type) {
+            case MRI_INT: {
+              int *row = &MRIIseq_vox(mri, 0, y + r, z, f);
+              for (x = 0; x < region->dx; x++) row[x] = orderIntBytes(((int *)buf)[i + x]);
+              break;
+            }
+            case MRI_SHORT: {
+              short *row = &MRISseq_vox(mri, 0, y + r, z, f);
+              for (x = 0; x < region->dx; x++) row[x] = orderShortBytes(((short *)buf)[i + x]);
+              break;
+            }
+            case MRI_TENSOR:
+            case MRI_FLOAT: {
+              float *row = &MRIFseq_vox(mri, 0, y + r, z, f);
+              for (x = 0; x < region->dx; x++) row[x] = orderFloatBytes(((float *)buf)[i + x]);
+              break;
+            }
+            case MRI_UCHAR:
+              memcpy(&MRIseq_vox(mri, 0, y + r, z, f), buf + i, region->dx);
+              break;
+            default:
+              free(buf);
+              errno = 0;
+              ErrorReturn(ERROR_UNSUPPORTED, (ERROR_UNSUPPORTED, "mghRead: unsupported type %d", mri->type));
+          }
+        }
+      }
+      exec_progress_callback(z, region->dz, f, mri->nframes);
+    }
+  }
+
+  free(buf);
+  return (NO_ERROR);
+}
+
+/*!
+\fn static MRI *mghRead(const char *fname, int read_volume, const MRI_REGION *region, int start_frame, int end_frame)
+\brief Reads an .mgh/.mgz file. Only frames start_frame to end_frame
+(all frames if start_frame < 0) and only the voxels inside region (the
+whole volume if NULL) are read; the vox2ras of the result is that of the
+cropped region.
+*/
+static MRI *mghRead(const char *fname, int read_volume, const MRI_REGION *region, int start_frame, int end_frame)
 {
   MRI *mri;
   znzFile fp;
-  int start_frame, end_frame, width, height, depth, nframes, type, x, y, z, bpv, dof, bytes, version, ival,
-      unused_space_size, good_ras_flag, i;
-  BUFTYPE *buf;
+  int width, height, depth, nframes, type, bpv, dof, version, unused_space_size, good_ras_flag;
   char unused_buf[UNUSED_SPACE_SIZE + 1];
   float fval, xsize, ysize, zsize, x_r, x_a, x_s, y_r, y_a, y_s, z_r, z_a, z_s, c_r, c_a, c_s, xfov, yfov, zfov;
-  short sval;
+  MRI_REGION box;
   //  int tag_data_size;
   const char *ext;
   int gzipped = 0;
@@ -10170,19 +10547,18 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
   }
 
   if (valid_ext) {
-    fp = znzopen(fname, "rb", gzipped);
+    fp = pgzopen(fname, "rb", gzipped);
     if (znz_isnull(fp)) {
       errno = 0;
-      ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s, %d): could not open file", fname, frame));
+      ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s): could not open file", fname));
     }
   }
   else {
     ErrorReturn(NULL,
                 (ERROR_BADPARM,
-                 "mghRead(%s, %d): could not open file.\n"
+                 "mghRead(%s): could not open file.\n"
                  "Filename extension must be .mgh, .mgh.gz or .mgz",
-                 fname,
-                 frame));
+                 fname));
   }
 
   /* keep the compiler quiet */
@@ -10193,7 +10569,7 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
   c_r = c_a = c_s = 0;
 
   nread = znzreadIntEx(&version, fp);
-  if (!nread) ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s, %d): read error", fname, frame));
+  if (!nread) ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s): read error", fname));
 
   width = znzreadInt(fp);
   height = znzreadInt(fp);
@@ -10247,92 +10623,63 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
       nframes = 9;
       break;
   }
-  bytes = width * height * bpv; /* bytes per slice */
-  if (!read_volume) {
-    mri = MRIallocHeader(width, height, depth, type, nframes);
-    mri->dof = dof;
-    mri->nframes = nframes;
-    if (gzipped) {  // pipe cannot seek
-      long count, total_bytes;
-      uchar buf[STRLEN];
+  if (start_frame < 0) {
+    start_frame = 0;
+    end_frame = nframes - 1;
+  }
+  if (start_frame >= nframes || end_frame >= nframes || end_frame < start_frame) {
+    znzclose(fp);
+    errno = 0;
+    ErrorReturn(NULL,
+                (ERROR_BADPARM,
+                 "mghRead(%s): frames %d to %d out of range (%d frames in volume)",
+                 fname,
+                 start_frame,
+                 end_frame,
+                 nframes));
+  }
+  if (mriCheckRegion(region, width, height, depth, &box) != NO_ERROR) {
+    znzclose(fp);
+    ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s): region out of bounds", fname));
+  }
+  int cropped = (box.dx != width || box.dy != height || box.dz != depth);
 
-      total_bytes = (long)mri->nframes * width * height * depth * bpv;
-      for (count = 0; count < total_bytes - STRLEN; count += STRLEN) znzread(buf, STRLEN, 1, fp);
-      znzread(buf, total_bytes - count, 1, fp);
+  long frame_bytes = (long)width * height * depth * bpv;
+  long data_offset = znztell(fp);
+  mri = NULL;
+  if (read_volume && !cropped && !gzipped && mghMmapEnabled() && type != MRI_TENSOR) {
+    // map the voxel data instead of copying it in; falls back to the
+    // regular read below if the mapping cannot be made
+    mri = MRIallocHeader(width, height, depth, type, end_frame - start_frame + 1);
+    mri->dof = dof;
+    if (mghMapVolume(mri, fname, data_offset + start_frame * frame_bytes) != NO_ERROR) {
+      if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "mghRead(%s): could not map file\n", fname);
+      MRIfree(&mri);
     }
-    else
-      znzseek(fp, (long)mri->nframes * width * height * depth * bpv, SEEK_CUR);
+  }
+  if (mri) {
+    // voxel data already mapped
+  }
+  else if (!read_volume) {
+    mri = MRIallocHeader(box.dx, box.dy, box.dz, type, end_frame - start_frame + 1);
+    mri->dof = dof;
+    mri->nframes = end_frame - start_frame + 1;
   }
   else {
-    if (frame >= 0) {
-      start_frame = end_frame = frame;
-      if (gzipped) {  // pipe cannot seek
-        long count;
-        for (count = 0; count < (long)frame * width * height * depth * bpv; count++) znzgetc(fp);
-      }
-      else
-        znzseek(fp, (long)frame * width * height * depth * bpv, SEEK_CUR);
-      nframes = 1;
-    }
-    else { /* hack - # of frames < -1 means to only read in that
-              many frames. Otherwise I would have had to change the whole
-              MRIread interface and that was too much of a pain. Sorry.
-           */
-      if (frame < -1) nframes = frame * -1;
-
-      start_frame = 0;
-      end_frame = nframes - 1;
-      if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "read %d frames\n", nframes);
-    }
-    buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE));
-    mri = MRIallocSequence(width, height, depth, type, nframes);
+    mri = MRIallocSequence(box.dx, box.dy, box.dz, type, end_frame - start_frame + 1);
     mri->dof = dof;
-    for (frame = start_frame; frame <= end_frame; frame++) {
-      for (z = 0; z < depth; z++) {
-        if ((int)znzread(buf, sizeof(char), bytes, fp) != bytes) {
-          // fclose(fp) ;
-          znzclose(fp);
-          free(buf);
-          ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read %d bytes at slice %d", fname, bytes, z));
-        }
-        switch (type) {
-          case MRI_INT:
-            for (i = y = 0; y < height; y++) {
-              for (x = 0; x < width; x++, i++) {
-                ival = orderIntBytes(((int *)buf)[i]);
-                MRIIseq_vox(mri, x, y, z, frame - start_frame) = ival;
-              }
-            }
-            break;
-          case MRI_SHORT:
-            for (i = y = 0; y < height; y++) {
-              for (x = 0; x < width; x++, i++) {
-                sval = orderShortBytes(((short *)buf)[i]);
-                MRISseq_vox(mri, x, y, z, frame - start_frame) = sval;
-              }
-            }
-            break;
-          case MRI_TENSOR:
-          case MRI_FLOAT:
-            for (i = y = 0; y < height; y++) {
-              for (x = 0; x < width; x++, i++) {
-                fval = orderFloatBytes(((float *)buf)[i]);
-                MRIFseq_vox(mri, x, y, z, frame - start_frame) = fval;
-              }
-            }
-            break;
-          case MRI_UCHAR:
-            local_buffer_to_image(buf, mri, z, frame - start_frame);
-            break;
-          default:
-            errno = 0;
-            ErrorReturn(NULL, (ERROR_UNSUPPORTED, "mghRead: unsupported type %d", mri->type));
-            break;
-        }
-        exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
-      }
+    if (mghReadVoxels(fp, mri, bpv, width, height, depth, &box, start_frame, data_offset) != NO_ERROR) {
+      znzclose(fp);
+      MRIfree(&mri);
+      ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read voxel data", fname));
     }
-    if (buf) free(buf);
+  }
+
+  // the tags follow the voxel data of all frames
+  if (znzseek(fp, data_offset + nframes * frame_bytes, SEEK_SET) == -1) {
+    znzclose(fp);
+    MRIfree(&mri);
+    ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not seek past voxel data", fname));
   }
 
   if (good_ras_flag > 0) {
@@ -10371,6 +10718,7 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
               fname);
     setDirectionCosine(mri, MRI_CORONAL);
   }
+  if (cropped) mriCropGeometry(mri, width, height, depth, &box);
   // read TR, Flip, TE, TI, FOV
   if (znzreadFloatEx(&(mri->tr), fp)) {
     if (znzreadFloatEx(&fval, fp)) {
@@ -10521,7 +10869,7 @@ static int mghWrite(MRI *mri, const char *fname, int frame)
     }
   }
   if (valid_ext) {
-    fp = znzopen(fname, "wb", gzipped);
+    fp = pgzopen(fname, "wb", gzipped);
     if (znz_isnull(fp)) {
       errno = 0;
       ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "mghWrite(%s, %d): could not open file", fname, frame));
@@ -11421,6 +11769,12 @@ MRI *MRIremoveNaNs(MRI *mri_src, MRI * mri_dst)
 {
   if (mri_dst != mri_src) mri_dst = MRIcopy(mri_src, mri_dst);
 
+  // integer types cannot hold NaNs - skip the scan so that memory-mapped
+  // volumes are not paged in just to check them
+  if (mri_dst->type == MRI_UCHAR || mri_dst->type == MRI_SHORT || mri_dst->type == MRI_INT ||
+      mri_dst->type == MRI_LONG)
+    return (mri_dst);
+
   int x;
   int nans = 0;
   static int first = 1;
@@ -0,0 +1,574 @@
+/**
+ * @brief bounding volume hierarchy over the faces or vertices of a surface
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "error.h"
+#include "macros.h"
+#include "mrisbvh.h"
+#include "mrishash.h"
+#include "mrisurf.h"
+#include "romp_support.h"
+#include "timer.h"
+
+
+// The tree is built top down, splitting the primitives at the median of
+// their centroids along the longest axis of the centroid bounds, until at
+// most BVH_LEAF_SIZE are left. The nodes are stored depth first so the
+// left child of a node always follows it.
+//
+#define BVH_LEAF_SIZE 4
+#define BVH_MAX_DEPTH 64
+
+struct BVH_NODE {
+  float lo[3], hi[3];
+  int first;  // leaf: first entry in prims, inner node: right child
+  int count;  // leaf: number of prims, inner node: 0
+};
+
+struct MRIS_BVH {
+  bool is_faces;
+  std::vector<BVH_NODE> nodes;
+  std::vector<int> prims;      // vertex or face numbers in leaf order
+  std::vector<float> coords;   // x,y,z of every vertex of the surface
+  std::vector<int> face_vnos;  // v[0..2] of every face of the surface
+};
+
+
+int MRISbvhRequested(void) { return getenv("FS_SURFACE_BVH") != NULL; }
+
+
+static void bvhPrimBounds(MRIS_BVH const *bvh, int prim, float *lo, float *hi)
+{
+  if (!bvh->is_faces) {
+    for (int a = 0; a < 3; a++) {
+      lo[a] = hi[a] = bvh->coords[3 * prim + a];
+    }
+    return;
+  }
+  int const *v = &bvh->face_vnos[3 * prim];
+  for (int a = 0; a < 3; a++) {
+    lo[a] = hi[a] = bvh->coords[3 * v[0] + a];
+    for (int n = 1; n < 3; n++) {
+      lo[a] = MIN(lo[a], bvh->coords[3 * v[n] + a]);
+      hi[a] = MAX(hi[a], bvh->coords[3 * v[n] + a]);
+    }
+  }
+}
+
+static int bvhBuild(MRIS_BVH *bvh, std::vector<float> const &centroids, int begin, int end, int depth)
+{
+  int const node = (int)bvh->nodes.size();
+  bvh->nodes.push_back(BVH_NODE());
+
+  float lo[3], hi[3], clo[3], chi[3];
+  for (int a = 0; a < 3; a++) {
+    lo[a] = clo[a] = 1e30f;
+    hi[a] = chi[a] = -1e30f;
+  }
+  for (int i = begin; i < end; i++) {
+    float plo[3], phi[3];
+    int const prim = bvh->prims[i];
+    bvhPrimBounds(bvh, prim, plo, phi);
+    for (int a = 0; a < 3; a++) {
+      lo[a] = MIN(lo[a], plo[a]);
+      hi[a] = MAX(hi[a], phi[a]);
+      clo[a] = MIN(clo[a], centroids[3 * prim + a]);
+      chi[a] = MAX(chi[a], centroids[3 * prim + a]);
+    }
+  }
+  for (int a = 0; a < 3; a++) {
+    bvh->nodes[node].lo[a] = lo[a];
+    bvh->nodes[node].hi[a] = hi[a];
+  }
+
+  int axis = 0;
+  for (int a = 1; a < 3; a++) {
+    if (chi[a] - clo[a] > chi[axis] - clo[axis]) axis = a;
+  }
+  if (end - begin <= BVH_LEAF_SIZE || depth >= BVH_MAX_DEPTH || chi[axis] <= clo[axis]) {
+    bvh->nodes[node].first = begin;
+    bvh->nodes[node].count = end - begin;
+    return node;
+  }
+
+  int const mid = (begin + end) / 2;
+  std::nth_element(bvh->prims.begin() + begin, bvh->prims.begin() + mid, bvh->prims.begin() + end,
+                   [&](int p0, int p1) { return centroids[3 * p0 + axis] < centroids[3 * p1 + axis]; });
+
+  bvhBuild(bvh, centroids, begin, mid, depth + 1);
+  int const right = bvhBuild(bvh, centroids, mid, end, depth + 1);
+  bvh->nodes[node].first = right;
+  bvh->nodes[node].count = 0;
+  return node;
+}
+
+static MRIS_BVH *bvhCreate(MRIS *mris, int which, bool is_faces)
+{
+  MRIS_BVH *bvh = new MRIS_BVH;
+  bvh->is_faces = is_faces;
+
+  bvh->coords.resize(3 * (size_t)mris->nvertices);
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    float *c = &bvh->coords[3 * (size_t)vno];
+    MRISvertexCoord2XYZ_float(&mris->vertices[vno], which, &c[0], &c[1], &c[2]);
+  }
+
+  std::vector<float> centroids;
+  if (is_faces) {
+    bvh->face_vnos.resize(3 * (size_t)mris->nfaces);
+    centroids.resize(3 * (size_t)mris->nfaces);
+    for (int fno = 0; fno < mris->nfaces; fno++) {
+      FACE const *f = &mris->faces[fno];
+      bool ripped = f->ripflag;
+      for (int n = 0; n < VERTICES_PER_FACE; n++) {
+        bvh->face_vnos[3 * fno + n] = f->v[n];
+        ripped = ripped || mris->vertices[f->v[n]].ripflag;
+      }
+      if (ripped) continue;
+      for (int a = 0; a < 3; a++) {
+        centroids[3 * fno + a] = (bvh->coords[3 * f->v[0] + a] + bvh->coords[3 * f->v[1] + a] +
+                                  bvh->coords[3 * f->v[2] + a]) / 3.0f;
+      }
+      bvh->prims.push_back(fno);
+    }
+  }
+  else {
+    for (int vno = 0; vno < mris->nvertices; vno++) {
+      if (mris->vertices[vno].ripflag) continue;
+      bvh->prims.push_back(vno);
+    }
+  }
+
+  if (!bvh->prims.empty()) {
+    bvh->nodes.reserve(2 * bvh->prims.size() / BVH_LEAF_SIZE + 1);
+    bvhBuild(bvh, is_faces ? centroids : bvh->coords, 0, (int)bvh->prims.size(), 0);
+  }
+  return bvh;
+}
+
+MRIS_BVH *MRISbvhCreateVertexTree(MRIS *mris, int which) { return bvhCreate(mris, which, false); }
+
+MRIS_BVH *MRISbvhCreateFaceTree(MRIS *mris, int which) { return bvhCreate(mris, which, true); }
+
+void MRISbvhFree(MRIS_BVH **pbvh)
+{
+  MRIS_BVH *bvh = *pbvh;
+  *pbvh = NULL;
+  delete bvh;
+}
+
+
+// squared distance from p to the box of a node, 0 if inside
+static double bvhBoxDistSq(BVH_NODE const &node, double const *p)
+{
+  double d = 0;
+  for (int a = 0; a < 3; a++) {
+    double const t = (p[a] < node.lo[a]) ? node.lo[a] - p[a] : (p[a] > node.hi[a]) ? p[a] - node.hi[a] : 0;
+    d += t * t;
+  }
+  return d;
+}
+
+// closest point to p on the triangle abc (Ericson, Real-Time Collision
+// Detection, 5.1.5), returns the squared distance
+static double bvhClosestPointOnTriangle(double const *p, float const *a, float const *b, float const *c, double *q)
+{
+  double ab[3], ac[3], ap[3];
+  for (int i = 0; i < 3; i++) {
+    ab[i] = b[i] - a[i];
+    ac[i] = c[i] - a[i];
+    ap[i] = p[i] - a[i];
+  }
+  double const d1 = ab[0] * ap[0] + ab[1] * ap[1] + ab[2] * ap[2];
+  double const d2 = ac[0] * ap[0] + ac[1] * ap[1] + ac[2] * ap[2];
+
+  double v = 0, w = 0;
+  if (d1 <= 0 && d2 <= 0) {
+    // vertex a
+  }
+  else {
+    double bp[3], cp[3];
+    for (int i = 0; i < 3; i++) {
+      bp[i] = p[i] - b[i];
+      cp[i] = p[i] - c[i];
+    }
+    double const d3 = ab[0] * bp[0] + ab[1] * bp[1] + ab[2] * bp[2];
+    double const d4 = ac[0] * bp[0] + ac[1] * bp[1] + ac[2] * bp[2];
+    double const d5 = ab[0] * cp[0] + ab[1] * cp[1] + ab[2] * cp[2];
+    double const d6 = ac[0] * cp[0] + ac[1] * cp[1] + ac[2] * cp[2];
+    double const vc = d1 * d4 - d3 * d2;
+    double const vb = d5 * d2 - d1 * d6;
+    double const va = d3 * d6 - d5 * d4;
+
+    if (d3 >= 0 && d4 <= d3) {  // vertex b
+      v = 1;
+    }
+    else if (vc <= 0 && d1 >= 0 && d3 <= 0) {  // edge ab
+      v = d1 / (d1 - d3);
+    }
+    else if (d6 >= 0 && d5 <= d6) {  // vertex c
+      w = 1;
+    }
+    else if (vb <= 0 && d2 >= 0 && d6 <= 0) {  // edge ac
+      w = d2 / (d2 - d6);
+    }
+    else if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) {  // edge bc
+      w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+      v = 1 - w;
+    }
+    else {  // interior
+      double const denom = 1.0 / (va + vb + vc);
+      v = vb * denom;
+      w = vc * denom;
+    }
+  }
+
+  double d = 0;
+  for (int i = 0; i < 3; i++) {
+    q[i] = a[i] + ab[i] * v + ac[i] * w;
+    d += (p[i] - q[i]) * (p[i] - q[i]);
+  }
+  return d;
+}
+
+// squared distance from p to primitive prim, and the closest point on it
+static double bvhPrimDistSq(MRIS_BVH const *bvh, int prim, double const *p, double *q)
+{
+  if (!bvh->is_faces) {
+    float const *c = &bvh->coords[3 * (size_t)prim];
+    double d = 0;
+    for (int a = 0; a < 3; a++) {
+      q[a] = c[a];
+      d += (p[a] - c[a]) * (p[a] - c[a]);
+    }
+    return d;
+  }
+  int const *v = &bvh->face_vnos[3 * (size_t)prim];
+  return bvhClosestPointOnTriangle(
+      p, &bvh->coords[3 * (size_t)v[0]], &bvh->coords[3 * (size_t)v[1]], &bvh->coords[3 * (size_t)v[2]], q);
+}
+
+// closest primitive to p within sqrt(max_dist_sq), nearest child first
+static int bvhClosest(MRIS_BVH const *bvh, double const *p, double max_dist_sq, double *pdist_sq, double *closest)
+{
+  int best = -1;
+  double best_d = max_dist_sq;
+  if (bvh->nodes.empty()) return -1;
+
+  int stack[2 * BVH_MAX_DEPTH + 2];
+  int nstack = 0;
+  stack[nstack++] = 0;
+  while (nstack > 0) {
+    BVH_NODE const &node = bvh->nodes[stack[--nstack]];
+    if (bvhBoxDistSq(node, p) > best_d) continue;
+
+    if (node.count > 0) {
+      for (int i = node.first; i < node.first + node.count; i++) {
+        double q[3];
+        double const d = bvhPrimDistSq(bvh, bvh->prims[i], p, q);
+        if (d < best_d || (d == best_d && best < 0)) {
+          best_d = d;
+          best = bvh->prims[i];
+          if (closest) {
+            closest[0] = q[0];
+            closest[1] = q[1];
+            closest[2] = q[2];
+          }
+        }
+      }
+      continue;
+    }
+
+    int const left = &node - &bvh->nodes[0] + 1, right = node.first;
+    double const dl = bvhBoxDistSq(bvh->nodes[left], p);
+    double const dr = bvhBoxDistSq(bvh->nodes[right], p);
+    // push the farther one first so that the nearer one is searched first
+    if (dl <= dr) {
+      if (dr <= best_d) stack[nstack++] = right;
+      if (dl <= best_d) stack[nstack++] = left;
+    }
+    else {
+      if (dl <= best_d) stack[nstack++] = left;
+      if (dr <= best_d) stack[nstack++] = right;
+    }
+  }
+
+  *pdist_sq = best_d;
+  return best;
+}
+
+
+int MRISbvhFindClosestVertex(MRIS_BVH const *bvh, float x, float y, float z, float *pdist)
+{
+  if (bvh->is_faces) {
+    ErrorReturn(-1, (ERROR_BADPARM, "MRISbvhFindClosestVertex: tree was built over faces"));
+  }
+  double const p[3] = {x, y, z};
+  double d;
+  int const vno = bvhClosest(bvh, p, 1e30, &d, NULL);
+  if (pdist) *pdist = (vno < 0) ? 1e10 : sqrt(d);
+  return vno;
+}
+
+int MRISbvhFindClosestFace(
+    MRIS_BVH const *bvh, float x, float y, float z, float max_dist, float *pdist, float *pclosest)
+{
+  if (!bvh->is_faces) {
+    ErrorReturn(-1, (ERROR_BADPARM, "MRISbvhFindClosestFace: tree was built over vertices"));
+  }
+  double const p[3] = {x, y, z};
+  double d, q[3];
+  int const fno = bvhClosest(bvh, p, (double)max_dist * max_dist, &d, q);
+  if (pdist) *pdist = (fno < 0) ? 1e10 : sqrt(d);
+  if (pclosest && fno >= 0) {
+    pclosest[0] = q[0];
+    pclosest[1] = q[1];
+    pclosest[2] = q[2];
+  }
+  return fno;
+}
+
+
+// entry distance of the ray into the box of a node, or max_t if it misses
+static double bvhRayBox(BVH_NODE const &node, double const *o, double const *dir, double const *inv_dir, double max_t)
+{
+  double t0 = 0, t1 = max_t;
+  for (int a = 0; a < 3; a++) {
+    if (dir[a] == 0) {  // parallel to the slab
+      if (o[a] < node.lo[a] || o[a] > node.hi[a]) return max_t;
+      continue;
+    }
+    double tn = (node.lo[a] - o[a]) * inv_dir[a];
+    double tf = (node.hi[a] - o[a]) * inv_dir[a];
+    if (tn > tf) std::swap(tn, tf);
+    t0 = MAX(t0, tn);
+    t1 = MIN(t1, tf);
+    if (t0 > t1) return max_t;
+  }
+  return t0;
+}
+
+// Moller-Trumbore, t of the hit or -1
+static double bvhRayTriangle(double const *o, double const *dir, float const *a, float const *b, float const *c)
+{
+  double e1[3], e2[3], s[3];
+  for (int i = 0; i < 3; i++) {
+    e1[i] = b[i] - a[i];
+    e2[i] = c[i] - a[i];
+    s[i] = o[i] - a[i];
+  }
+  double const pv[3] = {dir[1] * e2[2] - dir[2] * e2[1], dir[2] * e2[0] - dir[0] * e2[2], dir[0] * e2[1] - dir[1] * e2[0]};
+  double const det = e1[0] * pv[0] + e1[1] * pv[1] + e1[2] * pv[2];
+  if (det == 0) return -1;
+  double const inv = 1.0 / det;
+  double const u = (s[0] * pv[0] + s[1] * pv[1] + s[2] * pv[2]) * inv;
+  if (u < 0 || u > 1) return -1;
+  double const qv[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+  double const v = (dir[0] * qv[0] + dir[1] * qv[1] + dir[2] * qv[2]) * inv;
+  if (v < 0 || u + v > 1) return -1;
+  return (e2[0] * qv[0] + e2[1] * qv[1] + e2[2] * qv[2]) * inv;
+}
+
+int MRISbvhIntersectRay(MRIS_BVH const *bvh, float const *origin, float const *dir, float max_t, float *pt)
+{
+  if (!bvh->is_faces) {
+    ErrorReturn(-1, (ERROR_BADPARM, "MRISbvhIntersectRay: tree was built over vertices"));
+  }
+  if (bvh->nodes.empty()) return -1;
+
+  double const o[3] = {origin[0], origin[1], origin[2]};
+  double const d[3] = {dir[0], dir[1], dir[2]};
+  double const inv_dir[3] = {d[0] ? 1.0 / d[0] : 0, d[1] ? 1.0 / d[1] : 0, d[2] ? 1.0 / d[2] : 0};
+
+  int best = -1;
+  double best_t = max_t;
+  int stack[2 * BVH_MAX_DEPTH + 2];
+  int nstack = 0;
+  stack[nstack++] = 0;
+  while (nstack > 0) {
+    BVH_NODE const &node = bvh->nodes[stack[--nstack]];
+    if (node.count > 0) {
+      for (int i = node.first; i < node.first + node.count; i++) {
+        int const *v = &bvh->face_vnos[3 * (size_t)bvh->prims[i]];
+        double const t = bvhRayTriangle(
+            o, d, &bvh->coords[3 * (size_t)v[0]], &bvh->coords[3 * (size_t)v[1]], &bvh->coords[3 * (size_t)v[2]]);
+        if (t >= 0 && (t < best_t || (t == best_t && best < 0))) {
+          best_t = t;
+          best = bvh->prims[i];
+        }
+      }
+      continue;
+    }
+    int const left = &node - &bvh->nodes[0] + 1, right = node.first;
+    double const tl = bvhRayBox(bvh->nodes[left], o, d, inv_dir, best_t);
+    double const tr = bvhRayBox(bvh->nodes[right], o, d, inv_dir, best_t);
+    if (tl <= tr) {
+      if (tr < best_t) stack[nstack++] = right;
+      if (tl < best_t) stack[nstack++] = left;
+    }
+    else {
+      if (tl < best_t) stack[nstack++] = left;
+      if (tr < best_t) stack[nstack++] = right;
+    }
+  }
+
+  if (pt) *pt = (best < 0) ? max_t : best_t;
+  return best;
+}
+
+
+void MRISbvhFindClosestVertexBatch(MRIS_BVH const *bvh, int npoints, float const *xyz, int *vnos, float *dists)
+{
+  int i;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 256)
+#endif
+  for (i = 0; i < npoints; i++) {
+    ROMP_PFLB_begin
+    float d;
+    vnos[i] = MRISbvhFindClosestVertex(bvh, xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2], &d);
+    if (dists) dists[i] = d;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+void MRISbvhFindClosestFaceBatch(
+    MRIS_BVH const *bvh, int npoints, float const *xyz, float max_dist, int *fnos, float *dists, float *pclosest)
+{
+  int i;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 256)
+#endif
+  for (i = 0; i < npoints; i++) {
+    ROMP_PFLB_begin
+    float d;
+    fnos[i] = MRISbvhFindClosestFace(
+        bvh, xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2], max_dist, &d, pclosest ? pclosest + 3 * (size_t)i : NULL);
+    if (dists) dists[i] = d;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+void MRISbvhIntersectRayBatch(
+    MRIS_BVH const *bvh, int nrays, float const *origins, float const *dirs, float max_t, int *fnos, float *ts)
+{
+  int i;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 256)
+#endif
+  for (i = 0; i < nrays; i++) {
+    ROMP_PFLB_begin
+    float t;
+    fnos[i] = MRISbvhIntersectRay(bvh, origins + 3 * (size_t)i, dirs + 3 * (size_t)i, max_t, &t);
+    if (ts) ts[i] = t;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+
+/*-----------------------------------------------------
+  MRISbvhBenchmark() - time closest vertex queries with the vertex tree
+  and with vertex hash tables of several resolutions (including their
+  brute force fallback when the hash search fails), and closest point
+  queries with the face tree, on points within 5mm of the surface.
+  The hash answers and, for a subset of the points, brute force closest
+  points are checked against the trees.
+  ------------------------------------------------------*/
+int MRISbvhBenchmark(MRIS *mris, int npoints)
+{
+  static float const resolutions[] = {0.5, 1, 2, 4, 8, 16};
+  int const nres = sizeof(resolutions) / sizeof(resolutions[0]);
+
+  std::vector<float> xyz(3 * (size_t)npoints);
+  for (int i = 0; i < npoints; i++) {
+    VERTEX const *v = &mris->vertices[(int)(drand48() * mris->nvertices) % mris->nvertices];
+    xyz[3 * i] = v->x + 10 * (drand48() - 0.5);
+    xyz[3 * i + 1] = v->y + 10 * (drand48() - 0.5);
+    xyz[3 * i + 2] = v->z + 10 * (drand48() - 0.5);
+  }
+
+  printf("surface query benchmark: %d vertices, %d faces, %d points\n", mris->nvertices, mris->nfaces, npoints);
+
+  Timer timer;
+  MRIS_BVH *vtree = MRISbvhCreateVertexTree(mris, CURRENT_VERTICES);
+  double const vbuild = timer.seconds();
+  timer.reset();
+  MRIS_BVH *ftree = MRISbvhCreateFaceTree(mris, CURRENT_VERTICES);
+  double const fbuild = timer.seconds();
+
+  std::vector<int> vnos(npoints), fnos(npoints), hvnos(npoints);
+  std::vector<float> vdists(npoints), fdists(npoints), hdists(npoints);
+
+  timer.reset();
+  MRISbvhFindClosestVertexBatch(vtree, npoints, xyz.data(), vnos.data(), vdists.data());
+  double t = timer.seconds();
+  printf("  vertex tree         build %7.3f s  %10.0f queries/s\n", vbuild, npoints / MAX(t, 1e-9));
+
+  for (int r = 0; r < nres; r++) {
+    timer.reset();
+    MRIS_HASH_TABLE *mht = MHTcreateVertexTable_Resolution(mris, CURRENT_VERTICES, resolutions[r]);
+    MHTfreeze(mht);
+    double const build = timer.seconds();
+    timer.reset();
+    MHTfindClosestVertexNoXYZBatch(mht, mris, npoints, xyz.data(), hvnos.data(), hdists.data());
+    t = timer.seconds();
+    int ndiff = 0;
+    for (int i = 0; i < npoints; i++) {
+      if (fabs(hdists[i] - vdists[i]) > 1e-4) ndiff++;
+    }
+    printf("  vertex hash %5.1fmm build %7.3f s  %10.0f queries/s  %d disagree\n",
+           resolutions[r], build, npoints / MAX(t, 1e-9), ndiff);
+    MHTfree(&mht);
+  }
+
+  timer.reset();
+  MRISbvhFindClosestFaceBatch(ftree, npoints, xyz.data(), 1e10, fnos.data(), fdists.data(), NULL);
+  t = timer.seconds();
+  printf("  face tree           build %7.3f s  %10.0f queries/s\n", fbuild, npoints / MAX(t, 1e-9));
+
+  // exact closest points by brute force
+  int const ncheck = MIN(npoints, 200);
+  int nwrong = 0;
+  for (int i = 0; i < ncheck; i++) {
+    double const p[3] = {xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]};
+    double best = 1e30;
+    for (int fno = 0; fno < mris->nfaces; fno++) {
+      double q[3];
+      FACE const *f = &mris->faces[fno];
+      bool ripped = f->ripflag;
+      for (int n = 0; n < VERTICES_PER_FACE; n++) ripped = ripped || mris->vertices[f->v[n]].ripflag;
+      if (ripped) continue;
+      best = MIN(best, bvhPrimDistSq(ftree, fno, p, q));
+    }
+    if (fabs(sqrt(best) - fdists[i]) > 1e-4) nwrong++;
+  }
+  printf("  face tree closest points wrong in %d of %d brute force checks\n", nwrong, ncheck);
+
+  MRISbvhFree(&vtree);
+  MRISbvhFree(&ftree);
+  return (NO_ERROR);
+}
@@ -23,6 +23,8 @@
 #include <math.h>
 #include <stdlib.h>
 
+#include <vector>
+
 //----------------------------------------------------
 // Includes that differ for linux vs GW BC compile
 //----------------------------------------------------
@@ -418,12 +420,14 @@ static void mhtVoxelList_SampleTriangle(
 
 static void lockBucket(const MHBT *bucketc) {
 #ifdef HAVE_OPENMP
+    if (bucketc->frozen) return;
     MHBT *bucket = (MHBT *)bucketc;
     if (parallelLevel) omp_set_lock(&bucket->bucket_lock); else checkThread0();
 #endif
 }
 static void unlockBucket(const MHBT *bucketc) {
 #ifdef HAVE_OPENMP
+    if (bucketc->frozen) return;
     MHBT *bucket = (MHBT *)bucketc;
     if (parallelLevel) omp_unset_lock(&bucket->bucket_lock); else checkThread0();
 #endif
@@ -486,12 +490,20 @@ struct MRIS_HASH_TABLE_NoSurface : public MRIS_HASH_TABLE {
     int                nfaces;
     MHT_FACE*          f;
 
+    // Once frozen, the buckets and their bins live in these two arrays
+    // and are never changed again, so they are read without locking
+    //
+    bool               frozen;
+    MHBT*              frozen_buckets;
+    MHB*               frozen_bins;
+
 
     virtual MRIS_HASH_TABLE_NoSurface       * toMRIS_HASH_TABLE_NoSurface_Wkr()       { return this; }
     virtual MRIS_HASH_TABLE_NoSurface const * toMRIS_HASH_TABLE_NoSurface_Wkr() const { return this; }
 
     MRIS_HASH_TABLE_NoSurface(MHTFNO_t fno_usage, float vres, int which, int nfaces) 
-      : MRIS_HASH_TABLE(fno_usage, vres, which), nbuckets(0), nfaces(0), f(nullptr) 
+      : MRIS_HASH_TABLE(fno_usage, vres, which), nbuckets(0), nfaces(0), f(nullptr),
+        frozen(false), frozen_buckets(nullptr), frozen_bins(nullptr)
     {  
         bzero(&buckets_mustUseAcqRel, sizeof(buckets_mustUseAcqRel));
 #ifdef HAVE_OPENMP
@@ -529,6 +541,9 @@ struct MRIS_HASH_TABLE_NoSurface : public MRIS_HASH_TABLE {
 
     void  lockBuckets() const;
     void  unlockBuckets() const;
+
+    void  freeze();
+    void  checkNotFrozen() const;
     
     MHBT* acqBucket       (float x, float y, float z) const;
     MHBT* acqBucket       (int xv, int yv, int zv) const;
@@ -553,7 +568,7 @@ MRIS_HASH_TABLE_NoSurface::~MRIS_HASH_TABLE_NoSurface()
             if (!buckets_mustUseAcqRel[xv][yv]) continue;
             for (int zv = 0; zv < TABLE_SIZE; zv++) {
                 MHBT* bucket = buckets_mustUseAcqRel[xv][yv][zv];
-                if (!bucket) continue;
+                if (!bucket || frozen) continue;
 #ifdef HAVE_OPENMP
                 omp_destroy_lock(&bucket->bucket_lock);
 #endif
@@ -563,6 +578,8 @@ MRIS_HASH_TABLE_NoSurface::~MRIS_HASH_TABLE_NoSurface()
             ::free(buckets_mustUseAcqRel[xv][yv]);
         }
     }
+    ::free(frozen_buckets);
+    ::free(frozen_bins);
 
 #ifdef HAVE_OPENMP
     omp_destroy_lock(&buckets_lock);
@@ -616,6 +633,7 @@ MHBT* MRIS_HASH_TABLE_NoSurface::makeAndAcqBucket(int xv, int yv, int zv)
   //-----------------------------------------------
   // 1. Allocate a 1-D array at buckets_mustUseAcqRel[xv][yv]
   
+  checkNotFrozen();
   lockBuckets();
   
   if (!buckets_mustUseAcqRel[xv][yv]) {
@@ -669,6 +687,12 @@ MHBT* MRIS_HASH_TABLE_NoSurface::acqBucket(int xv, int yv, int zv) const
 {
   if (xv >= TABLE_SIZE || yv >= TABLE_SIZE || zv >= TABLE_SIZE || xv < 0 || yv < 0 || zv < 0) return (NULL);
 
+  // the pointers of a frozen table never change and its buckets are not locked
+  if (frozen) {
+    MHBT** const column = buckets_mustUseAcqRel[xv][yv];
+    return column ? column[zv] : NULL;
+  }
+
   lockBuckets();
 
   MHBT* bucket = NULL;
@@ -725,6 +749,73 @@ Done:
     return result;
 }
 
+
+void MRIS_HASH_TABLE_NoSurface::checkNotFrozen() const
+{
+    if (frozen) {
+        ErrorExit(ERROR_BADPARM, "%s: the hash table is frozen and can not be changed\n", __MYFUNCTION__);
+    }
+}
+
+
+// Move the buckets and their bins into two contiguous arrays, in the
+// order of their voxel indices so that neighboring buckets in z are
+// adjacent, and stop locking them.
+//
+void MRIS_HASH_TABLE_NoSurface::freeze()
+{
+    if (frozen) return;
+
+    int    nbuckets_used = 0;
+    size_t nbins         = 0;
+    for (int xv = 0; xv < TABLE_SIZE; xv++) {
+        for (int yv = 0; yv < TABLE_SIZE; yv++) {
+            MHBT** const column = buckets_mustUseAcqRel[xv][yv];
+            if (!column) continue;
+            for (int zv = 0; zv < TABLE_SIZE; zv++) {
+                if (!column[zv]) continue;
+                nbuckets_used++;
+                nbins += column[zv]->nused;
+            }
+        }
+    }
+
+    frozen_buckets = (MHBT*)calloc(MAX(1,nbuckets_used), sizeof(MHBT));
+    frozen_bins    = (MHB *)calloc(MAX(1,nbins),         sizeof(MHB));
+    if (!frozen_buckets || !frozen_bins)
+        ErrorExit(ERROR_NO_MEMORY, "%s: could not allocate %d buckets with %zu bins.\n", __MYFUNCTION__, nbuckets_used, nbins);
+
+    MHBT* dst_bucket = frozen_buckets;
+    MHB*  dst_bins   = frozen_bins;
+    for (int xv = 0; xv < TABLE_SIZE; xv++) {
+        for (int yv = 0; yv < TABLE_SIZE; yv++) {
+            MHBT** const column = buckets_mustUseAcqRel[xv][yv];
+            if (!column) continue;
+            for (int zv = 0; zv < TABLE_SIZE; zv++) {
+                MHBT* bucket = column[zv];
+                if (!bucket) continue;
+
+                memcpy(dst_bins, bucket->bins, bucket->nused*sizeof(MHB));
+                dst_bucket->nused = bucket->nused;
+                dst_bucket->frozen = true;
+                *(MHB**)&dst_bucket->bins     = dst_bins;
+                *(int *)&dst_bucket->max_bins = bucket->nused;
+
+#ifdef HAVE_OPENMP
+                omp_destroy_lock(&bucket->bucket_lock);
+#endif
+                if (bucket->bins) freeBins(bucket);
+                ::free(bucket);
+
+                column[zv] = dst_bucket++;
+                dst_bins += dst_bucket[-1].nused;
+            }
+        }
+    }
+
+    frozen = true;
+}
+
 #define buckets_mustUseAcqRel SHOULD_NOT_ACCESS_BUCKETS_DIRECTLY
 
 
@@ -807,6 +898,7 @@ int MRIS_HASH_TABLE_NoSurface::mhtRemoveFaceOrVertexAtVoxIx(int xv, int yv, int
   if (yv >= TABLE_SIZE) yv = TABLE_SIZE - 1;
   if (zv >= TABLE_SIZE) zv = TABLE_SIZE - 1;
 
+  checkNotFrozen();
   if (!existsBuckets2(xv,yv)) return (NO_ERROR);  // no bucket at such coordinates
   
   MHBT *bucket = acqBucket(xv,yv,zv);
@@ -2258,6 +2350,82 @@ int MRIS_HASH_TABLE_IMPL<Surface,Face,Vertex>::findVnoOfClosestVertexInTable(
   return vno;
 }
 
+/*---------------------------------------------------------------
+  findKClosestVertexNos
+  Finds the (up to) k unripped vertices closest to (x,y,z) that are
+  within max_dist, nearest first. The buckets are searched in cubic
+  shells around the one holding the point until the k-th closest
+  vertex found is nearer than any bucket not yet searched.
+  ---------------------------------------------------------------*/
+template <class Surface, class Face, class Vertex>
+int MRIS_HASH_TABLE_IMPL<Surface,Face,Vertex>::findKClosestVertexNos(
+    float x, float y, float z, float max_dist, int k, int *vnos, float *dists)
+{
+  if (k <= 0) return 0;
+
+  double const mhtres = vres();
+  double const xvol = WORLD_TO_VOLUME((double)x);
+  double const yvol = WORLD_TO_VOLUME((double)y);
+  double const zvol = WORLD_TO_VOLUME((double)z);
+  int const xv0 = int(xvol), yv0 = int(yvol), zv0 = int(zvol);
+
+  // distance from the point to the nearest wall of its bucket
+  double const wall = mhtres * MIN(MIN(MIN(xvol - xv0, xv0 + 1 - xvol), MIN(yvol - yv0, yv0 + 1 - yvol)),
+                                   MIN(zvol - zv0, zv0 + 1 - zvol));
+  double const max_dist_sq = (double)max_dist * max_dist;
+  int    const max_shell   = (int)MIN((double)TABLE_SIZE, ceil(max_dist / mhtres) + 1);
+
+  std::vector<double> dsq(k);
+  int nfound = 0;
+
+  for (int shell = 0; shell <= max_shell; shell++) {
+    for (int dx = -shell; dx <= shell; dx++) {
+      for (int dy = -shell; dy <= shell; dy++) {
+        // inside the shell only the two z walls are new
+        int const dzStep = (abs(dx) == shell || abs(dy) == shell) ? 1 : 2 * shell;
+        for (int dz = -shell; dz <= shell; dz += dzStep) {
+          MHBT *bucket = acqBucketAtVoxIx(xv0 + dx, yv0 + dy, zv0 + dz);
+          if (!bucket) continue;
+
+          MHB const *bin = bucket->bins;
+          for (int i = 0; i < bucket->nused; i++, bin++) {
+            int const vno = bin->fno;
+            auto vtx = surface.vertices(vno);
+            if (vtx.ripflag()) continue;
+
+            float tryx, tryy, tryz;
+            mhtVertex2xyz(vtx, which(), &tryx, &tryy, &tryz);
+            double const d = SQR(tryx - x) + SQR(tryy - y) + SQR(tryz - z);
+            if (d > max_dist_sq) continue;
+            if (nfound == k && d >= dsq[k - 1]) continue;
+
+            // insert keeping the list sorted
+            int j = (nfound < k) ? nfound++ : k - 1;
+            for (; j > 0 && dsq[j - 1] > d; j--) {
+              dsq[j]  = dsq[j - 1];
+              vnos[j] = vnos[j - 1];
+            }
+            dsq[j]  = d;
+            vnos[j] = vno;
+          }
+
+          relBucket(&bucket);
+        }
+      }
+    }
+
+    // every vertex not yet seen is at least this far away
+    double const reach = wall + shell * mhtres;
+    if (reach * reach > max_dist_sq) break;
+    if (nfound == k && dsq[k - 1] <= reach * reach) break;
+  }
+
+  if (dists) {
+    for (int i = 0; i < nfound; i++) dists[i] = sqrt(dsq[i]);
+  }
+  return nfound;
+}
+
 #define MAX_VERTICES 50000
 template <class Surface, class Face, class Vertex>
 int MRIS_HASH_TABLE_IMPL<Surface,Face,Vertex>::mhtBruteForceClosestVertex(
@@ -2394,6 +2562,15 @@ int MHTtestIsMRISselfIntersecting(MRIS* mris,  float res)
 int  MHTwhich(MRIS_HASH_TABLE const * mht) { return mht->which(); }
 
 
+// Frozen tables can be queried from any number of threads without locking
+//
+void MHTfreeze(MRIS_HASH_TABLE* mht) 
+{ mht->toMRIS_HASH_TABLE_NoSurface()->freeze(); }
+
+bool MHTisFrozen(MRIS_HASH_TABLE const* mht) 
+{ return mht->toMRIS_HASH_TABLE_NoSurface()->frozen; }
+
+
 // Add/remove the faces of which vertex vno is a part
 //
 int  MHTaddAllFaces   (MRIS_HASH_TABLE* mht, MRIS* mris, int vno) 
@@ -2454,6 +2631,14 @@ int MHTfindVnoOfClosestVertexInTable(MRIS_HASH_TABLE* mht,
   return mht->findVnoOfClosestVertexInTable(x,y,z,do_global_search); }
 
 
+int MHTfindKClosestVertexNos(MRIS_HASH_TABLE* mht,
+                                MRIS* mris,
+                                float x, float y, float z, float max_dist,
+                                int k, int *vnos, float *dists) 
+{ mht->toMRIS_HASH_TABLE_NoSurface()->checkConstructedWithVertices();
+  return mht->findKClosestVertexNos(x,y,z,max_dist,k,vnos,dists); }
+
+
 
 // utilities for finding closest face
 //
@@ -2553,3 +2738,95 @@ void MHTfindClosestFaceGeneric(
     mht->findClosestFaceNoGeneric(probex,probey,probez, in_max_distance_mm,in_max_mhts,project_into_face,pfno,pface_distance);
     *pface = (*pfno < 0) ? nullptr : &mris->faces[*pfno];
 }
+
+
+//=================================================================
+// Batched queries
+//
+// These answer one query per point of xyz (x,y,z triples). The points
+// are done in parallel when the table is frozen, otherwise serially
+// since the table may be locked or changed by other threads.
+//=================================================================
+
+void MHTfindClosestVertexNoXYZBatch(
+    MRIS_HASH_TABLE *mht,
+    MRIS *mris,
+    int npoints, float const *xyz,
+    int *vnos, float *dists)
+{
+  mht->toMRIS_HASH_TABLE_NoSurface()->checkConstructedWithVertices();
+  bool const parallel = MHTisFrozen(mht);
+
+  int i;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP2(parallel, assume_reproducible) schedule(dynamic, 256)
+#endif
+  for (i = 0; i < npoints; i++) {
+    ROMP_PFLB_begin
+    float dist;
+    vnos[i] = mht->findClosestVertexNoXYZ(xyz[3*i], xyz[3*i+1], xyz[3*i+2], &dist);
+    if (dists) dists[i] = dist;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+
+// vnos and dists hold k entries per point, nfound (if not NULL) gets the
+// number of them that were filled in
+//
+void MHTfindKClosestVertexNosBatch(
+    MRIS_HASH_TABLE *mht,
+    MRIS *mris,
+    int npoints, float const *xyz,
+    float max_dist, int k,
+    int *vnos, float *dists, int *nfound)
+{
+  mht->toMRIS_HASH_TABLE_NoSurface()->checkConstructedWithVertices();
+  bool const parallel = MHTisFrozen(mht);
+
+  int i;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP2(parallel, assume_reproducible) schedule(dynamic, 256)
+#endif
+  for (i = 0; i < npoints; i++) {
+    ROMP_PFLB_begin
+    int const n = mht->findKClosestVertexNos(
+        xyz[3*i], xyz[3*i+1], xyz[3*i+2], max_dist, k, vnos + (size_t)i*k, dists ? dists + (size_t)i*k : NULL);
+    if (nfound) nfound[i] = n;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+
+void MHTfindClosestFaceNoGenericBatch(
+    MRIS_HASH_TABLE *mht,
+    MRIS *mris,
+    int npoints, float const *xyz,
+    double in_max_distance_mm,
+    int    in_max_mhts,
+    int    project_into_face,
+    int *fnos, double *face_distances)
+{
+  mht->toMRIS_HASH_TABLE_NoSurface()->checkConstructedWithFaces();
+  bool const parallel = MHTisFrozen(mht);
+
+  int i;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP2(parallel, assume_reproducible) schedule(dynamic, 256)
+#endif
+  for (i = 0; i < npoints; i++) {
+    ROMP_PFLB_begin
+    double dist;
+    mht->findClosestFaceNoGeneric(xyz[3*i], xyz[3*i+1], xyz[3*i+2],
+                                  in_max_distance_mm, in_max_mhts, project_into_face,
+                                  &fnos[i], &dist);
+    if (face_distances) face_distances[i] = dist;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
@@ -24,6 +24,9 @@
 #include <math.h>
 #include <stdio.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "diag.h"
 #include "error.h"
 #include "macros.h"
@@ -34,6 +37,7 @@
 #include "mri_identify.h"
 #include "mrisurf_sphere_interp.h"
 #include "romp_support.h"
+#include "timer.h"
 #include "mrisp.h"
 
 /*---------------------------- STRUCTURES -------------------------*/
@@ -1424,14 +1428,11 @@ MRI_SP *MRISPclone(MRI_SP *mrisp_src)
 
 MRI_SP *MRISPconvolveGaussian(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, float radius, int fno)
 {
-  int u, v, cart_klen, klen, khalf, uk, vk, u1, v1, voff, f0, f1;
-  double d, k, total, ktotal, sigma_sq_inv, theta, phi, theta1, phi1, sin_phi, cos_phi, sin_phi1, cos_phi1;
-  float x0, y0, z0, x1, y1, z1, circumference = 0.0f, angle, max_len = 0.0f, min_len = 10000.0f;
-  IMAGE *Ip_src, *Ip_dst;
-  VECTOR *vec1, *vec2;
-
-  vec1 = VectorAlloc(3, MATRIX_REAL);
-  vec2 = VectorAlloc(3, MATRIX_REAL);
+  int cart_klen, f0, f1;
+  double sigma_sq_inv;
+  float circumference, max_len = 0.0f, min_len = 10000.0f;
+  IMAGE *Ip_src;
+  VECTOR *vec1;
 
   if (!mrisp_dst) mrisp_dst = MRISPclone(mrisp_src);
   mrisp_dst->sigma = sigma;
@@ -1450,7 +1451,6 @@ MRI_SP *MRISPconvolveGaussian(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma,
     sigma_sq_inv = 1.0f / (sigma * sigma);
 
   Ip_src = mrisp_src->Ip;
-  Ip_dst = mrisp_dst->Ip;
   if (fno < 0) {
     f0 = 0;
     f1 = Ip_src->num_frame - 1;
@@ -1459,102 +1459,133 @@ MRI_SP *MRISPconvolveGaussian(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma,
     f0 = f1 = fno;
   }
 
-  for (fno = f0; fno <= f1; fno++) /* for each frame */
-  {
-    for (u = 0; u < U_DIM(mrisp_src); u++) {
-      if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "\r%3.3d of %d     ", u, U_DIM(mrisp_src) - 1);
-      phi = (double)u * PHI_MAX / PHI_DIM(mrisp_src);
-      sin_phi = sin(phi);
-      cos_phi = cos(phi);
+  /* the radius vector of the first element */
+  vec1 = VectorAlloc(3, MATRIX_REAL);
+  VECTOR_LOAD(vec1, 0.0f, 0.0f, radius);
+  circumference = M_PI * 2.0 * V3_LEN(vec1);
+  VectorFree(&vec1);
 
-      for (v = 0; v < V_DIM(mrisp_src); v++) {
-        theta = (double)v * THETA_MAX / THETA_DIM(mrisp_src);
-        x0 = radius * sin_phi * cos(theta);
-        y0 = radius * sin_phi * sin(theta);
-        z0 = radius * cos_phi;
-        VECTOR_LOAD(vec1, x0, y0, z0); /* radius vector */
-        if (FZERO(circumference))      /* only calculate once */
-          circumference = M_PI * 2.0 * V3_LEN(vec1);
-        if (u == DEBUG_U && v == DEBUG_V) DiagBreak();
+  // every (frame, u) row only reads the source, so the rows are done in
+  // parallel with their own vectors and their own min_len/max_len
+  int const udim = U_DIM(mrisp_src);
+  int const nrows = (f1 - f0 + 1) * udim;
+  std::vector<float> row_min_len(nrows, 10000.0f), row_max_len(nrows, 0.0f);
 
-        /* compute the distance between adjacent spherical matrix
-           elements at this point on the surface (probably easier
-           to do with the parameterization, but I'll do it in
-           Cartesian space for now.
-           */
-        u1 = u + 1;
-        if (u1 >= U_DIM(mrisp_src)) u1 = U_DIM(mrisp_src) - (u1 - U_DIM(mrisp_src) + 2);
-        v1 = v + 1;
-        if (v1 >= V_DIM(mrisp_src)) v1 = V_DIM(mrisp_src) - (v1 - V_DIM(mrisp_src) + 2);
+  int row;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP2(mrisp_src != mrisp_dst, assume_reproducible) schedule(dynamic)
+#endif
+  for (row = 0; row < nrows; row++) {
+    ROMP_PFLB_begin
+    int const fno = f0 + row / udim, u = row % udim;
+    int v, klen, khalf, uk, vk, u1, v1, voff;
+    double d, k, total, ktotal, theta, phi, theta1, phi1, sin_phi, cos_phi, sin_phi1, cos_phi1;
+    float x0, y0, z0, x1, y1, z1, angle;
+    VECTOR *vec1 = VectorAlloc(3, MATRIX_REAL);
+    VECTOR *vec2 = VectorAlloc(3, MATRIX_REAL);
 
-        phi1 = (double)u1 * PHI_MAX / PHI_DIM(mrisp_src);
-        theta1 = (double)v1 * THETA_MAX / THETA_DIM(mrisp_src);
-        x1 = radius * sin(phi1) * cos(theta1);
-        y1 = radius * sin(phi1) * sin(theta1);
-        z1 = radius * cos(phi1);
-        VECTOR_LOAD(vec2, x1, y1, z1); /* radius vector */
-        angle = fabs(Vector3Angle(vec1, vec2));
-        d = circumference * angle / (2.0 * M_PI); /* geodesic distance */
-        if (d > max_len) max_len = d;
-        if (d < min_len) min_len = d;
+    if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "\r%3.3d of %d     ", u, U_DIM(mrisp_src) - 1);
+    phi = (double)u * PHI_MAX / PHI_DIM(mrisp_src);
+    sin_phi = sin(phi);
+    cos_phi = cos(phi);
 
-        /* d is now the distance between adjacent cells - compute kernel size*/
-        klen = nint(6.0f * sigma / d) + 1;
-        if (klen > MAX_KLEN) klen = MAX_KLEN;
+    for (v = 0; v < V_DIM(mrisp_src); v++) {
+      theta = (double)v * THETA_MAX / THETA_DIM(mrisp_src);
+      x0 = radius * sin_phi * cos(theta);
+      y0 = radius * sin_phi * sin(theta);
+      z0 = radius * cos_phi;
+      VECTOR_LOAD(vec1, x0, y0, z0); /* radius vector */
+      if (u == DEBUG_U && v == DEBUG_V) DiagBreak();
 
-        if (ISEVEN(klen)) klen++;
-        if (klen >= U_DIM(mrisp_src)) klen = U_DIM(mrisp_src) - 1;
-        if (klen >= V_DIM(mrisp_src)) klen = V_DIM(mrisp_src) - 1;
-        khalf = klen / 2;
+      /* compute the distance between adjacent spherical matrix
+         elements at this point on the surface (probably easier
+         to do with the parameterization, but I'll do it in
+         Cartesian space for now.
+         */
+      u1 = u + 1;
+      if (u1 >= U_DIM(mrisp_src)) u1 = U_DIM(mrisp_src) - (u1 - U_DIM(mrisp_src) + 2);
+      v1 = v + 1;
+      if (v1 >= V_DIM(mrisp_src)) v1 = V_DIM(mrisp_src) - (v1 - V_DIM(mrisp_src) + 2);
+
+      phi1 = (double)u1 * PHI_MAX / PHI_DIM(mrisp_src);
+      theta1 = (double)v1 * THETA_MAX / THETA_DIM(mrisp_src);
+      x1 = radius * sin(phi1) * cos(theta1);
+      y1 = radius * sin(phi1) * sin(theta1);
+      z1 = radius * cos(phi1);
+      VECTOR_LOAD(vec2, x1, y1, z1); /* radius vector */
+      angle = fabs(Vector3Angle(vec1, vec2));
+      d = circumference * angle / (2.0 * M_PI); /* geodesic distance */
+      if (d > row_max_len[row]) row_max_len[row] = d;
+      if (d < row_min_len[row]) row_min_len[row] = d;
+
+      /* d is now the distance between adjacent cells - compute kernel size*/
+      klen = nint(6.0f * sigma / d) + 1;
+      if (klen > MAX_KLEN) klen = MAX_KLEN;
+
+      if (ISEVEN(klen)) klen++;
+      if (klen >= U_DIM(mrisp_src)) klen = U_DIM(mrisp_src) - 1;
+      if (klen >= V_DIM(mrisp_src)) klen = V_DIM(mrisp_src) - 1;
+      khalf = klen / 2;
 
-        total = ktotal = 0.0;
-        for (uk = -khalf; uk <= khalf; uk++) {
-          u1 = u + uk;
-          if (u1 < 0) /* enforce spherical topology  */
-          {
-            voff = V_DIM(mrisp_src) / 2;
-            u1 = -u1;
-          }
-          else if (u1 >= U_DIM(mrisp_src)) {
-            u1 = U_DIM(mrisp_src) - (u1 - U_DIM(mrisp_src) + 1);
-            voff = V_DIM(mrisp_src) / 2;
-          }
-          else
-            voff = 0;
+      total = ktotal = 0.0;
+      for (uk = -khalf; uk <= khalf; uk++) {
+        u1 = u + uk;
+        if (u1 < 0) /* enforce spherical topology  */
+        {
+          voff = V_DIM(mrisp_src) / 2;
+          u1 = -u1;
+        }
+        else if (u1 >= U_DIM(mrisp_src)) {
+          u1 = U_DIM(mrisp_src) - (u1 - U_DIM(mrisp_src) + 1);
+          voff = V_DIM(mrisp_src) / 2;
+        }
+        else
+          voff = 0;
 
-          phi1 = (double)u1 * PHI_MAX / PHI_DIM(mrisp_src);
-          sin_phi1 = sin(phi1);
-          cos_phi1 = cos(phi1);
+        phi1 = (double)u1 * PHI_MAX / PHI_DIM(mrisp_src);
+        sin_phi1 = sin(phi1);
+        cos_phi1 = cos(phi1);
+
+        /* the kernel only depends on the row u1, so it is computed once
+           for the whole row of the window */
+        theta1 = (double)v * THETA_MAX / THETA_DIM(mrisp_src);
+        x1 = radius * sin_phi1 * cos(theta1);
+        y1 = radius * sin_phi1 * sin(theta1);
+        z1 = radius * cos_phi1;
+        VECTOR_LOAD(vec2, x1, y1, z1); /* radius vector */
+        angle = fabs(Vector3Angle(vec1, vec2));
+        d = circumference * angle / (2.0 * M_PI);
+        k = exp(-d * d * sigma_sq_inv);
 
-          for (vk = -khalf; vk <= khalf; vk++) {
-            theta1 = (double)v * THETA_MAX / THETA_DIM(mrisp_src);
-            x1 = radius * sin_phi1 * cos(theta1);
-            y1 = radius * sin_phi1 * sin(theta1);
-            z1 = radius * cos_phi1;
-            VECTOR_LOAD(vec2, x1, y1, z1); /* radius vector */
-            angle = fabs(Vector3Angle(vec1, vec2));
-            d = circumference * angle / (2.0 * M_PI);
-            k = exp(-d * d * sigma_sq_inv);
-            v1 = v + vk + voff;
-            while (v1 < 0) /* enforce spherical topology */
-              v1 += V_DIM(mrisp_src);
-            while (v1 >= V_DIM(mrisp_src)) v1 -= V_DIM(mrisp_src);
-            ktotal += k;
-            total += k * *IMAGEFseq_pix(Ip_src, u1, v1, fno);
-          }
+        for (vk = -khalf; vk <= khalf; vk++) {
+          v1 = v + vk + voff;
+          while (v1 < 0) /* enforce spherical topology */
+            v1 += V_DIM(mrisp_src);
+          while (v1 >= V_DIM(mrisp_src)) v1 -= V_DIM(mrisp_src);
+          ktotal += k;
+          total += k * *IMAGEFseq_pix(Ip_src, u1, v1, fno);
         }
-        if (u == DEBUG_U && v == DEBUG_V) DiagBreak();
-        total /= ktotal; /* normalize weights to 1 */
-        *IMAGEFseq_pix(mrisp_dst->Ip, u, v, fno) = total;
       }
+      if (u == DEBUG_U && v == DEBUG_V) DiagBreak();
+      total /= ktotal; /* normalize weights to 1 */
+      *IMAGEFseq_pix(mrisp_dst->Ip, u, v, fno) = total;
     }
+
+    VectorFree(&vec1);
+    VectorFree(&vec2);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (row = 0; row < nrows; row++) {
+    if (row_max_len[row] > max_len) max_len = row_max_len[row];
+    if (row_min_len[row] < min_len) min_len = row_min_len[row];
   }
 
   if (Gdiag & DIAG_SHOW) fprintf(stderr, "min_len = %2.3f mm, max_len = %2.3f mm\n", min_len, max_len);
   if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "done.\n");
 
-  VectorFree(&vec1);
-  VectorFree(&vec2);
   return (mrisp_dst);
 }
 /*-----------------------------------------------------
@@ -1566,16 +1597,184 @@ MRI_SP *MRISPconvolveGaussian(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma,
 ------------------------------------------------------*/
 static MRI_SP *MRISPblur_new(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int fno);
 static MRI_SP *MRISPblur_old(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int fno);
+static MRI_SP *MRISPblur_separable(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int *frames, int nframes);
+static bool mrisPblurSeparableRequested();
 
 MRI_SP *MRISPblur(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int fno) {
     static bool once, do_old;
     if (!once) { once = true;
         do_old = getenv("FREESUREFER_MRISPblur_old");
     }
+    if (!do_old && mrisPblurSeparableRequested()) {
+        std::vector<int> frames;
+        if (fno < 0) {
+            for (int f = 0; f < mrisp_src->Ip->num_frame; f++) frames.push_back(f);
+        } else {
+            frames.push_back(fno);
+        }
+        return MRISPblur_separable(mrisp_src, mrisp_dst, sigma, frames.data(), frames.size());
+    }
     return 
         (do_old ? MRISPblur_old : MRISPblur_new)(mrisp_src, mrisp_dst, sigma, fno);
 }
 
+// The kernel of MRISPblur is exp(-(uk^2 + sin(phi)^2 vk^2)/sigma^2), which is
+// the product of a kernel in u and a kernel in v whose width only depends on
+// the row u being written. The sum over the (u,v) window can therefore be
+// done as a sum over uk of whole rows followed by a circular convolution in
+// v, which takes O(khalf) instead of O(khalf^2) operations per element. The
+// frames are blurred in u-major copies so that both passes walk contiguous
+// memory, which also makes the blur safe to do in place.
+// The results equal those of MRISPblur_new up to rounding.
+//
+static int mrisPblurKHalf(MRI_SP *mrisp, int u, int cart_klen, int no_sphere)
+{
+  double const phi      = (double)u * PHI_MAX / PHI_DIM(mrisp);
+  double const sin_sq_u = squared(sin(phi));
+
+  int klen;
+  if (no_sphere) {
+    klen = cart_klen;
+  } else if (!FZERO(sin_sq_u)) {
+    int k = cart_klen * cart_klen;
+    klen = sqrt(k + k / sin_sq_u);
+    if (klen > MAX_LEN * cart_klen) klen = MAX_LEN * cart_klen;
+  } else {
+    klen = MAX_LEN * cart_klen; /* arbitrary max length */
+  }
+  if (klen >= U_DIM(mrisp)) klen = U_DIM(mrisp) - 1;
+  if (klen >= V_DIM(mrisp)) klen = V_DIM(mrisp) - 1;
+  return klen / 2;
+}
+
+static bool mrisPblurSeparableRequested()
+{
+  static bool once, separable;
+  if (!once) {
+    once = true;
+    separable = getenv("FS_SEPARABLE_MRISPBLUR") != NULL;
+  }
+  return separable;
+}
+
+static MRI_SP *MRISPblur_separable(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int *frames, int nframes)
+{
+  int const no_sphere = getenv("NO_SPHERE") != NULL;
+  if (no_sphere) fprintf(stderr, "disabling spherical geometry\n");
+
+  if (!mrisp_dst) mrisp_dst = MRISPclone(mrisp_src);
+  mrisp_dst->sigma = sigma;
+
+  int cart_klen = (int)nint(6.0f * sigma) + 1;
+  if (ISEVEN(cart_klen)) /* ensure it's odd */
+    cart_klen++;
+  double const sigma_sq_inv = FZERO(sigma) ? BIG : 1.0f / (sigma * sigma);
+
+  int const udim = U_DIM(mrisp_src), vdim = V_DIM(mrisp_src);
+  IMAGE const * const Ip_src = mrisp_src->Ip;
+  IMAGE       * const Ip_dst = mrisp_dst->Ip;
+
+  std::vector<int> khalfs(udim);
+  for (int u = 0; u < udim; u++) {
+    khalfs[u] = mrisPblurKHalf(mrisp_src, u, cart_klen, no_sphere);
+  }
+  int const kHalfHi = *std::max_element(khalfs.begin(), khalfs.end()) + 1;
+  std::vector<double> ukToExp(kHalfHi);
+  for (int uk = 0; uk < kHalfHi; uk++) {
+    ukToExp[uk] = exp(-(double)(uk * uk) * sigma_sq_inv);
+  }
+
+  // u-major copies of the frames, transposed[(n*udim + u)*vdim + v]
+  std::vector<float> transposed((size_t)nframes * udim * vdim);
+  for (int n = 0; n < nframes; n++) {
+    float * const dst = &transposed[(size_t)n * udim * vdim];
+    for (int v = 0; v < vdim; v++) {
+      float const * const src = IMAGEFseq_pix(Ip_src, 0, v, frames[n]);
+      for (int u = 0; u < udim; u++) dst[(size_t)u * vdim + v] = src[u];
+    }
+  }
+
+  std::vector<float> blurred(transposed.size());
+
+  int row;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic)
+#endif
+  for (row = 0; row < nframes * udim; row++) {
+    ROMP_PFLB_begin
+    int const n = row / udim, u = row % udim;
+    int const khalf = khalfs[u];
+    float const * const frame = &transposed[(size_t)n * udim * vdim];
+
+    double const phi      = (double)u * PHI_MAX / PHI_DIM(mrisp_src);
+    double const sin_sq_u = no_sphere ? 1.0 : squared(sin(phi));
+
+    // the rows within khalf of u, weighted in u, padded by khalf on both
+    // ends so that the convolution in v needs no wrapping
+    std::vector<double> padded(vdim + 2 * khalf, 0.0);
+    double * const rows = &padded[khalf];
+    double utotal = 0.0;
+    for (int uk = -khalf; uk <= khalf; uk++) {
+      int voff;
+      int u1 = u + uk;
+      if (u1 < 0) /* enforce spherical topology  */
+      {
+        voff = vdim / 2;
+        u1 = -u1;
+      }
+      else if (u1 >= udim) {
+        u1 = udim - (u1 - udim + 1);
+        voff = vdim / 2;
+      }
+      else {
+        voff = 0;
+      }
+      double const k = ukToExp[uk < 0 ? -uk : uk];
+      utotal += k;
+
+      // rows[v] += k * frame[u1][(v + voff) % vdim]
+      float const * const src = frame + (size_t)u1 * vdim;
+      int const vsplit = vdim - voff;
+      for (int v = 0; v < vsplit; v++) rows[v] += k * src[v + voff];
+      for (int v = vsplit; v < vdim; v++) rows[v] += k * src[v - vsplit];
+    }
+    for (int vk = 1; vk <= khalf; vk++) {
+      padded[khalf - vk] = rows[vdim - vk];
+      padded[khalf + vdim - 1 + vk] = rows[vk - 1];
+    }
+
+    std::vector<double> vkToExp(khalf + 1);
+    double vtotal = 0.0;
+    for (int vk = 0; vk <= khalf; vk++) {
+      vkToExp[vk] = exp(-sin_sq_u * (double)(vk * vk) * sigma_sq_inv);
+      vtotal += vk ? 2 * vkToExp[vk] : vkToExp[vk];
+    }
+    double const ktotal = utotal * vtotal;
+
+    float * const dst = &blurred[(size_t)row * vdim];
+    for (int v = 0; v < vdim; v++) {
+      double total = vkToExp[0] * rows[v];
+      for (int vk = 1; vk <= khalf; vk++) {
+        total += vkToExp[vk] * (rows[v - vk] + rows[v + vk]);
+      }
+      dst[v] = total / ktotal; /* normalize weights to 1 */
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (int n = 0; n < nframes; n++) {
+    float const * const src = &blurred[(size_t)n * udim * vdim];
+    for (int v = 0; v < vdim; v++) {
+      float * const dst = IMAGEFseq_pix(Ip_dst, 0, v, frames[n]);
+      for (int u = 0; u < udim; u++) dst[u] = src[(size_t)u * vdim + v];
+    }
+  }
+
+  return (mrisp_dst);
+}
+
 static MRI_SP *MRISPblur_new(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int fno) {
   int fnoLo_init, fnoHi_init;
   int no_sphere_init;
@@ -2719,11 +2918,11 @@ MRI_SP *MRIStoParameterizations(MRIS *mris, MRI_SP *mrisp, float scale, int *fra
 
 MRI_SP *MRISPblurFrames(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int *frames, int nframes)
 {
-  int n, u, v, cart_klen, klen, khalf, uk, vk, u1, v1, no_sphere, voff;
-  double k, *total, ktotal, sigma_sq_inv, udiff, vdiff, sin_sq_u, phi;
+  int cart_klen, no_sphere;
+  double sigma_sq_inv;
   IMAGE *Ip_src, *Ip_dst;
 
-  total = (double *)malloc(nframes * sizeof(double));
+  if (mrisPblurSeparableRequested()) return MRISPblur_separable(mrisp_src, mrisp_dst, sigma, frames, nframes);
 
   no_sphere = getenv("NO_SPHERE") != NULL;
   if (no_sphere) fprintf(stderr, "disabling spherical geometry\n");
@@ -2747,14 +2946,26 @@ MRI_SP *MRISPblurFrames(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int *
   Ip_src = mrisp_src->Ip;
   Ip_dst = mrisp_dst->Ip;
 
+  // each row u only reads the source, so the rows can be done in parallel
+  // unless the blur is done in place
+  int u;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP2(mrisp_src != mrisp_dst, assume_reproducible) schedule(dynamic)
+#endif
   for (u = 0; u < U_DIM(mrisp_src); u++) {
+    ROMP_PFLB_begin
+    int n, v, klen, khalf, uk, vk, u1, v1, voff;
+    double k, ktotal, udiff, vdiff, sin_sq_u, phi;
+    std::vector<double> total(nframes);
+
     if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "\r%3.3d of %d     ", u, U_DIM(mrisp_src) - 1);
     phi = (double)u * PHI_MAX / PHI_DIM(mrisp_src);
     sin_sq_u = sin(phi);
     sin_sq_u *= sin_sq_u;
     if (!FZERO(sin_sq_u)) {
-      k = cart_klen * cart_klen;
-      klen = sqrt(k + k / sin_sq_u);
+      int kk = cart_klen * cart_klen;
+      klen = sqrt(kk + kk / sin_sq_u);
       if (klen > MAX_LEN * cart_klen) klen = MAX_LEN * cart_klen;
     }
     else
@@ -2767,7 +2978,7 @@ MRI_SP *MRISPblurFrames(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int *
       /*      theta = (double)v*THETA_MAX / THETA_DIM(mrisp_src) ;*/
       if (u == DEBUG_U && v == DEBUG_V) DiagBreak();
 
-      memset(total, 0, nframes * sizeof(double));
+      std::fill(total.begin(), total.end(), 0.0);
       ktotal = 0.0;
       for (uk = -khalf; uk <= khalf; uk++) {
         udiff = (double)(uk * uk); /* distance squared in u */
@@ -2799,18 +3010,126 @@ MRI_SP *MRISPblurFrames(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int *
       if (u == DEBUG_U && v == DEBUG_V) DiagBreak();
       for (n = 0; n < nframes; n++) {
         total[n] /= ktotal; /* normalize weights to 1 */
-        *IMAGEFseq_pix(mrisp_dst->Ip, u, v, frames[n]) = total[n];
+        *IMAGEFseq_pix(Ip_dst, u, v, frames[n]) = total[n];
       }
     }
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
 
   if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "done.\n");
 
-  free(total);
+  return (mrisp_dst);
+}
+
+/*-----------------------------------------------------
+  A cache of blurred frames of one parameterization, e.g. a registration
+  template that is blurred to the same sigmas for every subject and every
+  round of a multi-scale registration. Entries are keyed by (sigma, frame)
+  and hold the frame as MRISPblur() would have written it. The source must
+  not change while the cache is in use. Not thread safe.
+  ------------------------------------------------------*/
+struct MRISP_BLUR_CACHE {
+  struct Entry {
+    float sigma;
+    int fno;
+    std::vector<float> pixels;
+  };
+  MRI_SP *mrisp_src;
+  std::vector<Entry> entries;
+  int nhits, nmisses;
+};
+
+MRISP_BLUR_CACHE *MRISPblurCacheAlloc(MRI_SP *mrisp_src)
+{
+  MRISP_BLUR_CACHE *cache = new MRISP_BLUR_CACHE;
+  cache->mrisp_src = mrisp_src;
+  cache->nhits = cache->nmisses = 0;
+  return (cache);
+}
+
+void MRISPblurCacheFree(MRISP_BLUR_CACHE **pcache)
+{
+  MRISP_BLUR_CACHE *cache = *pcache;
+  if (!cache) return;
+  *pcache = NULL;
+  if (Gdiag & DIAG_SHOW)
+    printf("blurred template cache: %d hits, %d misses, %d frames\n",
+           cache->nhits, cache->nmisses, (int)cache->entries.size());
+  delete cache;
+}
+
+/*-----------------------------------------------------
+  MRISPblurCached() - the same as MRISPblur(mrisp_src, mrisp_dst, sigma,
+  fno) for fno >= 0, except that a frame that was blurred to sigma before
+  is copied from the cache instead of being blurred again. Sources other
+  than the one the cache was made for are simply blurred.
+  ------------------------------------------------------*/
+MRI_SP *MRISPblurCached(MRISP_BLUR_CACHE *cache, MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int fno)
+{
+  if (!cache || mrisp_src != cache->mrisp_src || fno < 0) {
+    return MRISPblur(mrisp_src, mrisp_dst, sigma, fno);
+  }
+
+  size_t const npix = (size_t)mrisp_src->Ip->ocols * mrisp_src->Ip->orows;
+  for (auto const &entry : cache->entries) {
+    if (entry.sigma == sigma && entry.fno == fno) {
+      if (!mrisp_dst) mrisp_dst = MRISPclone(mrisp_src);
+      mrisp_dst->sigma = sigma;
+      memcpy(IMAGEFseq(mrisp_dst->Ip, fno), entry.pixels.data(), npix * sizeof(float));
+      cache->nhits++;
+      return (mrisp_dst);
+    }
+  }
 
+  mrisp_dst = MRISPblur(mrisp_src, mrisp_dst, sigma, fno);
+  MRISP_BLUR_CACHE::Entry entry;
+  entry.sigma = sigma;
+  entry.fno = fno;
+  entry.pixels.assign(IMAGEFseq(mrisp_dst->Ip, fno), IMAGEFseq(mrisp_dst->Ip, fno) + npix);
+  cache->entries.push_back(std::move(entry));
+  cache->nmisses++;
   return (mrisp_dst);
 }
 
+/*-----------------------------------------------------
+  MRISPblurBenchmark() - time blurring every frame of mrisp to each of the
+  given sigmas with the default blur and with the separable one, and
+  report how much they differ.
+  ------------------------------------------------------*/
+int MRISPblurBenchmark(MRI_SP *mrisp, float *sigmas, int nsigmas)
+{
+  int const nframes = mrisp->Ip->num_frame;
+  std::vector<int> frames(nframes);
+  for (int f = 0; f < nframes; f++) frames[f] = f;
+
+  printf("MRISPblur benchmark: %d x %d, %d frames\n", U_DIM(mrisp), V_DIM(mrisp), nframes);
+
+  MRI_SP *mrisp_ref = MRISPclone(mrisp), *mrisp_sep = MRISPclone(mrisp);
+  for (int i = 0; i < nsigmas; i++) {
+    Timer timer;
+    MRISPblur_new(mrisp, mrisp_ref, sigmas[i], -1);
+    double const ref_ms = timer.seconds() * 1000.0;
+
+    timer.reset();
+    MRISPblur_separable(mrisp, mrisp_sep, sigmas[i], frames.data(), nframes);
+    double const sep_ms = timer.seconds() * 1000.0;
+
+    double max_diff = 0, max_val = 0;
+    size_t const nvals = (size_t)mrisp->Ip->ocols * mrisp->Ip->orows * nframes;
+    float const *ref = IMAGEFseq(mrisp_ref->Ip, 0), *sep = IMAGEFseq(mrisp_sep->Ip, 0);
+    for (size_t j = 0; j < nvals; j++) {
+      max_diff = MAX(max_diff, fabs(ref[j] - sep[j]));
+      max_val = MAX(max_val, fabs(ref[j]));
+    }
+    printf("  sigma %6.2f: default %9.2f ms, separable %9.2f ms, speedup %6.2f, max diff %g (max value %g)\n",
+           sigmas[i], ref_ms, sep_ms, ref_ms / MAX(sep_ms, 1e-3), max_diff, max_val);
+  }
+  MRISPfree(&mrisp_ref);
+  MRISPfree(&mrisp_sep);
+  return (NO_ERROR);
+}
+
 int MRISPsetFrameVal(MRI_SP *mrisp, int frame, float val)
 {
   int u, v;
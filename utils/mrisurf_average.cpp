@@ -0,0 +1,306 @@
+/**
+ * @brief sparse nearest-neighbor averaging of per-vertex values
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+#include "mrisurf_base.h"
+
+
+// Nearest-neighbor averaging is done hundreds or thousands of times in a
+// row by the registration, smoothing and gradient averaging code. Walking
+// the VERTEX_TOPOLOGY lists and the ripflags of the VERTEX structs on each
+// pass touches far more memory than the values being averaged, so the
+// neighborhoods are compiled once into a compressed sparse row (CSR) table
+// and the passes only read that table and a dense array of values.
+//
+// The sums are formed in the same order as the per-vertex loops (center
+// first, then the neighbors in vt->v order) and divided by the same float
+// count, so the results are identical to those loops. Each row only reads
+// the previous pass, so the rows can be done in parallel and the result
+// does not depend on the number of threads.
+
+
+static bool mrisAveragerUses(MRIS const *mris, const float *mask, int vno)
+{
+  if (mask && mask[vno] < 0.5) {
+    return false;
+  }
+  return !mris->vertices[vno].ripflag;
+}
+
+/*-----------------------------------------------------
+  MRISaveragerAlloc() - compile the one-ring neighborhoods of mris into
+  an averaging operator. Vertices that are ripped, or that are outside
+  of mask (if not NULL, mask[vno] >= 0.5 is inside), neither change nor
+  contribute to their neighbors. With MRIS_AVERAGER_RIPPED_CENTERS the
+  ripped vertices inside the mask are averaged too, as MRISsmoothMRI()
+  does. Vertices without any usable neighbors are left out since their
+  average is their own value.
+  ------------------------------------------------------*/
+MRIS_AVERAGER *MRISaveragerAlloc(MRIS *mris, const float *mask, int flags)
+{
+  int const nvertices = mris->nvertices;
+
+  MRIS_AVERAGER *avg = (MRIS_AVERAGER *)calloc(1, sizeof(MRIS_AVERAGER));
+  if (!avg) {
+    ErrorExit(ERROR_NOMEMORY, "MRISaveragerAlloc: could not allocate averager");
+  }
+  avg->nvertices = nvertices;
+
+  // count first so that the table is allocated exactly
+  int nrows = 0;
+  size_t nnbrs = 0;
+  for (int vno = 0; vno < nvertices; vno++) {
+    if (mask && mask[vno] < 0.5) {
+      continue;
+    }
+    if (mris->vertices[vno].ripflag && !(flags & MRIS_AVERAGER_RIPPED_CENTERS)) {
+      continue;
+    }
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    int num = 0;
+    for (int n = 0; n < vt->vnum; n++) {
+      if (mrisAveragerUses(mris, mask, vt->v[n])) {
+        num++;
+      }
+    }
+    if (num > 0) {
+      nrows++;
+      nnbrs += num;
+    }
+  }
+
+  avg->nrows = nrows;
+  avg->row_vno = (int *)malloc((nrows + 1) * sizeof(int));
+  avg->row_start = (int *)malloc((nrows + 1) * sizeof(int));
+  avg->nbrs = (int *)malloc((nnbrs + 1) * sizeof(int));
+  avg->num = (float *)malloc((nrows + 1) * sizeof(float));
+  if (!avg->row_vno || !avg->row_start || !avg->nbrs || !avg->num) {
+    ErrorExit(ERROR_NOMEMORY, "MRISaveragerAlloc: could not allocate %d rows with %zu neighbors", nrows, nnbrs);
+  }
+
+  int r = 0;
+  int k = 0;
+  for (int vno = 0; vno < nvertices; vno++) {
+    if (mask && mask[vno] < 0.5) {
+      continue;
+    }
+    if (mris->vertices[vno].ripflag && !(flags & MRIS_AVERAGER_RIPPED_CENTERS)) {
+      continue;
+    }
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    int const row_start = k;
+    for (int n = 0; n < vt->vnum; n++) {
+      int const vno2 = vt->v[n];
+      if (mrisAveragerUses(mris, mask, vno2)) {
+        avg->nbrs[k++] = vno2;
+      }
+    }
+    if (k == row_start) {
+      continue;
+    }
+    avg->row_vno[r] = vno;
+    avg->row_start[r] = row_start;
+    avg->num[r] = (float)(k - row_start + 1);  // account for central vertex
+    r++;
+  }
+  avg->row_start[r] = k;
+
+  return (avg);
+}
+
+void MRISaveragerFree(MRIS_AVERAGER **pavg)
+{
+  MRIS_AVERAGER *avg = *pavg;
+  if (!avg) {
+    return;
+  }
+  *pavg = NULL;
+  free(avg->row_vno);
+  free(avg->row_start);
+  free(avg->nbrs);
+  free(avg->num);
+  free(avg);
+}
+
+
+// one averaging pass over NCH interleaved channels, out[row] = mean of in[]
+// over the row. Entries of vertices that are not rows are not written.
+template <int NCH>
+static void mrisAveragerPass(const MRIS_AVERAGER *avg, const float *in, float *out)
+{
+  int const * const row_vno = avg->row_vno;
+  int const * const row_start = avg->row_start;
+  int const * const nbrs = avg->nbrs;
+  float const * const num = avg->num;
+  int r;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static)
+#endif
+  for (r = 0; r < avg->nrows; r++) {
+    ROMP_PFLB_begin
+    size_t const center = (size_t)row_vno[r] * NCH;
+    float sum[NCH];
+    for (int c = 0; c < NCH; c++) {
+      sum[c] = in[center + c];
+    }
+    int const kHi = row_start[r + 1];
+    for (int k = row_start[r]; k < kHi; k++) {
+      float const *const nbr = in + (size_t)nbrs[k] * NCH;
+      for (int c = 0; c < NCH; c++) {
+        sum[c] += nbr[c];
+      }
+    }
+    for (int c = 0; c < NCH; c++) {
+      out[center + c] = sum[c] / num[r];
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+/*-----------------------------------------------------
+  MRISaveragerApply() - perform navgs nearest-neighbor averaging passes
+  on vals in place. vals holds nchannels (1 to 3) interleaved floats per
+  vertex, i.e. vals[vno*nchannels + c].
+  ------------------------------------------------------*/
+int MRISaveragerApply(const MRIS_AVERAGER *avg, float *vals, int nchannels, int navgs)
+{
+  if (nchannels < 1 || nchannels > 3) {
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "MRISaveragerApply: %d channels not supported", nchannels));
+  }
+  if (navgs <= 0 || avg->nrows == 0) {
+    return (NO_ERROR);
+  }
+
+  // the values of the vertices that are not rows must be the same in both
+  // buffers since the passes never write them
+  size_t const nvals = (size_t)avg->nvertices * nchannels;
+  float *tmp = (float *)malloc(nvals * sizeof(float));
+  if (!tmp) {
+    ErrorExit(ERROR_NOMEMORY, "MRISaveragerApply: could not allocate %zu floats", nvals);
+  }
+  memcpy(tmp, vals, nvals * sizeof(float));
+
+  float *in = vals, *out = tmp;
+  for (int i = 0; i < navgs; i++) {
+    switch (nchannels) {
+      case 1:
+        mrisAveragerPass<1>(avg, in, out);
+        break;
+      case 2:
+        mrisAveragerPass<2>(avg, in, out);
+        break;
+      default:
+        mrisAveragerPass<3>(avg, in, out);
+        break;
+    }
+    float *t = in;
+    in = out;
+    out = t;
+  }
+  if (in != vals) {
+    memcpy(vals, in, nvals * sizeof(float));
+  }
+
+  free(tmp);
+  return (NO_ERROR);
+}
+
+/*-----------------------------------------------------
+  MRISaveragerBenchmark() - time navgs averaging passes of the per-vertex
+  loop that the averager replaces against the averager itself on 1 and 3
+  channels of random values, and check that they agree. Meant to be run
+  on ic7 or fsaverage sized surfaces.
+  ------------------------------------------------------*/
+int MRISaveragerBenchmark(MRIS *mris, int navgs)
+{
+  int const nvertices = mris->nvertices;
+  float *ref = (float *)malloc(3 * (size_t)nvertices * sizeof(float));
+  float *tmp = (float *)malloc(3 * (size_t)nvertices * sizeof(float));
+  float *vals = (float *)malloc(3 * (size_t)nvertices * sizeof(float));
+  if (!ref || !tmp || !vals) {
+    ErrorExit(ERROR_NOMEMORY, "MRISaveragerBenchmark: could not allocate values");
+  }
+
+  printf("averaging benchmark: %d vertices, %d averages\n", nvertices, navgs);
+
+  Timer timer;
+  MRIS_AVERAGER *avg = MRISaveragerAlloc(mris, NULL, 0);
+  printf("  build   %8.2f ms (%d rows, %d neighbors)\n",
+         timer.seconds() * 1000.0, avg->nrows, avg->row_start[avg->nrows]);
+
+  for (int nchannels = 1; nchannels <= 3; nchannels += 2) {
+    for (size_t i = 0; i < (size_t)nvertices * nchannels; i++) {
+      ref[i] = vals[i] = drand48();
+    }
+
+    // the loop of MRISaverageVals()/MRISaverageGradients()
+    timer.reset();
+    for (int i = 0; i < navgs; i++) {
+      for (int vno = 0; vno < nvertices; vno++) {
+        VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+        VERTEX          const * const v  = &mris->vertices         [vno];
+        if (v->ripflag) {
+          continue;
+        }
+        float sum[3], num = 0.0f;
+        for (int c = 0; c < nchannels; c++) {
+          sum[c] = ref[(size_t)vno * nchannels + c];
+        }
+        for (int n = 0; n < vt->vnum; n++) {
+          int const vno2 = vt->v[n];
+          if (mris->vertices[vno2].ripflag) {
+            continue;
+          }
+          num++;
+          for (int c = 0; c < nchannels; c++) {
+            sum[c] += ref[(size_t)vno2 * nchannels + c];
+          }
+        }
+        num++;
+        for (int c = 0; c < nchannels; c++) {
+          tmp[(size_t)vno * nchannels + c] = sum[c] / num;
+        }
+      }
+      for (int vno = 0; vno < nvertices; vno++) {
+        if (mris->vertices[vno].ripflag) {
+          continue;
+        }
+        for (int c = 0; c < nchannels; c++) {
+          ref[(size_t)vno * nchannels + c] = tmp[(size_t)vno * nchannels + c];
+        }
+      }
+    }
+    double const ref_ms = timer.seconds() * 1000.0;
+
+    timer.reset();
+    MRISaveragerApply(avg, vals, nchannels, navgs);
+    double const avg_ms = timer.seconds() * 1000.0;
+
+    double max_diff = 0;
+    for (size_t i = 0; i < (size_t)nvertices * nchannels; i++) {
+      max_diff = MAX(max_diff, fabs(ref[i] - vals[i]));
+    }
+    printf("  %d channel%s: per-vertex %8.2f ms, averager %8.2f ms, speedup %5.2f, max diff %g\n",
+           nchannels, nchannels > 1 ? "s" : " ", ref_ms, avg_ms, ref_ms / MAX(avg_ms, 1e-3), max_diff);
+  }
+
+  MRISaveragerFree(&avg);
+  free(ref);
+  free(tmp);
+  free(vals);
+  return (NO_ERROR);
+}
@@ -500,6 +500,7 @@ void mrisDumpShape(FILE* file, MRIS const * mris) {
 
 static void MRISchangedNFacesNVertices(MRIS * mris, bool scrambled) {
   // useful for debugging
+  mrisTopologyChanged(mris);
 }
 
 void MRISacquireNverticesFrozen(MRIS *mris) {
@@ -1018,57 +1018,61 @@ int mrisComputeWhichSurfaceRepulsionTerm(
 
   name x y z
   ------------------------------------------------------*/
-int mrisComputeSpringTerm(MRI_SURFACE *mris, double l_spring)
+int mrisComputeSpringTerm(MRI_SURFACE *mris, double l_spring, MRIS_SOA **psoa)
 {
-  int vno, n, m;
-  float sx, sy, sz, x, y, z, dist_scale;
-
-  if (FZERO(l_spring)) {
-    return (NO_ERROR);
-  }
+  return (mrisComputeSpringTerms(mris, l_spring, 0.0, 0.0, psoa));
+}
 
+static float mrisSpringDistScale(MRIS const *mris)
+{
 #if METRIC_SCALE
   if (mris->patch) {
-    dist_scale = 1.0;
-  }
-  else {
-    dist_scale = sqrt(mris->orig_area / mris->total_area);
+    return 1.0;
   }
+  return sqrt(mris->orig_area / mris->total_area);
 #else
-  dist_scale = 1.0;
+  return 1.0;
 #endif
-  for (vno = 0; vno < mris->nvertices; vno++) {
-    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
-    VERTEX                * const v  = &mris->vertices         [vno];
-    if (v->ripflag) {
-      continue;
+}
+
+static void mrisSoaSpringTerm(MRIS_SOA *soa, double l_spring, float dist_scale)
+{
+  int vno;
+
+  // each vertex only writes its own gradient
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static)
+#endif
+  for (vno = 0; vno < soa->nvertices; vno++) {
+    ROMP_PFLB_begin
+    if (soa->ripflag[vno]) {
+      ROMP_PFLB_continue;
     }
     if (vno == Gdiag_no) {
       DiagBreak();
     }
 
-    if (v->border && !v->neg) {
-      continue;
+    if (soa->border[vno] && !soa->neg[vno]) {
+      ROMP_PFLB_continue;
     }
 
-    x = v->x;
-    y = v->y;
-    z = v->z;
+    float const x = soa->x[vno];
+    float const y = soa->y[vno];
+    float const z = soa->z[vno];
 
-    sx = sy = sz = 0.0;
-    n = 0;
-    for (m = 0; m < vt->vnum; m++) {
-      VERTEX const * const vn = &mris->vertices[vt->v[m]];
-      if (!vn->ripflag) {
-        sx += vn->x - x;
-        sy += vn->y - y;
-        sz += vn->z - z;
+    float sx = 0.0, sy = 0.0, sz = 0.0;
+    int n = 0;
+    int const mHi = soa->nbr_start[vno + 1];
+    for (int m = soa->nbr_start[vno]; m < mHi; m++) {
+      int const vno2 = soa->nbrs[m];
+      if (!soa->ripflag[vno2]) {
+        sx += soa->x[vno2] - x;
+        sy += soa->y[vno2] - y;
+        sz += soa->z[vno2] - z;
         n++;
       }
     }
-#if 0
-    n = 4 ;  /* avg # of nearest neighbors */
-#endif
     if (n > 0) {
       sx = dist_scale * sx / n;
       sy = dist_scale * sy / n;
@@ -1078,13 +1082,13 @@ int mrisComputeSpringTerm(MRI_SURFACE *mris, double l_spring)
     sx *= l_spring;
     sy *= l_spring;
     sz *= l_spring;
-    v->dx += sx;
-    v->dy += sy;
-    v->dz += sz;
+    soa->dx[vno] += sx;
+    soa->dy[vno] += sy;
+    soa->dz[vno] += sz;
     if (vno == Gdiag_no) fprintf(stdout, "v %d spring term:         (%2.3f, %2.3f, %2.3f)\n", vno, sx, sy, sz);
+    ROMP_PFLB_end
   }
-
-  return (NO_ERROR);
+  ROMP_PF_end
 }
 
 /*-----------------------------------------------------
@@ -1098,44 +1102,48 @@ int mrisComputeSpringTerm(MRI_SURFACE *mris, double l_spring)
   has the original (i.e. after
   global rotational alignment) spherical coordinates in the TMP2_VERTICES
   ------------------------------------------------------*/
-int mrisComputeLaplacianTerm(MRI_SURFACE *mris, double l_lap)
+int mrisComputeLaplacianTerm(MRI_SURFACE *mris, double l_lap, MRIS_SOA **psoa)
 {
-  int vno, n, m;
-  float x, y, z, vx, vy, vz, vnx, vny, vnz, dx, dy, dz;
+  return (mrisComputeSpringTerms(mris, 0.0, l_lap, 0.0, psoa));
+}
 
-  if (FZERO(l_lap)) {
-    return (NO_ERROR);
-  }
+static void mrisSoaLaplacianTerm(MRIS_SOA *soa, double l_lap)
+{
+  int vno;
 
-  for (vno = 0; vno < mris->nvertices; vno++) {
-    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
-    VERTEX                * const v  = &mris->vertices         [vno];
-    if (v->ripflag) {
-      continue;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static)
+#endif
+  for (vno = 0; vno < soa->nvertices; vno++) {
+    ROMP_PFLB_begin
+    if (soa->ripflag[vno]) {
+      ROMP_PFLB_continue;
     }
     if (vno == Gdiag_no) {
       DiagBreak();
     }
 
-    if (v->border && !v->neg) {
-      continue;
+    if (soa->border[vno] && !soa->neg[vno]) {
+      ROMP_PFLB_continue;
     }
 
-    x = v->x;
-    y = v->y;
-    z = v->z;
+    float const x = soa->x[vno];
+    float const y = soa->y[vno];
+    float const z = soa->z[vno];
 
-    n = 0;
-    vx = v->x - v->t2x;
-    vy = v->y - v->t2y;
-    vz = v->z - v->t2z;
-    dx = dy = dz = 0.0f;
-    for (m = 0; m < vt->vnum; m++) {
-      VERTEX const * const vn = &mris->vertices[vt->v[m]];
-      if (!vn->ripflag) {
-        vnx = vn->x - vn->t2x;
-        vny = vn->y - vn->t2y;
-        vnz = vn->z - vn->t2z;
+    int n = 0;
+    float const vx = soa->x[vno] - soa->t2x[vno];
+    float const vy = soa->y[vno] - soa->t2y[vno];
+    float const vz = soa->z[vno] - soa->t2z[vno];
+    float dx = 0.0f, dy = 0.0f, dz = 0.0f;
+    int const mHi = soa->nbr_start[vno + 1];
+    for (int m = soa->nbr_start[vno]; m < mHi; m++) {
+      int const vno2 = soa->nbrs[m];
+      if (!soa->ripflag[vno2]) {
+        float const vnx = soa->x[vno2] - soa->t2x[vno2];
+        float const vny = soa->y[vno2] - soa->t2y[vno2];
+        float const vnz = soa->z[vno2] - soa->t2z[vno2];
         dx += (vnx - vx);
         dy += (vny - vy);
         dz += (vnz - vz);
@@ -1159,15 +1167,15 @@ int mrisComputeLaplacianTerm(MRI_SURFACE *mris, double l_lap)
       dz = dz * l_lap / n;
     }
 
-    v->dx += dx;
-    v->dy += dy;
-    v->dz += dz;
+    soa->dx[vno] += dx;
+    soa->dy[vno] += dy;
+    soa->dz[vno] += dz;
     if (vno == Gdiag_no) {
       printf("l_lap: v %d: DX=(%2.2f,%2.2f,%2.2f)\n", vno, dx, dy, dz);
     }
+    ROMP_PFLB_end
   }
-
-  return (NO_ERROR);
+  ROMP_PF_end
 }
 
 /*-----------------------------------------------------
@@ -1180,58 +1188,40 @@ int mrisComputeLaplacianTerm(MRI_SURFACE *mris, double l_lap)
   average normal component which typically forces the surface
   to shrink.
   ------------------------------------------------------*/
-int mrisComputeNormalizedSpringTerm(MRIS* mris, double const l_spring)
+int mrisComputeNormalizedSpringTerm(MRIS* mris, double const l_spring, MRIS_SOA **psoa)
 {
-  if (FZERO(l_spring)) {
-    return (NO_ERROR);
-  }
-
-  float dist_scale_init;
-#if METRIC_SCALE
-  if (mris->patch) {
-    dist_scale_init = 1.0;
-  }
-  else {
-    dist_scale_init = sqrt(mris->orig_area / mris->total_area);
-  }
-#else
-  dist_scale_init = 1.0;
-#endif
-  const float dist_scale = dist_scale_init;
-
-  const double num = (double)MRISvalidVertices(mris);
+  return (mrisComputeSpringTerms(mris, 0.0, 0.0, l_spring, psoa));
+}
 
+static void mrisSoaNormalizedSpringTerm(MRIS_SOA *soa, double const l_spring, float const dist_scale, double const num)
+{
   double dot_total = 0.0;
   int vno;
   ROMP_PF_begin
 #ifdef HAVE_OPENMP
   #pragma omp parallel for if_ROMP(experimental) reduction(+ : dot_total)
 #endif
-  for (vno = 0; vno < mris->nvertices; vno++) {
+  for (vno = 0; vno < soa->nvertices; vno++) {
     ROMP_PFLB_begin
     
-    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
-    VERTEX                * const v  = &mris->vertices         [vno];
-    if (v->ripflag) {
+    if (soa->ripflag[vno]) {
       continue;
     }
     if (vno == Gdiag_no) {
       DiagBreak();
     }
 
+    float const x = soa->x[vno], y = soa->y[vno], z = soa->z[vno];
     float sx = 0.0, sy = 0.0, sz = 0.0;
     int n = 0;
-    int m;
-    for (m = 0; m < vt->vnum; m++) {
-      VERTEX *vn = &mris->vertices[vt->v[m]];
-      if (vn->ripflag) continue;
+    int const mHi = soa->nbr_start[vno + 1];
+    for (int m = soa->nbr_start[vno]; m < mHi; m++) {
+      int const vno2 = soa->nbrs[m];
+      if (soa->ripflag[vno2]) continue;
 
-      // Almost all the time in this loop is spent in the above conditions
-      // The following is NOT where the time goes!
-      //
-      sx += vn->x - v->x;
-      sy += vn->y - v->y;
-      sz += vn->z - v->z;
+      sx += soa->x[vno2] - x;
+      sy += soa->y[vno2] - y;
+      sz += soa->z[vno2] - z;
 
       n++;
     }
@@ -1242,10 +1232,10 @@ int mrisComputeNormalizedSpringTerm(MRIS* mris, double const l_spring)
     sy *= multiplier;
     sz *= multiplier;
 
-    dot_total += l_spring * (v->nx * sx + v->ny * sy + v->nz * sz);
-    v->dx += l_spring * sx;
-    v->dy += l_spring * sy;
-    v->dz += l_spring * sz;
+    dot_total += l_spring * (soa->nx[vno] * sx + soa->ny[vno] * sy + soa->nz[vno] * sz);
+    soa->dx[vno] += l_spring * sx;
+    soa->dy[vno] += l_spring * sy;
+    soa->dz[vno] += l_spring * sz;
 
     if (vno == Gdiag_no)
       fprintf(
@@ -1261,25 +1251,72 @@ int mrisComputeNormalizedSpringTerm(MRIS* mris, double const l_spring)
 #ifdef HAVE_OPENMP
   #pragma omp parallel for if_ROMP(experimental)
 #endif
-  for (vno = 0; vno < mris->nvertices; vno++) {
+  for (vno = 0; vno < soa->nvertices; vno++) {
     ROMP_PFLB_begin
     
-    VERTEX *v = &mris->vertices[vno];
-    if (v->ripflag) {
+    if (soa->ripflag[vno]) {
       continue;
     }
     if (vno == Gdiag_no) {
       DiagBreak();
     }
 
-    v->dx -= dot_avg * v->nx;
-    v->dy -= dot_avg * v->ny;
-    v->dz -= dot_avg * v->nz;
+    soa->dx[vno] -= dot_avg * soa->nx[vno];
+    soa->dy[vno] -= dot_avg * soa->ny[vno];
+    soa->dz[vno] -= dot_avg * soa->nz[vno];
     
     ROMP_PFLB_end
   }
   ROMP_PF_end
-  
+}
+
+/*-----------------------------------------------------
+  mrisComputeSpringTermsSoA() - add the spring, Laplacian and normalized
+  spring terms, in that order, to the gradient in soa. soa must hold the
+  positions, gradients and flags of mris, the normals if l_spring_norm is
+  not zero and the TMP2 vertices if l_lap is not zero. Gives the same
+  gradient as calling the three terms one after the other.
+  ------------------------------------------------------*/
+int mrisComputeSpringTermsSoA(MRIS *mris, MRIS_SOA *soa, double l_spring, double l_lap, double l_spring_norm)
+{
+  if (!FZERO(l_spring)) {
+    mrisSoaSpringTerm(soa, l_spring, mrisSpringDistScale(mris));
+  }
+  if (!FZERO(l_lap)) {
+    mrisSoaLaplacianTerm(soa, l_lap);
+  }
+  if (!FZERO(l_spring_norm)) {
+    mrisSoaNormalizedSpringTerm(soa, l_spring_norm, mrisSpringDistScale(mris), (double)MRISvalidVertices(mris));
+  }
+  return (NO_ERROR);
+}
+
+/*-----------------------------------------------------
+  mrisComputeSpringTerms() - the spring, Laplacian and normalized spring
+  terms with a single load of the vertex fields they read into a MRIS_SOA
+  and a single store of the gradient. If psoa is not NULL the arrays are
+  kept in *psoa for the next call (see MRISsoaAcquire), otherwise they are
+  freed on return.
+  ------------------------------------------------------*/
+int mrisComputeSpringTerms(MRIS *mris, double l_spring, double l_lap, double l_spring_norm, MRIS_SOA **psoa)
+{
+  if (FZERO(l_spring) && FZERO(l_lap) && FZERO(l_spring_norm)) {
+    return (NO_ERROR);
+  }
+
+  int fields = MRIS_SOA_XYZ | MRIS_SOA_DXYZ | MRIS_SOA_FLAGS;
+  if (!FZERO(l_lap)) {
+    fields |= MRIS_SOA_TMP2;
+  }
+  if (!FZERO(l_spring_norm)) {
+    fields |= MRIS_SOA_NORMALS;
+  }
+  MRIS_SOA *soa = psoa ? MRISsoaAcquire(psoa, mris, fields) : MRISsoaAlloc(mris, fields);
+  mrisComputeSpringTermsSoA(mris, soa, l_spring, l_lap, l_spring_norm);
+  MRISsoaStore(soa, mris, MRIS_SOA_DXYZ);
+  if (!psoa) {
+    MRISsoaFree(&soa);
+  }
   return (NO_ERROR);
 }
 
@@ -1476,18 +1513,70 @@ inline void vertexComputeTangentialSpringTerm(MRIS* mris, int vno, float* dx, fl
 }
 
 
-void mrisComputeTangentialSpringTerm(MRIS *mris, double l_spring)
+void mrisComputeTangentialSpringTerm(MRIS *mris, double l_spring, MRIS_SOA **psoa)
 {
   if (FZERO(l_spring)) return;
 
-  for (int vno = 0; vno < mris->nvertices; vno++) {
-    float dx = 0, dy = 0, dz = 0;
-    vertexComputeTangentialSpringTerm(mris, vno, &dx, &dy, &dz, l_spring);
+  // vertexComputeTangentialSpringTerm() over the arrays of a MRIS_SOA, kept in *psoa if psoa is not NULL
+  int const fields = MRIS_SOA_XYZ | MRIS_SOA_NORMALS | MRIS_SOA_DXYZ | MRIS_SOA_FLAGS;
+  MRIS_SOA *soa = psoa ? MRISsoaAcquire(psoa, mris, fields) : MRISsoaAlloc(mris, fields);
 
-    VERTEX * const vertex = &mris->vertices[vno];
-    vertex->dx += dx;
-    vertex->dy += dy;
-    vertex->dz += dz;
+  int vno;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static)
+#endif
+  for (vno = 0; vno < soa->nvertices; vno++) {
+    ROMP_PFLB_begin
+    if (soa->ripflag[vno]) ROMP_PFLB_continue;
+    if (soa->border[vno] && !soa->neg[vno]) ROMP_PFLB_continue;
+
+    float const x = soa->x[vno];
+    float const y = soa->y[vno];
+    float const z = soa->z[vno];
+
+    float sx = 0, sy = 0, sz = 0;
+
+    int n = 0;
+    int const mHi = soa->nbr_start[vno + 1];
+    for (int m = soa->nbr_start[vno]; m < mHi; m++) {
+      int const vno2 = soa->nbrs[m];
+      if (!soa->ripflag[vno2]) {
+        sx += soa->x[vno2] - x;
+        sy += soa->y[vno2] - y;
+        sz += soa->z[vno2] - z;
+        n++;
+      }
+    }
+
+    if (n > 0) {
+      sx /= n;
+      sy /= n;
+      sz /= n;
+    }
+
+    float const nx = soa->nx[vno];
+    float const ny = soa->ny[vno];
+    float const nz = soa->nz[vno];
+
+    // project onto normal
+    float nc = sx * nx + sy * ny + sz * nz;
+
+    // remove normal component and scale
+    float const dx = l_spring * (sx - nc * nx);
+    float const dy = l_spring * (sy - nc * ny);
+    float const dz = l_spring * (sz - nc * nz);
+
+    soa->dx[vno] += dx;
+    soa->dy[vno] += dy;
+    soa->dz[vno] += dz;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  MRISsoaStore(soa, mris, MRIS_SOA_DXYZ);
+  if (!psoa) {
+    MRISsoaFree(&soa);
   }
 }
 
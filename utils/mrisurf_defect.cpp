@@ -4383,7 +4383,6 @@ static SEGMENTATION *segmentIntersectingEdges(MRIS *mris, DEFECT *defect, int *v
 {
   int n, m, vno1, vno2, ndiscarded, nes, vtn;
   int nsegments, *segments, *sizes, changed, tmp;
-  EDGE e1, e2;
   SEGMENTATION *segmentation, *new_segmentation;
 
   nes = *nedges;
@@ -4491,23 +4490,32 @@ static SEGMENTATION *segmentIntersectingEdges(MRIS *mris, DEFECT *defect, int *v
 
   // fprintf(WHICH_OUTPUT,"finding overlapping edges \n");
 
-  /* finding overlapping edges */
+  /* finding overlapping edges - each edge only writes its own list */
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 64)
+#endif
   for (n = 0; n < nes; n++) {
+    ROMP_PFLB_begin
+    EDGE e1, e2;
+    int o;
     es[n].nxedges = 0;
     es[n].xedges = (int *)malloc((nes - 1) * sizeof(int));
     e1.vno1 = es[n].vno1;
     e1.vno2 = es[n].vno2;
-    for (m = 0; m < nes; m++) {
-      if (n == m) {
+    for (o = 0; o < nes; o++) {
+      if (n == o) {
         continue;
       }
-      e2.vno1 = es[m].vno1;
-      e2.vno2 = es[m].vno2;
+      e2.vno1 = es[o].vno1;
+      e2.vno2 = es[o].vno2;
       if (edgesIntersect(mris, &e1, &e2)) {
-        es[n].xedges[es[n].nxedges++] = m;
+        es[n].xedges[es[n].nxedges++] = o;
       }
     }
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
 
   /* allocating structure */
   segmentation = SEGMENTATIONalloc(MAX_SEGMENTS, MAX_SEGMENT_EDGES);
@@ -12148,8 +12156,8 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
 {
   DEFECT_VERTEX_STATE *dvs;
   DEFECT_PATCH dps1[MAX_PATCHES], dps2[MAX_PATCHES], *dps, *dp, *dps_next_generation;
-  int i, best_i, j, g, nselected, nreplacements, rank, nunchanged = 0, nelite, ncrossovers, k, l, noverlap;
-  int *overlap, ngenerations, nbests, last_euthanasia, nremovedvertices, nfinalvertices;
+  int i, best_i, j, g, nselected, nreplacements, rank, nunchanged = 0, nelite, ncrossovers, k, l;
+  int ngenerations, nbests, last_euthanasia, nremovedvertices, nfinalvertices;
   double fitness, best_fitness, last_best, fitness_mean, fitness_sigma, fitness_norm, pfitness, two_sigma_sq,
       last_fitness;
   static int dno = 0;     /* for debugging */
@@ -12262,27 +12270,37 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
     etable.overlapping_edges = (int **)calloc(nedges, sizeof(int *));
     etable.noverlap = (int *)calloc(nedges, sizeof(int));
     etable.flags = (unsigned char *)calloc(nedges, sizeof(unsigned char));
-    overlap = (int *)calloc(nedges, sizeof(int));
-    if (!etable.edges || !etable.overlapping_edges || !etable.noverlap || !overlap)
+    if (!etable.edges || !etable.overlapping_edges || !etable.noverlap || !etable.flags)
       ErrorExit(ERROR_NOMEMORY,
                 "mrisComputeOptimalRetessellation: Excessive "
                 "topologic defect encountered: could not allocate %d "
                 "edge table",
                 nedges);
 
-    for (nzero = i = 0; i < nedges; i++) /* compute overlapping
-                                                        for each edge */
-    {
+    /* compute overlapping for each edge. This is quadratic in the number
+       of edges and dominates the large defects, but each edge only reads
+       the surface and writes its own entry, so the edges are done in
+       parallel and the table does not depend on the number of threads */
+    nzero = 0;
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+ : nzero) schedule(dynamic, 64)
+#endif
+    for (i = 0; i < nedges; i++) {
+      ROMP_PFLB_begin
+      int overlap[MAX_EDGES + 1];
+      int noverlap, e;
+
       if (nedges > 50000 && !(i % 25000)) {
         fprintf(WHICH_OUTPUT, "%d of %d edges processed\n", i, nedges);
       }
       etable.noverlap[i] = 0;
-      for (noverlap = j = 0; j < nedges; j++) {
-        if (j == i) {
+      for (noverlap = e = 0; e < nedges; e++) {
+        if (e == i) {
           continue;
         }
-        if (edgesIntersect(mris_corrected, &et[i], &et[j])) {
-          overlap[noverlap] = j;
+        if (edgesIntersect(mris_corrected, &et[i], &et[e])) {
+          overlap[noverlap] = e;
           noverlap++;
         }
         if (noverlap > MAX_EDGES) {
@@ -12312,9 +12330,9 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
       else {
         nzero++;
       }
+      ROMP_PFLB_end
     }
-
-    free(overlap);
+    ROMP_PF_end
   }
 
   ROMP_SCOPE_end
@@ -12793,6 +12811,17 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
 
   ROMP_SCOPE_begin
 
+  /* The patches of a generation are evaluated one at a time, and so are
+     the defects: every mrisDefectPatchFitness() call retessellates the
+     defect into mris_corrected and marks the edges of etable, and whether
+     a crossover is also mutated depends on the best fitness so far.
+     Evaluating patches concurrently would need a copy of mris_corrected,
+     etable and computeDefectContext per thread, with the rp statistics
+     merged in patch order. All defects draw from the one randomNumber()
+     stream seeded by -seed, so doing defects concurrently would also need
+     a stream per defect, which changes every retessellation. Only the
+     edge tables above and the MRI likelihood inside each fitness
+     evaluation use threads. */
   while (nunchanged < max_unchanged) {
     if (ngenerations == parms->niters) {
       break;
@@ -1895,12 +1895,11 @@ int mrisComputePositioningGradients(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
   mrisComputeIntensityGradientTerm(mris, parms->l_grad, mri_brain, mri_brain);
   mrisComputeSurfaceRepulsionTerm(mris, parms->l_surf_repulse, mht_v_orig);
 
-  mrisComputeLaplacianTerm(mris, parms->l_lap);
+  mrisComputeLaplacianTerm(mris, parms->l_lap, &parms->soa);
   MRISaverageGradients(mris, avgs);
 
   /* smoothness terms */
-  mrisComputeSpringTerm(mris, parms->l_spring);
-  mrisComputeNormalizedSpringTerm(mris, parms->l_spring_norm);
+  mrisComputeSpringTerms(mris, parms->l_spring, 0.0, parms->l_spring_norm, &parms->soa);
   mrisComputeRepulsiveTerm(mris, parms->l_repulse, mht_v_current, mht_f_current);
   mrisComputeThicknessSmoothnessTerm(mris, parms->l_tsmooth, parms);
   mrisComputeThicknessMinimizationTerm(mris, parms->l_thick_min, parms);
@@ -1910,7 +1909,7 @@ int mrisComputePositioningGradients(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
   /*    mrisComputeAverageNormalTerm(mris, avgs, parms->l_nspring) ;*/
   /*    mrisComputeCurvatureTerm(mris, parms->l_curv) ;*/
   mrisComputeNonlinearSpringTerm(mris, parms->l_nlspring, parms);
-  mrisComputeTangentialSpringTerm(mris, parms->l_tspring);
+  mrisComputeTangentialSpringTerm(mris, parms->l_tspring, &parms->soa);
   mrisComputeNonlinearTangentialSpringTerm(mris, parms->l_nltspring, parms->min_dist);
 
   if (mht_v_orig) {
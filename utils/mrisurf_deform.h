@@ -61,7 +61,7 @@ static int transform(float *xptr, float *yptr, float *zptr, float nx, float ny,
 
 int mrisComputeDuraTerm(MRI_SURFACE *mris, double l_dura, MRI *mri_dura, double dura_thresh);
 
-int mrisComputeSpringTerm           (MRI_SURFACE *mris, double l_spring);
+int mrisComputeSpringTerm           (MRI_SURFACE *mris, double l_spring, MRIS_SOA **psoa = NULL);
 int mrisComputeLaplacianTerm        (MRI_SURFACE *mris, double l_laplacian);
 int mrisComputeNormalizedSpringTerm (MRI_SURFACE *mris, double l_spring);
 
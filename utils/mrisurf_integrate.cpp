@@ -25,7 +25,26 @@
 
 static int mrisIntegrationEpoch     (MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int n_avgs);
 static double mrisLineMinimize      (MRI_SURFACE *mris, INTEGRATION_PARMS *parms);
-static double mrisLineMinimizeSearch(MRI_SURFACE *mris, INTEGRATION_PARMS *parms);
+static double mrisLineMinimizeSearch(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, MRIS_METRIC_TRACKER *mpt);
+
+// The FS_INCREMENTAL_MP tracker of an integration loop, printed and freed
+// on whatever path the loop returns by.
+class MetricTrackerScope
+{
+ public:
+  explicit MetricTrackerScope(MRI_SURFACE *mris) : mpt(MRISmetricTrackerRequested(mris)) {}
+  ~MetricTrackerScope()
+  {
+    if (mpt) {
+      MRISmetricTrackerPrint(stdout, mpt);
+      MRISmetricTrackerFree(&mpt);
+    }
+  }
+  MetricTrackerScope(MetricTrackerScope const &) = delete;
+  MetricTrackerScope &operator=(MetricTrackerScope const &) = delete;
+
+  MRIS_METRIC_TRACKER *mpt;
+};
 
 /*-----------------------------------------------------*/
 int mrisLogIntegrationParms(FILE *fp, MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
@@ -408,6 +427,8 @@ int MRISintegrate(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int n_averages)
   double sse_thresh, pct_neg, pct_neg_area, total_vertices, tol;
   /*, scale, last_neg_area */;
   MHT *mht_v_current = NULL;
+  MetricTrackerScope tracker(mris);
+  MRIS_METRIC_TRACKER *mpt = tracker.mpt;
 
   if (Gdiag & DIAG_WRITE && parms->fp == NULL) {
     char fname[STRLEN];
@@ -445,7 +466,7 @@ int MRISintegrate(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int n_averages)
 
   mrisProjectSurface(mris);
 
-  MRIScomputeMetricProperties(mris);            // this can change XYZ slightly
+  MRIScomputeMetricPropertiesIncremental(mris, mpt);  // this can change XYZ slightly
 
 #if AVERAGE_AREAS
   MRISreadTriangleProperties(mris, mris->fname);
@@ -585,16 +606,16 @@ int MRISintegrate(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int n_averages)
 
     mrisComputeRepulsiveRatioTerm(mris, parms->l_repulse_ratio, mht_v_current);
 
-    mrisComputeLaplacianTerm(mris, parms->l_lap);
+    mrisComputeLaplacianTerm(mris, parms->l_lap, &parms->soa);
     MRISaverageGradients(mris, n_averages);
-    mrisComputeSpringTerm(mris, parms->l_spring);
+    mrisComputeSpringTerm(mris, parms->l_spring, &parms->soa);
     mrisComputeThicknessMinimizationTerm(mris, parms->l_thick_min, parms);
     mrisComputeThicknessParallelTerm(mris, parms->l_thick_parallel, parms);
     mrisComputeThicknessNormalTerm(mris, parms->l_thick_normal, parms);
     mrisComputeThicknessSpringTerm(mris, parms->l_thick_spring, parms);
     mrisComputeAshburnerTriangleTerm(mris, parms->l_ashburner_triangle, parms);
 
-    mrisComputeTangentialSpringTerm(mris, parms->l_tspring);
+    mrisComputeTangentialSpringTerm(mris, parms->l_tspring, &parms->soa);
     mrisComputeNonlinearTangentialSpringTerm(mris, parms->l_nltspring, parms->min_dist);
     mrisComputeNonlinearSpringTerm(mris, parms->l_nlspring, parms);
     mrisComputeQuadraticCurvatureTerm(mris, parms->l_curv);
@@ -615,7 +636,7 @@ int MRISintegrate(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int n_averages)
 
     switch (parms->integration_type) {
       case INTEGRATE_LM_SEARCH:
-        delta_t = mrisLineMinimizeSearch(mris, parms);
+        delta_t = mrisLineMinimizeSearch(mris, parms, mpt);
         break;
       default:
       case INTEGRATE_LINE_MINIMIZE:
@@ -693,7 +714,7 @@ int MRISintegrate(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int n_averages)
     }
 
     mrisProjectSurface(mris);
-    MRIScomputeMetricProperties(mris);
+    MRIScomputeMetricPropertiesIncremental(mris, mpt);
     if (parms->remove_neg && mris->neg_area > 0) {
       INTEGRATION_PARMS p;
       //      printf("removing overlap with smoothing\n") ;
@@ -762,6 +783,8 @@ int MRISintegrate(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int n_averages)
     MHTfree(&mht_v_current);
   }
 
+  MRISsoaFree(&parms->soa);
+
   parms->ending_sse = MRIScomputeSSE(mris, parms);
   /*  mrisProjectSurface(mris) ;*/
 
@@ -1020,10 +1043,17 @@ int MRISregister(MRI_SURFACE *mris,
       }
       MRISuseMeanCurvature(mris);  // restore current target
       mrisp = MRIStoParameterization(mris, NULL, 1, 0);
+      // the parameterizations blurred for the previous sigma
+      if (parms->mrisp != saved_parms.mrisp) {
+        MRISPfree(&parms->mrisp);
+      }
+      if (parms->mrisp_template != saved_parms.mrisp_template) {
+        MRISPfree(&parms->mrisp_template);
+      }
 #if 1
       parms->mrisp = MRISPblur(mrisp, NULL, sigma, 0);
-      parms->mrisp_template = MRISPblur(mrisp_template, NULL, sigma, ino);
-      MRISPblur(mrisp_template, parms->mrisp_template, sigma, ino + 1); /* variances */
+      parms->mrisp_template = MRISPblurCached(parms->mrisp_template_cache, mrisp_template, NULL, sigma, ino);
+      MRISPblurCached(parms->mrisp_template_cache, mrisp_template, parms->mrisp_template, sigma, ino + 1); /* variances */
 #else
       dof = *IMAGEFseq_pix(mrisp_template->Ip, 0, 0, 2);
       if (dof < 1) {
@@ -1229,10 +1259,16 @@ int MRISregister(MRI_SURFACE *mris,
   parms->l_area = parms->l_parea = parms->l_spring = 0.0;
   mrisRemoveNegativeArea(mris, parms, parms->n_averages, MAX_NEG_AREA_PCT, 3);
 #endif
-#if 0
-  MRISPfree(&parms->mrisp) ;
-  MRISPfree(&parms->mrisp_template) ;
-#endif
+  // parms is restored below, which would drop the last blurred parameterizations
+  if (mris->vp == (void *)parms->mrisp) {
+    mris->vp = NULL;
+  }
+  if (parms->mrisp != saved_parms.mrisp) {
+    MRISPfree(&parms->mrisp);
+  }
+  if (parms->mrisp_template != saved_parms.mrisp_template) {
+    MRISPfree(&parms->mrisp_template);
+  }
   msec = start.milliseconds();
   if (Gdiag & DIAG_SHOW) fprintf(stdout, "registration took %2.2f hours\n", (float)msec / (1000.0f * 60.0f * 60.0f));
   if (Gdiag & DIAG_WRITE) {
@@ -1967,7 +2003,7 @@ static double mrisLineMinimize(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
   Use a binary search in the gradient direction to find the
   location of the minimum.
   ------------------------------------------------------*/
-static double mrisLineMinimizeSearch(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
+static double mrisLineMinimizeSearch(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, MRIS_METRIC_TRACKER *mpt)
 {
   FILE *fp = NULL;
   if ((Gdiag & DIAG_WRITE) && DIAG_VERBOSE_ON) {
@@ -2035,7 +2071,7 @@ static double mrisLineMinimizeSearch(MRI_SURFACE *mris, INTEGRATION_PARMS *parms
 
     MRISapplyGradient(mris, delta_t);
     mrisProjectSurface(mris);
-    MRIScomputeMetricProperties(mris);
+    MRIScomputeMetricPropertiesIncremental(mris, mpt);
     double sse = MRIScomputeSSE(mris, parms);
     MRISrestoreOldPositions(mris);
 
@@ -2052,7 +2088,7 @@ static double mrisLineMinimizeSearch(MRI_SURFACE *mris, INTEGRATION_PARMS *parms
 
     MRISapplyGradient(mris, min_delta);
     mrisProjectSurface(mris);
-    MRIScomputeMetricProperties(mris);
+    MRIScomputeMetricPropertiesIncremental(mris, mpt);
     double sse = MRIScomputeSSE(mris, parms);
     MRISrestoreOldPositions(mris);
 
@@ -2083,7 +2119,7 @@ static double mrisLineMinimizeSearch(MRI_SURFACE *mris, INTEGRATION_PARMS *parms
   
     MRISapplyGradient(mris, delta_t);
     mrisProjectSurface(mris);
-    MRIScomputeMetricProperties(mris);
+    MRIScomputeMetricPropertiesIncremental(mris, mpt);
     double sse = MRIScomputeSSE(mris, parms);
 
     if (sse <= min_sse) /* new minimum found */
@@ -2103,7 +2139,7 @@ static double mrisLineMinimizeSearch(MRI_SURFACE *mris, INTEGRATION_PARMS *parms
 
       MRISrestoreOldPositions(mris);
       mrisProjectSurface(mris);
-      MRIScomputeMetricProperties(mris);
+      MRIScomputeMetricPropertiesIncremental(mris, mpt);
     }
     if (total_delta + delta_t >= 10.0 * min_delta) {
       increasing = 0;
@@ -2724,6 +2760,8 @@ MRI_SURFACE *MRISquickSphere(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int ma
 int MRISinflateBrain(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
 {
   int write_iterations = parms->write_iterations;
+  MetricTrackerScope tracker(mris);
+  MRIS_METRIC_TRACKER *mpt = tracker.mpt;
 
   if (IS_QUADRANGULAR(mris)) {
     MRISremoveTriangleLinks(mris);
@@ -2786,7 +2824,7 @@ int MRISinflateBrain(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
     mrisLogIntegrationParms(stderr, mris, parms);
   }
 
-  MRIScomputeMetricProperties(mris);    // changes XYZ
+  MRIScomputeMetricPropertiesIncremental(mris, mpt);    // changes XYZ
   
   int    const niterations        = parms->niterations;
   double const desired_rms_height = parms->desired_rms_height;
@@ -2853,17 +2891,15 @@ int MRISinflateBrain(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
       MRISaverageGradients(mris, n_averages);
       mrisComputeNormalSpringTerm(mris, parms->l_nspring);
       mrisComputeNonlinearSpringTerm(mris, parms->l_nlspring, parms);
-      mrisComputeTangentialSpringTerm(mris, parms->l_tspring);
+      mrisComputeTangentialSpringTerm(mris, parms->l_tspring, &parms->soa);
       mrisComputeNonlinearTangentialSpringTerm(mris, parms->l_nltspring, parms->min_dist);
       mrisComputeQuadraticCurvatureTerm(mris, parms->l_curv);
-      mrisComputeSpringTerm(mris, parms->l_spring);
-      mrisComputeLaplacianTerm(mris, parms->l_lap);
-      mrisComputeNormalizedSpringTerm(mris, parms->l_spring_norm);
+      mrisComputeSpringTerms(mris, parms->l_spring, parms->l_lap, parms->l_spring_norm, &parms->soa);
       
       double delta_t;
       switch (parms->integration_type) {
         case INTEGRATE_LM_SEARCH:
-          delta_t = mrisLineMinimizeSearch(mris, parms);
+          delta_t = mrisLineMinimizeSearch(mris, parms, mpt);
           break;
         default:
         case INTEGRATE_LINE_MINIMIZE:
@@ -2878,7 +2914,7 @@ int MRISinflateBrain(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
       }
       
       mrisTrackTotalDistanceNew(mris); /* update sulc */
-      MRIScomputeMetricProperties(mris);
+      MRIScomputeMetricPropertiesIncremental(mris, mpt);
       
       MRIScomputeSSE(mris, parms);  // WHAT DOES THIS ACHIEVE?
       
@@ -2915,14 +2951,14 @@ int MRISinflateBrain(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
       }
 
       if (parms->scale > 0) {
-        MRIScomputeMetricProperties(mris);
+        MRIScomputeMetricPropertiesIncremental(mris, mpt);
         printf(
             "rescaling brain to retain original "
             "surface area %2.0f (%2.2f), current %2.1f\n",
             mris->orig_area,
             sqrt(mris->orig_area / (mris->total_area + mris->neg_area)), mris->total_area);
         MRISscaleBrainArea(mris);
-        MRIScomputeMetricProperties(mris);
+        MRIScomputeMetricPropertiesIncremental(mris, mpt);
 //	printf("after rescaling, surface area %2.1f\n", mris->total_area);
 	MRISprintTessellationStats(mris, stderr);
       }
@@ -2941,6 +2977,7 @@ int MRISinflateBrain(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
   }
 
   fprintf(stdout, "\ninflation complete.\n");
+  MRISsoaFree(&parms->soa);
   if (Gdiag & DIAG_WRITE) {
     INTEGRATION_PARMS_closeFp(parms);
   }
@@ -2960,6 +2997,8 @@ int MRISinflateToSphere(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
   int n_averages, n, write_iterations, niterations, base_averages;
   double delta_t = 0.0, rms_radial_error, sse, base_dt;
   MHT *mht_v_current = NULL;
+  MetricTrackerScope tracker(mris);
+  MRIS_METRIC_TRACKER *mpt = tracker.mpt;
 
   printf("Entering MRISinflateToSphere()\n");
 
@@ -2988,7 +3027,7 @@ int MRISinflateToSphere(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
   if(Gdiag & DIAG_SHOW) 
     mrisLogIntegrationParms(stderr, mris, parms);
 
-  MRIScomputeMetricProperties(mris);
+  MRIScomputeMetricPropertiesIncremental(mris, mpt);
 
   /*  parms->start_t = 0 ;*/
   niterations = parms->niterations;
@@ -3031,16 +3070,15 @@ int MRISinflateToSphere(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
       mrisComputeRepulsiveRatioTerm(mris, parms->l_repulse_ratio, mht_v_current);
       mrisComputeConvexityTerm(mris, parms->l_convex);
 
-      mrisComputeLaplacianTerm(mris, parms->l_lap);
+      mrisComputeLaplacianTerm(mris, parms->l_lap, &parms->soa);
       mrisComputeNonlinearSpringTerm(mris, parms->l_nlspring, parms);
-      mrisComputeTangentialSpringTerm(mris, parms->l_tspring);
+      mrisComputeTangentialSpringTerm(mris, parms->l_tspring, &parms->soa);
       mrisComputeNonlinearTangentialSpringTerm(mris, parms->l_nltspring, parms->min_dist);
       MRISaverageGradients(mris, n_averages);
-      mrisComputeSpringTerm(mris, parms->l_spring);
-      mrisComputeNormalizedSpringTerm(mris, parms->l_spring_norm);
+      mrisComputeSpringTerms(mris, parms->l_spring, 0.0, parms->l_spring_norm, &parms->soa);
       switch (parms->integration_type) {
         case INTEGRATE_LM_SEARCH:
-          delta_t = mrisLineMinimizeSearch(mris, parms);
+          delta_t = mrisLineMinimizeSearch(mris, parms, mpt);
           break;
         default:
         case INTEGRATE_LINE_MINIMIZE:
@@ -3054,7 +3092,7 @@ int MRISinflateToSphere(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
           break;
       }
       mrisTrackTotalDistance(mris); /* update sulc */
-      MRIScomputeMetricProperties(mris);
+      MRIScomputeMetricPropertiesIncremental(mris, mpt);
       sse = MRIScomputeSSE(mris, parms);
       rms_radial_error = sqrt(mrisComputeSphereError(mris, 1.0, parms->a) / mris->nvertices);
       if (!((n + 1) % 5)) /* print some diagnostics */
@@ -3093,6 +3131,7 @@ int MRISinflateToSphere(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
   }
 
   fprintf(stdout, "\nspherical inflation complete.\n");
+  MRISsoaFree(&parms->soa);
   if (Gdiag & DIAG_WRITE) {
     INTEGRATION_PARMS_closeFp(parms);
   }
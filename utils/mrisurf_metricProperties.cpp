@@ -14,6 +14,8 @@
  * Reporting: freesurfer@nmr.mgh.harvard.edu
  *
  */
+#include <vector>
+
 #include "mrisurf_metricProperties.h"
 
 #include "mrisurf_MRIS.h"
@@ -1872,6 +1874,398 @@ int MRIScomputeMetricProperties(MRIS *mris)
   return NO_ERROR;
 }
 
+
+// Incremental metric properties
+//
+// The per-face and per-vertex computations below are those of
+// MRIScomputeTriangleProperties() and MRIScomputeNormals(), restricted to
+// the faces and vertices around the moved ones. Everything that sums over
+// the whole surface (bounding box, total area, average vertex distance,
+// orientation) is cheap compared to them and is still done in full.
+
+MRIS_METRIC_TRACKER *MRISmetricTrackerAlloc(MRIS *mris, float tol, float max_frac)
+{
+  MRIS_METRIC_TRACKER *mpt = (MRIS_METRIC_TRACKER *)calloc(1, sizeof(MRIS_METRIC_TRACKER));
+  if (!mpt) {
+    ErrorExit(ERROR_NOMEMORY, "MRISmetricTrackerAlloc: could not allocate tracker");
+  }
+  mpt->tol = tol;
+  mpt->max_frac = max_frac;
+  return (mpt);
+}
+
+/*-----------------------------------------------------
+  MRISmetricTrackerRequested() - a tracker for the integration loops if
+  FS_INCREMENTAL_MP is set, NULL (full passes) otherwise. The value of
+  FS_INCREMENTAL_MP is the tolerance in mm, empty meaning 0.
+  ------------------------------------------------------*/
+MRIS_METRIC_TRACKER *MRISmetricTrackerRequested(MRIS *mris)
+{
+  char const *cp = getenv("FS_INCREMENTAL_MP");
+  if (!cp) {
+    return (NULL);
+  }
+  return (MRISmetricTrackerAlloc(mris, *cp ? atof(cp) : 0.0f, 0.3f));
+}
+
+static void mrisMetricTrackerFreeSnapshot(MRIS_METRIC_TRACKER *mpt)
+{
+  freeAndNULL(mpt->xyz);
+  freeAndNULL(mpt->vripflag);
+  freeAndNULL(mpt->fripflag);
+  freeAndNULL(mpt->vflags);
+  freeAndNULL(mpt->fflags);
+}
+
+void MRISmetricTrackerFree(MRIS_METRIC_TRACKER **pmpt)
+{
+  MRIS_METRIC_TRACKER *mpt = *pmpt;
+  if (!mpt) {
+    return;
+  }
+  *pmpt = NULL;
+  mrisMetricTrackerFreeSnapshot(mpt);
+  free(mpt);
+}
+
+int MRISmetricTrackerPrint(FILE *fp, MRIS_METRIC_TRACKER const *mpt)
+{
+  int const nupdates = mpt->nfull + mpt->nincremental;
+  fprintf(fp,
+          "metric properties: %d updates, %d incremental (%2.1f%% of the vertices on average), %2.2f s\n",
+          nupdates,
+          mpt->nincremental,
+          mpt->nincremental && mpt->nvertices ? 100.0 * mpt->nupdated / (mpt->nincremental * (double)mpt->nvertices) : 0.0,
+          mpt->seconds);
+  return (NO_ERROR);
+}
+
+// remember the positions and ripflags of every vertex after a full pass
+static void mrisMetricTrackerSnapshot(MRIS *mris, MRIS_METRIC_TRACKER *mpt)
+{
+  if (!mpt->xyz || mpt->nvertices != mris->nvertices || mpt->nfaces != mris->nfaces) {
+    mrisMetricTrackerFreeSnapshot(mpt);
+    mpt->xyz = (float *)malloc(3 * (size_t)mris->nvertices * sizeof(float));
+    mpt->vripflag = (char *)malloc(mris->nvertices + 1);
+    mpt->fripflag = (char *)malloc(mris->nfaces + 1);
+    mpt->vflags = (char *)malloc(mris->nvertices + 1);
+    mpt->fflags = (char *)malloc(mris->nfaces + 1);
+    if (!mpt->xyz || !mpt->vripflag || !mpt->fripflag || !mpt->vflags || !mpt->fflags) {
+      ErrorExit(ERROR_NOMEMORY, "mrisMetricTrackerSnapshot: could not allocate %d vertices", mris->nvertices);
+    }
+  }
+  mpt->nvertices = mris->nvertices;
+  mpt->nfaces = mris->nfaces;
+  mpt->nsize = mris->nsize;
+  mpt->status = mris->status;
+
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const * const v = &mris->vertices[vno];
+    mpt->xyz[3 * vno] = v->x;
+    mpt->xyz[3 * vno + 1] = v->y;
+    mpt->xyz[3 * vno + 2] = v->z;
+    mpt->vripflag[vno] = (char)v->ripflag;
+  }
+  for (int fno = 0; fno < mris->nfaces; fno++) {
+    mpt->fripflag[fno] = (char)mris->faces[fno].ripflag;
+  }
+}
+
+// area, unit normal and angles of one face, as MRIScomputeTriangleProperties() does them
+static void mrisComputeFaceTriangleProperties(MRIS *mris, int fno)
+{
+  FACE * const face = &mris->faces[fno];
+  VERTEX const * const v[3] = {
+    &mris->vertices[face->v[0]], &mris->vertices[face->v[1]], &mris->vertices[face->v[2]]};
+
+  float const a[3] = {v[1]->x - v[0]->x, v[1]->y - v[0]->y, v[1]->z - v[0]->z};
+  float const b[3] = {v[2]->x - v[0]->x, v[2]->y - v[0]->y, v[2]->z - v[0]->z};
+  float n[3] = {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+
+  face->area = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]) * 0.5f;
+
+  float len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+  len = FZERO(len) ? 1.0f : 1.0f / len;
+  n[0] *= len;
+  n[1] *= len;
+  n[2] *= len;
+  setFaceNorm(mris, fno, n[0], n[1], n[2]);
+
+  for (int ano = 0; ano < ANGLES_PER_TRIANGLE; ano++) {
+    // corner, then the vertices before and after it
+    VERTEX const * const vo = v[ano];
+    VERTEX const * const va = v[(ano + 2) % 3];
+    VERTEX const * const vb = v[(ano + 1) % 3];
+    float const ea[3] = {va->x - vo->x, va->y - vo->y, va->z - vo->z};
+    float const eb[3] = {vb->x - vo->x, vb->y - vo->y, vb->z - vo->z};
+    float cross = n[0] * (eb[1] * ea[2] - eb[2] * ea[1]);
+    cross += n[1] * (eb[2] * ea[0] - eb[0] * ea[2]);
+    cross += n[2] * (eb[0] * ea[1] - eb[1] * ea[0]);
+    float const dot = ea[0] * eb[0] + ea[1] * eb[1] + ea[2] * eb[2];
+    face->angle[ano] = fastApproxAtan2f(cross, dot);
+  }
+}
+
+// normal and area of one vertex, as MRIScomputeNormals() and
+// MRIScomputeTriangleProperties() do them. false if the normal degenerates.
+static bool mrisComputeVertexNormalAndArea(MRIS *mris, int vno)
+{
+  VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+  VERTEX                * const v  = &mris->vertices         [vno];
+
+  float snorm[3] = {0, 0, 0};
+  float corner_area = 0, area = 0;
+  int count = 0;
+  for (int n = 0; n < vt->num; n++) {
+    int const fno = vt->f[n];
+    FACE const * const face = &mris->faces[fno];
+    if (face->ripflag) continue;
+
+    count++;
+    float norm[3];
+    mrisNormalFace(mris, fno, (int)vt->n[n], norm);
+    snorm[0] += norm[0];
+    snorm[1] += norm[1];
+    snorm[2] += norm[2];
+    corner_area += mrisTriangleArea(mris, fno, (int)vt->n[n]);
+
+    // the areas of oriented faces may have been made negative
+    area += fabs(face->area);
+  }
+
+  if (count && !(mrisNormalize(snorm) > 0.0)) {
+    return false;
+  }
+
+  float const fix = fix_vertex_area ? 3.0 : 2.0;
+  if (v->origarea < 0) {
+    v->origarea = corner_area / fix;
+  }
+  v->area = area / fix;
+  v->nx = snorm[0];
+  v->ny = snorm[1];
+  v->nz = snorm[2];
+  return true;
+}
+
+// distances from one vertex to its neighbors, as mrisComputeVertexDistances() does them
+static void mrisComputeVertexDistanceRow(MRIS *mris, int vno, bool spherical)
+{
+  VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+  VERTEX                * const v  = &mris->vertices         [vno];
+  float * const dist = v->dist;
+
+  if (!spherical) {
+    for (int n = 0; n < vt->vtotal; n++) {
+      VERTEX const * const vn = &mris->vertices[vt->v[n]];
+      float const xd = v->x - vn->x, yd = v->y - vn->y, zd = v->z - vn->z;
+      dist[n] = sqrt(xd * xd + yd * yd + zd * zd);
+    }
+    return;
+  }
+
+  XYZ xyz_normalized;
+  float radius;
+  XYZ_NORMALIZED_LOAD(&xyz_normalized, &radius, v->x, v->y, v->z);
+  for (int n = 0; n < vt->vtotal; n++) {
+    VERTEX const * const vn = &mris->vertices[vt->v[n]];
+    float d = 0.0;
+    if (!vn->ripflag) {
+      XYZ xyz_n;
+      float length;
+      XYZ_NORMALIZED_LOAD(&xyz_n, &length, vn->x, vn->y, vn->z);
+      if (!FZERO(length)) {
+        d = fabs(XYZApproxAngle_knownLength(&xyz_normalized, vn->x, vn->y, vn->z, length)) * radius;
+      }
+    }
+    dist[n] = d;
+  }
+}
+
+// the incremental update proper, false if a full pass is needed after all
+static bool mrisUpdateMetricPropertiesAround(MRIS *mris, MRIS_METRIC_TRACKER *mpt)
+{
+  int const nvertices = mris->nvertices, nfaces = mris->nfaces;
+  char * const vflags = mpt->vflags;
+  char * const fflags = mpt->fflags;
+
+  // faces with a moved vertex, vertices on those faces, and vertices
+  // with a moved neighbor (their distance rows)
+  std::vector<int> faces, vertices, rows;
+  for (int fno = 0; fno < nfaces; fno++) {
+    FACE const * const face = &mris->faces[fno];
+    fflags[fno] = 0;
+    for (int n = 0; n < VERTICES_PER_FACE; n++) {
+      if (vflags[face->v[n]] & 1) fflags[fno] = 1;
+    }
+    if (fflags[fno] && !face->ripflag) faces.push_back(fno);
+  }
+  for (int vno = 0; vno < nvertices; vno++) {
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    if (mris->vertices[vno].ripflag) continue;
+    bool area = vflags[vno] & 1, row = area;
+    for (int n = 0; n < vt->num && !area; n++) {
+      if (fflags[vt->f[n]]) area = true;
+    }
+    for (int n = 0; n < vt->vtotal && !row; n++) {
+      if (vflags[vt->v[n]] & 1) row = true;
+    }
+    if (area) vertices.push_back(vno);
+    if (row) rows.push_back(vno);
+  }
+
+  int const nfaces_dirty = faces.size();
+  int i;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (i = 0; i < nfaces_dirty; i++) {
+    ROMP_PFLB_begin
+    mrisComputeFaceTriangleProperties(mris, faces[i]);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  int const nvertices_dirty = vertices.size();
+  int ndegenerate = 0;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+ : ndegenerate)
+#endif
+  for (i = 0; i < nvertices_dirty; i++) {
+    ROMP_PFLB_begin
+    if (!mrisComputeVertexNormalAndArea(mris, vertices[i])) ndegenerate++;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  if (ndegenerate > 0) {
+    return false;  // only a full pass moves vertices to fix their normals
+  }
+
+  bool const spherical = MRIS_Status_distanceFormula(mris->status) == MRIS_Status_DistanceFormula_1;
+  int const nrows = rows.size();
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (i = 0; i < nrows; i++) {
+    ROMP_PFLB_begin
+    mrisComputeVertexDistanceRow(mris, rows[i], spherical);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  mrisComputeSurfaceDimensions(mris);
+
+  // the total of MRIScomputeTriangleProperties(), which is before orientation
+  double total_area = 0.0;
+
+  #define ROMP_VARIABLE       fno
+  #define ROMP_LO             0
+  #define ROMP_HI             nfaces
+
+  #define ROMP_SUMREDUCTION0  total_area
+
+  #define ROMP_FOR_LEVEL      ROMP_level_shown_reproducible
+
+#ifdef ROMP_SUPPORT_ENABLED
+  const int romp_for_line = __LINE__;
+#endif
+  #include "romp_for_begin.h"
+  ROMP_for_begin
+
+    #define total_area ROMP_PARTIALSUM(0)
+
+    FACE const * const face = &mris->faces[fno];
+    if (face->ripflag) continue;
+    total_area += fabs(face->area);
+
+    #undef total_area
+
+  #include "romp_for_end.h"
+
+  mris->total_area = (float)total_area;
+  mris->avg_vertex_area = mris->total_area / nvertices;
+  MRIScomputeAvgInterVertexDist(mris, &mris->std_vertex_dist);
+  mrisOrientSurface(mris);
+  if (mris->status == MRIS_PARAMETERIZED_SPHERE || mris->status == MRIS_RIGID_BODY || mris->status == MRIS_SPHERE) {
+    mris->total_area = M_PI * mris->radius * mris->radius * 4.0;
+  }
+
+  mpt->nupdated += nvertices_dirty;
+  return true;
+}
+
+/*-----------------------------------------------------
+  MRIScomputeMetricPropertiesIncremental() - bring the metric properties
+  of mris up to date, recomputing only around the vertices that moved more
+  than mpt->tol since the last call (see MRIS_METRIC_TRACKER).
+  ------------------------------------------------------*/
+int MRIScomputeMetricPropertiesIncremental(MRIS *mris, MRIS_METRIC_TRACKER *mpt)
+{
+  if (!mpt) {
+    return (MRIScomputeMetricProperties(mris));
+  }
+
+  Timer timer;
+  int const nvertices = mris->nvertices, nfaces = mris->nfaces;
+
+  bool full = !mpt->xyz || mpt->nvertices != nvertices || mpt->nfaces != nfaces || mpt->nsize != mris->nsize ||
+              mpt->status != mris->status || mris->status == MRIS_PLANE || mris->dist_nsize != mris->nsize;
+
+  int nmoved = 0, nchanged = 0;
+  if (!full) {
+    float const tol2 = mpt->tol * mpt->tol;
+    int vno;
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+ : nmoved, nchanged)
+#endif
+    for (vno = 0; vno < nvertices; vno++) {
+      ROMP_PFLB_begin
+      VERTEX const * const v = &mris->vertices[vno];
+      float const * const xyz = &mpt->xyz[3 * vno];
+      float const dx = v->x - xyz[0], dy = v->y - xyz[1], dz = v->z - xyz[2];
+      float const d2 = dx * dx + dy * dy + dz * dz;
+      bool const moved = tol2 > 0 ? d2 > tol2 : d2 != 0;
+      mpt->vflags[vno] = moved ? 1 : 0;
+      if (moved) nmoved++;
+      if ((char)v->ripflag != mpt->vripflag[vno] || (!v->ripflag && !v->dist)) nchanged++;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    for (int fno = 0; fno < nfaces && !nchanged; fno++) {
+      if ((char)mris->faces[fno].ripflag != mpt->fripflag[fno]) nchanged++;
+    }
+    full = nchanged > 0 || nmoved > mpt->max_frac * nvertices;
+  }
+
+  if (!full && nmoved > 0) {
+    full = !mrisUpdateMetricPropertiesAround(mris, mpt);
+  }
+
+  if (full) {
+    MRIScomputeMetricProperties(mris);  // may move vertices with degenerate normals
+    mrisMetricTrackerSnapshot(mris, mpt);
+    mpt->nfull++;
+  }
+  else {
+    for (int vno = 0; vno < nvertices; vno++) {
+      if (!(mpt->vflags[vno] & 1)) continue;
+      VERTEX const * const v = &mris->vertices[vno];
+      mpt->xyz[3 * vno] = v->x;
+      mpt->xyz[3 * vno + 1] = v->y;
+      mpt->xyz[3 * vno + 2] = v->z;
+    }
+    mpt->nincremental++;
+  }
+
+  mpt->seconds += timer.seconds();
+  return (NO_ERROR);
+}
+
 // Convenience functions
 //
 int load_orig_triangle_vertices(MRIS *mris, int fno, double U0[3], double U1[3], double U2[3])
@@ -9171,184 +9565,55 @@ int MRISuseNegCurvature(MRIS *mris)
 
 
 /*-----------------------------------------------------
-  MRISaverageGradients() - spatially smooths gradients (dx,dy,dz)
-  using num_avgs nearest-neighbor averages. See also
-  MRISaverageGradientsFast()
+  mrisAverageGradients() - num_avgs nearest-neighbor averages of the
+  gradients (dx,dy,dz) using the sparse averaging operator, which is
+  built once and applied to the three components together. tdx,tdy,tdz
+  are left holding the result, as the per-vertex loops did.
   ------------------------------------------------------*/
-typedef struct MRISaverageGradients_Data {
-  float dx,dy,dz;
-} MRISaverageGradients_Data;
-
-typedef struct MRISaverageGradients_Control {    
-  int numNeighbors;
-  int firstNeighbor;
-} MRISaverageGradients_Control;
-
-static int                              MRISaverageGradients_neighbors_size;
-static int*	                        MRISaverageGradients_neighbors;
-static int  	                        MRISaverageGradients_controls_and_data_size;
-static MRISaverageGradients_Control*    MRISaverageGradients_controls;
-static MRISaverageGradients_Data*       MRISaverageGradients_datas_init;
-
-static int*     MRISaverageGradients_new2old_indexMap;
-static int*     MRISaverageGradients_old2new_indexMap;
-
-
-// optimizing the program
-//  There are two things that can be done to optimize the code
-//  (a) put those that have the same numNeighbors together, to avoid the branch mispredicts
-//  (b) keep the locality of reference by reordering only nearby indices
-// both are important...
-
-static bool MRISaverageGradients_index_le(int lhs, int rhs) {
- 
-    MRISaverageGradients_Control* controls = MRISaverageGradients_controls;
-    
-    // L2 caches are 256KB = 64KB fp numbers = about 20K vertices
-    // so, for locality of reference purposes, we keep about 16768 = 2^14 together
-    //
-    int const lhsLocality = lhs>>14;
-    int const rhsLocality = rhs>>14;
-    
-    if (       lhsLocality != rhsLocality)
-    	return lhsLocality <= rhsLocality;
-
-    if (       controls[lhs].numNeighbors != controls[rhs].numNeighbors)
-    	return controls[lhs].numNeighbors <= controls[rhs].numNeighbors;
-
-    return lhs <= rhs;
-}
-
-#define SORT_NAME           sort_MRISaverageGradients_index
-#define SORT_NAME_partition sort_MRISaverageGradients_index_partition
-#define SORT_NAME_isSorted  sort_MRISaverageGradients_index_isSorted
-#define SORT_NAME_small     sort_MRISaverageGradients_index_small
-   
-#define SORT_ELEMENT    int
-#define SORT_LE         MRISaverageGradients_index_le
-#include "sort_definition.h"
-
-static void MRISaverageGradients_optimize() {
-  typedef MRISaverageGradients_Data    Data;
-  typedef MRISaverageGradients_Control Control;
-
-  static bool once, optimize;
-  if (!once) { once = true;
-    optimize = !getenv("FREESURFER_MRISaverageGradients_optimize_suppress");
-    if (!optimize) {
-      fprintf(stdout, "FREESURFER_MRISaverageGradients_optimize_suppress so not optimizing\n");
-    }
-  }
-  
-  if (!optimize) {
-    free(MRISaverageGradients_new2old_indexMap);
-    free(MRISaverageGradients_old2new_indexMap);
-    return;
-  }
-  
-  int                                 const controls_and_data_size  = MRISaverageGradients_controls_and_data_size;
-  const MRISaverageGradients_Control* const controls                = MRISaverageGradients_controls;
-  const MRISaverageGradients_Data*    const datas_init              = MRISaverageGradients_datas_init;
-  const int*                          const neighbors               = MRISaverageGradients_neighbors;
-  int                                 const neighbors_size          = MRISaverageGradients_neighbors_size;
-
-  int* new2old_indexMap = MRISaverageGradients_new2old_indexMap;
-  int* old2new_indexMap = MRISaverageGradients_old2new_indexMap;
-
-  // sort the old indices to get the order to process the old indices in
-  new2old_indexMap = (int*)realloc(new2old_indexMap, controls_and_data_size*sizeof(int));
-  int ni;
-  for (ni = 0; ni < controls_and_data_size; ni++) {
-    new2old_indexMap[ni] = ni;
-  }
-  
-  sort_MRISaverageGradients_index(new2old_indexMap, controls_and_data_size, true);
-
-  // compute the inverse
-  old2new_indexMap = (int*)realloc(old2new_indexMap, controls_and_data_size*sizeof(int));
-  for (ni = 0; ni < controls_and_data_size; ni++) {
-    int oi = new2old_indexMap[ni];
-    old2new_indexMap[oi] = ni;
+static void mrisAverageGradients(MRIS *mris, int num_avgs)
+{
+  int const nvertices = mris->nvertices;
+  float *d = (float *)malloc(3 * (size_t)nvertices * sizeof(float));
+  if (!d) {
+    ErrorExit(ERROR_NOMEMORY, "mrisAverageGradients: could not allocate %d gradients", nvertices);
   }
-  
-  // permute the program
-  int*	   const new_neighbors  = (int    *)malloc(neighbors_size         * sizeof(int));
-  Data*	   const new_datas_init = (Data   *)malloc(controls_and_data_size * sizeof(Data));
-  Control* const new_controls   = (Control*)malloc(controls_and_data_size * sizeof(Control));
-  int            new_neighborsSize = 0;
-  for (ni = 0; ni < controls_and_data_size; ni++) {
-    int const old_index         = new2old_indexMap[ni];
-    int const old_firstNeighbor = controls[old_index].firstNeighbor;
-    int const numNeighbors      = controls[old_index].numNeighbors;
-    new_controls[ni].numNeighbors  = numNeighbors;
-    new_controls[ni].firstNeighbor = new_neighborsSize;
-    int j;
-    for (j = 0; j < numNeighbors; j++) {
-      new_neighbors[new_neighborsSize++] = old2new_indexMap[neighbors[old_firstNeighbor + j]];	
-    }
-    new_datas_init[ni] = datas_init[old_index];
+  int vno;
+  for (vno = 0; vno < nvertices; vno++) {
+    VERTEX const * const v = &mris->vertices[vno];
+    d[3 * vno + 0] = v->dx;
+    d[3 * vno + 1] = v->dy;
+    d[3 * vno + 2] = v->dz;
   }
-    
-  free(MRISaverageGradients_datas_init); MRISaverageGradients_datas_init = new_datas_init;
-  free(MRISaverageGradients_controls);   MRISaverageGradients_controls   = new_controls;
-  free(MRISaverageGradients_neighbors);  MRISaverageGradients_neighbors  = new_neighbors;
-
-  MRISaverageGradients_new2old_indexMap = new2old_indexMap;
-  MRISaverageGradients_old2new_indexMap = old2new_indexMap;
-}
 
+  MRIS_AVERAGER *avg = MRISaveragerAlloc(mris, NULL, 0);
+  MRISaveragerApply(avg, d, 3, num_avgs);
+  MRISaveragerFree(&avg);
 
-static void MRISaverageGradients_write(
-  const char*                           filename,
-  int                                   num_avgs,
-  int                                   neighbors_size,
-  const int*                            neighbors,
-  int                                   index_to_vno_size,
-  const MRISaverageGradients_Control*   controls, 
-  const MRISaverageGradients_Data*      datas_inp) 
-{
-  fprintf(stdout, "%s:%d writing %s\n",__FILE__, __LINE__, filename);
-  int i;
-  FILE* f = fopen(filename, "w");
-  fprintf(f, "num_avgs:%d\n", num_avgs);
-  fprintf(f, "neighbors_size:%d\n", neighbors_size);
-  for (i = 0; i < neighbors_size; i++) fprintf(f, "  %5d %5d\n", i, neighbors[i]);
-  fprintf(f, "controls and data size:%d\n", index_to_vno_size);
-  for (i = 0; i < index_to_vno_size; i++) {
-    fprintf(f, "  %5d %5d %5d %g %g %g\n", 
-	          i, 
-		  controls[i].numNeighbors, controls[i].firstNeighbor, 
-		  datas_inp[i].dx, datas_inp[i].dy, datas_inp[i].dz);
+  for (vno = 0; vno < nvertices; vno++) {
+    VERTEX * const v = &mris->vertices[vno];
+    if (v->ripflag) {
+      continue;
+    }
+    v->dx = v->tdx = d[3 * vno + 0];
+    v->dy = v->tdy = d[3 * vno + 1];
+    v->dz = v->tdz = d[3 * vno + 2];
   }
-  fclose(f);
-  fprintf(stdout, "%s:%d finished writing %s\n",__FILE__, __LINE__, filename);
+  free(d);
 }
 
+/*-----------------------------------------------------
+  MRISaverageGradients() - spatially smooths gradients (dx,dy,dz)
+  using num_avgs nearest-neighbor averages. See also
+  MRISaverageGradientsFast()
+  ------------------------------------------------------*/
 int MRISaverageGradients(MRIS *mris, int num_avgs)
 {
-  int i, vno;
-  float sigma;
   VERTEX *v;
-  MRI_SP *mrisp, *mrisp_blur;
-  const char *UFSS;
 
-  // Must explicity "setenv USE_FAST_SURF_SMOOTHER 0" to turn off fast
-  UFSS = getenv("USE_FAST_SURF_SMOOTHER");
-  if (!UFSS) {
-    UFSS = "1";
-  }
-#ifdef HAVE_OPENMP
-  UFSS = "0";  // MRISaverageGradientsFast can't use openmp
-#endif
-  if (strcmp(UFSS, "0")) {
-    i = MRISaverageGradientsFast(mris, num_avgs);
-    return (i);
-  }
   if (Gdiag_no > 0 && DIAG_VERBOSE_ON) {
     printf("MRISaverageGradients()\n");
   }
 
-  // Below is not used if using Fast
   if (num_avgs <= 0) {
     return (NO_ERROR);
   }
@@ -9357,378 +9622,8 @@ int MRISaverageGradients(MRIS *mris, int num_avgs)
     v = &mris->vertices[Gdiag_no];
     fprintf(stdout, "before averaging %d times dot = %2.2f ", num_avgs, v->dx * v->nx + v->dy * v->ny + v->dz * v->nz);
   }
-  // use convolution
-  if (0 && mris->status == MRIS_PARAMETERIZED_SPHERE) {
-    sigma = sqrt((float)num_avgs) / 4.0;
-    mrisp = MRISgradientToParameterization(mris, NULL, 1.0);
-    mrisp_blur = MRISPblur(mrisp, NULL, sigma, -1);
-    MRISgradientFromParameterization(mrisp_blur, mris);
-    MRISPfree(&mrisp);
-    MRISPfree(&mrisp_blur);
-  }
-  else
-  {
-    // This code shows the num_avgs typically is repeated 1-4 times as 1024, 256, 64, 16, 4, and then 1
-    if (0) {
-      static int num_avgs_being_counted = 0;
-      static int count = 0;
-      static int limit = 1;
-      int changing = (num_avgs_being_counted != num_avgs);
-      if (changing || count == limit) {
-        if (count > 0) {
-          fprintf(stderr,"%s:%d num_avgs:%d count:%d\n",__FILE__,__LINE__,num_avgs_being_counted,count);
-          fprintf(stdout,"%s:%d num_avgs:%d count:%d\n",__FILE__,__LINE__,num_avgs_being_counted,count);
-        }
-        if (!changing) limit *= 2;
-        else {
-          num_avgs_being_counted = num_avgs;
-          count = 0;
-          limit = 1;
-        }
-      }
-      count++;
-    }
-
-    // Since the num_avgs is so high there are far more efficient ways to iterate.
-    // The following implementation is one of them.
-
-    // The following code supports three ways of doing the two algorithms
-    // - only the old algorithm
-    // - only the new algorithm
-    // - both algorithms, and compare them
-    
-    static int doNew = 1;
-    static int doOld = 0;
-    
-    if (doOld && doNew && num_avgs > 10) {
-        fprintf(stdout, "%s:%d reducing num_avgs:%d to 10\n", __FILE__, __LINE__, num_avgs);
-        num_avgs = 10;
-    }
-     
-    // This is the new algorithm
-    int *vno_to_index = NULL;
-    int *index_to_vno = NULL;
-    int  index_to_vno_size = 0;
-    
-    typedef MRISaverageGradients_Data Data;
-    Data *datas_inp = NULL;
-    Data *datas_out = NULL;
-
-    typedef MRISaverageGradients_Control Control;
-    Control *controls = NULL;
-
-    int  neighbors_capacity = 0;
-    int  neighbors_size     = 0;
-    int *neighbors          = NULL;
-    
-    if (doNew) {
-    
-      // Malloc the needed storage
-      vno_to_index = (int*)    malloc(sizeof(int)     * mris->nvertices) ;
-      index_to_vno = (int*)    malloc(sizeof(int)     * mris->nvertices) ;
-      datas_inp    = (Data*)   malloc(sizeof(Data)    * mris->nvertices) ;
-      datas_out    = (Data*)   malloc(sizeof(Data)    * mris->nvertices) ;
-      controls     = (Control*)malloc(sizeof(Control) * mris->nvertices) ;
-    
-      // Find all the vertices that will change
-      // Ripped ones, and those whose neighbors are all ripped,
-      // will not change and hence are not entered
-      for (vno = 0 ; vno < mris->nvertices ; vno++)
-      {
-        VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
-        VERTEX          const * const v  = &mris->vertices         [vno];
-        
-        int num = 0;
-        if (!v->ripflag) {
-          num = 1;
-          // At this stage the neighbors with higher vno's will not have 
-          // been entered into the vno_to_index table
-          int  vnum = vt->vnum;
-          int const *pnb  = vt->v;
-          int  vnb;
-          for (vnb = 0; vnb < vnum; vnb++) {
-            int neighborVno = *pnb++;
-            VERTEX* vn = &mris->vertices[neighborVno]; // neighboring vertex pointer
-            if (vn->ripflag) continue;
-            num++;
-          }
-        }
-        
-        if (num <= 1) {
-          vno_to_index[vno] = -1;
-        } else {
-          vno_to_index[vno] = index_to_vno_size;
-          index_to_vno[index_to_vno_size] = vno;
-          Data *d = datas_inp + index_to_vno_size;
-          d->dx = v->dx;
-          d->dy = v->dy;
-          d->dz = v->dz;
-          Control *c = controls + index_to_vno_size;
-          c->numNeighbors = num - 1;
-          index_to_vno_size++;
-        }
-      }
-      
-      // For each vertex that will change, fill in the index of the vertices it must average with.
-      // There could be many of them, so this array vector grows as needed.
-      neighbors_capacity = 6 * index_to_vno_size;
-      neighbors_size     = 0;
-      neighbors          = (int*)malloc(sizeof(int) * neighbors_capacity);
-      
-      int index;
-      for (index = 0; index < index_to_vno_size; index++) {
-        const int vno = index_to_vno[index];
-        Control *const c = controls + index;
-        c->firstNeighbor = neighbors_size;
-        VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
-        int const vnum = vt->vnum;
-        int const *pnb = vt->v;
-        int vnb;
-        for (vnb = 0; vnb < vnum; vnb++) {
-          int const neighborVno = *pnb++;
-          int const neighborIndex = vno_to_index[neighborVno];
-          if (neighborIndex < 0) continue;  // ripflag must be set
-          if (neighbors_size == neighbors_capacity) {
-            int  const new_neighbors_capacity = neighbors_capacity + neighbors_capacity/2;
-            int* const new_neighbors = (int*)malloc(sizeof(int) * new_neighbors_capacity);
-            int i; 
-            for (i = 0; i < neighbors_size; i++) new_neighbors[i] = neighbors[i];
-            free(neighbors);
-            neighbors = new_neighbors ;
-            neighbors_capacity = new_neighbors_capacity ;
-          }
-          neighbors[neighbors_size++] = neighborIndex ;
-        }      
-      }
-      
-      // Print out for later investigation
-      //
-      if (0) {
-        static int once;
-	if (!once++) {
-          MRISaverageGradients_write("tesselation_averaging_data.txt",
-            num_avgs, neighbors_size, neighbors, index_to_vno_size, controls, datas_inp);
-	}
-      }
-
-      // Optimize enough iterations to payback the cost
-      //
-      freeAndNULL(MRISaverageGradients_new2old_indexMap);
-      freeAndNULL(MRISaverageGradients_old2new_indexMap);
-
-      if (num_avgs > 150) {
-
-        MRISaverageGradients_neighbors_size         = neighbors_size;
-        MRISaverageGradients_neighbors              = neighbors;
-        MRISaverageGradients_controls_and_data_size = index_to_vno_size;
-        MRISaverageGradients_controls               = controls;
-        MRISaverageGradients_datas_init             = datas_inp;
 
-        MRISaverageGradients_optimize();
-
-        neighbors_size    = MRISaverageGradients_neighbors_size;
-        neighbors         = MRISaverageGradients_neighbors;
-        index_to_vno_size = MRISaverageGradients_controls_and_data_size;
-        controls          = MRISaverageGradients_controls;
-        datas_inp         = MRISaverageGradients_datas_init;
-      }
-      
-      if (0) {
-        static int once;
-	if (!once++) {
-          MRISaverageGradients_write("tesselation_averaging_data.optimized.txt", 
-            num_avgs, neighbors_size, neighbors, index_to_vno_size, controls, datas_inp);
-	}
-      }
-
-      // Choose chunk size assuming should evenly distribute the number of neighbors to process
-      //
-      typedef struct Chunk { int indexLo; } Chunk;
-#define chunksCapacity 17  // 4 * omp_get_max_threads() + 1 // must be at least 3
-      Chunk chunks[chunksCapacity];
-      size_t chunksSize = 0;
-      { int const neighborsPerChunk = neighbors_size/(chunksCapacity-1);
-        int chunkSumNumNeighbors = 0;
-        chunks[chunksSize++].indexLo = 0;
-        int index;
-        for (index = 0; index < index_to_vno_size; index++ ) {
-          Control *c = controls  + index;
-          chunkSumNumNeighbors += c->numNeighbors;
-          if (chunkSumNumNeighbors < neighborsPerChunk) continue;
-          chunks[chunksSize++].indexLo = index;
-          chunkSumNumNeighbors = 0;
-          if (chunksSize == chunksCapacity-1) break;
-        }
-        chunks[chunksSize++].indexLo = index_to_vno_size;
-      }
-#undef chunksCapacity
-
-      // Do all the iterations
-      for (i = 0 ; i < num_avgs ; i++) {
-        
-        unsigned int chunksIndex;
-        ROMP_PF_begin
-#ifdef HAVE_OPENMP
-        #pragma omp parallel for if_ROMP(assume_reproducible)
-#endif
-        for (chunksIndex = 0; chunksIndex < chunksSize-1 ; chunksIndex++ ) {
-          int
-            indexLo = chunks[chunksIndex  ].indexLo, 
-            indexHi = chunks[chunksIndex+1].indexLo;
-          int index;
-          for (index = indexLo; index < indexHi; index++ ) {
-	    ROMP_PFLB_begin
-
-            Data *d = datas_inp + index;
-            Control *c = controls  + index;
-            float dx = d->dx, dy = d->dy, dz = d->dz;
-            
-            int *nearby = neighbors + c->firstNeighbor;
-            int n;
-            for (n = 0; n < c->numNeighbors; n++) {
-              int neighborIndex = nearby[n];
-              Data *neighborData = datas_inp + neighborIndex;
-              dx += neighborData->dx; dy += neighborData->dy; dz += neighborData->dz;
-            }
-
-            d = datas_out + index;
-            float inv_num = 1.0f/(c->numNeighbors + 1);
-            
-            d->dx = dx*inv_num ; d->dy = dy*inv_num ; d->dz = dz*inv_num; 
-          }	  
-	  ROMP_PFLB_end
-        }
-	ROMP_PF_end
-  
-        // swap the output and the input going into the next round
-        Data* tmp = datas_inp ; datas_inp = datas_out ; datas_out = tmp;
-      }
-    }
-    
-    // Only perform the old algorithm when needed
-    if (doOld) {
-    
-      // This is the old algorithm
-      for (i = 0 ; i < num_avgs ; i++) {
-  
-        ROMP_PF_begin
-#ifdef HAVE_OPENMP
-        #pragma omp parallel for if_ROMP(experimental)
-#endif
-  
-        for (vno = 0; vno < mris->nvertices; vno++) {
-	  ROMP_PFLB_begin
-	  
-          float dx, dy, dz, num;
-          int vnb, vnum;
-  
-          VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
-          VERTEX                * const v  = &mris->vertices         [vno];
-          if (v->ripflag) ROMP_PF_continue;
-  
-          dx  = v->dx;
-          dy  = v->dy;
-          dz  = v->dz;
-          int const * pnb = vt->v;
-          // vnum = vt->v2num ? vt->v2num : vt->vnum;
-          vnum = vt->vnum;
-          for (num = 0.0f, vnb = 0; vnb < vnum; vnb++) {
-            VERTEX const * const vn = &mris->vertices[*pnb++]; // neighboring vertex pointer
-            if (vn->ripflag) continue;
-  
-            num++;
-            dx += vn->dx;
-            dy += vn->dy;
-            dz += vn->dz;
-          }
-          num++;
-          v->tdx = dx / num;
-          v->tdy = dy / num;
-          v->tdz = dz / num;
-	  ROMP_PFLB_end
-        }
-	ROMP_PF_end
-	
-	ROMP_PF_begin
-#ifdef HAVE_OPENMP
-	#pragma omp parallel for if_ROMP(experimental) schedule(static, 1)
-#endif
-        for (vno = 0; vno < mris->nvertices; vno++) {
-	  ROMP_PFLB_begin
-	  
-          VERTEX * const v = &mris->vertices[vno];
-          if (v->ripflag) ROMP_PF_continue;
-  
-          v->dx = v->tdx;
-          v->dy = v->tdy;
-          v->dz = v->tdz;
-	  
-	  ROMP_PFLB_end
-        }
-	ROMP_PF_end
-	
-      }  // end of one of the num_avgs iterations
-
-    }  // if (doOld) 
-
-    if (doOld && doNew) {
-      fprintf(stdout, "%s:%d comparing old and new algorithms\n", __FILE__, __LINE__);
-      int errors = 0;
-      for (vno = 0 ; vno < mris->nvertices ; vno++) {
-        VERTEX *v = &mris->vertices[vno];
-        int old_index = vno_to_index[vno];
-        if (old_index == -1) {
-          // check has not changed - but this is not currently possible
-          // but could be enabled by making all these nodes go into the high end of the initial datas_inp vector
-        } else {
-          int new_index = MRISaverageGradients_old2new_indexMap ? MRISaverageGradients_old2new_indexMap[old_index] : old_index;
-          Data *d = datas_inp + new_index;
-          if (!closeEnough(d->dx,v->dx) || !closeEnough(d->dy,v->dy) || !closeEnough(d->dz,v->dz)) {
-            errors++;
-            if (errors < 10) {
-              fprintf(stdout,"%s:%d vno:%d d->dx:%g v->dx:%g d->dy:%g v->dy:%g d->dz:%g v->dz:%g - datas_inp\n",__FILE__,__LINE__,
-                      vno, d->dx, v->dx, d->dy, v->dy, d->dz, v->dz);
-            }
-          }
-          
-        }
-      }
-      fprintf(stderr,"%s:%d errors:%d\n",__FILE__,__LINE__,errors);
-      if (errors > 0) exit (103);
-    }
-
-    // Put the results where they belong
-    // Note: this code does not set tdx, etc. - I believe they are temporaries   
-    if (doNew) {
-      int errors = 0;
-      int new_index;
-      for (new_index = 0 ; new_index < index_to_vno_size; new_index++) {
-
-        int old_index = MRISaverageGradients_new2old_indexMap ? MRISaverageGradients_new2old_indexMap[new_index] : new_index;
-
-        int vno   = index_to_vno[old_index];
-        VERTEX *v = &mris->vertices[vno];
-        Data   *d = datas_inp + new_index;
-        
-        v->dx = d->dx;
-        v->dy = d->dy;
-        v->dz = d->dz;
-      }
-
-      if (errors > 0) {
-        fprintf(stderr,"%s:%d errors:%d\n",__FILE__,__LINE__,errors);
-        exit (104);
-      }
-      
-      free(datas_out); 
-      free(datas_inp);
-      free(neighbors); 
-      free(controls);
-      
-      free(index_to_vno);
-      free(vno_to_index);
-    }
-  }
+  mrisAverageGradients(mris, num_avgs);
 
   if (Gdiag_no >= 0) {
     float dot;
@@ -9743,137 +9638,19 @@ int MRISaverageGradients(MRIS *mris, int num_avgs)
 
 /*-----------------------------------------------------
   MRISaverageGradientsFast() - spatially smooths gradients (dx,dy,dz)
-  using num_avgs nearest-neighbor averages. This is a faster version
-  of MRISaverageGradients(). Should be about 40% faster. It also gives
-  identical results as can be verified with MRISaverageGradientsFastCheck().
+  using num_avgs nearest-neighbor averages. This used to be a faster
+  version of MRISaverageGradients(); both now use the same sparse
+  averaging operator and give identical results, as can be verified with
+  MRISaverageGradientsFastCheck().
   ------------------------------------------------------*/
 int MRISaverageGradientsFast(MRIS *mris, int num_avgs)
 {
-  int vno, vnb, *pnb, num, nthavg;
-
-  float const **pdx, **pdy, **pdz;
-  float sumdx, sumdy, sumdz;
-  float const **pdx0, **pdy0, **pdz0;
-  float *tdx, *tdy, *tdz, *tdx0, *tdy0, *tdz0;
-  int *nNbrs, *nNbrs0, *rip, *rip0, nNbrsMax;
-
   if (Gdiag_no > 0 && DIAG_VERBOSE_ON) {
     printf("MRISaverageGradientsFast()\n");
   }
-
-  // Alloc arrays. If there are ripped vertices, then only rip
-  // needs nvertices elements
-  nNbrsMax = 12;  // Should measure this, but overalloc does not hurt
-  pdx = (float const **)calloc(mris->nvertices * nNbrsMax, sizeof(float *));
-  pdy = (float const **)calloc(mris->nvertices * nNbrsMax, sizeof(float *));
-  pdz = (float const **)calloc(mris->nvertices * nNbrsMax, sizeof(float *));
-  tdx = (float        *)calloc(mris->nvertices,            sizeof(float));
-  tdy = (float        *)calloc(mris->nvertices,            sizeof(float));
-  tdz = (float        *)calloc(mris->nvertices,            sizeof(float));
-  nNbrs = (int        *)calloc(mris->nvertices,            sizeof(int));
-  rip = (int          *)calloc(mris->nvertices,            sizeof(int));
-
-  pdx0 = pdx;
-  pdy0 = pdy;
-  pdz0 = pdz;
-  tdx0 = tdx;
-  tdy0 = tdy;
-  tdz0 = tdz;
-  rip0 = rip;
-  nNbrs0 = nNbrs;
-
-  // Set up pointers
-  for (vno = 0; vno < mris->nvertices; vno++) {
-    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
-    VERTEX                * const v  = &mris->vertices         [vno];
-    if (v->ripflag) {
-      rip[vno] = 1;
-      continue;
-    }
-    rip[vno] = 0;
-    *pdx++ = &(v->dx);
-    *pdy++ = &(v->dy);
-    *pdz++ = &(v->dz);
-    pnb = vt->v;
-    num = 1;
-    for (vnb = 0; vnb < vt->vnum; vnb++) {
-      VERTEX const * const vn = &mris->vertices[*pnb++]; /* neighboring vertex pointer */
-      if (vn->ripflag) {
-        continue;
-      }
-      *pdx++ = &(vn->dx);
-      *pdy++ = &(vn->dy);
-      *pdz++ = &(vn->dz);
-      num++;
-    }
-    *nNbrs++ = num;
-  }
-
-  // Loop through the iterations
-  for (nthavg = 0; nthavg < num_avgs; nthavg++) {
-    // Init pointers for this iteration
-    pdx = pdx0;
-    pdy = pdy0;
-    pdz = pdz0;
-    rip = rip0;
-    nNbrs = nNbrs0;
-    tdx = tdx0;
-    tdy = tdy0;
-    tdz = tdz0;
-    // Loop through vertices, average nearest neighbors
-    for (vno = 0; vno < mris->nvertices; vno++) {
-      if (*rip++) {
-        continue;
-      }
-      sumdx = *(*pdx++);
-      sumdy = *(*pdy++);
-      sumdz = *(*pdz++);
-      for (vnb = 0; vnb < (*nNbrs) - 1; vnb++) {
-        sumdx += *(*pdx++);
-        sumdy += *(*pdy++);
-        sumdz += *(*pdz++);
-      }
-      *tdx++ = sumdx / (*nNbrs);
-      *tdy++ = sumdy / (*nNbrs);
-      *tdz++ = sumdz / (*nNbrs);
-      nNbrs++;
-    }
-    // Load up for the next round
-    rip = rip0;
-    tdx = tdx0;
-    tdy = tdy0;
-    tdz = tdz0;
-    for (vno = 0; vno < mris->nvertices; vno++) {
-      if (*rip++) {
-        continue;
-      }
-      VERTEX * const v = &mris->vertices[vno];
-      v->dx = *tdx++;
-      v->dy = *tdy++;
-      v->dz = *tdz++;
-    }
-  }
-
-  rip = rip0;
-  for (vno = 0; vno < mris->nvertices; vno++) {
-    if (*rip++) {
-      continue;
-    }
-    VERTEX * const v = &mris->vertices[vno];
-    v->tdx = v->dx;
-    v->tdy = v->dy;
-    v->tdz = v->dz;
+  if (num_avgs > 0) {
+    mrisAverageGradients(mris, num_avgs);
   }
-
-  free(pdx0);
-  free(pdy0);
-  free(pdz0);
-  free(tdx0);
-  free(tdy0);
-  free(tdz0);
-  free(rip0);
-  free(nNbrs0);
-
   return (NO_ERROR);
 }
 /*--------------------------------------------------------*/
@@ -435,6 +435,7 @@ int MRISpositionSurfaces(MRI_SURFACE *mris, MRI **mri_flash, int nvolumes, INTEG
   if (!(parms->flags & IPFLAG_NO_SELF_INT_TEST)) {
     MHTfree(&mht);
   }
+  MRISsoaFree(&parms->soa);
   return (NO_ERROR);
 }
 
@@ -609,11 +610,11 @@ int MRISpositionSurface(MRI_SURFACE *mris, MRI *mri_brain, MRI *mri_smooth, INTE
       (*gMRISexternalGradient)(mris, parms);
     }
     /*mrisMarkSulcalVertices(mris, parms) ;*/
-    mrisComputeLaplacianTerm(mris, parms->l_lap);
+    mrisComputeLaplacianTerm(mris, parms->l_lap, &parms->soa);
     mrisAverageSignedGradients(mris, avgs);
     /*mrisUpdateSulcalGradients(mris, parms) ;*/
     /* smoothness terms */
-    mrisComputeSpringTerm(mris, parms->l_spring);
+    mrisComputeSpringTerm(mris, parms->l_spring, &parms->soa);
     if(parms->l_hinge > 0 || parms->l_spring_nzr > 0){
       if(mris->edges == NULL){
 	printf("First pass, creating edges\n");
@@ -636,7 +637,7 @@ int MRISpositionSurface(MRI_SURFACE *mris, MRI *mri_brain, MRI *mri_smooth, INTE
       printf("#@%% hinge cost weight=%g, cost = %g\n",parms->l_hinge,hingecost);
 
     }
-    mrisComputeNormalizedSpringTerm(mris, parms->l_spring_norm);
+    mrisComputeNormalizedSpringTerm(mris, parms->l_spring_norm, &parms->soa);
     mrisComputeRepulsiveTerm(mris, parms->l_repulse, mht_v_current, mht_f_current);
     mrisComputeThicknessSmoothnessTerm(mris, parms->l_tsmooth, parms);
     mrisComputeThicknessMinimizationTerm(mris, parms->l_thick_min, parms);
@@ -646,7 +647,7 @@ int MRISpositionSurface(MRI_SURFACE *mris, MRI *mri_brain, MRI *mri_smooth, INTE
     /*mrisComputeAverageNormalTerm(mris, avgs, parms->l_nspring) ;*/
     /*mrisComputeCurvatureTerm(mris, parms->l_curv) ;*/
     mrisComputeNonlinearSpringTerm(mris, parms->l_nlspring, parms);
-    mrisComputeTangentialSpringTerm(mris, parms->l_tspring);
+    mrisComputeTangentialSpringTerm(mris, parms->l_tspring, &parms->soa);
     mrisComputeNonlinearTangentialSpringTerm(mris, parms->l_nltspring, parms->min_dist);
     mrisComputeMaxSpringTerm(mris, parms->l_max_spring);
     mrisComputeAngleAreaTerms(mris, parms);
@@ -868,6 +869,7 @@ int MRISpositionSurface(MRI_SURFACE *mris, MRI *mri_brain, MRI *mri_smooth, INTE
   if (mht_v_orig) {
     MHTfree(&mht_v_orig);
   }
+  MRISsoaFree(&parms->soa);
 
   return (NO_ERROR);
 }
@@ -967,9 +969,7 @@ int MRISpositionSurface_mef(
     /*                mrisUpdateSulcalGradients(mris, parms) ;*/
 
     /* smoothness terms */
-    mrisComputeSpringTerm(mris, parms->l_spring);
-    mrisComputeLaplacianTerm(mris, parms->l_lap);
-    mrisComputeNormalizedSpringTerm(mris, parms->l_spring_norm);
+    mrisComputeSpringTerms(mris, parms->l_spring, parms->l_lap, parms->l_spring_norm, &parms->soa);
     mrisComputeRepulsiveTerm(mris, parms->l_repulse, mht_v_current, mht_f_current);
     mrisComputeThicknessSmoothnessTerm(mris, parms->l_tsmooth, parms);
     mrisComputeThicknessMinimizationTerm(mris, parms->l_thick_min, parms);
@@ -977,7 +977,7 @@ int MRISpositionSurface_mef(
     mrisComputeNormalSpringTerm(mris, parms->l_nspring);
     mrisComputeQuadraticCurvatureTerm(mris, parms->l_curv);
     mrisComputeNonlinearSpringTerm(mris, parms->l_nlspring, parms);
-    mrisComputeTangentialSpringTerm(mris, parms->l_tspring);
+    mrisComputeTangentialSpringTerm(mris, parms->l_tspring, &parms->soa);
     mrisComputeNonlinearTangentialSpringTerm(mris, parms->l_nltspring, parms->min_dist);
 
     do {
@@ -1067,6 +1067,7 @@ int MRISpositionSurface_mef(
   if (mht_v_orig) {
     MHTfree(&mht_v_orig);
   }
+  MRISsoaFree(&parms->soa);
   return (NO_ERROR);
 }
 
@@ -5370,12 +5371,9 @@ MRI *MRISsmoothMRI(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *BinMask, MRI *Ta
   -------------------------------------------------------------------*/
 MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI *Targ)
 {
-  int nnbrs, nthstep, frame, vno, nthnbr, num, nvox, nbrvno, reshape;
+  int frame, vno, c, nchannels, nvox, reshape;
   MRI *SrcTmp, *mritmp, *IncMaskTmp = NULL;
   int msecTime;
-  int *nNbrs, *nNbrs0, *rip, *rip0, nNbrsMax;
-  float **pF, **pF0, *tF, *tF0, sumF;
-  VERTEX *v, *vn;
 
   if (Gdiag_no > 0) printf("MRISsmoothMRIFast()\n");
 
@@ -5415,85 +5413,33 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
     }
   }
 
-  // Alloc arrays. If there are ripped vertices, then only rip
-  // needs nvertices elements
-  nNbrsMax = 12;  // Should measure this, but overalloc does not hurt
-  pF = (float **)calloc(Surf->nvertices * nNbrsMax, sizeof(float *));
-  tF = (float *)calloc(Surf->nvertices, sizeof(float));
-  nNbrs = (int *)calloc(Surf->nvertices, sizeof(int));
-  rip = (int *)calloc(Surf->nvertices, sizeof(int));
-
-  pF0 = pF;
-  tF0 = tF;
-  rip0 = rip;
-  nNbrs0 = nNbrs;
+  // The mask is inclusive, so vertices out of the mask neither change nor
+  // contribute. Ripped vertices in the mask are smoothed (but do not
+  // contribute to their neighbors), as in MRISsmoothMRI().
+  float *mask = NULL;
+  if (IncMaskTmp) {
+    mask = (float *)malloc(Surf->nvertices * sizeof(float));
+    for (vno = 0; vno < Surf->nvertices; vno++) mask[vno] = MRIgetVoxVal(IncMaskTmp, vno, 0, 0, 0);
+  }
+  MRIS_AVERAGER *avg = MRISaveragerAlloc(Surf, mask, MRIS_AVERAGER_RIPPED_CENTERS);
 
   Timer mytimer;
 
-  // Loop through frames
-  for (frame = 0; frame < Src->nframes; frame++) {
-    // Set up pointers for this frame
-    pF = pF0;
-    rip = rip0;
-    nNbrs = nNbrs0;
+  // Smooth up to three frames at a time, interleaved
+  float *vals = (float *)malloc(3 * (size_t)Surf->nvertices * sizeof(float));
+  for (frame = 0; frame < Src->nframes; frame += nchannels) {
+    nchannels = MIN(3, Src->nframes - frame);
     for (vno = 0; vno < Surf->nvertices; vno++) {
-      v = &Surf->vertices[vno];
-      if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, vno, 0, 0, 0) < 0.5) {
-        // Mask is inclusive, so look for out of mask
-        // should exclude rips here too? Original does not.
-        rip[vno] = 1;
-        MRIFseq_vox(SrcTmp, vno, 0, 0, frame) = 0;
-        continue;
-      }
-      rip[vno] = 0;
-      *pF++ = (float *)(&(MRIFseq_vox(SrcTmp, vno, 0, 0, frame)));
-      nnbrs = Surf->vertices_topology[vno].vnum;
-      num = 1;
-      for (nthnbr = 0; nthnbr < nnbrs; nthnbr++) {
-        nbrvno = Surf->vertices_topology[vno].v[nthnbr];
-        vn = &Surf->vertices[nbrvno];
-        if (vn->ripflag) {
-          continue;
-        }
-        if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, nbrvno, 0, 0, 0) < 0.5) {
-          continue;
-        }
-        *pF++ = (float *)(&(MRIFseq_vox(SrcTmp, nbrvno, 0, 0, frame)));
-        num++;
+      for (c = 0; c < nchannels; c++) {
+        if (mask && mask[vno] < 0.5)
+          MRIFseq_vox(SrcTmp, vno, 0, 0, frame + c) = 0;
+        vals[(size_t)vno * nchannels + c] = MRIFseq_vox(SrcTmp, vno, 0, 0, frame + c);
       }
-      *nNbrs++ = num;  // num takes into account all rips/masks
     }
-
-    // Step through the iterations
-    for (nthstep = 0; nthstep < nSmoothSteps; nthstep++) {
-      // Init pointers for this iteration
-      pF = pF0;
-      rip = rip0;
-      tF = tF0;
-      nNbrs = nNbrs0;
-      // Loop through vertices, average nearest neighbors
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) {
-          continue;
-        }
-        sumF = *(*pF++);
-        for (nthnbr = 0; nthnbr < (*nNbrs) - 1; nthnbr++) {
-          sumF += *(*pF++);
-        }
-        *tF++ = sumF / (*nNbrs);
-        nNbrs++;
-      }
-      // Load up for the next step
-      rip = rip0;
-      tF = tF0;
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) {
-          continue;
-        }
-        MRIsetVoxVal(SrcTmp, vno, 0, 0, frame, *tF++);
-      }
+    MRISaveragerApply(avg, vals, nchannels, nSmoothSteps);
+    for (vno = 0; vno < Surf->nvertices; vno++) {
+      for (c = 0; c < nchannels; c++) MRIFseq_vox(SrcTmp, vno, 0, 0, frame + c) = vals[(size_t)vno * nchannels + c];
     }
-
   } /* end loop over frame */
 
   // Copy to the output
@@ -5514,10 +5460,9 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
 
   MRIfree(&SrcTmp);
   if (IncMaskTmp) MRIfree(&IncMaskTmp);
-  free(pF0);
-  free(tF0);
-  free(rip0);
-  free(nNbrs0);
+  MRISaveragerFree(&avg);
+  free(vals);
+  free(mask);
 
   return (Targ);
 }
@@ -0,0 +1,364 @@
+/**
+ * @brief structure-of-arrays copies of the vertex fields used by the geometric sweeps
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+#include "mrisurf_base.h"
+#include "mrisurf_compute_dxyz.h"
+
+
+// A VERTEX is several hundred bytes, so a sweep that reads the positions
+// and ripflags of the one-ring neighbors of every vertex pulls one or two
+// cache lines per neighbor to use a dozen bytes of them. MRIS_SOA holds the
+// few fields such a sweep needs in one array per field, so the neighbor
+// reads hit packed floats and the per-vertex work vectorizes. The VERTEX
+// array stays the representation the rest of the code reads and writes:
+// load the groups a sweep needs, run it on the arrays and store back the
+// groups it changed. So far only the spring and Laplacian terms of the
+// integration loops do this, and each of their calls still loads and
+// stores every vertex of the groups it uses; what is saved is the random
+// access to the neighbors, not the copy.
+
+
+#define MRIS_SOA_FLOAT_GROUPS (MRIS_SOA_XYZ | MRIS_SOA_NORMALS | MRIS_SOA_DXYZ | MRIS_SOA_TMP2)
+
+static float *mrisSoaFloats(int nvertices)
+{
+  float *p = (float *)malloc(((size_t)nvertices + 1) * sizeof(float));
+  if (!p) {
+    ErrorExit(ERROR_NOMEMORY, "MRISsoaAlloc: could not allocate %d floats", nvertices);
+  }
+  return p;
+}
+
+static char *mrisSoaChars(int nvertices)
+{
+  char *p = (char *)malloc(((size_t)nvertices + 1) * sizeof(char));
+  if (!p) {
+    ErrorExit(ERROR_NOMEMORY, "MRISsoaAlloc: could not allocate %d flags", nvertices);
+  }
+  return p;
+}
+
+/*-----------------------------------------------------
+  MRISsoaAlloc() - allocate the arrays of the MRIS_SOA_* groups in fields
+  and load them from mris. The one-ring neighbor table is always built.
+  ------------------------------------------------------*/
+MRIS_SOA *MRISsoaAlloc(MRIS *mris, int fields)
+{
+  int const nvertices = mris->nvertices;
+
+  MRIS_SOA *soa = (MRIS_SOA *)calloc(1, sizeof(MRIS_SOA));
+  if (!soa) {
+    ErrorExit(ERROR_NOMEMORY, "MRISsoaAlloc: could not allocate arrays");
+  }
+  soa->nvertices = nvertices;
+  soa->nfaces = mris->nfaces;
+  soa->topology_clock = mris->topology_clock;
+  soa->fields = fields;
+
+  if (fields & MRIS_SOA_XYZ) {
+    soa->x = mrisSoaFloats(nvertices);
+    soa->y = mrisSoaFloats(nvertices);
+    soa->z = mrisSoaFloats(nvertices);
+  }
+  if (fields & MRIS_SOA_NORMALS) {
+    soa->nx = mrisSoaFloats(nvertices);
+    soa->ny = mrisSoaFloats(nvertices);
+    soa->nz = mrisSoaFloats(nvertices);
+  }
+  if (fields & MRIS_SOA_DXYZ) {
+    soa->dx = mrisSoaFloats(nvertices);
+    soa->dy = mrisSoaFloats(nvertices);
+    soa->dz = mrisSoaFloats(nvertices);
+  }
+  if (fields & MRIS_SOA_TMP2) {
+    soa->t2x = mrisSoaFloats(nvertices);
+    soa->t2y = mrisSoaFloats(nvertices);
+    soa->t2z = mrisSoaFloats(nvertices);
+  }
+  if (fields & MRIS_SOA_FLAGS) {
+    soa->ripflag = mrisSoaChars(nvertices);
+    soa->border = mrisSoaChars(nvertices);
+    soa->neg = mrisSoaChars(nvertices);
+  }
+
+  size_t nnbrs = 0;
+  for (int vno = 0; vno < nvertices; vno++) {
+    nnbrs += mris->vertices_topology[vno].vnum;
+  }
+  soa->nbr_start = (int *)malloc(((size_t)nvertices + 1) * sizeof(int));
+  soa->nbrs = (int *)malloc((nnbrs + 1) * sizeof(int));
+  if (!soa->nbr_start || !soa->nbrs) {
+    ErrorExit(ERROR_NOMEMORY, "MRISsoaAlloc: could not allocate %zu neighbors", nnbrs);
+  }
+  int k = 0;
+  for (int vno = 0; vno < nvertices; vno++) {
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    soa->nbr_start[vno] = k;
+    for (int n = 0; n < vt->vnum; n++) {
+      soa->nbrs[k++] = vt->v[n];
+    }
+  }
+  soa->nbr_start[nvertices] = k;
+
+  MRISsoaLoad(soa, mris, fields);
+  return (soa);
+}
+
+void MRISsoaFree(MRIS_SOA **psoa)
+{
+  MRIS_SOA *soa = *psoa;
+  if (!soa) {
+    return;
+  }
+  *psoa = NULL;
+  free(soa->x);   free(soa->y);   free(soa->z);
+  free(soa->nx);  free(soa->ny);  free(soa->nz);
+  free(soa->dx);  free(soa->dy);  free(soa->dz);
+  free(soa->t2x); free(soa->t2y); free(soa->t2z);
+  free(soa->ripflag);
+  free(soa->border);
+  free(soa->neg);
+  free(soa->nbr_start);
+  free(soa->nbrs);
+  free(soa);
+}
+
+/*-----------------------------------------------------
+  MRISsoaAcquire() - load the MRIS_SOA_* groups in fields from mris into
+  *psoa and return it. *psoa is allocated if it is NULL, and freed and
+  allocated again (with the groups it had as well as fields) if it lacks
+  one of the groups or the topology of mris has changed since it was built
+  (mris->topology_clock is restamped by every change of the vertex
+  neighbors or faces, and no two surfaces share a stamp). Otherwise the
+  arrays and the neighbor table are reused, so an integration that keeps
+  *psoa across its steps only copies the vertex fields. The caller frees *psoa with MRISsoaFree.
+  ------------------------------------------------------*/
+MRIS_SOA *MRISsoaAcquire(MRIS_SOA **psoa, MRIS *mris, int fields)
+{
+  MRIS_SOA *soa = *psoa;
+
+  if (soa && (soa->nvertices != mris->nvertices || soa->nfaces != mris->nfaces ||
+              soa->topology_clock != mris->topology_clock || (fields & soa->fields) != fields)) {
+    fields |= soa->fields;
+    MRISsoaFree(psoa);
+    soa = NULL;
+  }
+  if (!soa) {
+    soa = *psoa = MRISsoaAlloc(mris, fields);
+  }
+  else {
+    MRISsoaLoad(soa, mris, fields);
+  }
+  return (soa);
+}
+
+/*-----------------------------------------------------
+  MRISsoaLoad() - copy the MRIS_SOA_* groups in fields from the vertices
+  of mris into soa. The groups must have been allocated.
+  ------------------------------------------------------*/
+int MRISsoaLoad(MRIS_SOA *soa, MRIS *mris, int fields)
+{
+  if ((fields & soa->fields) != fields || soa->nvertices != mris->nvertices) {
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM, "MRISsoaLoad: fields 0x%x not allocated for %d vertices", fields, mris->nvertices));
+  }
+
+  int vno;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static)
+#endif
+  for (vno = 0; vno < soa->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX const * const v = &mris->vertices[vno];
+    if (fields & MRIS_SOA_XYZ) {
+      soa->x[vno] = v->x;
+      soa->y[vno] = v->y;
+      soa->z[vno] = v->z;
+    }
+    if (fields & MRIS_SOA_NORMALS) {
+      soa->nx[vno] = v->nx;
+      soa->ny[vno] = v->ny;
+      soa->nz[vno] = v->nz;
+    }
+    if (fields & MRIS_SOA_DXYZ) {
+      soa->dx[vno] = v->dx;
+      soa->dy[vno] = v->dy;
+      soa->dz[vno] = v->dz;
+    }
+    if (fields & MRIS_SOA_TMP2) {
+      soa->t2x[vno] = v->t2x;
+      soa->t2y[vno] = v->t2y;
+      soa->t2z[vno] = v->t2z;
+    }
+    if (fields & MRIS_SOA_FLAGS) {
+      soa->ripflag[vno] = v->ripflag;
+      soa->border[vno] = v->border;
+      soa->neg[vno] = v->neg;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (NO_ERROR);
+}
+
+/*-----------------------------------------------------
+  MRISsoaStore() - copy the float groups in fields (not the flags, which
+  the sweeps only read) from soa back into the vertices of mris.
+  ------------------------------------------------------*/
+int MRISsoaStore(const MRIS_SOA *soa, MRIS *mris, int fields)
+{
+  fields &= MRIS_SOA_FLOAT_GROUPS;
+  if ((fields & soa->fields) != fields || soa->nvertices != mris->nvertices) {
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM, "MRISsoaStore: fields 0x%x not allocated for %d vertices", fields, mris->nvertices));
+  }
+
+  int vno;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static)
+#endif
+  for (vno = 0; vno < soa->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX * const v = &mris->vertices[vno];
+    if (fields & MRIS_SOA_XYZ) {
+      v->x = soa->x[vno];
+      v->y = soa->y[vno];
+      v->z = soa->z[vno];
+    }
+    if (fields & MRIS_SOA_NORMALS) {
+      v->nx = soa->nx[vno];
+      v->ny = soa->ny[vno];
+      v->nz = soa->nz[vno];
+    }
+    if (fields & MRIS_SOA_DXYZ) {
+      v->dx = soa->dx[vno];
+      v->dy = soa->dy[vno];
+      v->dz = soa->dz[vno];
+    }
+    if (fields & MRIS_SOA_TMP2) {
+      v->t2x = soa->t2x[vno];
+      v->t2y = soa->t2y[vno];
+      v->t2z = soa->t2z[vno];
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (NO_ERROR);
+}
+
+/*-----------------------------------------------------
+  MRISsoaBenchmark() - time ntimes spring term sweeps of the per-vertex
+  loop over the VERTEX structs against mrisComputeSpringTerms(), with the
+  arrays allocated for every sweep, kept across the sweeps, and without the
+  cost of loading and storing them, and check that the gradients agree.
+  Meant to be run on ic7 or fsaverage sized surfaces.
+  ------------------------------------------------------*/
+int MRISsoaBenchmark(MRIS *mris, int ntimes)
+{
+  int const nvertices = mris->nvertices;
+  float *ref = (float *)malloc(3 * (size_t)nvertices * sizeof(float));
+  if (!ref) {
+    ErrorExit(ERROR_NOMEMORY, "MRISsoaBenchmark: could not allocate gradients");
+  }
+
+  printf("structure-of-arrays benchmark: %d vertices, %d spring sweeps\n", nvertices, ntimes);
+
+  MRISclearGradient(mris);
+
+  // the loop of mrisComputeSpringTerm() before it used MRIS_SOA
+  float const dist_scale = mris->patch ? 1.0 : sqrt(mris->orig_area / mris->total_area);
+  Timer timer;
+  for (int i = 0; i < ntimes; i++) {
+    for (int vno = 0; vno < nvertices; vno++) {
+      VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+      VERTEX                * const v  = &mris->vertices         [vno];
+      if (v->ripflag || (v->border && !v->neg)) {
+        continue;
+      }
+      float sx = 0, sy = 0, sz = 0;
+      int n = 0;
+      for (int m = 0; m < vt->vnum; m++) {
+        VERTEX const * const vn = &mris->vertices[vt->v[m]];
+        if (!vn->ripflag) {
+          sx += vn->x - v->x;
+          sy += vn->y - v->y;
+          sz += vn->z - v->z;
+          n++;
+        }
+      }
+      if (n > 0) {
+        sx = dist_scale * sx / n;
+        sy = dist_scale * sy / n;
+        sz = dist_scale * sz / n;
+      }
+      v->dx += sx;
+      v->dy += sy;
+      v->dz += sz;
+    }
+  }
+  double const aos_ms = timer.seconds() * 1000.0;
+  for (int vno = 0; vno < nvertices; vno++) {
+    VERTEX * const v = &mris->vertices[vno];
+    ref[3 * vno + 0] = v->dx;
+    ref[3 * vno + 1] = v->dy;
+    ref[3 * vno + 2] = v->dz;
+  }
+
+  MRISclearGradient(mris);
+  timer.reset();
+  for (int i = 0; i < ntimes; i++) {
+    mrisComputeSpringTerms(mris, 1.0, 0.0, 0.0);
+  }
+  double const alloc_ms = timer.seconds() * 1000.0;
+
+  MRISclearGradient(mris);
+  MRIS_SOA *soa = NULL;
+  timer.reset();
+  for (int i = 0; i < ntimes; i++) {
+    mrisComputeSpringTerms(mris, 1.0, 0.0, 0.0, &soa);
+  }
+  double const soa_ms = timer.seconds() * 1000.0;
+  MRISsoaFree(&soa);
+
+  MRISclearGradient(mris);
+  soa = MRISsoaAlloc(mris, MRIS_SOA_XYZ | MRIS_SOA_DXYZ | MRIS_SOA_FLAGS);
+  timer.reset();
+  for (int i = 0; i < ntimes; i++) {
+    mrisComputeSpringTermsSoA(mris, soa, 1.0, 0.0, 0.0);
+  }
+  double const sweep_ms = timer.seconds() * 1000.0;
+  MRISsoaStore(soa, mris, MRIS_SOA_DXYZ);
+  MRISsoaFree(&soa);
+
+  double max_diff = 0;
+  for (int vno = 0; vno < nvertices; vno++) {
+    VERTEX const * const v = &mris->vertices[vno];
+    max_diff = MAX(max_diff, fabs(ref[3 * vno + 0] - v->dx));
+    max_diff = MAX(max_diff, fabs(ref[3 * vno + 1] - v->dy));
+    max_diff = MAX(max_diff, fabs(ref[3 * vno + 2] - v->dz));
+  }
+  printf("  per-vertex %8.2f ms, arrays allocated per sweep %8.2f ms (speedup %5.2f), arrays kept across sweeps %8.2f ms "
+         "(speedup %5.2f), arrays without load/store %8.2f ms (speedup %5.2f), max diff %g\n",
+         aos_ms, alloc_ms, aos_ms / MAX(alloc_ms, 1e-3), soa_ms, aos_ms / MAX(soa_ms, 1e-3),
+         sweep_ms, aos_ms / MAX(sweep_ms, 1e-3), max_diff);
+
+  MRISclearGradient(mris);
+  free(ref);
+  return (NO_ERROR);
+}
@@ -2346,10 +2346,10 @@ int MRISexpandSurface(MRI_SURFACE *mris, float distance, INTEGRATION_PARMS *parm
               }
             }
           }
-          mrisComputeSpringTerm(mris, parms->l_spring);
+          mrisComputeSpringTerm(mris, parms->l_spring, &parms->soa);
           mrisComputeConvexityTerm(mris, parms->l_convex);
-          mrisComputeLaplacianTerm(mris, parms->l_lap);
-          mrisComputeNormalizedSpringTerm(mris, parms->l_spring_norm);
+          mrisComputeLaplacianTerm(mris, parms->l_lap, &parms->soa);
+          mrisComputeNormalizedSpringTerm(mris, parms->l_spring_norm, &parms->soa);
           mrisComputeThicknessSmoothnessTerm(mris, parms->l_tsmooth, parms);
           mrisComputeThicknessMinimizationTerm(mris, parms->l_thick_min, parms);
           mrisComputeThicknessParallelTerm(mris, parms->l_thick_parallel, parms);
@@ -2358,7 +2358,7 @@ int MRISexpandSurface(MRI_SURFACE *mris, float distance, INTEGRATION_PARMS *parm
           mrisComputeQuadraticCurvatureTerm(mris, parms->l_curv);
           mrisComputeMaxSpringTerm(mris, parms->l_max_spring);
           mrisComputeNonlinearSpringTerm(mris, parms->l_nlspring, parms);
-          mrisComputeTangentialSpringTerm(mris, parms->l_tspring);
+          mrisComputeTangentialSpringTerm(mris, parms->l_tspring, &parms->soa);
           mrisComputeNonlinearTangentialSpringTerm(mris, parms->l_nltspring, parms->min_dist);
           mrisComputeAngleAreaTerms(mris, parms);
           MRISaverageGradients(mris, avgs);
@@ -2395,6 +2395,7 @@ int MRISexpandSurface(MRI_SURFACE *mris, float distance, INTEGRATION_PARMS *parm
   if (mht) {
     MHTfree(&mht);
   }
+  MRISsoaFree(&parms->soa);
   free(pial_x);
   free(pial_y);
   free(pial_z);
@@ -2684,7 +2685,7 @@ int MRISremoveCompressedRegions(MRI_SURFACE *mris, double min_dist)
     {
       mrisComputePlaneTerm(mris, 0, 0);
     }
-    mrisComputeSpringTerm(mris, l_spring);
+    mrisComputeSpringTerm(mris, l_spring, &parms.soa);
     mrisComputeBorderTerm(mris, 1 - l_spring);
     mrisComputeConvexityTerm(mris, l_convex);
     MRISaverageGradients(mris, n_averages);
@@ -2705,6 +2706,7 @@ int MRISremoveCompressedRegions(MRI_SURFACE *mris, double min_dist)
   if (mht) {
     MHTfree(&mht);
   }
+  MRISsoaFree(&parms.soa);
   MRISsetNeighborhoodSizeAndDist(mris, nsize);
   return (NO_ERROR);
 }
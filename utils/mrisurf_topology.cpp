@@ -21,6 +21,8 @@
 
 #include "mrisurf_base.h"
 
+#include <atomic>
+
 
 // MRIS code dealing with the existence and connectedness of the vertices, edges, and faces
 //                   and with their partitioning into sets (ripped, marked, ...)
@@ -357,8 +359,20 @@ int mrisCountValidLinks(MRIS *mris, int vno1, int vno2)
 }
 
 
+// The stamps come from one counter shared by all the surfaces of the
+// process, so a surface never gets a stamp that another surface, or it
+// before a change, already had.
+//
+void mrisTopologyChanged(MRIS const *mris)
+{
+  static std::atomic<long> clock(0);
+  const_cast<MRIS*>(mris)->topology_clock = ++clock;
+}
+
+
 short modVnum(MRIS const *mris, int vno, short add, bool clear) 
 {
+  mrisTopologyChanged(mris);
   VERTEX_TOPOLOGY* vt = &mris->vertices_topology[vno];
   short * p = const_cast<short*>(&vt->vnum);
   if (clear) *p = 0;
@@ -1922,6 +1936,8 @@ void mrisSetVertexFaceIndex(MRIS *mris, int vno, int fno)
   }
   cheapAssert(n < VERTICES_PER_FACE);
 
+  mrisTopologyChanged(mris);
+
   int i;
   for (i = 0; i < vt->num; i++)
     if (vt->f[i] == fno) {
@@ -2101,6 +2117,7 @@ static void mrisAttachFaceWkr(MRIS* mris, int fno, int vno0, int vno1, int vno2,
   cheapAssertValidVno(mris,vno0);
   cheapAssertValidVno(mris,vno1);
   cheapAssertValidVno(mris,vno2);
+  mrisTopologyChanged(mris);
  
   cheapAssert(mrisCanAttachFaceToVertices(mris, vno0, vno1, vno2));
     //
@@ -2693,6 +2710,7 @@ int mrisRemoveFace(MRIS *mris, int fno)
 {
   FACE* face = &mris->faces[fno];
   face->ripflag = 1;
+  mrisTopologyChanged(mris);
   
   int vno;
   for (vno = 0; vno < VERTICES_PER_FACE; vno++) {
@@ -2867,6 +2885,8 @@ void MRISrenumberRemovingRippedFacesAndVertices(MRIS* mris) {
   ------------------------------------------------------*/
 void MRISremoveRipped(MRIS *mris)
 {
+  mrisTopologyChanged(mris);
+
   float* distCache          = (float*)calloc(mris->nvertices,sizeof(float));
   float* distOrigCache      = (float*)calloc(mris->nvertices,sizeof(float));
   int* affectedVnosPlus2    = (int  *)calloc(mris->nvertices,sizeof(int));
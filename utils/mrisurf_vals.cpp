@@ -1882,37 +1882,28 @@ Performs navgs steps of iterative spatial smoothing on curv.
 ------------------------------------------------------*/
 int MRISaverageCurvatures(MRI_SURFACE *mris, int navgs)
 {
-  int i, vno, vnb, vnum;
-  float curv, num;
-
-  for (i = 0; i < navgs; i++) {
+  if (navgs > 0) {
+    float *curvs = (float *)malloc(mris->nvertices * sizeof(float));
+    if (!curvs) {
+      ErrorExit(ERROR_NOMEMORY, "MRISaverageCurvatures: could not allocate %d floats", mris->nvertices);
+    }
+    int vno;
     for (vno = 0; vno < mris->nvertices; vno++) {
-      VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
-      VERTEX                * const v  = &mris->vertices         [vno];
-      if (v->ripflag) {
-        continue;
-      }
-      curv = v->curv;
-      int const * pnb  = vt->v;
-      vnum = vt->vnum;
-      for (num = 0.0f, vnb = 0; vnb < vnum; vnb++) {
-        VERTEX const * const vn = &mris->vertices[*pnb++]; /* neighboring vertex pointer */
-        if (vn->ripflag) {
-          continue;
-        }
-        num++;
-        curv += vn->curv;
-      }
-      num++; /*  account for central vertex */
-      v->tdx = curv / num;
+      curvs[vno] = mris->vertices[vno].curv;
     }
+
+    MRIS_AVERAGER *avg = MRISaveragerAlloc(mris, NULL, 0);
+    MRISaveragerApply(avg, curvs, 1, navgs);
+    MRISaveragerFree(&avg);
+
     for (vno = 0; vno < mris->nvertices; vno++) {
       VERTEX * const v = &mris->vertices[vno];
       if (v->ripflag) {
         continue;
       }
-      v->curv = v->tdx;
+      v->curv = v->tdx = curvs[vno];
     }
+    free(curvs);
   }
   mrisComputeCurvatureMinMax(mris);
   return (NO_ERROR);
@@ -1995,53 +1986,32 @@ int MRISaverageMarkedVals(MRI_SURFACE *mris, int navgs)
 
 int MRISaverageVals(MRI_SURFACE *mris, int navgs)
 {
-  int i, vno;
-
-  for (i = 0; i < navgs; i++) {
-    ROMP_PF_begin
-#ifdef HAVE_OPENMP
-    #pragma omp parallel for if_ROMP(experimental) shared(mris, i) schedule(static, 1)
-#endif
-    for (vno = 0; vno < mris->nvertices; vno++) {
-      ROMP_PFLB_begin
-      
-      int vnb, vnum;
-      float val, num;
-
-      VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
-      VERTEX                * const v  = &mris->vertices         [vno];
-      if (v->ripflag) ROMP_PF_continue;
-
-      val = v->val;
-      int const * pnb  = vt->v;
-      vnum = vt->vnum;
-      for (num = 0.0f, vnb = 0; vnb < vnum; vnb++) {
-        VERTEX const * const vn = &mris->vertices[*pnb++]; /* neighboring vertex pointer */
-        if (vn->ripflag) continue;
+  if (navgs <= 0) {
+    return (NO_ERROR);
+  }
 
-        num++;
-        val += vn->val;
-      }
-      num++; /*  account for central vertex */
-      v->tdx = val / num;
-      ROMP_PFLB_end
-    }
-    ROMP_PF_end
+  float *vals = (float *)malloc(mris->nvertices * sizeof(float));
+  if (!vals) {
+    ErrorExit(ERROR_NOMEMORY, "MRISaverageVals: could not allocate %d floats", mris->nvertices);
+  }
+  int vno;
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    vals[vno] = mris->vertices[vno].val;
+  }
 
-    ROMP_PF_begin
-#ifdef HAVE_OPENMP
-    #pragma omp parallel for if_ROMP(experimental) shared(mris, i) schedule(static, 1)
-#endif
-    for (vno = 0; vno < mris->nvertices; vno++) {
-      ROMP_PFLB_begin
-      VERTEX * const v = &mris->vertices[vno];
-      if (v->ripflag) ROMP_PF_continue;
+  MRIS_AVERAGER *avg = MRISaveragerAlloc(mris, NULL, 0);
+  MRISaveragerApply(avg, vals, 1, navgs);
+  MRISaveragerFree(&avg);
 
-      v->val = v->tdx;
-      ROMP_PFLB_end
+  // tdx is left holding the last average, as the per-vertex loop did
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX * const v = &mris->vertices[vno];
+    if (v->ripflag) {
+      continue;
     }
-    ROMP_PF_end
+    v->val = v->tdx = vals[vno];
   }
+  free(vals);
 
   return (NO_ERROR);
 }
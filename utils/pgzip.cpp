@@ -0,0 +1,527 @@
+/**
+ * @brief parallel block-gzip file io
+ *
+ * Compressed volumes are written as a series of independent gzip members of
+ * PGZIP_BLOCK_SIZE uncompressed bytes each. Concatenated members are a valid
+ * gzip stream (RFC 1952), so the files can still be read by gzip, zlib and
+ * the regular znz path. Each member header carries an 'FS' extra subfield
+ * holding the compressed size of the member, which lets the reader index all
+ * member boundaries without inflating and then inflate just the members that
+ * are read, in parallel. Writers compress members as they fill.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <zlib.h>
+
+#include "diag.h"
+#include "error.h"
+#include "romp_support.h"
+
+#include "pgzip.h"
+
+// member header: ID1 ID2 CM FLG MTIME(4) XFL OS XLEN(2) SI1 SI2 LEN(2) MSIZE(4)
+#define PGZ_HEADER_SIZE 20
+#define PGZ_TRAILER_SIZE 8
+#define PGZ_XLEN 8
+#define PGZ_SI1 'F'
+#define PGZ_SI2 'S'
+#define PGZ_FEXTRA 0x04
+
+static int pgzip_enabled = -1;
+
+static void put16(unsigned char *p, unsigned int v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+}
+
+static void put32(unsigned char *p, unsigned long v)
+{
+  put16(p, v & 0xffff);
+  put16(p + 2, (v >> 16) & 0xffff);
+}
+
+static unsigned int get16(const unsigned char *p) { return p[0] | (p[1] << 8); }
+
+static unsigned long get32(const unsigned char *p) { return get16(p) | ((unsigned long)get16(p + 2) << 16); }
+
+
+/*!
+\fn int pgzipEnabled(void)
+\brief Returns 1 if compressed files should go through the parallel
+block-gzip path. This is the case when more than one OpenMP thread is
+available, unless it has been turned off with pgzipSetEnabled(0) or by
+setting FS_PGZIP=0.
+*/
+int pgzipEnabled(void)
+{
+  if (pgzip_enabled < 0) {
+    const char *s = getenv("FS_PGZIP");
+    pgzip_enabled = (s == NULL || strcmp(s, "0") != 0);
+  }
+  return (pgzip_enabled && omp_get_max_threads() > 1);
+}
+
+
+void pgzipSetEnabled(int enabled) { pgzip_enabled = enabled; }
+
+
+/*!
+\fn static int pgzipParseHeader(const unsigned char *p, size_t avail, size_t *pmsize)
+\brief Checks whether p points to a gzip member header written by
+pgzipCompress() and, if so, returns 1 and sets the total size of the
+member (header, deflate data and trailer) in pmsize.
+*/
+static int pgzipParseHeader(const unsigned char *p, size_t avail, size_t *pmsize)
+{
+  if (avail < PGZ_HEADER_SIZE + PGZ_TRAILER_SIZE) return (0);
+  if (p[0] != 0x1f || p[1] != 0x8b || p[2] != Z_DEFLATED) return (0);
+  if (p[3] != PGZ_FEXTRA || get16(p + 10) != PGZ_XLEN) return (0);
+  if (p[12] != PGZ_SI1 || p[13] != PGZ_SI2 || get16(p + 14) != 4) return (0);
+
+  size_t msize = get32(p + 16);
+  if (msize < PGZ_HEADER_SIZE + PGZ_TRAILER_SIZE || msize > avail) return (0);
+  *pmsize = msize;
+  return (1);
+}
+
+
+/*!
+\fn int pgzipIsBlocked(const char *fname)
+\brief Returns 1 if fname starts with a gzip member that carries a
+pgzip size index, ie. if it can be inflated in parallel.
+*/
+int pgzipIsBlocked(const char *fname)
+{
+  unsigned char header[PGZ_HEADER_SIZE];
+  FILE *fp = fopen(fname, "rb");
+  if (!fp) return (0);
+  size_t nread = fread(header, 1, PGZ_HEADER_SIZE, fp);
+  fclose(fp);
+
+  size_t msize;
+  return (nread == PGZ_HEADER_SIZE && pgzipParseHeader(header, (size_t)-1, &msize));
+}
+
+
+/*!
+\fn static int pgzipDeflateMember(const unsigned char *in, size_t nbytes, int level, std::vector<unsigned char> &member)
+\brief Compresses nbytes of in into a complete, self-contained gzip member.
+*/
+static int pgzipDeflateMember(const unsigned char *in, size_t nbytes, int level, std::vector<unsigned char> &member)
+{
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) return (ERROR_NOMEMORY);
+
+  size_t bound = deflateBound(&strm, nbytes);
+  member.resize(PGZ_HEADER_SIZE + bound + PGZ_TRAILER_SIZE);
+  strm.next_in = (Bytef *)in;
+  strm.avail_in = nbytes;
+  strm.next_out = &member[PGZ_HEADER_SIZE];
+  strm.avail_out = bound;
+  int ret = deflate(&strm, Z_FINISH);
+  size_t msize = PGZ_HEADER_SIZE + strm.total_out + PGZ_TRAILER_SIZE;
+  deflateEnd(&strm);
+  if (ret != Z_STREAM_END) return (ERROR_BADFILE);
+
+  unsigned char *p = &member[0];
+  p[0] = 0x1f;
+  p[1] = 0x8b;
+  p[2] = Z_DEFLATED;
+  p[3] = PGZ_FEXTRA;
+  put32(p + 4, 0);  // no mtime, so output only depends on the data
+  p[8] = 0;
+  p[9] = 255;       // unknown OS
+  put16(p + 10, PGZ_XLEN);
+  p[12] = PGZ_SI1;
+  p[13] = PGZ_SI2;
+  put16(p + 14, 4);
+  put32(p + 16, msize);
+
+  p = &member[msize - PGZ_TRAILER_SIZE];
+  put32(p, crc32(crc32(0L, Z_NULL, 0), in, nbytes));
+  put32(p + 4, nbytes);
+
+  member.resize(msize);
+  return (NO_ERROR);
+}
+
+
+/*!
+\fn int pgzipCompress(const void *buf, size_t nbytes, FILE *fp, int level)
+\brief Compresses buf into fp as a sequence of independent gzip members,
+deflating the members in parallel. Members are produced in batches of a
+few per thread so the compressed data held in memory stays bounded.
+*/
+int pgzipCompress(const void *buf, size_t nbytes, FILE *fp, int level)
+{
+  const unsigned char *in = (const unsigned char *)buf;
+  long nblocks = (nbytes + PGZIP_BLOCK_SIZE - 1) / PGZIP_BLOCK_SIZE;
+  if (nblocks == 0) nblocks = 1;  // an empty member keeps the file valid gzip
+
+  long batch = 4 * omp_get_max_threads();
+  std::vector<std::vector<unsigned char>> members(batch);
+
+  for (long b0 = 0; b0 < nblocks; b0 += batch) {
+    long nb = (nblocks - b0 < batch) ? nblocks - b0 : batch;
+    int err = NO_ERROR;
+    long b;
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic) reduction(max : err)
+#endif
+    for (b = 0; b < nb; b++) {
+      ROMP_PFLB_begin
+      size_t offset = (b0 + b) * (size_t)PGZIP_BLOCK_SIZE;
+      size_t len = (nbytes - offset < PGZIP_BLOCK_SIZE) ? nbytes - offset : PGZIP_BLOCK_SIZE;
+      int berr = pgzipDeflateMember(in + offset, len, level, members[b]);
+      if (berr > err) err = berr;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    if (err != NO_ERROR) ErrorReturn(err, (err, "pgzipCompress: could not deflate block"));
+    for (b = 0; b < nb; b++) {
+      if (fwrite(&members[b][0], 1, members[b].size(), fp) != members[b].size())
+        ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "pgzipCompress: could not write %d bytes", (int)members[b].size()));
+    }
+  }
+
+  return (NO_ERROR);
+}
+
+
+// stream backing a znzFile opened with pgzopen(). For reading it holds the
+// member index of the file and a small cache of inflated members; for
+// writing it holds the uncompressed bytes that have not been compressed yet.
+typedef struct
+{
+  FILE *fp;                     // the compressed file
+  int writing;
+  int level;                    // compression level
+  size_t pos;                   // uncompressed stream position
+  size_t nbytes;                // uncompressed size of the stream
+
+  // reading
+  std::vector<size_t> moffset;  // compressed offset of each member
+  std::vector<size_t> msize;    // compressed size of each member
+  std::vector<size_t> uoffset;  // uncompressed offset of each member, plus the total
+  std::map<long, std::vector<unsigned char>> cache;  // inflated members
+  long next;                    // first member after the last inflated range
+  long ahead;                   // members currently read ahead
+
+  // writing
+  std::vector<unsigned char> pending;  // bytes from uncompressed offset flushed on
+  size_t flushed;               // uncompressed bytes already compressed and written
+} PGZ_STREAM;
+
+
+/*!
+\fn static int pgzipIndex(PGZ_STREAM *s)
+\brief Builds the member index of the file open in s->fp from the member
+headers (compressed sizes) and trailers (uncompressed sizes), without
+inflating anything. Returns 1 if the whole file consists of members
+written by pgzipCompress(), otherwise 0.
+*/
+static int pgzipIndex(PGZ_STREAM *s)
+{
+  if (fseeko(s->fp, 0, SEEK_END) != 0) return (0);
+  off_t nin = ftello(s->fp);
+  if (nin <= 0) return (0);
+
+  size_t pos = 0, nout = 0, len;
+  unsigned char header[PGZ_HEADER_SIZE], isize[4];
+  while (pos < (size_t)nin) {
+    if (fseeko(s->fp, pos, SEEK_SET) != 0 || fread(header, 1, PGZ_HEADER_SIZE, s->fp) != PGZ_HEADER_SIZE) return (0);
+    if (!pgzipParseHeader(header, nin - pos, &len)) return (0);
+    if (fseeko(s->fp, pos + len - 4, SEEK_SET) != 0 || fread(isize, 1, 4, s->fp) != 4) return (0);
+    s->moffset.push_back(pos);
+    s->msize.push_back(len);
+    s->uoffset.push_back(nout);
+    nout += get32(isize);
+    pos += len;
+  }
+  s->uoffset.push_back(nout);
+  s->nbytes = nout;
+  return (1);
+}
+
+
+/*!
+\fn static long pgzMember(const PGZ_STREAM *s, size_t pos)
+\brief Returns the member that holds uncompressed byte pos.
+*/
+static long pgzMember(const PGZ_STREAM *s, size_t pos)
+{
+  return (std::upper_bound(s->uoffset.begin(), s->uoffset.end(), pos) - s->uoffset.begin() - 1);
+}
+
+
+/*!
+\fn static ssize_t pgzStreamRead(void *cookie, char *buf, size_t size)
+\brief Reads size bytes at the stream position. Only the members that
+cover the requested range are inflated, in parallel: members that lie
+entirely inside the range go straight into buf, the ones at its ends go
+into the member cache. While the file is read sequentially up to one
+member per thread is read ahead into the cache as well, doubling from one
+member, so that reads of a slice at a time still inflate in parallel while
+a header read inflates little more than the first member.
+*/
+static ssize_t pgzStreamRead(void *cookie, char *buf, size_t size)
+{
+  PGZ_STREAM *s = (PGZ_STREAM *)cookie;
+  if (s->pos >= s->nbytes) return (0);
+  if (size > s->nbytes - s->pos) size = s->nbytes - s->pos;
+  size_t start = s->pos, end = s->pos + size;
+  long nmembers = s->moffset.size();
+  long m0 = pgzMember(s, start), m1 = pgzMember(s, end - 1), m;
+
+  int missing = 0;
+  for (m = m0; m <= m1 && !missing; m++) missing = !s->cache.count(m);
+
+  if (missing) {
+    if (m0 == s->next) {
+      s->ahead = 2 * s->ahead;
+      if (s->ahead < 1) s->ahead = 1;
+      if (s->ahead > omp_get_max_threads()) s->ahead = omp_get_max_threads();
+    }
+    else
+      s->ahead = 0;
+    long mend = m1 + s->ahead;
+    if (mend >= nmembers) mend = nmembers - 1;
+
+    // the new cache keeps the cached members in the range, the rest is dropped
+    std::map<long, std::vector<unsigned char>> cache;
+    std::vector<long> todo;
+    std::vector<unsigned char *> dst;
+    for (m = m0; m <= mend; m++) {
+      std::map<long, std::vector<unsigned char>>::iterator it = s->cache.find(m);
+      if (it != s->cache.end()) {
+        cache[m].swap(it->second);
+        continue;
+      }
+      todo.push_back(m);
+      if (m <= m1 && s->uoffset[m] >= start && s->uoffset[m + 1] <= end)
+        dst.push_back((unsigned char *)buf + (s->uoffset[m] - start));
+      else {
+        std::vector<unsigned char> &member = cache[m];
+        member.resize(s->uoffset[m + 1] - s->uoffset[m] + 1);
+        dst.push_back(&member[0]);
+      }
+    }
+    s->cache.swap(cache);
+    s->next = mend + 1;
+
+    // the members to inflate are contiguous in the file, so read them in one go
+    size_t cstart = s->moffset[todo.front()];
+    size_t cend = s->moffset[todo.back()] + s->msize[todo.back()];
+    std::vector<unsigned char> in(cend - cstart);
+    if (fseeko(s->fp, cstart, SEEK_SET) != 0 || fread(&in[0], 1, in.size(), s->fp) != in.size()) {
+      ErrorPrintf(ERROR_BADFILE, "pgzopen: could not read compressed data");
+      return (-1);
+    }
+
+    long ntodo = todo.size(), t;
+    int err = NO_ERROR;
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic) reduction(max : err)
+#endif
+    for (t = 0; t < ntodo; t++) {
+      ROMP_PFLB_begin
+      long mt = todo[t];
+      size_t expected = s->uoffset[mt + 1] - s->uoffset[mt];
+      z_stream strm;
+      memset(&strm, 0, sizeof(strm));
+      int merr = ERROR_BADFILE;
+      if (inflateInit2(&strm, 16 + MAX_WBITS) == Z_OK) {
+        strm.next_in = &in[s->moffset[mt] - cstart];
+        strm.avail_in = s->msize[mt];
+        strm.next_out = dst[t];
+        strm.avail_out = expected;
+        // zlib verifies the member crc and length in the trailer
+        if (inflate(&strm, Z_FINISH) == Z_STREAM_END && strm.total_out == expected) merr = NO_ERROR;
+        inflateEnd(&strm);
+      }
+      if (merr > err) err = merr;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    if (err != NO_ERROR) {
+      s->cache.clear();
+      ErrorPrintf(ERROR_BADFILE, "pgzopen: corrupt gzip member");
+      return (-1);
+    }
+  }
+
+  // copy the parts of the range held in the cache
+  for (m = m0; m <= m1; m++) {
+    std::map<long, std::vector<unsigned char>>::iterator it = s->cache.find(m);
+    if (it == s->cache.end()) continue;  // inflated straight into buf
+    size_t from = (start > s->uoffset[m]) ? start : s->uoffset[m];
+    size_t to = (end < s->uoffset[m + 1]) ? end : s->uoffset[m + 1];
+    memcpy(buf + (from - start), &it->second[from - s->uoffset[m]], to - from);
+  }
+
+  s->pos = end;
+  return (size);
+}
+
+
+/*!
+\fn static int pgzStreamFlush(PGZ_STREAM *s, size_t nbytes)
+\brief Compresses and writes the first nbytes of the pending data and
+drops them from the pending buffer. nbytes must be a multiple of
+PGZIP_BLOCK_SIZE except for the final flush on close.
+*/
+static int pgzStreamFlush(PGZ_STREAM *s, size_t nbytes)
+{
+  if (pgzipCompress(nbytes ? &s->pending[0] : NULL, nbytes, s->fp, s->level) != NO_ERROR) return (-1);
+  s->pending.erase(s->pending.begin(), s->pending.begin() + nbytes);
+  s->flushed += nbytes;
+  return (0);
+}
+
+
+/*!
+\fn static ssize_t pgzStreamWrite(void *cookie, const char *buf, size_t size)
+\brief Appends size bytes at the stream position. Whenever a batch of
+complete members (four per thread) is pending in front of the stream
+position, it is compressed in parallel and written out, so only about one
+batch of uncompressed data is held in memory.
+*/
+static ssize_t pgzStreamWrite(void *cookie, const char *buf, size_t size)
+{
+  PGZ_STREAM *s = (PGZ_STREAM *)cookie;
+  size_t off = s->pos - s->flushed;
+  if (off + size > s->pending.size()) s->pending.resize(off + size, 0);
+  memcpy(&s->pending[off], buf, size);
+  s->pos += size;
+  if (s->pos > s->nbytes) s->nbytes = s->pos;
+
+  size_t batch = (size_t)4 * omp_get_max_threads() * PGZIP_BLOCK_SIZE;
+  off = s->pos - s->flushed;
+  if (off >= batch && pgzStreamFlush(s, off - off % PGZIP_BLOCK_SIZE) != 0) return (-1);
+  return (size);
+}
+
+
+/*!
+\fn static int pgzStreamSeek(void *cookie, off64_t *offset, int whence)
+\brief Like gzseek(), a stream open for writing can only seek to data
+that has not been compressed yet.
+*/
+static int pgzStreamSeek(void *cookie, off64_t *offset, int whence)
+{
+  PGZ_STREAM *s = (PGZ_STREAM *)cookie;
+  off64_t pos;
+  switch (whence) {
+    case SEEK_SET:
+      pos = *offset;
+      break;
+    case SEEK_CUR:
+      pos = s->pos + *offset;
+      break;
+    case SEEK_END:
+      pos = s->nbytes + *offset;
+      break;
+    default:
+      return (-1);
+  }
+  if (pos < 0 || (s->writing && (size_t)pos < s->flushed)) return (-1);
+  s->pos = pos;
+  *offset = pos;
+  return (0);
+}
+
+static int pgzStreamClose(void *cookie)
+{
+  PGZ_STREAM *s = (PGZ_STREAM *)cookie;
+  int ret = 0;
+  if (s->writing) {
+    // the rest, or a single empty member if nothing was written so that
+    // the file is still valid gzip
+    if ((s->pending.size() || s->flushed == 0) && pgzStreamFlush(s, s->pending.size()) != 0) ret = EOF;
+  }
+  if (fclose(s->fp) != 0) ret = EOF;
+  delete s;
+  return (ret);
+}
+
+
+/*!
+\fn znzFile pgzopen(const char *path, const char *mode, int use_compression)
+\brief Drop-in replacement for znzopen(). When use_compression is set and
+pgzipEnabled(), files opened for writing are compressed with
+pgzipCompress() a batch of members at a time as the data comes in, and
+files written that way are read through their member index, inflating
+only the members that are actually read (see pgzStreamRead). Files
+without the index are read through znzopen(), as is everything when the
+parallel path is disabled.
+*/
+znzFile pgzopen(const char *path, const char *mode, int use_compression)
+{
+#ifdef __GLIBC__
+  if (!use_compression || !pgzipEnabled()) return (znzopen(path, mode, use_compression));
+
+  int writing = (strchr(mode, 'w') != NULL);
+  if (!writing && (strchr(mode, 'r') == NULL || !pgzipIsBlocked(path))) return (znzopen(path, mode, use_compression));
+
+  PGZ_STREAM *s = new PGZ_STREAM();
+  s->writing = writing;
+  s->level = Z_DEFAULT_COMPRESSION;
+  const char *digit = strpbrk(mode, "0123456789");  // gzopen-style level, eg. "wb9"
+  if (digit) s->level = *digit - '0';
+  s->pos = s->nbytes = s->flushed = 0;
+  s->next = -1;
+  s->ahead = 0;
+
+  s->fp = fopen(path, writing ? "wb" : "rb");
+  if (!s->fp) {
+    delete s;
+    return (NULL);
+  }
+  if (!writing && !pgzipIndex(s)) {
+    // data after the indexed members (eg. appended by another tool)
+    fclose(s->fp);
+    delete s;
+    return (znzopen(path, mode, use_compression));
+  }
+
+  cookie_io_functions_t io = {pgzStreamRead, pgzStreamWrite, pgzStreamSeek, pgzStreamClose};
+  FILE *fp = fopencookie(s, writing ? "wb" : "rb", io);
+  if (!fp) {
+    pgzStreamClose(s);
+    return (NULL);
+  }
+
+  znzFile file = (znzFile)calloc(1, sizeof(struct znzptr));
+  file->withz = 0;
+  file->nzfptr = fp;
+  return (file);
+#else
+  return (znzopen(path, mode, use_compression));
+#endif
+}
@@ -0,0 +1,110 @@
+/**
+ * @brief timing of the surface and atlas kernels against the code they replace
+ *
+ * mris_benchmark <surface> <avgs|bvh|soa> <n>
+ * mris_benchmark <gca> densities <n>
+ * mris_benchmark <m3z> smoothness <n>
+ *
+ *   avgs  time n nearest-neighbor averaging passes with the per-vertex loop
+ *         and with the sparse averaging operator (MRISaveragerBenchmark)
+ *   bvh   time closest vertex and closest point queries of n random points
+ *         with the bounding volume hierarchies and with vertex hash tables
+ *         (MRISbvhBenchmark)
+ *   soa   time n spring term sweeps over the vertex structures and over the
+ *         structure-of-arrays copy of the vertex fields (MRISsoaBenchmark)
+ *   densities  time the class log densities of n random atlas nodes with
+ *         the original MATRIX code and with the precomputed inverse
+ *         covariance table (GCAprofileDensities)
+ *   smoothness  time n smoothness gradients of a morph with the node loop
+ *         and with the gathered displacement arrays (GCAMprofileSmoothness)
+ *
+ * Use a large surface (e.g. ic7 or fsaverage), or a full atlas such as
+ * RB_all.gca, or a full size morph. Each benchmark also reports how far its answers are from
+ * those of the reference code.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "gca.h"
+#include "gcamorph.h"
+#include "macros.h"
+#include "mrisbvh.h"
+#include "mrisurf.h"
+
+const char *Progname = "mris_benchmark";
+
+int main(int argc, char *argv[])
+{
+  MRIS *mris;
+  GCA *gca;
+  GCA_MORPH *gcam;
+  int n, ret;
+
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s <surface> <avgs|bvh|soa> <n>\n", Progname);
+    fprintf(stderr, "       %s <gca> densities <n>\n", Progname);
+    fprintf(stderr, "       %s <m3z> smoothness <n>\n", Progname);
+    exit(1);
+  }
+  n = atoi(argv[3]);
+  if (n <= 0) {
+    ErrorExit(ERROR_BADPARM, "%s: n must be positive", Progname);
+  }
+
+  if (!strcmp(argv[2], "densities")) {
+    gca = GCAread(argv[1]);
+    if (!gca) {
+      ErrorExit(ERROR_NOFILE, "%s: could not read classifier array from %s", Progname, argv[1]);
+    }
+    ret = GCAprofileDensities(gca, n);
+    GCAfree(&gca);
+    exit(ret == NO_ERROR ? 0 : 1);
+  }
+  if (!strcmp(argv[2], "smoothness")) {
+    gcam = GCAMread(argv[1]);
+    if (!gcam) {
+      ErrorExit(ERROR_NOFILE, "%s: could not read morph from %s", Progname, argv[1]);
+    }
+    ret = GCAMprofileSmoothness(gcam, n, NULL);
+    GCAMfree(&gcam);
+    exit(ret == NO_ERROR ? 0 : 1);
+  }
+
+  mris = MRISfastRead(argv[1]);
+  if (!mris) {
+    ErrorExit(ERROR_NOFILE, "%s: could not read surface file %s", Progname, argv[1]);
+  }
+
+  if (!strcmp(argv[2], "avgs")) {
+    ret = MRISaveragerBenchmark(mris, n);
+  }
+  else if (!strcmp(argv[2], "bvh")) {
+    ret = MRISbvhBenchmark(mris, n);
+  }
+  else if (!strcmp(argv[2], "soa")) {
+    MRIScomputeMetricProperties(mris);
+    mris->orig_area = mris->total_area;  // spring terms scale by sqrt(orig_area/total_area)
+    ret = MRISsoaBenchmark(mris, n);
+  }
+  else {
+    ErrorExit(ERROR_BADPARM, "%s: unknown benchmark %s", Progname, argv[2]);
+  }
+
+  MRISfree(&mris);
+  exit(ret == NO_ERROR ? 0 : 1);
+}
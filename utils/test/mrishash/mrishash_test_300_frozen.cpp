@@ -0,0 +1,108 @@
+/*--------------------------------------------
+  mrishash_test_300_frozen.cpp
+
+  Checks that a frozen vertex hash table answers the same as it did
+  before it was frozen, that the batched queries agree with the single
+  ones, and that the k closest vertices agree with a brute force search.
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "mrisurf.h"
+#include "mrishash.h"
+#include "icosahedron.h"
+
+const char *Progname = "mrishash_frozen_test";
+
+#define NPROBES 2000
+#define K       5
+#define MAXDIST 8.0f
+
+int main(int argc, char *argv[])
+{
+  int errors = 0;
+
+  srand(1234);
+  MRIS *mris = ic2562_make_two_icos(0, 0, 0, 40, 0, 0, 0, 43);
+  MRIS_HASH_TABLE *mht = MHTcreateVertexTable_Resolution(mris, CURRENT_VERTICES, 2.0);
+
+  std::vector<float> xyz(3 * NPROBES);
+  for (int i = 0; i < NPROBES; i++) {
+    float const r = 30 + 20 * ((double)rand() / RAND_MAX);
+    float vx = (double)rand() / RAND_MAX - 0.5, vy = (double)rand() / RAND_MAX - 0.5, vz = (double)rand() / RAND_MAX - 0.5;
+    float const len = sqrt(vx * vx + vy * vy + vz * vz);
+    xyz[3 * i] = r * vx / len;
+    xyz[3 * i + 1] = r * vy / len;
+    xyz[3 * i + 2] = r * vz / len;
+  }
+
+  // answers of the table before freezing
+  std::vector<int> vnos(NPROBES), knos(NPROBES * K), nfound(NPROBES);
+  std::vector<float> dists(NPROBES), kdists(NPROBES * K);
+  for (int i = 0; i < NPROBES; i++) {
+    float const *p = &xyz[3 * i];
+    vnos[i] = MHTfindClosestVertexNoXYZ(mht, mris, p[0], p[1], p[2], &dists[i]);
+    nfound[i] = MHTfindKClosestVertexNos(mht, mris, p[0], p[1], p[2], MAXDIST, K, &knos[K * i], &kdists[K * i]);
+
+    // brute force k closest
+    std::vector<float> all;
+    for (int vno = 0; vno < mris->nvertices; vno++) {
+      VERTEX const *v = &mris->vertices[vno];
+      float const d = sqrt(SQR(v->x - p[0]) + SQR(v->y - p[1]) + SQR(v->z - p[2]));
+      if (d <= MAXDIST) all.push_back(d);
+    }
+    std::sort(all.begin(), all.end());
+    int const nexpected = std::min((int)all.size(), K);
+    if (nfound[i] != nexpected) {
+      printf("probe %d: found %d of the %d closest vertices\n", i, nfound[i], nexpected);
+      errors++;
+      continue;
+    }
+    for (int j = 0; j < nexpected; j++) {
+      if (fabs(kdists[K * i + j] - all[j]) > 1e-4) {
+        printf("probe %d: closest %d is at %g, not %g\n", i, j, kdists[K * i + j], all[j]);
+        errors++;
+      }
+    }
+  }
+
+  MHTfreeze(mht);
+  if (!MHTisFrozen(mht)) {
+    printf("table is not frozen\n");
+    errors++;
+  }
+
+  std::vector<int> bvnos(NPROBES), bknos(NPROBES * K), bnfound(NPROBES);
+  std::vector<float> bdists(NPROBES), bkdists(NPROBES * K);
+  MHTfindClosestVertexNoXYZBatch(mht, mris, NPROBES, xyz.data(), bvnos.data(), bdists.data());
+  MHTfindKClosestVertexNosBatch(mht, mris, NPROBES, xyz.data(), MAXDIST, K, bknos.data(), bkdists.data(), bnfound.data());
+
+  for (int i = 0; i < NPROBES; i++) {
+    if (bvnos[i] != vnos[i] || bdists[i] != dists[i]) {
+      printf("probe %d: frozen closest vertex %d (%g), was %d (%g)\n", i, bvnos[i], bdists[i], vnos[i], dists[i]);
+      errors++;
+    }
+    if (bnfound[i] != nfound[i]) {
+      printf("probe %d: frozen found %d closest, was %d\n", i, bnfound[i], nfound[i]);
+      errors++;
+      continue;
+    }
+    for (int j = 0; j < nfound[i]; j++) {
+      if (bknos[K * i + j] != knos[K * i + j]) {
+        printf("probe %d: frozen closest %d is %d, was %d\n", i, j, bknos[K * i + j], knos[K * i + j]);
+        errors++;
+      }
+    }
+  }
+
+  MHTfree(&mht);
+  MRISfree(&mris);
+
+  printf("%d errors\n", errors);
+  return errors ? 1 : 0;
+}
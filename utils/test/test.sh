@@ -10,3 +10,5 @@ test_command topology_test
 test_command tiff_write_image
 test_command sc_test
 test_command sse_mathfun_test
+test_command test_incremental_mp
+test_command test_gcam_smoothness
@@ -0,0 +1,65 @@
+/**
+ * @brief gcamSmoothnessTerm against the node loop it replaced
+ *
+ * Displaces the nodes of a small morph at random, marks some of them
+ * invalid, and checks that the smoothness gradient computed from the
+ * gathered displacement arrays equals, bit for bit, the one computed by
+ * reading every neighbor from its node (GCAMprofileSmoothness).
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "gcamorph.h"
+
+const char *Progname = "test_gcam_smoothness";
+
+int main(int argc, char *argv[])
+{
+  GCA_MORPH *gcam;
+  double max_diff = -1;
+  int x, y, z;
+
+  // odd sizes so the clamped borders are not symmetric
+  gcam = GCAMalloc(23, 19, 17);
+  if (!gcam) {
+    ErrorExit(ERROR_NOMEMORY, "%s: could not allocate morph", Progname);
+  }
+
+  srand48(17);
+  for (x = 0; x < gcam->width; x++)
+    for (y = 0; y < gcam->height; y++)
+      for (z = 0; z < gcam->depth; z++) {
+        GCA_MORPH_NODE *gcamn = &gcam->nodes[x][y][z];
+        gcamn->origx = 2 * x;
+        gcamn->origy = 2 * y;
+        gcamn->origz = 2 * z;
+        gcamn->x = gcamn->origx + 3 * (drand48() - 0.5);
+        gcamn->y = gcamn->origy + 3 * (drand48() - 0.5);
+        gcamn->z = gcamn->origz + 3 * (drand48() - 0.5);
+        gcamn->invalid = drand48() < 0.1 ? GCAM_POSITION_INVALID : GCAM_VALID;
+        gcamn->dx = gcamn->dy = gcamn->dz = 0;
+      }
+
+  GCAMprofileSmoothness(gcam, 1, &max_diff);
+  GCAMfree(&gcam);
+
+  if (max_diff != 0) {
+    fprintf(stderr, "%s: gradients differ by up to %g\n", Progname, max_diff);
+    exit(1);
+  }
+  exit(0);
+}
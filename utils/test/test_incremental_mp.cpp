@@ -0,0 +1,145 @@
+/**
+ * @brief MRIScomputeMetricPropertiesIncremental against full passes
+ *
+ * Moves a few vertices of an icosahedral surface at a time and checks that
+ * the incremental metric properties (tolerance 0) equal those of the
+ * default MRIScomputeMetricProperties() on a copy moved the same way, both
+ * for a bumpy triangular surface and for a sphere, whose distances are
+ * measured along the sphere.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "error.h"
+#include "icosahedron.h"
+#include "macros.h"
+#include "mrisurf.h"
+
+const char *Progname = "test_incremental_mp";
+
+#define NROUNDS 14
+#define MAX_DIFF 1e-4
+
+static int nerrors = 0;
+
+static void check(double full, double incremental, const char *what, int round, int i)
+{
+  if (!(fabs(full - incremental) <= MAX_DIFF * MAX(1.0, fabs(full)))) {
+    if (nerrors++ < 20)
+      fprintf(stderr, "round %d: %s %d is %g, full pass %g\n", round, what, i, incremental, full);
+  }
+}
+
+// every 7th vertex, a different set each round, moved out by up to 1%
+static void move_vertices(MRIS *mris, int round)
+{
+  for (int vno = round % 7; vno < mris->nvertices; vno += 7) {
+    VERTEX const *v = &mris->vertices[vno];
+    float const scale = 1.0f + 0.002f * (1 + (vno + round) % 5);
+    MRISsetXYZ(mris, vno, v->x * scale, v->y * scale, v->z * scale);
+  }
+}
+
+static void compare_surfaces(MRIS *mris_full, MRIS *mris_inc, int round)
+{
+  float *fn_full = MRISgetFaceNormalArray(mris_full);
+  float *fn_inc = MRISgetFaceNormalArray(mris_inc);
+
+  for (int fno = 0; fno < mris_full->nfaces; fno++) {
+    check(mris_full->faces[fno].area, mris_inc->faces[fno].area, "face area", round, fno);
+    for (int i = 0; i < 3; i++) {
+      check(fn_full[3 * fno + i], fn_inc[3 * fno + i], "face normal", round, fno);
+      check(mris_full->faces[fno].angle[i], mris_inc->faces[fno].angle[i], "face angle", round, fno);
+    }
+  }
+  delete[] fn_full;
+  delete[] fn_inc;
+
+  for (int vno = 0; vno < mris_full->nvertices; vno++) {
+    VERTEX_TOPOLOGY const *vt = &mris_full->vertices_topology[vno];
+    VERTEX const *vf = &mris_full->vertices[vno], *vi = &mris_inc->vertices[vno];
+    check(vf->area, vi->area, "vertex area", round, vno);
+    check(vf->nx, vi->nx, "vertex normal", round, vno);
+    check(vf->ny, vi->ny, "vertex normal", round, vno);
+    check(vf->nz, vi->nz, "vertex normal", round, vno);
+    for (int n = 0; n < vt->vtotal; n++) {
+      check(vf->dist[n], vi->dist[n], "distance of vertex", round, vno);
+    }
+  }
+  check(mris_full->total_area, mris_inc->total_area, "total area", round, 0);
+  check(mris_full->avg_vertex_dist, mris_inc->avg_vertex_dist, "average vertex distance", round, 0);
+}
+
+static void test_surface(MRIS *mris_ico, MRIS_Status status)
+{
+  MRIS *mris, *mris_full, *mris_inc;
+  MRIS_METRIC_TRACKER *mpt;
+
+  // radius 100, with bumps unless it is a sphere
+  mris = MRISclone(mris_ico);
+  mris->status = status;
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const *v = &mris->vertices[vno];
+    float r = sqrt(v->x * v->x + v->y * v->y + v->z * v->z);
+    float scale = 100.0f / r;
+    if (status != MRIS_SPHERE) {
+      scale *= 1.0f + 0.1f * sin(3.0f * v->x / r) * cos(2.0f * v->z / r);
+    }
+    MRISsetXYZ(mris, vno, v->x * scale, v->y * scale, v->z * scale);
+  }
+  MRIScomputeMetricProperties(mris);
+  mris->radius = MRISaverageRadius(mris);
+  MRISsetNeighborhoodSizeAndDist(mris, 2);
+
+  mris_full = MRISclone(mris);
+  mris_inc = MRISclone(mris);
+  MRISfree(&mris);
+
+  mpt = MRISmetricTrackerAlloc(mris_inc, 0.0f, 0.3f);
+  MRIScomputeMetricProperties(mris_full);
+  MRIScomputeMetricPropertiesIncremental(mris_inc, mpt);
+  compare_surfaces(mris_full, mris_inc, 0);
+  for (int round = 1; round <= NROUNDS; round++) {
+    move_vertices(mris_full, round);
+    move_vertices(mris_inc, round);
+    MRIScomputeMetricProperties(mris_full);
+    MRIScomputeMetricPropertiesIncremental(mris_inc, mpt);
+    compare_surfaces(mris_full, mris_inc, round);
+  }
+  if (mpt->nincremental != NROUNDS) {
+    fprintf(stderr, "%s: %d of %d updates were incremental\n", MRIS_Status_text(status), mpt->nincremental, NROUNDS);
+    nerrors++;
+  }
+
+  MRISmetricTrackerFree(&mpt);
+  MRISfree(&mris_full);
+  MRISfree(&mris_inc);
+}
+
+int main(int argc, char *argv[])
+{
+  // ic2562_make_surface() flips the faces of every surface after the first
+  MRIS *mris_ico = ic2562_make_surface(0, 0);
+  test_surface(mris_ico, MRIS_SURFACE);
+  test_surface(mris_ico, MRIS_SPHERE);
+  MRISfree(&mris_ico);
+  if (nerrors) {
+    fprintf(stderr, "%d differences from the full pass\n", nerrors);
+    exit(1);
+  }
+  exit(0);
+}